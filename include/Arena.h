@@ -0,0 +1,91 @@
+#pragma once
+#include "Common.h"
+#include "Numa.h"
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace llt_memoryPool
+{
+
+// 请求级的区域分配器（MemoryPool::Arena）：对象一起生、一起死的场景
+//   - 直接从PageCache拿span，在span里按指针往后切，单个对象不能释放
+//   - checkpoint()/rewind()可以嵌套，回到某个检查点就等于释放了它之后分配的所有对象
+//   - reset()一次把所有对象作废，默认保留span给下一个请求用，稳态下完全不碰PageCache的锁
+// 不是线程安全的，一个请求（一个线程）一个；对象的析构函数不会被调用
+class BumpArena
+{
+public:
+    // 检查点：当时所在的span和切到的位置
+    struct Checkpoint
+    {
+        Span* span;
+        char* cursor;
+    };
+
+    // spanPages是每次向PageCache要的页数，超过它的分配单独拿一个够大的span
+    // node是从哪个节点的PageCache拿，默认是调用线程所在的节点
+    explicit BumpArena(size_t spanPages = DEFAULT_SPAN_PAGES, size_t node = MAX_NUMA_NODES);
+    ~BumpArena();
+    BumpArena(const BumpArena&) = delete;
+    BumpArena& operator=(const BumpArena&) = delete;
+
+    // align必须是2的幂；PageCache在上限内拿不到span时返回nullptr
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        uintptr_t cursor = (reinterpret_cast<uintptr_t>(cursor_) + align - 1) & ~(uintptr_t(align) - 1);
+        // 用<而不是<=：还没有span时cursor_和end_都是nullptr，0字节的分配也要进慢路径
+        if (cursor + size < reinterpret_cast<uintptr_t>(end_)) [[likely]]
+        {
+            cursor_ = reinterpret_cast<char*>(cursor + size);
+            return reinterpret_cast<void*>(cursor);
+        }
+        return allocateSlow(size, align);
+    }
+
+    // 在区域里构造一个T，分配失败抛std::bad_alloc；区域作废时不会调用析构函数
+    template<typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        void* memory = allocate(sizeof(T), alignof(T));
+        if (memory == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return new (memory) T(std::forward<Args>(args)...);
+    }
+
+    Checkpoint checkpoint() const { return Checkpoint{current_, cursor_}; }
+    // 回到检查点，之后分配的对象全部作废；更晚的检查点随之失效，span留着继续用
+    void rewind(const Checkpoint& point);
+
+    // 作废所有对象：keepSpans为true时保留span下次复用，否则全部还给PageCache，O(span数)
+    void reset(bool keepSpans = true);
+
+    // 当前手里的span个数和它们一共多少字节
+    size_t spanCount() const { return span_count_; }
+    size_t reservedBytes() const { return reserved_bytes_; }
+
+    static constexpr size_t DEFAULT_SPAN_PAGES = 16;
+
+private:
+    // 当前span放不下：往后找一个放得下的span，没有就向PageCache要
+    void* allocateSlow(size_t size, size_t align);
+    // 在current_后面插入一个至少能放下size字节的新span
+    Span* newSpan(size_t size, size_t align);
+    void releaseSpans();
+    void enter(Span* span);
+
+private:
+    // span按使用顺序用Span::next串起来，current_后面的是rewind/reset之后空出来的
+    Span* head_ = nullptr;
+    Span* current_ = nullptr;
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+    size_t span_pages_;
+    size_t node_;
+    size_t span_count_ = 0;
+    size_t reserved_bytes_ = 0;
+};
+
+} // namespace llt_memoryPool
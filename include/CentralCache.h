@@ -1,38 +1,175 @@
 #pragma once
 #include "Common.h"
+#include "Numa.h"
+#include "SpinLock.h"
 #include <mutex>
+#include <atomic>
+
+// 中心缓存桶锁的类型，CMake变量LLT_MEMPOOL_CENTRAL_LOCK=mutex|spin|ticket
+#ifndef LLT_MEMPOOL_CENTRAL_LOCK
+#define LLT_MEMPOOL_CENTRAL_LOCK 0
+#endif
 
 namespace llt_memoryPool
 {
 
-class CentralCache
+class Heap;
+
+// 一个大小等级的无锁“整批”栈
+// 栈里每个元素是ThreadCache刚好还回来的一整批对象（batchNum个），不拆开：
+//   第1个字还是批内的链表指针，第一个对象的第2个字存下一批的头
+// 所以只有对象不小于两个指针的等级才能用，8字节等级走原来的加锁路径
+// 栈顶是指针加64位版本号，放在同一个16字节里一次CAS（x86-64的cmpxchg16b，编译要-mcx16），每次修改版本号+1
+// 弹栈的线程在读到栈顶和CAS之间被抢占多久，版本号都不会绕回来，不会ABA
+struct BatchStack
+{
+    // 低8字节是指针，高8字节是版本号；只通过CentralCache.cpp里的loadTop/casTop访问
+    alignas(16) unsigned __int128 top = 0;
+    // 近似深度，只用来限制栈里囤积的批数
+    std::atomic<size_t> depth{0};
+};
+
+// span按占用率分桶：0..OCCUPANCY_BUCKETS-1放没满的（编号越大越满），最后一个桶放满的
+// 总是从最满的未满span分配，快空的span没人再分配，对象陆续还回来以后整个还给PageCache合并
+constexpr size_t OCCUPANCY_BUCKETS = 8;
+
+struct SpanBuckets
+{
+    SpanList lists[OCCUPANCY_BUCKETS + 1];
+    // 同一等级的span页数相同，对象数也相同
+    size_t total_objects = 0;
+    // 0号桶里一个对象都没分出去的span数（已经切好，留着不还给PageCache）
+    size_t empty_spans = 0;
+    // 所有桶里的span数和它们use_count的和，统计导出直接读，不用走一遍链表
+    size_t spans = 0;
+    size_t used_objects = 0;
+};
+
+// 每个等级默认留几个空span：一批对象反复取出、还回时span不再每次都还给PageCache又重新切
+constexpr size_t DEFAULT_EMPTY_SPANS = 1;
+
+// 每个等级最多囤多少批，超过以后走加锁路径还给span，避免内存一直卡在栈里
+constexpr size_t MAX_STACK_BATCHES = MIN_BATCHES_PER_SPAN;
+
+// 缓存行大小，桶按它对齐
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// 一个大小等级的全部状态放在一起，按缓存行对齐：相邻等级的锁不再挤在同一行里互相抢
+// 自旋锁/票据锁时整个桶正好一行，std::mutex（40字节）时两行
+template<typename Lock>
+struct alignas(CACHE_LINE_SIZE) CentralBucket
+{
+    Lock lock;
+    // 第一次用到这个等级时才创建
+    SpanBuckets* spans = nullptr;
+    // 下面三个计数都在锁里改
+    size_t fetches = 0;         // 加锁取对象的次数
+    size_t releases = 0;        // 加锁还对象的次数
+    size_t new_spans = 0;       // 向PageCache要的span数
+    BatchStack stack;
+};
+
+// 中心缓存按桶锁的类型模板化：std::mutex、SpinLock（TTAS+退避）或者TicketLock
+// 库里用的是CentralLock（CMake变量LLT_MEMPOOL_CENTRAL_LOCK），三种都显式实例化了，压测可以直接比较
+template<typename Lock>
+class BasicCentralCache
 {
 public:
-    static CentralCache& getInstance()
+    // 默认堆在每个NUMA节点上的中心缓存，只从本节点的PageCache取span；别的堆的中心缓存由Heap持有
+    // 按需创建：一个实例有FREE_LIST_SIZE个桶，不用的节点不要白白占内存
+    static BasicCentralCache& getInstance(size_t node = 0)
+    {
+        BasicCentralCache* instance = instances_[node].load(std::memory_order_acquire);
+        return instance != nullptr ? *instance : createInstance(node);
+    }
+    // 节点的中心缓存还没创建时返回nullptr，不会触发创建
+    static BasicCentralCache* getIfCreated(size_t node)
     {
-        static CentralCache instance;
-        return instance;
+        return instances_[node].load(std::memory_order_acquire);
     }
     //之前没有batchNum，只能自适应获得合适大小
     //*&，指针的引用，不需要写二级指针了。
     size_t fetchRange(void*& start,void*& end,size_t index, size_t batchNum);
     void releaseListToSpans(void* start, size_t size,size_t bytes);
-    CentralCache(const CentralCache&)=delete;
-    CentralCache& operator=(const CentralCache&)=delete;
+    // 归还以start开头的count个对象；刚好是一整批时不加锁压栈，否则走releaseListToSpans
+    void releaseRange(void* start, size_t count, size_t index);
+    // 把所有等级栈里的批拆回span，空span还给PageCache
+    void drainBatchStacks();
+    // 各等级留着的空span全部还给PageCache，返回还掉的span数
+    size_t releaseEmptySpans();
+    // 每个等级最多留几个空span，0表示一空就还（原来的行为）；只管这一个中心缓存，整个堆的用Heap::setEmptySpanLimit
+    void setEmptySpanLimit(size_t count) { empty_span_limit_.store(count, std::memory_order_relaxed); }
+    size_t emptySpanLimit() const { return empty_span_limit_.load(std::memory_order_relaxed); }
+    // 预留：保证index等级的span里至少有count个空闲对象，不够就申请新span并预先缺页
+    // 返回span里现有的空闲对象数，堆上限不够时可能少于count
+    size_t reserve(size_t index, size_t count);
+
+    // 某个等级的计数快照（加锁读，统计导出线程定期调用）
+    struct BucketCounters
+    {
+        size_t fetches;
+        size_t releases;
+        size_t new_spans;
+        size_t spans;          // 中心缓存手里的span数
+        size_t free_objects;   // span里和批栈里的空闲对象
+        size_t used_objects;   // 交给线程缓存的对象，包括还囤在线程缓存里的
+    };
+    BucketCounters counters(size_t index);
+
+    BasicCentralCache(const BasicCentralCache&)=delete;
+    BasicCentralCache& operator=(const BasicCentralCache&)=delete;
 
 private:
-    // 相互是还所有原子指针为nullptr
-    //=default，default会默认nullptr
-    CentralCache();
-    ~CentralCache();
+    friend class Heap;
+    BasicCentralCache(Heap& heap, size_t node);
+    ~BasicCentralCache();
+    static BasicCentralCache& createInstance(size_t node);
+    // 同一个堆里别的节点的中心缓存
+    BasicCentralCache& sibling(size_t node);
+
+    // 链表里混有其他节点的对象时（跨节点释放），按节点拆开分别归还
+    void releaseForeignObjects(void* start, size_t bytes);
+
+    // 第一次用到这个等级时才创建span桶，调用者持有bucket.lock
+    SpanBuckets& bucketsFor(size_t index);
+    // 向PageCache要一个新span，切成对象链表挂进0号桶，调用者持有bucket.lock
+    // prefault时切之前先把整个span的物理页一次性缺页进来
+    Span* newSpanFor(size_t index, SpanBuckets& buckets, bool prefault);
+    // use_count变了以后把span挪到对应的桶
+    void rebucket(SpanBuckets& buckets, Span* span);
+    // 空span从桶里摘下来准备还给PageCache，调用者持有bucket.lock
+    void detachEmptySpan(SpanBuckets& buckets, Span* span, size_t index);
+
+    bool pushBatch(size_t index, void* start);
+    bool popBatch(size_t index, void*& start, void*& end);
 
 
 private:
-    // 中心缓存的自由链表
-    //mutex是不可拷贝的，而array的默认构造又必须要拷贝，所以有问题，所以可以从指针间接持有
-    std::array<SpanList*, FREE_LIST_SIZE> span_lists_;
-    std::array<std::mutex, FREE_LIST_SIZE> span_lists_mutex_;
-    std::array<std::mutex, FREE_LIST_SIZE> span_lists_mutex_2;
+    // 锁不可拷贝也不可移动，桶数组跟着实例一次new出来
+    std::array<CentralBucket<Lock>, FREE_LIST_SIZE> buckets_;
+    // 所属的堆，span都从这个堆的页堆拿
+    Heap& heap_;
+    size_t node_;
+    // 创建时取所属堆的设置
+    std::atomic<size_t> empty_span_limit_;
+
+    static std::atomic<BasicCentralCache*> instances_[MAX_NUMA_NODES];
+    static std::once_flag instance_flags_[MAX_NUMA_NODES];
 };
 
-} // namespace llt_memoryPool
\ No newline at end of file
+// 0=std::mutex 1=SpinLock 2=TicketLock
+#if LLT_MEMPOOL_CENTRAL_LOCK == 1
+using CentralLock = SpinLock;
+#elif LLT_MEMPOOL_CENTRAL_LOCK == 2
+using CentralLock = TicketLock;
+#else
+using CentralLock = std::mutex;
+#endif
+
+using CentralCache = BasicCentralCache<CentralLock>;
+
+extern template class BasicCentralCache<std::mutex>;
+extern template class BasicCentralCache<SpinLock>;
+extern template class BasicCentralCache<TicketLock>;
+
+} // namespace llt_memoryPool
@@ -0,0 +1,112 @@
+#pragma once
+#include "Common.h"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <string>
+
+namespace llt_memoryPool
+{
+
+// 网络缓冲区（对应Muduo的Buffer），数据放在一串定长块里，块从内存池的大小等级里拿
+//   +-------------+------------------+------------------+
+//   | prependable |     readable     |     writable     |   每一块都是这个布局
+//   +-------------+------------------+------------------+
+//   - 第一块的前面留kCheapPrepend字节给prepend，不够时在前面插一块
+//   - 读写都可以跨块，readv/writev直接用块内的地址组iovec，不拷贝、不搬移
+//   - 读完的块先放进备用链表给后面的写复用，备用太多时成批还给内存池
+// 不是线程安全的，一个连接一个
+class ChainBuffer
+{
+public:
+    static constexpr size_t kCheapPrepend = 8;
+    static constexpr size_t kDefaultBlockSize = 16384;
+    // 备用块超过这个数就还掉一半
+    static constexpr size_t kMaxSpareBlocks = 16;
+    // 一次readv最多的iovec数
+    static constexpr int kMaxIov = 64;
+    // readFd保证至少有这么多可写空间
+    static constexpr size_t kReadChunk = 64 * 1024;
+
+    // blockSize向上取成2的幂，范围[256, MAX_BYTES]
+    explicit ChainBuffer(size_t blockSize = kDefaultBlockSize);
+    ~ChainBuffer();
+    ChainBuffer(ChainBuffer&& other) noexcept;
+    ChainBuffer& operator=(ChainBuffer&& other) noexcept;
+    ChainBuffer(const ChainBuffer&) = delete;
+    ChainBuffer& operator=(const ChainBuffer&) = delete;
+    void swap(ChainBuffer& other) noexcept;
+
+    size_t readableBytes() const { return readable_; }
+    // 不再申请新块就能写下的字节数
+    size_t writableBytes() const;
+    size_t prependableBytes() const { return head_ != nullptr ? head_->reader : kCheapPrepend; }
+
+    // 第一块里连续可读的部分，跨块的数据要用readableIov或者copyOut
+    const char* peek() const { return head_ != nullptr ? head_->data() + head_->reader : nullptr; }
+    size_t contiguousReadable() const { return head_ != nullptr ? head_->writer - head_->reader : 0; }
+    // 从可读区开头拷贝最多len字节，不移动读位置
+    size_t copyOut(void* dst, size_t len) const;
+
+    void retrieve(size_t len);
+    void retrieveAll() { retrieve(readable_); }
+    std::string retrieveAsString(size_t len);
+    std::string retrieveAllAsString() { return retrieveAsString(readable_); }
+
+    void append(const void* data, size_t len);
+    void append(const std::string& str) { append(str.data(), str.size()); }
+    // 写到可读区前面，len不能超过一块的容量
+    void prepend(const void* data, size_t len);
+
+    // 可读区的iovec（给writev），返回用了几个
+    int readableIov(struct iovec* iov, int maxIov) const;
+    // 保证至少有len字节可写（不够就挂新块），再返回可写区的iovec（给readv）
+    int writableIov(struct iovec* iov, int maxIov, size_t len);
+    // readv之类直接写进可写区以后，告诉缓冲区写了多少
+    void hasWritten(size_t len);
+
+    // 可写区补到kReadChunk字节，readv直接读进块里
+    ssize_t readFd(int fd, int* savedErrno);
+    // 可读区整个writev出去，写出去多少就retrieve多少
+    ssize_t writeFd(int fd, int* savedErrno);
+
+    // 把备用块和链尾没用上的空块全部还给内存池，连接空闲时调用
+    void shrink();
+    // 链上的块数（不含备用块）
+    size_t blockCount() const;
+    size_t blockSize() const { return block_size_; }
+
+private:
+    struct Block
+    {
+        Block* next;
+        uint32_t reader;
+        uint32_t writer;
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+        const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    };
+
+    Block* newBlock();
+    // 读完的块进备用链表
+    void recycle(Block* block);
+    // 把备用链表里多于keep的部分还掉
+    void releaseSpare(size_t keep);
+    // 在链尾挂一块空的
+    void appendBlock();
+    // 有空位的写入块，没有就挂一块
+    Block* writeBlock();
+    void releaseAll();
+
+private:
+    Block* head_ = nullptr;
+    // 正在写的块：它前面的块写满了，后面的块都是空的
+    Block* write_ = nullptr;
+    Block* last_ = nullptr;
+    Block* spare_ = nullptr;
+    size_t spare_count_ = 0;
+    size_t readable_ = 0;
+    size_t block_size_;
+    size_t capacity_;
+};
+
+} // namespace llt_memoryPool
@@ -3,16 +3,37 @@
 #include <array>
 #include <cstdlib>
 #include "logger.h"
+#include "Hardening.h"
 #include <mutex>
+#include <cstdint>
+#include <algorithm>
+#include <new>
+#include <utility>
+
+// 离线生成的等级表（tools/sizeclass_gen的输出），CMake变量LLT_MEMPOOL_SIZE_CLASS_TABLE给出头文件路径
+// 表里在llt_memoryPool::generated定义CLASS_COUNT和每个等级的大小、批量数、span页数
+#ifdef LLT_MEMPOOL_SIZE_CLASS_TABLE
+#include LLT_MEMPOOL_SIZE_CLASS_TABLE
+#define LLT_MEMPOOL_GENERATED_CLASSES 1
+#else
+#define LLT_MEMPOOL_GENERATED_CLASSES 0
+#endif
 
 namespace llt_memoryPool 
 {
 // 对齐数和大小定义
 constexpr size_t ALIGNMENT = 8;
 constexpr size_t MAX_BYTES = 256 * 1024; // 256KB
+#if LLT_MEMPOOL_GENERATED_CLASSES
+constexpr size_t FREE_LIST_SIZE = generated::CLASS_COUNT;
+#else
 constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT; // ALIGNMENT等于指针void*的大小
+#endif
 constexpr size_t PAGE_SIZE = 4096; // 4K页大小
 constexpr size_t PageShift =12;
+// 中等对象：大于MEDIUM_BYTES、不超过MAX_BYTES的请求在三层引擎里不走大小等级，
+// 按整页直接从PageCache拿span，ThreadCache按页数缓存最近释放的几块
+constexpr size_t MEDIUM_BYTES = 32 * 1024;
 constexpr size_t MinSystemAllocPages=64;
 // 【约束 1】一次性从 PageHeap 批发的总内存，最好别超过一个上限
 //           这个值可以比 ThreadCache 的上限大，比如 128KB
@@ -22,6 +43,60 @@ constexpr size_t MAX_BYTES_PER_SPAN = 256 * 1024;
 //我们希望一个 Span 至少能满足 8 次 ThreadCache 的 fetch 请求
 constexpr size_t MIN_BATCHES_PER_SPAN = 8;
 
+// 内部元数据（Span、中心缓存的桶、各层的单例）直接向malloc要，不走operator new：
+// 链接了src/newdelete/NewDelete.cpp以后全局operator new就是内存池自己，持着页堆的锁再进来会死锁
+inline void* internalAllocate(size_t size, size_t align = alignof(std::max_align_t))
+{
+    void* memory = align <= alignof(std::max_align_t)
+        ? std::malloc(size)
+        : std::aligned_alloc(align, (size + align - 1) & ~(align - 1));
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+inline void internalFree(void* memory)
+{
+    std::free(memory);
+}
+
+template<typename T, typename... Args>
+T* internalNew(Args&&... args)
+{
+    return new (internalAllocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+}
+
+template<typename T>
+void internalDelete(T* ptr)
+{
+    if (ptr != nullptr)
+    {
+        ptr->~T();
+        internalFree(ptr);
+    }
+}
+
+// 给内部的标准容器用（PageCache的空闲span索引）
+template<typename T>
+struct InternalAllocator
+{
+    using value_type = T;
+
+    InternalAllocator() = default;
+    template<typename U>
+    InternalAllocator(const InternalAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(internalAllocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T* ptr, size_t) { internalFree(ptr); }
+
+    template<typename U>
+    bool operator==(const InternalAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const InternalAllocator<U>&) const { return false; }
+};
+
 // 内存块头部信息
 struct BlockHeader
 {
@@ -30,7 +105,92 @@ struct BlockHeader
     BlockHeader* next; // 指向下一个内存块
 };
 
+namespace detail
+{
+    // 默认等级表：每8字节一个等级
+    inline size_t defaultBatchNum(size_t size)
+    {
+        // 基准：每次批量获取不超过4KB内存
+        constexpr size_t MAX_BATCH_SIZE = 4 * 1024; // 4KB
+
+        // 根据对象大小设置合理的基准批量数
+        size_t baseNum;
+        if (size <= 32) baseNum = 64;    // 64 * 32 = 2KB
+        else if (size <= 64) baseNum = 32;  // 32 * 64 = 2KB
+        else if (size <= 128) baseNum = 16; // 16 * 128 = 2KB
+        else if (size <= 256) baseNum = 8;  // 8 * 256 = 2KB
+        else if (size <= 512) baseNum = 4;  // 4 * 512 = 2KB
+        else if (size <= 1024) baseNum = 2; // 2 * 1024 = 2KB
+        else baseNum = 1;                   // 大于1024的对象每次只从中心缓存取1个
+
+        // 计算最大批量数
+        size_t maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
+
+        // 取最小值，但确保至少返回1
+        size_t result = std::max(size_t(1), std::min(maxNum, baseNum));
+        return result;
+    }
+
+    inline size_t defaultPages(size_t object_size)
+    {
+        size_t batchnums=defaultBatchNum(object_size);
+        size_t desire_sizes=batchnums*MIN_BATCHES_PER_SPAN;
+        size_t desire_bytes=desire_sizes*object_size;
+        size_t pages_by_desire=(PAGE_SIZE+desire_bytes-1)/PAGE_SIZE;
+        size_t pages_by_limit=MAX_BYTES_PER_SPAN/PAGE_SIZE;
+        size_t result_pages=std::min(pages_by_desire,pages_by_limit);
+        return std::max(size_t(1),result_pages);
+    }
+
+#if LLT_MEMPOOL_GENERATED_CLASSES
+    // 生成的表必须从小到大、都是ALIGNMENT的倍数、最后一个正好是MAX_BYTES，编译期检查
+    constexpr bool validClassTable()
+    {
+        for (size_t i = 0; i < generated::CLASS_COUNT; ++i)
+        {
+            size_t size = generated::CLASS_SIZES[i];
+            if (size == 0 || size % ALIGNMENT != 0 || (i > 0 && size <= generated::CLASS_SIZES[i - 1]))
+            {
+                return false;
+            }
+            if (generated::CLASS_PAGES[i] == 0 || generated::CLASS_PAGES[i] * PAGE_SIZE < size ||
+                generated::CLASS_BATCH[i] == 0)
+            {
+                return false;
+            }
+        }
+        return generated::CLASS_SIZES[generated::CLASS_COUNT - 1] == MAX_BYTES;
+    }
+    static_assert(validClassTable(), "generated size-class table is malformed");
+
+    // 按8字节向上取整以后的大小到等级的查找表，编译期建好
+    struct ClassIndexTable
+    {
+        uint16_t index[MAX_BYTES / ALIGNMENT];
+    };
+
+    constexpr ClassIndexTable makeClassIndex()
+    {
+        ClassIndexTable table{};
+        size_t cls = 0;
+        for (size_t i = 0; i < MAX_BYTES / ALIGNMENT; ++i)
+        {
+            size_t bytes = (i + 1) * ALIGNMENT;
+            while (generated::CLASS_SIZES[cls] < bytes)
+            {
+                ++cls;
+            }
+            table.index[i] = static_cast<uint16_t>(cls);
+        }
+        return table;
+    }
+
+    inline constexpr ClassIndexTable CLASS_INDEX = makeClassIndex();
+#endif
+}
+
 // 大小类管理
+// 默认每8字节一个等级；配置了LLT_MEMPOOL_SIZE_CLASS_TABLE时用离线生成的表（tools/sizeclass_gen）
 class SizeClass 
 {
 public:
@@ -43,48 +203,40 @@ public:
     {   
         // 确保bytes至少为ALIGNMENT
         bytes = std::max(bytes, ALIGNMENT);
+#if LLT_MEMPOOL_GENERATED_CLASSES
+        return detail::CLASS_INDEX.index[(bytes + ALIGNMENT - 1) / ALIGNMENT - 1];
+#else
         // 向上取整后-1
         return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+#endif
     }
 
     static size_t getSize(size_t index)
     {
+#if LLT_MEMPOOL_GENERATED_CLASSES
+        return generated::CLASS_SIZES[index];
+#else
         return index * ALIGNMENT + ALIGNMENT;
+#endif
     }
     static size_t getPages(size_t index)
     {
-        const size_t object_size=SizeClass::getSize(index);
-        size_t batchnums=getBatchNum(object_size);
-        size_t desire_sizes=batchnums*MIN_BATCHES_PER_SPAN;
-        size_t desire_bytes=desire_sizes*object_size;
-        size_t pages_by_desire=(PAGE_SIZE+desire_bytes-1)/PAGE_SIZE;
-        size_t pages_by_limit=MAX_BYTES_PER_SPAN/PAGE_SIZE;
-        size_t result_pages=std::min(pages_by_desire,pages_by_limit);
-        return std::max(size_t(1),result_pages);
+#if LLT_MEMPOOL_GENERATED_CLASSES
+        return generated::CLASS_PAGES[index];
+#else
+        return detail::defaultPages(SizeClass::getSize(index));
+#endif
     }
 
+    // size是等级的大小（或者落在这个等级里的任意大小）
     static size_t getBatchNum(size_t size)
-{
-    // 基准：每次批量获取不超过4KB内存
-    constexpr size_t MAX_BATCH_SIZE = 4 * 1024; // 4KB
-
-    // 根据对象大小设置合理的基准批量数
-    size_t baseNum;
-    if (size <= 32) baseNum = 64;    // 64 * 32 = 2KB
-    else if (size <= 64) baseNum = 32;  // 32 * 64 = 2KB
-    else if (size <= 128) baseNum = 16; // 16 * 128 = 2KB
-    else if (size <= 256) baseNum = 8;  // 8 * 256 = 2KB
-    else if (size <= 512) baseNum = 4;  // 4 * 512 = 2KB
-    else if (size <= 1024) baseNum = 2; // 2 * 1024 = 2KB
-    else baseNum = 1;                   // 大于1024的对象每次只从中心缓存取1个
-
-    // 计算最大批量数
-    size_t maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
-
-    // 取最小值，但确保至少返回1
-    size_t result = std::max(size_t(1), std::min(maxNum, baseNum));
-    return result;
-}
+    {
+#if LLT_MEMPOOL_GENERATED_CLASSES
+        return generated::CLASS_BATCH[getIndex(size)];
+#else
+        return detail::defaultBatchNum(size);
+#endif
+    }
 
 };
 
@@ -102,6 +254,22 @@ struct Span{
     //index等级
     size_t size_class=0;
     size_t use_count=0;
+    //所属NUMA节点
+    size_t node=0;
+    //空闲时已经madvise还给系统，不计入已提交内存
+    bool decommitted=false;
+    //页是全零的：刚提交或者刚madvise过，还没交出去被写过
+    bool zeroed=false;
+    //大于MAX_BYTES的对象独占的span，不属于任何等级（size_class没有意义）
+    bool large=false;
+    //在CentralCache里所在的占用率桶
+    size_t occupancy_bucket=0;
+    //空闲、还没和邻居合并过，挂在PageCache的待合并链表上（借用next/prev）
+    bool coalesce_pending=false;
+#if LLT_MEMPOOL_HARDENED
+    //每个对象一位，1表示已经从span交出去（在线程缓存、批栈或用户手里）
+    uint64_t* alloc_bitmap=nullptr;
+#endif
     //锁
     std::mutex lock_;
 
@@ -124,14 +292,14 @@ struct Span{
 class SpanList{
     public:
     SpanList(){
-        head_=new Span;
+        head_=internalNew<Span>();
         head_->next=head_;
         head_->prev=head_;  
         size_=0;
     }
     ~SpanList()
     {
-        delete head_;
+        internalDelete(head_);
     }
     //350法则
     SpanList(const SpanList&) = delete;
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+// 加固模式：编译期开关，CMake选项LLT_MEMPOOL_HARDENED或者链接llt_memorypool_hardened
+// 打开以后：
+//   - 自由链表的next指针按“槽地址+进程随机数”编码，解码出未对齐的指针直接报错
+//   - ThreadCache释放时和链表头比较，抓最直接的重复释放
+//   - 每个span带一张分配位图，releaseListToSpans里抓重复释放、野指针和大小不匹配的释放
+//   - 可选的采样保护页：每N次分配有一次放在单独的页里，后面紧跟一个不可访问的保护页
+// 头文件里的快路径和库必须用同一个开关编译，所以宏由CMake作为PUBLIC定义传下去
+#ifndef LLT_MEMPOOL_HARDENED
+#define LLT_MEMPOOL_HARDENED 0
+#endif
+
+// 保护页的默认采样间隔，0表示关闭，运行时可以用MemoryPool::setGuardSampleRate改
+#ifndef LLT_MEMPOOL_GUARD_SAMPLE_RATE
+#define LLT_MEMPOOL_GUARD_SAMPLE_RATE 0
+#endif
+
+namespace llt_memoryPool
+{
+
+constexpr bool HARDENED = LLT_MEMPOOL_HARDENED != 0;
+
+namespace hardening
+{
+    // 进程启动时从getrandom取，低3位清零，编码后的指针仍然是8字节对齐的
+    extern uintptr_t freelist_key;
+
+    // 打印出错原因和地址后abort，不经过异步日志（进程马上就没了）
+    [[noreturn]] void fail(const char* what, const void* ptr);
+
+    inline uintptr_t linkMask(const void* slot)
+    {
+        // 槽地址参与编码：同一个next值存在不同对象里的密文不同
+        return (freelist_key ^ (reinterpret_cast<uintptr_t>(slot) >> 12)) & ~uintptr_t(7);
+    }
+
+    // 不校验的编解码，给可能读到过期数据的无锁批栈用
+    inline void* maskWord(const void* slot, void* value)
+    {
+        return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(value) ^ linkMask(slot));
+    }
+
+    // 当前的采样间隔，0表示关闭
+    size_t guardSampleRate();
+    void setGuardSampleRate(size_t rate);
+
+    // 采样保护页：对象放在页尾，后一页PROT_NONE，越界写直接段错误；
+    // 释放后整页改成PROT_NONE并排队一段时间再复用，释放后使用也会段错误
+    // 只接收不超过一页的请求，槽用完或者太大时返回nullptr，调用者走普通路径
+    void* guardedAllocate(size_t size);
+    // ptr在保护页区域里时处理释放并返回true
+    bool guardedDeallocate(void* ptr, size_t size);
+    // ptr是还没释放的保护页对象时返回它按8字节取整的大小，否则返回0
+    size_t guardedSize(const void* ptr);
+
+    // 保护页区域：GUARD_SLOTS个槽，每槽一页数据一页保护，第一次采样时才预留
+    constexpr size_t GUARD_SLOTS = 1024;
+    constexpr size_t GUARD_REGION_BYTES = GUARD_SLOTS * 2 * 4096;
+    extern std::atomic<uintptr_t> guard_region_begin;
+
+    // 快路径用：区域还没预留时begin是0，一次原子读加一次比较
+    inline bool isGuarded(const void* ptr)
+    {
+        uintptr_t begin = guard_region_begin.load(std::memory_order_relaxed);
+        return begin != 0 && reinterpret_cast<uintptr_t>(ptr) - begin < GUARD_REGION_BYTES;
+    }
+}
+
+// 自由链表里第一个字的读写，所有层都通过这两个函数，加固模式下统一编码
+inline void* loadNext(void* obj)
+{
+#if LLT_MEMPOOL_HARDENED
+    void* next = hardening::maskWord(obj, *reinterpret_cast<void**>(obj));
+    if (reinterpret_cast<uintptr_t>(next) & 7) [[unlikely]]
+    {
+        hardening::fail("corrupted free list link", obj);
+    }
+    return next;
+#else
+    return *reinterpret_cast<void**>(obj);
+#endif
+}
+
+inline void storeNext(void* obj, void* next)
+{
+#if LLT_MEMPOOL_HARDENED
+    *reinterpret_cast<void**>(obj) = hardening::maskWord(obj, next);
+#else
+    *reinterpret_cast<void**>(obj) = next;
+#endif
+}
+
+} // namespace llt_memoryPool
@@ -0,0 +1,116 @@
+#pragma once
+#include "Common.h"
+#include "Numa.h"
+#include "HeapLimit.h"
+#include "ThreadCache.h"
+#include "CentralCache.h"
+#include <atomic>
+#include <mutex>
+
+namespace llt_memoryPool
+{
+
+class PageCache;
+
+// 一个堆的统计快照
+struct HeapStats
+{
+    size_t committed = 0;      // 已提交（计入堆上限）的字节数
+    size_t limit = 0;          // 堆上限，0表示不限制
+    size_t free_bytes = 0;     // 页堆空闲span里还提交着的字节数，releaseMemory能还给系统的部分
+    size_t reserved = 0;       // 预留的虚拟地址空间
+    size_t thread_caches = 0;  // 在这个堆上有线程缓存的线程数
+};
+
+// 独立的堆：自己的PageCache和CentralCache（每个NUMA节点一个，按需创建）、自己的堆上限、压力回调和统计，
+// 每个线程在每个堆上各有一个线程缓存。不同租户/子系统各用一个堆，内存互不混用，destroy()一步整个还给系统
+// 默认堆就是原来那一套：MemoryPool的静态接口、PageCache/CentralCache/HeapLimit::getInstance都落在它上面
+// 堆总是三层引擎；页本地引擎（LLT_MEMPOOL_PAGE_LOCAL）只接管MemoryPool的静态接口
+class Heap
+{
+public:
+    // 默认堆，编号0，不销毁
+    static Heap& defaultHeap();
+    // 新建一个堆，limit是它的堆上限（0表示不限制）；MAX_HEAPS个编号都在用时返回nullptr
+    static Heap* create(size_t limit = 0);
+    // 销毁堆：各线程在它上面的缓存直接丢掉，预留的地址空间全部munmap，Heap对象本身也释放
+    // 从这个堆分出去的指针全部失效；调用时不能有别的线程还在用它。默认堆不能销毁
+    void destroy();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // 和MemoryPool::allocate/deallocate一样；释放必须回到分配它的那个堆
+    void* allocate(size_t size) { return threadCache()->allocate(size); }
+    void deallocate(void* ptr, size_t size) { threadCache()->deallocate(ptr, size); }
+
+    // 调用线程在这个堆上的线程缓存，第一次用时创建
+    ThreadCache* threadCache()
+    {
+        return id_ == 0 ? ThreadCache::getInstance() : ThreadCache::getInstance(*this);
+    }
+
+    // 堆上限和压力回调，语义和MemoryPool的同名接口一样，只统计这个堆
+    void setLimit(size_t bytes) { limit_.setLimit(bytes); }
+    size_t limit() const { return limit_.limit(); }
+    size_t committed() const { return limit_.committed(); }
+    void setPressureCallback(PressureCallback callback) { limit_.setCallback(std::move(callback)); }
+    // 这个堆的中心缓存每个等级最多留几个空span（默认DEFAULT_EMPTY_SPANS），0表示一空就还
+    // 已经创建的各节点中心缓存立即生效，之后创建的在创建时取这个值
+    void setEmptySpanLimit(size_t count);
+    size_t emptySpanLimit() const { return empty_span_limit_.load(std::memory_order_relaxed); }
+    // 跑一遍这个堆的释放级联，返回还给系统的字节数
+    size_t releaseMemory() { return limit_.releaseMemory(true); }
+    HeapStats stats() const;
+
+    size_t id() const { return id_; }
+
+    // 下面给三层缓存内部用
+    PageCache& pageCache(size_t node)
+    {
+        PageCache* cache = pages_[node].load(std::memory_order_acquire);
+        return cache != nullptr ? *cache : createPageCache(node);
+    }
+    // 节点的页堆还没创建时返回nullptr，不会触发创建
+    PageCache* pageCacheIfCreated(size_t node) const { return pages_[node].load(std::memory_order_acquire); }
+    // 默认堆用CentralCache::getInstance的那一份，压测直接拿的也是它
+    CentralCache& centralCache(size_t node);
+    CentralCache* centralCacheIfCreated(size_t node) const;
+    HeapLimit& limiter() { return limit_; }
+
+    // 在这个堆已创建的页堆里查找ptr属于哪个节点，先查hint，找不到返回MAX_NUMA_NODES
+    size_t findNode(void* ptr, size_t hint = 0) const;
+    // 按地址找回allocateLarge交出去的span（中等对象也是这样拿的）
+    // 加固模式下确认ptr是span的起点、页数和size对得上，否则直接报错
+    Span* largeSpanOf(void* ptr, size_t size);
+    // 按地址找回所属节点和span，PageCache::LARGE_DECOMMIT_PAGES页以上的立即还给系统
+    void deallocateLarge(void* ptr, size_t size);
+
+private:
+    Heap(size_t id, size_t limit);
+    ~Heap();
+
+    PageCache& createPageCache(size_t node);
+
+private:
+    size_t id_;
+    HeapLimit limit_;
+    std::atomic<size_t> empty_span_limit_{DEFAULT_EMPTY_SPANS};
+    std::atomic<PageCache*> pages_[MAX_NUMA_NODES] = {};
+    std::once_flag page_flags_[MAX_NUMA_NODES];
+    // 默认堆不用这两个
+    std::atomic<CentralCache*> centrals_[MAX_NUMA_NODES] = {};
+    std::once_flag central_flags_[MAX_NUMA_NODES];
+};
+
+inline ThreadCache* ThreadCache::getInstance(Heap& heap)
+{
+    ThreadCache* cache = tls_heap_caches_[heap.id()];
+    if (cache != nullptr) [[likely]]
+    {
+        return cache;
+    }
+    return createInstance(heap);
+}
+
+} // namespace llt_memoryPool
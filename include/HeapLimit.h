@@ -0,0 +1,80 @@
+#pragma once
+#include "Common.h"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+
+namespace llt_memoryPool
+{
+
+class Heap;
+
+// 内存压力等级
+enum class PressureLevel
+{
+    Approaching = 0,   // 已提交内存超过上限的PRESSURE_PERCENT%
+    Exhausted = 1      // 上限内找不到内存，本次分配在回调之后还会再试一次
+};
+
+// 压力回调：在分配线程上同步调用，调用时不持有内存池的任何锁
+// 回调里可以释放（也可以分配）池内存，重入的压力事件会被忽略
+using PressureCallback = std::function<void(PressureLevel level, size_t committed, size_t limit)>;
+
+// 已提交内存超过上限的这个百分比就算“接近上限”
+constexpr size_t PRESSURE_PERCENT = 90;
+
+// 堆上限：统计PageCache已提交（mmap且没有madvise掉）的字节数，newSpan按它拒绝申请
+// 大于MAX_BYTES的大对象也从PageCache拿整数页，同样计入
+// 每个Heap一个，只统计和回收自己那个堆
+class HeapLimit
+{
+public:
+    // 默认堆的上限
+    static HeapLimit& getInstance();
+    HeapLimit(const HeapLimit&)=delete;
+    HeapLimit& operator=(const HeapLimit&)=delete;
+
+    // 0表示不限制
+    void setLimit(size_t bytes) { limit_.store(bytes, std::memory_order_relaxed); }
+    size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+    size_t committed() const { return committed_.load(std::memory_order_relaxed); }
+
+    // 记账bytes，超过上限时不记账并返回false
+    bool tryCharge(size_t bytes);
+    void uncharge(size_t bytes) { committed_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+    // 已提交内存是否超过上限的PRESSURE_PERCENT%
+    bool underPressure() const
+    {
+        size_t limit = limit_.load(std::memory_order_relaxed);
+        return limit != 0 && committed_.load(std::memory_order_relaxed) >= limit / 100 * PRESSURE_PERCENT;
+    }
+
+    void setCallback(PressureCallback callback);
+
+    // 释放级联（都只在所属的堆里）：当前线程缓存 -> 请求空闲线程回收 -> 中心缓存的批栈和留着的空span -> PageCache空闲span还给系统
+    // aggressive为false时（接近上限）只回收线程缓存和中心缓存的批栈，不动留着的空span，也不还给系统
+    // 返回还给系统的字节数；不持有任何锁时才能调用
+    size_t releaseMemory(bool aggressive);
+
+    // 分配慢路径发现压力时调用：跑一遍级联再通知回调，返回还给系统的字节数
+    // Approaching限频、只跑不还给系统的前几步，Exhausted每次都跑完整的级联；本线程已经在处理压力时直接返回0
+    size_t onPressure(PressureLevel level);
+
+private:
+    friend class Heap;
+    explicit HeapLimit(Heap& heap) : heap_(heap) {}
+    ~HeapLimit()=default;
+
+private:
+    Heap& heap_;
+    std::atomic<size_t> limit_{0};
+    std::atomic<size_t> committed_{0};
+    // 上一次处理Approaching的时间，避免每个慢路径都去扫PageCache
+    std::atomic<uint64_t> last_approaching_ns_{0};
+    std::mutex callback_mutex_;
+    PressureCallback callback_;
+};
+
+} // namespace llt_memoryPool
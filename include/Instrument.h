@@ -0,0 +1,217 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// 慢路径插桩：编译期开关，CMake选项LLT_MEMPOOL_INSTRUMENT，默认关
+// 打开以后记录：
+//   - CentralCache每个等级的桶锁、每个节点的PageCache锁：获取次数、冲突次数、等待时间和持有时间
+//   - fetchFromCentralCache、allocateSpan、newSpan、deallocateSpan的延迟直方图（按2的幂分桶，纳秒）
+//   - 各条慢路径的执行次数（批栈命中、跨节点归还、提交新页、madvise等）
+// 关掉时TimedLock就是std::lock_guard，PathTimer和count是空函数，不占任何存储
+#ifndef LLT_MEMPOOL_INSTRUMENT
+#define LLT_MEMPOOL_INSTRUMENT 0
+#endif
+
+namespace llt_memoryPool
+{
+
+constexpr bool INSTRUMENTED = LLT_MEMPOOL_INSTRUMENT != 0;
+
+namespace instrument
+{
+    // 计时的慢路径
+    enum class Path
+    {
+        FetchFromCentral,
+        AllocateSpan,
+        NewSpan,
+        DeallocateSpan,
+        Count
+    };
+
+    // 只计数的慢路径
+    enum class Event
+    {
+        BatchStackPop,      // fetchRange直接从批栈拿到一整批
+        BatchStackPush,     // releaseRange整批压进批栈
+        ReleaseToSpans,     // releaseListToSpans加锁还给span
+        ForeignRelease,     // 链表里有其他节点的对象，按节点分流
+        SpanReturned,       // 空span还给PageCache
+        ArenaCommit,        // 从预留的地址空间提交新页
+        Decommit,           // 空闲span madvise还给系统
+        TrimRequest,        // PageCache请求所有线程回收缓存
+        Coalesce,           // 找不到够大的空闲span，合并一遍地址相连的空闲span
+        Count
+    };
+
+    // 两种锁：CentralCache的桶锁按等级统计，PageCache的锁按节点统计
+    enum class Lock
+    {
+        CentralBucket,
+        PageCache,
+        Count
+    };
+
+    // 直方图第i个桶是[2^i, 2^(i+1))纳秒，第0个桶包括0，最后一个桶兜底
+    constexpr size_t HISTOGRAM_BUCKETS = 40;
+
+    struct PathSnapshot
+    {
+        uint64_t count = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        // 分位数取所在桶的上界
+        uint64_t p50_ns = 0;
+        uint64_t p99_ns = 0;
+    };
+
+    struct LockSnapshot
+    {
+        uint64_t acquisitions = 0;
+        // try_lock失败、真正等过的次数
+        uint64_t contended = 0;
+        uint64_t wait_ns = 0;
+        uint64_t hold_ns = 0;
+        uint64_t max_wait_ns = 0;
+        uint64_t max_hold_ns = 0;
+        uint64_t p99_wait_ns = 0;
+        uint64_t p99_hold_ns = 0;
+    };
+
+    // 快照和打印在两种构建里都有，关掉插桩时返回全0
+    PathSnapshot pathSnapshot(Path path);
+    // 某一类锁的汇总
+    LockSnapshot lockSnapshot(Lock lock);
+    uint64_t eventCount(Event event);
+    // 路径延迟、锁汇总、冲突最多的几个桶锁和事件计数，文本表格
+    void dump(FILE* out);
+    void reset();
+
+    inline uint64_t nowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+#if LLT_MEMPOOL_INSTRUMENT
+    class Histogram
+    {
+    public:
+        void record(uint64_t ns);
+        void snapshot(PathSnapshot& out) const;
+        uint64_t percentile(double fraction) const;
+        void reset();
+
+    private:
+        std::atomic<uint64_t> buckets_[HISTOGRAM_BUCKETS] = {};
+        std::atomic<uint64_t> count_{0};
+        std::atomic<uint64_t> total_ns_{0};
+        std::atomic<uint64_t> max_ns_{0};
+    };
+
+    // 一把锁（或者一组锁）的计数
+    struct LockStats
+    {
+        std::atomic<uint64_t> acquisitions{0};
+        std::atomic<uint64_t> contended{0};
+        std::atomic<uint64_t> wait_ns{0};
+        std::atomic<uint64_t> hold_ns{0};
+    };
+
+    LockStats* centralLock(size_t index);
+    LockStats* pageLock(size_t node);
+    void recordPath(Path path, uint64_t ns);
+    void recordLock(Lock kind, LockStats* stats, bool contended, uint64_t wait_ns, uint64_t hold_ns);
+
+    extern std::atomic<uint64_t> events[static_cast<size_t>(Event::Count)];
+
+    inline void count(Event event)
+    {
+        events[static_cast<size_t>(event)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 先try_lock：没冲突时不算等待，只读一次时钟
+    template<typename Mutex>
+    class TimedLock
+    {
+    public:
+        TimedLock(Mutex& mutex, Lock kind, LockStats* stats)
+            : mutex_(mutex), kind_(kind), stats_(stats)
+        {
+            uint64_t begin = nowNs();
+            contended_ = !mutex_.try_lock();
+            if (contended_)
+            {
+                mutex_.lock();
+                locked_ns_ = nowNs();
+            }
+            else
+            {
+                locked_ns_ = begin;
+            }
+            wait_ns_ = locked_ns_ - begin;
+        }
+        ~TimedLock()
+        {
+            uint64_t hold = nowNs() - locked_ns_;
+            mutex_.unlock();
+            recordLock(kind_, stats_, contended_, wait_ns_, hold);
+        }
+        TimedLock(const TimedLock&) = delete;
+        TimedLock& operator=(const TimedLock&) = delete;
+
+    private:
+        Mutex& mutex_;
+        Lock kind_;
+        LockStats* stats_;
+        bool contended_;
+        uint64_t locked_ns_;
+        uint64_t wait_ns_;
+    };
+
+    class PathTimer
+    {
+    public:
+        explicit PathTimer(Path path) : path_(path), begin_ns_(nowNs()) {}
+        ~PathTimer() { recordPath(path_, nowNs() - begin_ns_); }
+        PathTimer(const PathTimer&) = delete;
+        PathTimer& operator=(const PathTimer&) = delete;
+
+    private:
+        Path path_;
+        uint64_t begin_ns_;
+    };
+#else
+    struct LockStats;
+
+    inline LockStats* centralLock(size_t) { return nullptr; }
+    inline LockStats* pageLock(size_t) { return nullptr; }
+    inline void count(Event) {}
+
+    template<typename Mutex>
+    class TimedLock
+    {
+    public:
+        TimedLock(Mutex& mutex, Lock, LockStats*) : mutex_(mutex) { mutex_.lock(); }
+        ~TimedLock() { mutex_.unlock(); }
+        TimedLock(const TimedLock&) = delete;
+        TimedLock& operator=(const TimedLock&) = delete;
+
+    private:
+        Mutex& mutex_;
+    };
+
+    class PathTimer
+    {
+    public:
+        explicit PathTimer(Path) {}
+        PathTimer(const PathTimer&) = delete;
+        PathTimer& operator=(const PathTimer&) = delete;
+    };
+#endif
+}
+
+} // namespace llt_memoryPool
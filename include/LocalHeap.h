@@ -0,0 +1,187 @@
+#pragma once
+#include "Common.h"
+#include <atomic>
+#include <cstdint>
+
+namespace llt_memoryPool
+{
+
+// 页本地引擎（mimalloc式）：可以替代ThreadCache/CentralCache这两层
+//   - 内存按4MB对齐的段向系统申请，段头里放所有页的元数据，指针按地址直接算出所在的页，不查表
+//   - 每个段只属于一个线程的堆，页也只分给一个大小等级
+//   - 每页三条链表：free（分配用）、local_free（本线程释放）、thread_free（其他线程释放，一次CAS压入）
+//   - 线程退出时还有对象没回来的段被“遗弃”，别的线程需要新页时再接管
+// 编译期用LLT_MEMPOOL_ENGINE=pagelocal让MemoryPool走这个引擎；不管选哪个，这个类都可以直接用来对比
+
+constexpr size_t LOCAL_SEGMENT_SHIFT = 22;
+constexpr size_t LOCAL_SEGMENT_SIZE = size_t(1) << LOCAL_SEGMENT_SHIFT;       // 4MB
+constexpr size_t LOCAL_SMALL_PAGE_SHIFT = 16;                                  // 64KB
+constexpr size_t LOCAL_LARGE_PAGE_SHIFT = 21;                                  // 2MB
+// 不超过它的对象放在64KB的页里（每页至少8个），更大的放2MB的页
+constexpr size_t LOCAL_SMALL_BLOCK_MAX = 8 * 1024;
+constexpr size_t LOCAL_MAX_PAGES = LOCAL_SEGMENT_SIZE >> LOCAL_SMALL_PAGE_SHIFT; // 64
+
+struct LocalPage
+{
+    void* free = nullptr;                       // 分配链表，只有所属线程访问
+    void* local_free = nullptr;                 // 所属线程释放的对象
+    std::atomic<uintptr_t> thread_free{0};      // 其他线程释放的对象
+    size_t used = 0;                            // 交出去还没收回的对象数（thread_free里的也算）
+    size_t capacity = 0;                        // 已经串进链表的对象数，按需往后扩
+    size_t reserved = 0;                        // 这一页最多能放多少个对象
+    size_t block_size = 0;
+    size_t size_class = 0;
+    char* start = nullptr;                      // 第一个对象的地址
+    LocalPage* next = nullptr;                  // 所在的等级队列或者full队列
+    LocalPage* prev = nullptr;
+    bool in_use = false;
+    bool in_full = false;
+};
+
+struct LocalSegment
+{
+    std::atomic<uint64_t> owner{0};             // 所属堆的id，0表示被遗弃
+    size_t page_shift = 0;
+    size_t page_count = 0;
+    size_t used_pages = 0;
+    size_t node = 0;
+    LocalSegment* next = nullptr;               // 堆的段链表或者遗弃链表
+    LocalSegment* prev = nullptr;
+    LocalPage pages[LOCAL_MAX_PAGES];
+};
+
+class LocalHeap
+{
+public:
+    static LocalHeap* getInstance()
+    {
+        LocalHeap* heap = tls_heap_;
+        if (heap != nullptr) [[likely]]
+        {
+            return heap;
+        }
+        return createInstance();
+    }
+
+    // 本线程已经有堆时返回它，不会创建
+    static LocalHeap* currentIfCreated() { return tls_heap_; }
+
+    void* allocate(size_t size)
+    {
+        if (size == 0)
+        {
+            size = ALIGNMENT;
+        }
+        if (size > MAX_BYTES) [[unlikely]]
+        {
+            return allocateLarge(size);
+        }
+        size_t index = SizeClass::getIndex(size);
+        LocalPage* page = pages_[index];
+        if (page != nullptr && page->free != nullptr) [[likely]]
+        {
+            void* ptr = page->free;
+            page->free = loadNext(ptr);
+            page->used++;
+            return ptr;
+        }
+        return allocateSlow(index);
+    }
+
+    // 任何线程都可以调用，不需要本线程有堆
+    static void deallocate(void* ptr, size_t size)
+    {
+        if (size > MAX_BYTES) [[unlikely]]
+        {
+            deallocateLarge(ptr, size);
+            return;
+        }
+        LocalSegment* segment = segmentOf(ptr);
+        LocalPage* page = pageOf(segment, ptr);
+        LocalHeap* heap = tls_heap_;
+        if (heap != nullptr && segment->owner.load(std::memory_order_relaxed) == heap->id_) [[likely]]
+        {
+            storeNext(ptr, page->local_free);
+            page->local_free = ptr;
+            if (--page->used == 0 || page->in_full) [[unlikely]]
+            {
+                heap->freeSlow(page);
+            }
+            return;
+        }
+        remoteFree(page, ptr);
+    }
+
+    static LocalSegment* segmentOf(const void* ptr)
+    {
+        return reinterpret_cast<LocalSegment*>(reinterpret_cast<uintptr_t>(ptr) & ~(LOCAL_SEGMENT_SIZE - 1));
+    }
+
+    static LocalPage* pageOf(LocalSegment* segment, const void* ptr)
+    {
+        size_t offset = reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(segment);
+        return &segment->pages[offset >> segment->page_shift];
+    }
+
+    uint64_t id() const { return id_; }
+    size_t node() const { return node_; }
+    // 本堆拥有的段数
+    size_t segmentCount() const { return segment_count_; }
+    // 当前在遗弃链表上、等待接管的段数
+    static size_t abandonedCount();
+
+    LocalHeap(const LocalHeap&) = delete;
+    LocalHeap& operator=(const LocalHeap&) = delete;
+
+private:
+    friend struct LocalHeapHolder;
+    LocalHeap();
+    ~LocalHeap();
+    static LocalHeap* createInstance();
+
+    void* allocateSlow(size_t index);
+    // 大于MAX_BYTES的对象和三层引擎一样走PageCache
+    void* allocateLarge(size_t size);
+    static void deallocateLarge(void* ptr, size_t size);
+    // 本线程释放后页空了，或者页在full队列里
+    void freeSlow(LocalPage* page);
+    static void remoteFree(LocalPage* page, void* ptr);
+
+    // 在等级队列里找一个有空闲对象的页，顺手把满页挪到full队列
+    LocalPage* findFreePage(size_t index);
+    // 把thread_free和local_free收进free，只在free为空时做
+    static void collect(LocalPage* page);
+    // 把还没初始化的对象往后再串一段
+    static void extend(LocalPage* page);
+    // 从自己的段、遗弃的段或者新段里拿一个空页给index等级
+    LocalPage* newPage(size_t index);
+    LocalPage* takeFreePage(LocalSegment* segment, size_t index);
+    LocalSegment* newSegment(size_t page_shift);
+    // 接管一个遗弃的段，没有合适的返回nullptr
+    LocalSegment* adoptSegment(size_t page_shift);
+    void retirePage(LocalPage* page);
+    void releaseSegment(LocalSegment* segment);
+
+    void queuePushFront(LocalPage* page);
+    void queueRemove(LocalPage* page);
+    void fullPush(LocalPage* page);
+    void fullRemove(LocalPage* page);
+    void segmentPush(LocalSegment* segment);
+    void segmentRemove(LocalSegment* segment);
+
+private:
+    // 每个等级的页队列，队头是当前分配的页
+    std::array<LocalPage*, FREE_LIST_SIZE> pages_;
+    // 没有空闲对象的页，慢路径里轮流检查有没有别的线程还回来的对象
+    LocalPage* full_ = nullptr;
+    LocalPage* full_tail_ = nullptr;
+    LocalSegment* segments_ = nullptr;
+    size_t segment_count_ = 0;
+    uint64_t id_;
+    size_t node_;
+
+    __attribute__((tls_model("initial-exec")))
+    static inline thread_local LocalHeap* tls_heap_ = nullptr;
+};
+
+} // namespace llt_memoryPool
@@ -1,25 +1,160 @@
 #pragma once
 // 只包含需要的头文件
 #include "ThreadCache.h"
+#include "LocalHeap.h"
+#include "Heap.h"
+#include "Arena.h"
+#include "Instrument.h"
+#include "Trace.h"
+#include "StatsExport.h"
+#include <new>
+#include <utility>
+#include <vector>
+
+// MemoryPool后面的分配引擎：0是ThreadCache/CentralCache/PageCache三层，1是页本地引擎（LocalHeap）
+// 和加固开关一样由CMake作为PUBLIC定义传下来（LLT_MEMPOOL_ENGINE=tiered|pagelocal）
+#ifndef LLT_MEMPOOL_PAGE_LOCAL
+#define LLT_MEMPOOL_PAGE_LOCAL 0
+#endif
 
 namespace llt_memoryPool
 {
 
+// 启动预留的一项：size大小的对象预留count个
+struct ReserveEntry
+{
+    size_t size;
+    size_t count;
+};
+
+// 静态接口都作用在默认堆（Heap::defaultHeap()）上；要彼此隔离、能整体销毁的堆见Heap.h
 class MemoryPool
 {
 public:
+    // 请求级的区域分配器，见Arena.h
+    using Arena = BumpArena;
+
     static void* allocate(size_t size)
     {
-        //LogDebug("[MemoryPool:allocate] 分配内存请求，大小: " + std::to_string(size) + " 字节");
+        LogDebug("[MemoryPool:allocate] 分配内存请求，大小: %zu 字节", size);
+#if LLT_MEMPOOL_PAGE_LOCAL
+        void* ptr = LocalHeap::getInstance()->allocate(size);
+#else
         void* ptr = ThreadCache::getInstance()->allocate(size);
-        //LogDebug("[MemoryPool:allocate] 内存分配完成，地址: " + std::to_string(reinterpret_cast<uintptr_t>(ptr)));
+#endif
+        LogDebug("[MemoryPool:allocate] 内存分配完成，地址: %p", ptr);
+        if (ptr != nullptr)
+        {
+            trace::onAllocate(ptr, size);
+        }
         return ptr;
     }
 
     static void deallocate(void* ptr, size_t size)
     {
-        //LogDebug("[MemoryPool:deallocate] 释放内存请求，地址: " + std::to_string(reinterpret_cast<uintptr_t>(ptr)) + "，大小: " + std::to_string(size) + " 字节");
+        LogDebug("[MemoryPool:deallocate] 释放内存请求，地址: %p，大小: %zu 字节", ptr, size);
+        // 真正释放之前记录：这个地址被别的线程重新分配出来时，释放一定排在前面
+        if (ptr != nullptr)
+        {
+            trace::onFree(ptr, size);
+        }
+#if LLT_MEMPOOL_PAGE_LOCAL
+        LocalHeap::deallocate(ptr, size);
+#else
         ThreadCache::getInstance()->deallocate(ptr, size);
+#endif
+    }
+
+    // 分配并清零（calloc）：整页分配的对象（大对象，三层引擎里还有中等对象）页还没被写过时（新提交或者madvise过）不再memset
+    static void* allocateZeroed(size_t size);
+
+    // ptr所在块的实际大小：小对象是等级的大小，大对象是整数页，相当于malloc_usable_size
+    // ptr必须是allocate返回、还没释放的指针；按这个大小deallocate和按申请时的大小一样，不带大小的operator delete靠它
+    static size_t usableSize(void* ptr);
+
+    // 请求其他空闲线程在下一次操作时把缓存多余的部分还给中心缓存，返回被请求的线程数
+    static size_t trimThreadCaches();
+
+    // 立即回收当前线程的缓存
+    static void trimCurrentThread();
+
+    // mmap总量超过bytes以后持续请求空闲线程回收（每个页堆最多每10ms一次），0表示只在需要mmap时请求
+    static void setTrimThreshold(size_t bytes);
+
+    // 默认堆的中心缓存每个等级最多留几个空span不还给页堆（默认DEFAULT_EMPTY_SPANS），0表示一空就还；释放级联照样会还掉
+    // 别的堆用Heap::setEmptySpanLimit
+    static void setEmptySpanLimit(size_t count);
+
+    // 池内已提交内存的硬上限，0表示不限制
+    // 接近上限时跑释放级联并通知压力回调；上限内实在找不到内存时allocate返回nullptr
+    static void setHeapLimit(size_t bytes);
+    static size_t heapLimit();
+    // PageCache当前已提交（没有还给系统）的字节数
+    static size_t committedBytes();
+    // 传空的function取消回调
+    static void setPressureCallback(PressureCallback callback);
+    // 手动跑一遍释放级联，返回还给系统的字节数
+    static size_t releaseMemory();
+
+    // 启动预热：提前为size所在的等级准备count个对象的span并让物理页缺页进来，
+    // 之后的分配不再走mmap和缺页；fillThreadCache时顺便把调用线程的缓存补满
+    // 返回中心缓存里该等级可用的空闲对象数（页本地引擎是调用线程预热过的对象数），超过MAX_BYTES的大小返回0，
+    // 三层引擎里超过MEDIUM_BYTES的中等对象按整页从页堆拿、不经过中心缓存，同样返回0
+    static size_t reserve(size_t size, size_t count, bool fillThreadCache = false);
+    static size_t reserve(const std::vector<ReserveEntry>& profile, bool fillThreadCache = false);
+    // 文本形式的预留配置，"64:10000,256:2000"表示64字节1万个、256字节2千个
+    // profile为nullptr时读环境变量LLT_MEMPOOL_RESERVE，没设置什么也不做；格式不对的项跳过并打日志
+    static size_t reserveProfile(const char* profile = nullptr, bool fillThreadCache = false);
+
+    // 分配轨迹录制（要用LLT_MEMPOOL_TRACE编译），见Trace.h；格式和重放工具见tools/trace_replay.cpp
+    // 已经在录、文件打不开或者没编译进来时返回false
+    static bool startTrace(const char* path, size_t maxRecords = trace::DEFAULT_TRACE_RECORDS);
+    // 停止录制，返回写下的记录条数
+    static size_t stopTrace();
+
+    // 把默认堆的计数按intervalMs发布到共享内存段/dev/shm/llt_mempool.<pid>，见StatsExport.h；tools/mempool_top附着查看
+    // 分配路径上没有开销，已经在导出时返回false
+    static bool startStatsExport(unsigned intervalMs = stats::DEFAULT_INTERVAL_MS);
+    static void stopStatsExport();
+
+    // 打印慢路径插桩的统计（锁等待/持有时间、延迟直方图、慢路径次数），没开LLT_MEMPOOL_INSTRUMENT时只打印一行提示
+    static void dumpInstrumentation(FILE* out = stderr);
+    // 清零插桩统计，压测的预热阶段之后调用
+    static void resetInstrumentation();
+
+    // 加固模式下保护页的采样间隔（每n次分配一次），0关闭；对调用线程和之后新建的线程生效
+    // 普通构建里只记下数值，不会采样
+    static void setGuardSampleRate(size_t n);
+
+    // 类型化接口：分配失败抛std::bad_alloc，构造函数抛异常时内存会还回去
+    template<typename T, typename... Args>
+    static T* create(Args&&... args)
+    {
+        void* memory = allocate(sizeof(T));
+        if (memory == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        try
+        {
+            return new (memory) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            deallocate(memory, sizeof(T));
+            throw;
+        }
+    }
+
+    template<typename T>
+    static void destroy(T* ptr)
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        ptr->~T();
+        deallocate(ptr, sizeof(T));
     }
 
 };
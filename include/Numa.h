@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <atomic>
+
+namespace llt_memoryPool
+{
+
+// 最多支持的NUMA节点数，PageCache/CentralCache按节点各有一份
+constexpr size_t MAX_NUMA_NODES = 8;
+
+// NUMA拓扑
+// 真实拓扑从/sys/devices/system/node/online读取；
+// 单节点机器上可以用simulate()或环境变量LLT_MEMPOOL_NUMA_NODES模拟多节点，
+// 模拟模式下线程按轮转分配到节点，并且不会真的调用mbind
+class NumaTopology
+{
+public:
+    static NumaTopology& getInstance()
+    {
+        static NumaTopology instance;
+        return instance;
+    }
+    NumaTopology(const NumaTopology&)=delete;
+    NumaTopology& operator=(const NumaTopology&)=delete;
+
+    size_t nodeCount() const { return node_count_.load(std::memory_order_relaxed); }
+    bool isSimulated() const { return simulated_.load(std::memory_order_relaxed); }
+
+    // 模拟nodes个节点，只影响之后创建的ThreadCache
+    void simulate(size_t nodes);
+
+    // 当前线程所在的节点，ThreadCache构造时调用一次
+    size_t currentNode();
+
+    // 把[addr,addr+len)的物理页优先放到node上，模拟模式或单节点时什么也不做
+    bool bindToNode(void* addr, size_t len, size_t node);
+
+private:
+    NumaTopology();
+    ~NumaTopology()=default;
+
+private:
+    std::atomic<size_t> node_count_{1};
+    std::atomic<bool> simulated_{false};
+    // 模拟模式下的轮转计数
+    std::atomic<size_t> next_sim_node_{0};
+};
+
+} // namespace llt_memoryPool
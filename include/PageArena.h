@@ -0,0 +1,126 @@
+#pragma once
+#include "Common.h"
+#include <atomic>
+#include <cstdint>
+
+// 每个节点一次预留多大的虚拟地址空间（GB），CMake变量LLT_MEMPOOL_ARENA_RESERVE_GB
+#ifndef LLT_MEMPOOL_ARENA_RESERVE_GB
+#define LLT_MEMPOOL_ARENA_RESERVE_GB 64
+#endif
+
+namespace llt_memoryPool
+{
+
+constexpr size_t ARENA_RESERVE_BYTES = size_t(LLT_MEMPOOL_ARENA_RESERVE_GB) << 30;
+// 系统不给这么大的预留（ulimit -v、sanitizer的地址布局）时对半缩，缩到这个值还失败才算失败
+constexpr size_t ARENA_MIN_RESERVE_BYTES = size_t(1) << 30;
+// 预留用完以后再预留新的一块，最多这么多块
+constexpr size_t ARENA_MAX_CHUNKS = 16;
+
+// 页堆的地址空间：一次预留一大块PROT_NONE的连续地址，按需从前往后提交（mprotect成可读写）
+//   - 页号到Span的映射是平铺的数组，下标就是页在这块里的偏移，数组本身也是按需缺页的
+//   - “指针是不是我的”就是一次区间比较，预留用完后再追加一块，查找时依次比较
+//   - 提交出去的页不再取消映射，还给系统只用madvise，批栈读到过期的对象头也不会段错误
+//     唯一的例外是整个堆销毁（Heap::destroy），这时已经没有线程在用它了
+// 映射的写入由PageCache在自己的锁里做，读不加锁：活着的对象所在span的映射不会变
+class PageArena
+{
+public:
+    PageArena() = default;
+    // 预留的地址空间和映射表全部munmap
+    ~PageArena();
+    PageArena(const PageArena&) = delete;
+    PageArena& operator=(const PageArena&) = delete;
+
+    // 提交numPages页并返回起始地址，预留不够时追加一块；失败返回nullptr。调用者持有PageCache锁
+    void* commit(size_t numPages);
+
+    bool contains(const void* ptr) const
+    {
+        return findChunk(reinterpret_cast<uintptr_t>(ptr)) != nullptr;
+    }
+
+    // ptr所在页的span，不在本区域或者还没映射返回nullptr
+    Span* lookup(const void* ptr) const
+    {
+        uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+        const Chunk* chunk = findChunk(address);
+        if (chunk == nullptr)
+        {
+            return nullptr;
+        }
+        return chunk->pagemap[(address - chunk->base) >> PageShift].load(std::memory_order_acquire);
+    }
+
+    // 两个地址在同一块预留里；相邻的两块在地址上可能正好挨着，span不能跨块合并
+    bool sameChunk(const void* a, const void* b) const
+    {
+        const Chunk* chunk = findChunk(reinterpret_cast<uintptr_t>(a));
+        return chunk != nullptr && chunk == findChunk(reinterpret_cast<uintptr_t>(b));
+    }
+
+    // 从start开始的numPages页都映射到span，调用者持有PageCache锁
+    void assign(void* start, size_t numPages, Span* span);
+
+    // 已经预留的地址空间和已经提交的字节数
+    size_t reservedBytes() const;
+    size_t committedBytes() const;
+
+    // 按地址顺序把提交过的每个span交给fn一次（fn可以释放它），调用者保证没有并发修改
+    template<typename Fn>
+    void forEachSpan(Fn fn) const
+    {
+        size_t count = chunk_count_.load(std::memory_order_acquire);
+        for (size_t c = 0; c < count; ++c)
+        {
+            const Chunk& chunk = chunks_[c];
+            size_t pages = chunk.used.load(std::memory_order_relaxed) >> PageShift;
+            size_t page = 0;
+            while (page < pages)
+            {
+                Span* span = chunk.pagemap[page].load(std::memory_order_relaxed);
+                if (span == nullptr)
+                {
+                    ++page;
+                    continue;
+                }
+                // span的页在一块里连续，第一次遇到的就是它的起点
+                page += span->num_pages;
+                fn(span);
+            }
+        }
+    }
+
+private:
+    struct Chunk
+    {
+        uintptr_t base = 0;
+        size_t bytes = 0;
+        // 下一次从这里往后提交，只在PageCache锁里改，统计时不加锁读
+        std::atomic<size_t> used{0};
+        std::atomic<Span*>* pagemap = nullptr;
+    };
+
+    const Chunk* findChunk(uintptr_t address) const
+    {
+        size_t count = chunk_count_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Chunk& chunk = chunks_[i];
+            if (address - chunk.base < chunk.bytes)
+            {
+                return &chunk;
+            }
+        }
+        return nullptr;
+    }
+
+    // 预留一块新的地址空间，能放下minBytes；失败返回false
+    bool reserveChunk(size_t minBytes);
+
+private:
+    Chunk chunks_[ARENA_MAX_CHUNKS];
+    std::atomic<size_t> chunk_count_{0};
+};
+
+} // namespace llt_memoryPool
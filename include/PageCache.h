@@ -1,48 +1,153 @@
 #pragma once
 #include "Common.h"
-#include <unordered_map>
+#include "Numa.h"
+#include "PageArena.h"
+#include <set>
+#include <array>
 #include <mutex>
+#include <atomic>
 
 namespace llt_memoryPool
 {
 
+class Heap;
+
 class PageCache
 {
 public:
-    static PageCache& getInstance()
-    {
-        static PageCache instance;
-        //LogDebug("[PageCache:getInstance] 获取页缓存实例");
-        return instance;
-    }
+    // 默认堆在每个NUMA节点上的页堆，按需创建，进程退出前不销毁；别的堆的页堆由Heap持有
+    static PageCache& getInstance(size_t node = 0);
+    // 节点的页堆还没创建时返回nullptr，不会触发创建
+    static PageCache* getIfCreated(size_t node);
     PageCache(const PageCache&)=delete;
     PageCache& operator=(const PageCache&)=delete;
 
     // 分配指定页数的span
     Span* allocateSpan(size_t numPages);
 
-    // 释放span
-    void deallocateSpan(Span* ptr);
+    // 释放span；decommit为真时先madvise还给系统
+    // 不和相邻的空闲span合并：同样大小的下一次请求直接拿走，合并推迟到找不到够大的span时
+    void deallocateSpan(Span* ptr, bool decommit = false);
+    // 一次加锁释放一串span（用next串起来），中心缓存放掉桶锁以后成批归还
+    void deallocateSpans(Span* list);
+    // 立即把上一次合并以来放回的空闲span和它们相连的空闲邻居合并起来，返回合并掉的span数
+    size_t coalesceFreeSpans();
+
+    // 大于MAX_BYTES的对象：直接从本节点的页堆拿整数页的span，上限内拿不到时跑一遍所属堆的压力回收再试
+    // zeroed不为空时告诉调用者这些页是不是全零（新提交或者madvise过还没被写过）
+    // 释放按地址找节点，见Heap::deallocateLarge
+    void* allocateLarge(size_t size, bool* zeroed = nullptr);
 
     static void* getPageAddress(Span* span);
 
-    Span* mapAddressToSpan(void* ptr);
+    // 不加锁：查的是活着的对象时，它所在span的映射不会变
+    Span* mapAddressToSpan(void* ptr) const { return arena_.lookup(ptr); }
+    // ptr在本节点预留的地址空间里
+    bool owns(const void* ptr) const { return arena_.contains(ptr); }
+    // 本节点预留的地址空间
+    size_t reservedBytes() const { return arena_.reservedBytes(); }
+
+    // 让span的物理页立刻缺页进来（可写），之后第一次访问不再触发缺页；不需要持锁
+    // span已经mbind到所属节点，所以不在mmap时用MAP_POPULATE（那样会在绑定之前分配物理页）
+    static void prefault(Span* span);
+
+    // 把所有空闲span用madvise还给系统（映射保留，地址仍可读），返回释放的字节数
+    size_t releaseFreeSpans();
+    // 空闲span里还提交着（没有madvise）的字节数
+    size_t freeBytes();
+    // 空闲span按页数分格：第i格是[2^i, 2^(i+1))页，最后一格包括更大的，已经还给系统的也算
+    void freeRunHistogram(size_t* spans, size_t* pages, size_t buckets);
+
+    // 在默认堆所有已创建的页堆里查找ptr属于哪个节点，先查hint，找不到返回MAX_NUMA_NODES
+    static size_t findNode(void* ptr, size_t hint = 0);
+
+    size_t node() const { return node_; }
+    Heap& heap() const { return heap_; }
+
+    // 所有堆、所有节点一共从系统mmap了多少字节（销毁的堆会扣掉）
+    static size_t mappedBytes() { return mapped_bytes_.load(std::memory_order_relaxed); }
+    // 软上限：mmap总量超过它以后，分配span时请求空闲线程缓存回收（限频）；0表示关闭
+    static void setTrimThreshold(size_t bytes) { trim_threshold_.store(bytes, std::memory_order_relaxed); }
+    static size_t trimThreshold() { return trim_threshold_.load(std::memory_order_relaxed); }
+
+    // 释放时至少这么多页的大对象直接madvise，和glibc大块内存munmap的效果一样，也让下一次allocateZeroed免清零
+    static constexpr size_t LARGE_DECOMMIT_PAGES = 256;
 
     static inline size_t AddressToPageID(void* ptr) {
     return reinterpret_cast<uintptr_t>(ptr) >> PageShift;
 }
 private:
-    PageCache()=default;
-    ~PageCache()=default;
+    friend class Heap;
+    PageCache(Heap& heap, size_t node) : heap_(heap), node_(node) {}
+    // 只有Heap::destroy会析构：释放所有span的元数据，地址空间随arena_一起munmap
+    ~PageCache();
+    // allocateSpan的主体，调用者持有mutex_；需要请求线程缓存回收时把wantTrim置为true
+    Span* allocateSpanLocked(size_t numPages, bool& wantTrim);
+    // 请求这个堆的空闲线程缓存回收，限频；不能持有mutex_
+    void requestTrim();
     //向操作系统申请新一块内存
     Span* newSpan(size_t num_pages);
+    // 空闲span还给系统并从已提交内存里扣掉，调用者持有mutex_
+    void decommitSpan(Span* span);
+    // deallocateSpan的主体，调用者持有mutex_
+    void releaseSpan(Span* span, bool decommit);
+    // 待合并链表上的span逐个和左右的空闲邻居合并，调用者持有mutex_
+    size_t coalesceLocked();
+    // span和地址相连、状态相同的空闲邻居合并，返回合并后的span，调用者持有mutex_
+    Span* mergeNeighbours(Span* span, size_t& merged);
+    // 待合并链表，调用者持有mutex_
+    void pushPending(Span* span);
+    void unlinkPending(Span* span);
+    // 拿出空闲链表的span要重新记账，超过堆上限返回false，调用者持有mutex_
+    bool recommitSpan(Span* span, size_t numPages);
     //void mergeSpan(Span* span);
     //Span* splitSpan(Span* span, size_t num_pages);
+
+    // 空闲span索引，调用者持有mutex_
+    // 挂进去之后不能再改num_pages/start_address，要先摘下来
+    void insertFree(Span* span);
+    void eraseFree(Span* span);
+    // 最合适的空闲span：页数够用里最小的，同样大小里地址最低的；没有返回nullptr
+    Span* findFree(size_t numPages);
 private:
-    static const size_t MaxPages = 256; // 256/4
-    SpanList free_lists_[MaxPages];
-    std::unordered_map<size_t, Span*> span_map_;
+    // 页数小于它的空闲span按页数分桶，桶内按地址排序，位图记录哪些桶非空，找桶O(1)
+    static constexpr size_t SmallRunPages = 128;
+    static constexpr size_t BitmapWords = SmallRunPages / 64;
+    struct AddressLess
+    {
+        bool operator()(const Span* a, const Span* b) const { return a->start_address < b->start_address; }
+    };
+    // 更大的按(页数, 地址)排序放一棵树，lower_bound就是最合适的，页数没有上限
+    struct SizeAddressLess
+    {
+        bool operator()(const Span* a, const Span* b) const
+        {
+            if (a->num_pages != b->num_pages)
+            {
+                return a->num_pages < b->num_pages;
+            }
+            return a->start_address < b->start_address;
+        }
+    };
+    std::set<Span*, AddressLess, InternalAllocator<Span*>> small_runs_[SmallRunPages];
+    std::array<uint64_t, BitmapWords> small_bitmap_{};
+    std::set<Span*, SizeAddressLess, InternalAllocator<Span*>> large_runs_;
+    // 上一次合并以来放进空闲索引的span，为空时找不到够大的span也不用再合并
+    // 合并只查这些span左右两页的映射，不用把整个空闲索引翻一遍
+    Span* pending_ = nullptr;
+    // 地址空间和页号到span的映射
+    PageArena arena_;
     std::mutex mutex_;
+    // 所属的堆，记账和压力回收都在这个堆里
+    Heap& heap_;
+    // 所属NUMA节点，newSpan申请的内存会绑定到这个节点
+    size_t node_;
+    // 上一次请求线程缓存回收的时间，两次之间至少隔TRIM_REQUEST_INTERVAL_NS
+    std::atomic<uint64_t> last_trim_ns_{0};
+    static constexpr uint64_t TRIM_REQUEST_INTERVAL_NS = 10 * 1000 * 1000;
+
+    static std::atomic<size_t> mapped_bytes_;
+    static std::atomic<size_t> trim_threshold_;
 };
 
 } // namespace llt_memoryPool
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace llt_memoryPool
+{
+
+// 自旋等待时让出流水线，超线程的兄弟线程能跑得快一点
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// 等待的退避：pause次数每轮翻倍，到上限以后改成yield
+// 持锁的线程被换下CPU时一直空转只会更慢，单核机器上尤其明显
+class Backoff
+{
+public:
+    void pause()
+    {
+        if (spins_ <= MAX_SPINS)
+        {
+            for (uint32_t i = 0; i < spins_; ++i)
+            {
+                cpuRelax();
+            }
+            spins_ <<= 1;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    static constexpr uint32_t MAX_SPINS = 64;
+    uint32_t spins_ = 1;
+};
+
+// test-and-test-and-set自旋锁：先只读地等锁看起来空了再去抢，等待时不来回抢缓存行
+// 和std::mutex一样有lock/try_lock/unlock，可以直接给std::lock_guard用
+class SpinLock
+{
+public:
+    void lock()
+    {
+        Backoff backoff;
+        while (locked_.exchange(true, std::memory_order_acquire))
+        {
+            while (locked_.load(std::memory_order_relaxed))
+            {
+                backoff.pause();
+            }
+        }
+    }
+
+    bool try_lock()
+    {
+        return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked_{false};
+};
+
+// 票据锁：先来先得，等待的线程多时不会有线程一直抢不到
+// 排在前面的人越多退避越久，大家不用同时盯着serving_
+class TicketLock
+{
+public:
+    void lock()
+    {
+        uint32_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+        uint32_t serving = serving_.load(std::memory_order_acquire);
+        if (serving == ticket)
+        {
+            return;
+        }
+        Backoff backoff;
+        while (serving != ticket)
+        {
+            for (uint32_t ahead = ticket - serving; ahead > 1; --ahead)
+            {
+                cpuRelax();
+            }
+            backoff.pause();
+            serving = serving_.load(std::memory_order_acquire);
+        }
+    }
+
+    bool try_lock()
+    {
+        uint32_t serving = serving_.load(std::memory_order_acquire);
+        uint32_t expected = serving;
+        // 只有没人排队时才能拿到：next_等于serving_就把它加一
+        return next_.compare_exchange_strong(expected, serving + 1, std::memory_order_acquire,
+                                             std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<uint32_t> next_{0};
+    std::atomic<uint32_t> serving_{0};
+};
+
+} // namespace llt_memoryPool
@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// 运行时统计导出：默认关，MemoryPool::startStatsExport打开，或者设置环境变量LLT_MEMPOOL_STATS=<间隔毫秒>在进程启动时就打开
+// 打开以后一个后台线程按间隔把默认堆的计数写进/dev/shm/llt_mempool.<pid>，退出或stop时删掉
+// 分配路径上没有任何钩子：计数都是中心缓存和页堆本来就在锁里维护的，后台线程定期加锁读一遍
+// 段里的数据用序列锁保护，别的进程只读映射，不会挡住写者；tools/mempool_top按PID附着看实时速率
+namespace llt_memoryPool
+{
+namespace stats
+{
+    // 段开头的"LLTSTA01"
+    constexpr uint64_t STATS_MAGIC = 0x3130415453544c4cULL;
+    constexpr uint32_t STATS_VERSION = 1;
+    constexpr unsigned DEFAULT_INTERVAL_MS = 1000;
+    // 页堆空闲span的直方图格数：第i格是[2^i, 2^(i+1))页，最后一格包括更大的
+    constexpr size_t RUN_BUCKETS = 16;
+
+    // 段的布局：一个StatsHeader，后面RUN_BUCKETS个RunStats，再后面class_count个ClassStats，全部是本机字节序
+    // sequence之前的字段start时写好以后不再变；之后的部分（包括两个数组）每次发布都重写
+    struct StatsHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t class_count;
+        uint32_t run_buckets;
+        uint64_t pid;
+        uint64_t interval_ms;
+        // 内存池的页大小，RunStats里的页数乘它是字节数
+        uint64_t page_size;
+        // 序列锁：写者改之前加1变成奇数，写完再加1变回偶数；读者前后两次读到同一个偶数才算拿到完整的一份
+        std::atomic<uint64_t> sequence;
+        uint64_t publishes;
+        // CLOCK_MONOTONIC的纳秒数，两份快照相减算速率
+        uint64_t timestamp_ns;
+        uint64_t mapped_bytes;     // 所有页堆提交过的字节（进程级）
+        uint64_t committed_bytes;  // 默认堆已提交、计入堆上限的字节
+        uint64_t heap_limit;       // 0表示不限制
+        uint64_t free_bytes;       // 页堆空闲span里还提交着的字节
+        uint64_t reserved_bytes;   // 预留的虚拟地址空间
+        uint64_t thread_caches;    // 默认堆上的线程缓存数
+        // 慢路径次数：线程缓存向中心缓存取、还，中心缓存向页堆要span，都是各等级的和
+        uint64_t fetches;
+        uint64_t releases;
+        uint64_t new_spans;
+    };
+
+    struct RunStats
+    {
+        uint64_t spans;
+        uint64_t pages;
+    };
+
+    // 一个大小等级在中心缓存看来的状态，各NUMA节点相加
+    struct ClassStats
+    {
+        uint64_t size;
+        uint64_t cached_bytes;  // span里和批栈里的空闲对象
+        uint64_t in_use_bytes;  // 交给线程缓存的对象，还囤在线程缓存里的也算
+        uint64_t spans;
+        uint64_t fetches;
+        uint64_t releases;
+        uint64_t new_spans;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock needs a lock-free 64-bit atomic");
+
+    inline size_t segmentBytes(size_t classCount)
+    {
+        return sizeof(StatsHeader) + RUN_BUCKETS * sizeof(RunStats) + classCount * sizeof(ClassStats);
+    }
+
+    inline const RunStats* runs(const void* segment)
+    {
+        return reinterpret_cast<const RunStats*>(static_cast<const char*>(segment) + sizeof(StatsHeader));
+    }
+
+    inline const ClassStats* classes(const void* segment)
+    {
+        return reinterpret_cast<const ClassStats*>(static_cast<const char*>(segment) + sizeof(StatsHeader) +
+                                                   RUN_BUCKETS * sizeof(RunStats));
+    }
+
+    // pid进程的统计段路径
+    inline void segmentPath(char* buffer, size_t bytes, uint64_t pid)
+    {
+        std::snprintf(buffer, bytes, "/dev/shm/llt_mempool.%llu", static_cast<unsigned long long>(pid));
+    }
+
+    // 按序列锁从映射segment复制一份完整的快照到out（都是bytes大小），写者一直在写、重试retries次仍失败时返回false
+    inline bool readSnapshot(const void* segment, void* out, size_t bytes, int retries = 1000)
+    {
+        const StatsHeader* header = static_cast<const StatsHeader*>(segment);
+        for (int i = 0; i < retries; ++i)
+        {
+            uint64_t before = header->sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                continue;
+            }
+            std::memcpy(out, segment, bytes);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->sequence.load(std::memory_order_relaxed) == before)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 开始导出，已经在导出或者段建不起来时返回false
+    bool start(unsigned intervalMs = DEFAULT_INTERVAL_MS);
+    // 停止导出并删掉段
+    void stop();
+    bool active();
+}
+
+} // namespace llt_memoryPool
@@ -1,34 +1,197 @@
 #pragma once
 #include "Common.h"
+#include "Numa.h"
+#include <atomic>
 
 namespace llt_memoryPool 
 {
 
+class Heap;
+
+// 进程里最多同时存在的堆（含默认堆），每个线程按堆编号存自己的线程缓存
+constexpr size_t MAX_HEAPS = 64;
+
+// 中等对象按页数分的种类：MEDIUM_BYTES/PAGE_SIZE+1页到MAX_BYTES/PAGE_SIZE页
+constexpr size_t MEDIUM_MIN_PAGES = MEDIUM_BYTES / PAGE_SIZE + 1;
+constexpr size_t MEDIUM_PAGE_KINDS = MAX_BYTES / PAGE_SIZE - MEDIUM_MIN_PAGES + 1;
+// 每个线程缓存的中等对象最多这么多字节，再放不下时整个还给页堆
+constexpr size_t MEDIUM_CACHE_BYTES = 1024 * 1024;
+
 // 线程本地缓存
+// 快路径（自由链表的弹出/压入）全部内联在头文件里，补货和归还等慢路径在ThreadCache.cpp
 class ThreadCache
 {
 public:
+    // tls_cache_是平凡的initial-exec TLS指针：没有初始化守卫，也不走__tls_get_addr
+    // 第一次使用（或线程退出后再用）才进createInstance
     static ThreadCache* getInstance()
     {
-        static thread_local ThreadCache instance;
-        //LogDebug("[ThreadCache:getInstance] 获取线程本地缓存实例");
-        return &instance;
+        ThreadCache* cache = tls_cache_;
+        if (cache != nullptr) [[likely]]
+        {
+            return cache;
+        }
+        LogDebug("[ThreadCache:getInstance] 获取线程本地缓存实例");
+        return createInstance();
+    }
+    // 本线程在heap上的缓存（默认堆以外的堆），定义在Heap.h
+    static ThreadCache* getInstance(Heap& heap);
+
+    void* allocate(size_t size)
+    {
+        // 处理0大小的分配请求
+        if (size == 0)
+        {
+            size = ALIGNMENT; // 至少分配一个对齐大小
+        }
+
+        if (size > MEDIUM_BYTES) [[unlikely]]
+        {
+            // 中等对象和大对象按整页从本节点的页堆拿，中等对象先查本线程缓存的空闲块
+            return allocatePages(size);
+        }
+
+#if LLT_MEMPOOL_HARDENED
+        // 采样：倒数到0的这一次放到保护页里，保护页用完了就照常分配
+        if (--guardCountdown_ == 0) [[unlikely]]
+        {
+            if (void* ptr = allocateGuarded(size))
+            {
+                return ptr;
+            }
+        }
+#endif
+
+        size_t index = SizeClass::getIndex(size);
+
+        // 检查线程本地自由链表
+        // 如果 freeList_[index] 不为空，表示该链表中有可用内存块
+        if (void* ptr = freeList_[index]) [[likely]]
+        {
+            freeList_[index] = loadNext(ptr); // 将freeList_[index]指向的内存块的下一个内存块地址（取决于内存块的实现）
+            // 更新自由链表大小
+            freeListSize_[index]--;
+            return ptr;
+        }
+
+        // 如果线程本地自由链表为空，则从中心缓存获取一批内存
+        return allocateSlow(index);
     }
 
-    void* allocate(size_t size);
-    void deallocate(void* ptr, size_t size);
+    void deallocate(void* ptr, size_t size)
+    {
+        if (size > MEDIUM_BYTES) [[unlikely]]
+        {
+            deallocatePages(ptr, size);
+            return;
+        }
+
+#if LLT_MEMPOOL_HARDENED
+        if (hardening::isGuarded(ptr)) [[unlikely]]
+        {
+            hardening::guardedDeallocate(ptr, size);
+            return;
+        }
+#endif
+
+        size_t index = SizeClass::getIndex(size);
+
+#if LLT_MEMPOOL_HARDENED
+        // 最常见的重复释放：连着释放同一个指针两次
+        if (ptr == freeList_[index]) [[unlikely]]
+        {
+            hardening::fail("double free", ptr);
+        }
+#endif
+
+        // 插入到线程本地自由链表
+        storeNext(ptr, freeList_[index]);
+        freeList_[index] = ptr;
+
+        // 更新自由链表大小
+        freeListSize_[index]++; // 增加对应大小类的自由链表大小
+
+        // 判断是否需要将部分内存回收给中心缓存
+        //bug:getsize是这个index的字节大小，而不是尺寸
+        // if (freeListSize_[index]>SizeClass::getSize(index))
+        // {
+        //     releaseExcessMemory(index);
+        // }
+        // 链表过长或者有别的线程请求回收时才进慢路径，忙线程只多一次本地读
+        if (freeListSize_[index] > SizeClass::getBatchNum(SizeClass::getSize(index)) * 2 ||
+            trimRequested_.load(std::memory_order_relaxed)) [[unlikely]]
+        {
+            deallocateSlow(index);
+        }
+    }
+
+    // 本线程所属的NUMA节点，决定从哪个CentralCache补货
+    size_t node() const { return node_; }
+    Heap& heap() const { return *heap_; }
+
+    // 本线程缓存里空闲对象的总字节数，只能在所属线程调用
+    size_t cachedBytes() const;
+    // 立即把每个等级多于一批的部分还给中心缓存，keepBatch为false时全部归还
+    void trim(bool keepBatch = true);
+
+    // 大于MEDIUM_BYTES的对象：中等对象先查mediumList_，没有再和大对象一样走PageCache
+    // zeroed不为空时告诉调用者页是不是已知全零，从mediumList_拿到的是用过的，一定不是
+    void* allocatePages(size_t size, bool* zeroed = nullptr);
+
+    // 从中心缓存补货直到index等级的自由链表里至少有count个对象
+    // 最多补到两批（再多下一次释放就会还回去），返回链表里的对象数
+    size_t prefill(size_t index, size_t count);
+
+    // 本线程在编号为heap的堆上已有的实例，没有（或线程正在退出）时返回nullptr，不会创建
+    static ThreadCache* currentIfCreated(size_t heap = 0) { return heap == 0 ? tls_cache_ : tls_heap_caches_[heap]; }
+
+#if LLT_MEMPOOL_HARDENED
+    // 按当前的采样间隔重新开始倒数
+    void resetGuardCountdown();
+#endif
+
+    // 编号为heap的堆上当前存活的线程缓存个数
+    static size_t liveCount(size_t heap = 0);
+    // 请求编号为heap的堆上所有空闲的线程缓存在下一次操作时回收，返回发出请求的个数
+    // 发起者自己、以及上一轮请求以来走过慢路径的线程视为忙碌，不会被打扰
+    static size_t requestTrimAll(size_t heap = 0);
     ThreadCache(const ThreadCache&)=delete;
     ThreadCache& operator=(const ThreadCache&)=delete;
 private:
+    friend class Heap;
     //之前不是default，是将freelist置nullptr和freelistSize置0
-    ThreadCache() {
-        // 初始化数组
-        for (size_t i = 0; i < FREE_LIST_SIZE; ++i) {
-            freeList_[i] = nullptr;
-            freeListSize_[i] = 0;
-        }
-    }
+    explicit ThreadCache(Heap& heap);
     ~ThreadCache();
+    // 创建本线程的实例并设置tls_cache_；线程退出阶段（实例已析构）换成直通实例
+    static ThreadCache* createInstance();
+    // 创建本线程在heap上的实例并设置tls_heap_caches_，线程退出时由退出钩子归还
+    static ThreadCache* createInstance(Heap& heap);
+    // 线程退出：本线程在默认堆以外的堆上的缓存全部还回去
+    static void releaseHeapCaches();
+    // Heap::destroy：所有线程在编号为heap的堆上的缓存直接丢掉（内存随堆一起还给系统）
+    // 等正在退出、还在往这个堆里还内存的线程做完才返回
+    static void dropHeapCaches(size_t heap);
+    // 从注册表摘下，调用者持有注册表的锁
+    void unlink();
+    void deallocatePages(void* ptr, size_t size);
+    // 缓存的中等对象全部还给页堆
+    void releaseMediumCache();
+    // 大于MAX_BYTES的对象走PageCache，zeroed见PageCache::allocateLarge
+    void* allocateLarge(size_t size, bool* zeroed = nullptr);
+    void deallocateLarge(void* ptr, size_t size);
+    // 自由链表为空：补货后再弹出一个
+    // 补不到货时先跑一遍压力回收再试一次，还是拿不到才返回nullptr
+    void* allocateSlow(size_t index);
+    // 释放后链表过长或者收到回收请求
+    void deallocateSlow(size_t index);
+#if LLT_MEMPOOL_HARDENED
+    // 采样命中：重置倒数并尝试从保护页分配，失败返回nullptr
+    void* allocateGuarded(size_t size);
+#endif
+    // 记录本线程在当前这一轮里走过慢路径
+    void markActive();
+    // 把链表头部num个对象还给中心缓存，batchable时允许压进无锁批栈
+    void releaseFromList(size_t index, size_t num, bool batchable);
     // 从中心缓存获取内存
     void fetchFromCentralCache(size_t index);
     // 归还内存到中心缓存
@@ -45,6 +208,35 @@ private:
     // 每个线程的自由链表数组
     std::array<void*, FREE_LIST_SIZE> freeList_;   
     std::array<size_t, FREE_LIST_SIZE> freeListSize_; // 自由链表大小统计
+    // 中等对象按页数缓存的空闲块，链表指针写在块的第一个字里
+    std::array<void*, MEDIUM_PAGE_KINDS> mediumList_{};
+    size_t mediumBytes_ = 0;
+    // 所属的堆和它的编号，补货和归还都在这个堆里
+    Heap* heap_;
+    size_t heapId_;
+    size_t node_;
+#if LLT_MEMPOOL_HARDENED
+    // 距离下一次保护页采样还剩几次分配
+    size_t guardCountdown_;
+#endif
+
+    // 别的线程设置，本线程在下一次慢路径或释放时检查
+    std::atomic<bool> trimRequested_{false};
+    // 最近一次走慢路径时的回收轮次
+    std::atomic<uint64_t> lastActiveEpoch_{0};
+    // 注册表链表，受注册表的锁保护；已经摘下（线程退出时）的不再在链表里
+    ThreadCache* regPrev_ = nullptr;
+    ThreadCache* regNext_ = nullptr;
+    bool registered_ = false;
+    // 线程退出阶段的直通实例：不囤对象，每次分配只从中心缓存拿走要的那一个，释放立刻还回去
+    bool passthrough_ = false;
+    // 默认堆以外的堆：所属线程的tls_heap_caches_里指向自己的那一格，销毁堆时由别的线程清空
+    ThreadCache** slot_ = nullptr;
+
+    __attribute__((tls_model("initial-exec")))
+    static inline thread_local ThreadCache* tls_cache_ = nullptr;
+    // 默认堆以外的堆按编号存，不在快路径上，用普通的TLS模型（动态加载时不占静态TLS）
+    static inline thread_local ThreadCache* tls_heap_caches_[MAX_HEAPS] = {};
 };
 
 } // namespace memoryPool
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// 分配轨迹录制：编译期开关，CMake选项LLT_MEMPOOL_TRACE，默认关
+// 打开以后MemoryPool::startTrace开始录，或者设置环境变量LLT_MEMPOOL_TRACE_FILE在进程启动时就开始、退出时收尾
+// 关掉时钩子是空函数，startTrace直接返回false
+// 录下来的文件用tools/trace_replay按原来的线程交错重放，对比内存池和系统malloc
+#ifndef LLT_MEMPOOL_TRACE
+#define LLT_MEMPOOL_TRACE 0
+#endif
+
+namespace llt_memoryPool
+{
+
+constexpr bool TRACED = LLT_MEMPOOL_TRACE != 0;
+
+namespace trace
+{
+    // 文件开头的"LLTTRC01"
+    constexpr uint64_t TRACE_MAGIC = 0x3130435254544c4cULL;
+    constexpr uint32_t TRACE_VERSION = 1;
+    // 默认最多录这么多条（24字节一条，约96MB），文件按这个大小ftruncate，没写到的部分是稀疏的
+    constexpr size_t DEFAULT_TRACE_RECORDS = size_t(1) << 22;
+
+    enum class Op : uint8_t
+    {
+        Allocate = 0,
+        Free = 1,
+    };
+
+    // 文件格式：一个TraceHeader，后面紧跟record_count条TraceRecord，全部是本机字节序
+    struct TraceHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t record_count;
+        // 文件写满以后丢掉的条数
+        uint64_t dropped;
+        // 录制开始时steady_clock的纳秒数，记录里的时间戳都相对它
+        uint64_t start_ns;
+    };
+
+    // 记录按抢到槽位的顺序排列，就是全局的先后顺序：
+    // 释放在真正释放之前记录，分配在拿到地址之后记录，同一个地址先被释放才可能再被分配出来
+    struct TraceRecord
+    {
+        uint64_t timestamp_ns;
+        // 对象ID就是地址，在对象活着的期间唯一；重放时按先后顺序换成连续的编号
+        uint64_t object;
+        // 超过4GB的大小截成UINT32_MAX
+        uint32_t size;
+        // 录制期间按第一次记录的先后给线程编的号，从0开始
+        uint16_t thread;
+        uint8_t op;
+        uint8_t reserved;
+    };
+
+    static_assert(sizeof(TraceRecord) == 24, "trace record layout changed");
+
+    // 开始往path录，已经在录或者文件打不开时返回false
+    bool start(const char* path, size_t maxRecords = DEFAULT_TRACE_RECORDS);
+    // 停止录制并把文件截到实际大小，返回写下的条数；没在录时返回0
+    size_t stop();
+    bool active();
+
+#if LLT_MEMPOOL_TRACE
+    extern std::atomic<bool> enabled;
+
+    void record(Op op, const void* ptr, size_t size);
+
+    inline void onAllocate(const void* ptr, size_t size)
+    {
+        if (enabled.load(std::memory_order_relaxed)) [[unlikely]]
+        {
+            record(Op::Allocate, ptr, size);
+        }
+    }
+
+    inline void onFree(const void* ptr, size_t size)
+    {
+        if (enabled.load(std::memory_order_relaxed)) [[unlikely]]
+        {
+            record(Op::Free, ptr, size);
+        }
+    }
+#else
+    inline void onAllocate(const void*, size_t) {}
+    inline void onFree(const void*, size_t) {}
+#endif
+}
+
+} // namespace llt_memoryPool
@@ -5,7 +5,16 @@
 #include <ctime>
 #include <atomic>
 #include <thread>
-#include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+// 编译期日志级别：0=ERROR 1=WARN 2=INFO 3=DEBUG，-1关闭所有日志
+// 高于这个级别的日志调用整个被if constexpr丢掉，参数也不会求值
+#ifndef LLT_MEMPOOL_LOG_LEVEL
+#define LLT_MEMPOOL_LOG_LEVEL 2
+#endif
 
 namespace llt_memoryPool
 {
@@ -17,6 +26,66 @@ namespace llt_memoryPool
         DEBUG = 3   // 最低级别
     };
 
+    constexpr bool isLogLevelEnabled(LogLevel level)
+    {
+        return static_cast<int>(level) <= LLT_MEMPOOL_LOG_LEVEL;
+    }
+
+    // 环形缓冲区里一条记录的文本，定长（整条记录128字节）；更长的消息拆成几条连续的记录
+    constexpr size_t LOG_MESSAGE_SIZE = 104;
+    // 一条消息格式化以后最多这么多字节（含结尾的0），再长的在完整的UTF-8字符处截断
+    constexpr size_t LOG_MAX_MESSAGE = 1024;
+
+    struct LogRecord
+    {
+        uint64_t timestamp_ns;
+        uint64_t thread_id;
+        LogLevel level;
+        bool isThread;
+        // 同一条消息后面还有记录，写线程拼起来再输出
+        bool continued;
+        char message[LOG_MESSAGE_SIZE];
+    };
+
+    // s的前n个字节里最后一个UTF-8字符不完整时，返回它首字节的位置，否则返回n
+    inline size_t utf8Cut(const char* s, size_t n)
+    {
+        size_t p = n;
+        while (p > 0 && (static_cast<unsigned char>(s[p - 1]) & 0xC0) == 0x80)
+        {
+            --p;
+        }
+        if (p == 0)
+        {
+            return n;
+        }
+        unsigned char lead = static_cast<unsigned char>(s[p - 1]);
+        size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+        return p - 1 + length <= n ? n : p - 1;
+    }
+
+    // 每个线程一个单生产者单消费者的无锁环形缓冲区
+    // 生产者是写日志的线程，消费者是后台写线程；满了直接丢弃，绝不阻塞分配路径
+    class LogRing
+    {
+    public:
+        static constexpr size_t CAPACITY = 1024; // 必须是2的幂
+
+        // 放不下整条消息（可能是几条记录）时整条丢掉
+        bool push(LogLevel level, bool isThread, const char* fmt, ...)
+            __attribute__((format(printf, 4, 5)));
+        bool pop(LogRecord& record);
+
+        std::atomic<bool> dead{false};      // 所属线程已退出，排空后由写线程回收
+        std::atomic<uint64_t> dropped{0};   // 缓冲区满丢掉的条数
+        LogRing* next = nullptr;            // 注册链表，只在头部插入
+
+    private:
+        LogRecord records_[CAPACITY];
+        std::atomic<size_t> head_{0};       // 消费者位置
+        std::atomic<size_t> tail_{0};       // 生产者位置
+    };
+
     class Logger
     {
     private:
@@ -24,74 +93,133 @@ namespace llt_memoryPool
         std::string logFilePath;
         std::string logFileName;
         std::string logFileTime;
-        std::atomic_flag logFileLock;
-    
+
+        // 所有线程的环形缓冲区
+        std::atomic<LogRing*> rings_{nullptr};
+        std::thread writer_;
+        std::mutex writerMutex_;
+        std::condition_variable writerCond_;
+        bool stop_ = false;
+
+        // 进程退出时Logger析构以后，其他线程（或thread_local析构）的日志直接丢掉
+        static std::atomic<bool> shutdown_;
+
     private:
         std::string getCurrentTime();
-        
+        void writerLoop();
+        // 排空所有缓冲区，返回写出的条数
+        size_t drain();
+        // message是拼好的整条消息
+        void write(const LogRecord& record, const char* message);
+        LogRing* localRing();
+
     public:
         Logger(const Logger&) = delete;
         Logger& operator=(const Logger&) = delete;
-        
+
         static Logger& getInstance() {
             static Logger instance;
             return instance;
         }
-        
-        Logger(const std::string& filePath="../build/log/") {
-            logFileTime = getCurrentTime();
-            logFilePath = filePath;
-            logFileName = "log_" + logFileTime + ".txt";
-            logFile.open(logFilePath + logFileName, std::ios::app);
-            if (!logFile.is_open()) {
-                std::cerr << "Failed to open log file: " << logFileName << std::endl;
-            }
+
+        static bool isShutdown() {
+            return shutdown_.load(std::memory_order_acquire);
         }
-        
-        ~Logger() {
-            logFile.close();
+
+        // filePath为空时看环境变量LLT_MEMPOOL_LOG_DIR；都没有就不建目录、不写文件，全部输出到stderr
+        // 给了目录时才创建它，日志写进里面的log_<启动时间>.txt
+        Logger(const std::string& filePath="");
+        ~Logger();
+
+        // 格式化写入当前线程的缓冲区，由后台线程落盘
+        template<typename... Args>
+        void logf(LogLevel level, bool isThread, const char* fmt, Args... args) {
+            LogRing* ring = localRing();
+            if (ring == nullptr) {
+                return;
+            }
+            if constexpr (sizeof...(Args) == 0) {
+                ring->push(level, isThread, "%s", fmt);
+            } else {
+                ring->push(level, isThread, fmt, args...);
+            }
         }
 
-   
         // 基本日志记录函数
-        void log(LogLevel level, const std::string& message, bool isThread = true);
-        
+        void log(LogLevel level, const std::string& message, bool isThread = true) {
+            logf(level, isThread, "%s", message.c_str());
+        }
+
+        // 等缓冲区里已有的日志全部落盘，测试和退出前用
+        void flush();
+
         // 便捷日志记录方法
         void info(const std::string& message, bool isThread = true) {
                 log(LogLevel::INFO, message, isThread);
 
         }
-        
+
         void warn(const std::string& message, bool isThread = true) {
                 log(LogLevel::WARN, message, isThread);
         }
-        
+
         void error(const std::string& message, bool isThread = true) {
                 log(LogLevel::ERROR, message, isThread);
         }
-        
+
         void debug(const std::string& message, bool isThread = true) {
                 log(LogLevel::DEBUG, message, isThread);
         }
     };
 
     // 全局函数式API，替代原宏定义
+    // printf风格的重载只传整数/指针，级别被编译期关掉时连格式化都没有；
+    // std::string重载保留给旧代码，但实参在调用点就已经构造好了
+    template<LogLevel Level, typename... Args>
+    inline void logAt(const char* fmt, Args... args) {
+        if constexpr (isLogLevelEnabled(Level)) {
+            if (!Logger::isShutdown()) {
+                Logger::getInstance().logf(Level, true, fmt, args...);
+            }
+        }
+    }
+
+    template<typename... Args>
+    inline void LogInfo(const char* fmt, Args... args) {
+        logAt<LogLevel::INFO>(fmt, args...);
+    }
+
+    template<typename... Args>
+    inline void LogWarn(const char* fmt, Args... args) {
+        logAt<LogLevel::WARN>(fmt, args...);
+    }
+
+    template<typename... Args>
+    inline void LogError(const char* fmt, Args... args) {
+        logAt<LogLevel::ERROR>(fmt, args...);
+    }
+
+    template<typename... Args>
+    inline void LogDebug(const char* fmt, Args... args) {
+        logAt<LogLevel::DEBUG>(fmt, args...);
+    }
+
     inline void LogInfo(const std::string& message) {
-        Logger::getInstance().info(message);
+        logAt<LogLevel::INFO>("%s", message.c_str());
     }
-    
+
     inline void LogWarn(const std::string& message) {
-        Logger::getInstance().warn(message);
+        logAt<LogLevel::WARN>("%s", message.c_str());
     }
-    
+
     inline void LogError(const std::string& message) {
-        Logger::getInstance().error(message);
+        logAt<LogLevel::ERROR>("%s", message.c_str());
     }
-    
+
     inline void LogDebug(const std::string& message) {
-        Logger::getInstance().debug(message);
+        logAt<LogLevel::DEBUG>("%s", message.c_str());
     }
-    
-    
-    
-} // namespace llt_memoryPool
\ No newline at end of file
+
+
+
+} // namespace llt_memoryPool
@@ -0,0 +1,124 @@
+#include "../include/Arena.h"
+#include "../include/PageCache.h"
+#include "../include/ThreadCache.h"
+#include "../include/HeapLimit.h"
+#include <algorithm>
+
+namespace llt_memoryPool
+{
+
+BumpArena::BumpArena(size_t spanPages, size_t node)
+    : span_pages_(spanPages == 0 ? 1 : spanPages)
+{
+    if (node >= MAX_NUMA_NODES)
+    {
+        ThreadCache* cache = ThreadCache::currentIfCreated();
+        node = cache != nullptr ? cache->node() : NumaTopology::getInstance().currentNode();
+    }
+    node_ = node;
+}
+
+BumpArena::~BumpArena()
+{
+    releaseSpans();
+}
+
+void* BumpArena::allocateSlow(size_t size, size_t align)
+{
+    // rewind/reset以后后面还有空出来的span，放得下就接着用
+    Span* next = current_ != nullptr ? current_->next : head_;
+    if (next != nullptr)
+    {
+        uintptr_t start = reinterpret_cast<uintptr_t>(next->start_address);
+        uintptr_t cursor = (start + align - 1) & ~(uintptr_t(align) - 1);
+        if (cursor + size < start + next->num_pages * PAGE_SIZE)
+        {
+            enter(next);
+            cursor_ = reinterpret_cast<char*>(cursor + size);
+            return reinterpret_cast<void*>(cursor);
+        }
+    }
+    Span* span = newSpan(size, align);
+    if (span == nullptr)
+    {
+        return nullptr;
+    }
+    enter(span);
+    uintptr_t cursor = (reinterpret_cast<uintptr_t>(cursor_) + align - 1) & ~(uintptr_t(align) - 1);
+    cursor_ = reinterpret_cast<char*>(cursor + size);
+    return reinterpret_cast<void*>(cursor);
+}
+
+Span* BumpArena::newSpan(size_t size, size_t align)
+{
+    // 多要一个字节，配合allocate里的<判断
+    size_t pages = std::max(span_pages_, (size + align + PAGE_SIZE) / PAGE_SIZE);
+    PageCache& page_cache = PageCache::getInstance(node_);
+    Span* span = page_cache.allocateSpan(pages);
+    if (span == nullptr)
+    {
+        // 和线程缓存一样：跑一遍释放级联再试最后一次
+        HeapLimit::getInstance().onPressure(PressureLevel::Exhausted);
+        span = page_cache.allocateSpan(pages);
+        if (span == nullptr)
+        {
+            LogWarn("[BumpArena:newSpan] 节点%zu 申请 %zu 页失败", node_, pages);
+            return nullptr;
+        }
+    }
+    // 插在current_后面，空出来的span排在它后面，留给之后的分配
+    Span*& link = current_ != nullptr ? current_->next : head_;
+    span->next = link;
+    link = span;
+    span_count_++;
+    reserved_bytes_ += pages * PAGE_SIZE;
+    return span;
+}
+
+void BumpArena::enter(Span* span)
+{
+    current_ = span;
+    cursor_ = static_cast<char*>(span->start_address);
+    end_ = cursor_ + span->num_pages * PAGE_SIZE;
+}
+
+void BumpArena::rewind(const Checkpoint& point)
+{
+    current_ = point.span;
+    cursor_ = point.cursor;
+    end_ = current_ != nullptr ? static_cast<char*>(current_->start_address) + current_->num_pages * PAGE_SIZE
+                               : nullptr;
+}
+
+void BumpArena::reset(bool keepSpans)
+{
+    if (!keepSpans)
+    {
+        releaseSpans();
+        return;
+    }
+    if (head_ != nullptr)
+    {
+        enter(head_);
+    }
+}
+
+void BumpArena::releaseSpans()
+{
+    PageCache& page_cache = PageCache::getInstance(node_);
+    Span* span = head_;
+    while (span != nullptr)
+    {
+        Span* next = span->next;
+        page_cache.deallocateSpan(span);
+        span = next;
+    }
+    head_ = nullptr;
+    current_ = nullptr;
+    cursor_ = nullptr;
+    end_ = nullptr;
+    span_count_ = 0;
+    reserved_bytes_ = 0;
+}
+
+} // namespace llt_memoryPool
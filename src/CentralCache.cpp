@@ -1,8 +1,12 @@
 #include "../include/CentralCache.h"
 #include "../include/PageCache.h"
+#include "../include/Heap.h"
+#include "../include/Instrument.h"
+#include <algorithm>
 #include <cassert>
 #include <thread>
 #include <vector>
+#include <type_traits>
 
 namespace llt_memoryPool
 {
@@ -10,65 +14,424 @@ namespace llt_memoryPool
 // 每次从PageCache获取span大小（以页为单位）
 static const size_t SPAN_PAGES = 8;
 
-CentralCache::CentralCache()
+static inline void* stackPtr(unsigned __int128 top)
 {
-    for(size_t i = 0; i < FREE_LIST_SIZE; ++i)
+    return reinterpret_cast<void*>(static_cast<uint64_t>(top));
+}
+
+// 换成ptr，版本号+1
+static inline unsigned __int128 stackPack(void* ptr, unsigned __int128 prev)
+{
+    uint64_t tag = static_cast<uint64_t>(prev >> 64) + 1;
+    return (static_cast<unsigned __int128>(tag) << 64) | reinterpret_cast<uint64_t>(ptr);
+}
+
+// 两半分开按8字节原子读，可能读到撕裂的一对；那样的值CAS一定失败，失败时带回的是完整的当前值
+static inline unsigned __int128 loadTop(BatchStack& stack)
+{
+    uint64_t* words = reinterpret_cast<uint64_t*>(&stack.top);
+    uint64_t tag = __atomic_load_n(words + 1, __ATOMIC_ACQUIRE);
+    uint64_t ptr = __atomic_load_n(words, __ATOMIC_ACQUIRE);
+    return (static_cast<unsigned __int128>(tag) << 64) | ptr;
+}
+
+// 16字节CAS（全屏障）；失败时expected更新成当前值
+static inline bool casTop(BatchStack& stack, unsigned __int128& expected, unsigned __int128 desired)
+{
+    unsigned __int128 current = __sync_val_compare_and_swap(&stack.top, expected, desired);
+    if (current == expected)
+    {
+        return true;
+    }
+    expected = current;
+    return false;
+}
+
+// 对象的第n个字，栈上的对象可能正在被别的线程改写，统一用原子读写
+static inline void* loadWord(void* obj, size_t n)
+{
+    return __atomic_load_n(reinterpret_cast<void**>(obj) + n, __ATOMIC_RELAXED);
+}
+
+static inline void storeWord(void* obj, size_t n, void* value)
+{
+    __atomic_store_n(reinterpret_cast<void**>(obj) + n, value, __ATOMIC_RELAXED);
+}
+
+// 批栈里“下一批”的链接，加固模式下和第1个字一样编码；popBatch可能读到过期数据，所以不校验
+static inline void* loadBatchLink(void* obj)
+{
+#if LLT_MEMPOOL_HARDENED
+    return hardening::maskWord(static_cast<void**>(obj)+1,loadWord(obj,1));
+#else
+    return loadWord(obj,1);
+#endif
+}
+
+static inline void storeBatchLink(void* obj, void* next)
+{
+#if LLT_MEMPOOL_HARDENED
+    storeWord(obj,1,hardening::maskWord(static_cast<void**>(obj)+1,next));
+#else
+    storeWord(obj,1,next);
+#endif
+}
+
+#if LLT_MEMPOOL_HARDENED
+// 对象在span里的序号，不在对象边界上的指针直接报错
+// 每个对象只做一次除法，这条路径上每个对象都要算一遍
+static inline size_t objectIndex(Span* span, void* obj, size_t object_size)
+{
+    size_t offset=static_cast<char*>(obj)-static_cast<char*>(span->start_address);
+    size_t bit=offset/object_size;
+    if(bit*object_size!=offset||offset+object_size>span->num_pages*PAGE_SIZE)
+    {
+        hardening::fail("free of pointer not returned by allocate",obj);
+    }
+    return bit;
+}
+
+// 从span交出去的count个对象置位
+static void markAllocated(Span* span, void* start, size_t count)
+{
+    size_t object_size=SizeClass::getSize(span->size_class);
+    void* current=start;
+    for(size_t i=0;i<count&&current!=nullptr;++i)
+    {
+        size_t bit=objectIndex(span,current,object_size);
+        span->alloc_bitmap[bit/64]|=uint64_t(1)<<(bit%64);
+        current=loadNext(current);
+    }
+}
+#endif
+
+template<typename Lock>
+std::atomic<BasicCentralCache<Lock>*> BasicCentralCache<Lock>::instances_[MAX_NUMA_NODES];
+template<typename Lock>
+std::once_flag BasicCentralCache<Lock>::instance_flags_[MAX_NUMA_NODES];
+
+template<typename Lock>
+BasicCentralCache<Lock>::BasicCentralCache(Heap& heap, size_t node)
+    : heap_(heap), node_(node), empty_span_limit_(heap.emptySpanLimit())
+{
+}
+
+template<typename Lock>
+BasicCentralCache<Lock>& BasicCentralCache<Lock>::createInstance(size_t node)
+{
+    std::call_once(instance_flags_[node], [node]{
+        void* memory = internalAllocate(sizeof(BasicCentralCache), alignof(BasicCentralCache));
+        instances_[node].store(new (memory) BasicCentralCache(Heap::defaultHeap(), node), std::memory_order_release);
+    });
+    return *instances_[node].load(std::memory_order_acquire);
+}
+
+template<typename Lock>
+BasicCentralCache<Lock>& BasicCentralCache<Lock>::sibling(size_t node)
+{
+    // 堆只持有CentralLock的实例；压测直接拿的其他锁类型的实例都在默认堆上
+    if constexpr (std::is_same_v<Lock, CentralLock>)
+    {
+        return heap_.centralCache(node);
+    }
+    else
     {
-        span_lists_[i]=new SpanList();
-    } 
+        return getInstance(node);
+    }
 }
 
-CentralCache::~CentralCache()
+template<typename Lock>
+BasicCentralCache<Lock>::~BasicCentralCache()
 {
     for(size_t i = 0; i < FREE_LIST_SIZE; ++i)
     {
-        delete span_lists_[i];
+        internalDelete(buckets_[i].spans);
+    }
+}
+
+template<typename Lock>
+bool BasicCentralCache<Lock>::pushBatch(size_t index, void* start)
+{
+    // 8字节对象放不下两个字
+    if(SizeClass::getSize(index)<2*sizeof(void*)) return false;
+    BatchStack& stack=buckets_[index].stack;
+    if(stack.depth.load(std::memory_order_relaxed)>=MAX_STACK_BATCHES) return false;
+    unsigned __int128 top=loadTop(stack);
+    do
+    {
+        storeBatchLink(start,stackPtr(top));
+    } while(!casTop(stack,top,stackPack(start,top)));
+    stack.depth.fetch_add(1,std::memory_order_relaxed);
+    return true;
+}
+
+template<typename Lock>
+bool BasicCentralCache<Lock>::popBatch(size_t index, void*& start, void*& end)
+{
+    BatchStack& stack=buckets_[index].stack;
+    unsigned __int128 top=loadTop(stack);
+    void* head=nullptr;
+    do
+    {
+        head=stackPtr(top);
+        if(head==nullptr) return false;
+        // head可能刚被别人弹走并改写，读到的是脏数据也没关系，版本号变了CAS一定失败
+        // span只会还给PageCache，不会munmap，所以这里的读不会段错误
+    } while(!casTop(stack,top,stackPack(loadBatchLink(head),top)));
+    stack.depth.fetch_sub(1,std::memory_order_relaxed);
+    // 已经独占这一批了，顺着链表找到尾
+    void* tail=head;
+    while(void* next=loadNext(tail))
+    {
+        tail=next;
+    }
+    start=head;
+    end=tail;
+    return true;
+}
+
+template<typename Lock>
+void BasicCentralCache<Lock>::releaseRange(void* start, size_t count, size_t index)
+{
+    // 跨节点释放的对象也会被压进本节点的栈，下一个从栈里取的线程拿到的是远端内存；
+    // 逐个查归属要拿PageCache的锁，得不偿失，drain的时候releaseListToSpans会按节点分流
+    // 加固模式不走批栈：整批压栈再弹出会绕过alloc_bitmap，重复释放的对象会被再次分出去
+#if !LLT_MEMPOOL_HARDENED
+    if(count==SizeClass::getBatchNum(SizeClass::getSize(index))&&pushBatch(index,start))
+    {
+        instrument::count(instrument::Event::BatchStackPush);
+        return;
+    }
+#endif
+    releaseListToSpans(start,count,SizeClass::getSize(index));
+}
+
+template<typename Lock>
+void BasicCentralCache<Lock>::drainBatchStacks()
+{
+    for(size_t index=0;index<FREE_LIST_SIZE;++index)
+    {
+        void* start=nullptr;
+        void* end=nullptr;
+        while(popBatch(index,start,end))
+        {
+            releaseListToSpans(start,SizeClass::getBatchNum(SizeClass::getSize(index)),SizeClass::getSize(index));
+        }
+    }
+}
+
+template<typename Lock>
+SpanBuckets& BasicCentralCache<Lock>::bucketsFor(size_t index)
+{
+    SpanBuckets* buckets=buckets_[index].spans;
+    if(buckets==nullptr)
+    {
+        buckets=internalNew<SpanBuckets>();
+        buckets->total_objects=SizeClass::getPages(index)*PAGE_SIZE/SizeClass::getSize(index);
+        buckets_[index].spans=buckets;
+    }
+    return *buckets;
+}
+
+template<typename Lock>
+void BasicCentralCache<Lock>::rebucket(SpanBuckets& buckets, Span* span)
+{
+    size_t bucket=span->use_count>=buckets.total_objects
+                      ? OCCUPANCY_BUCKETS
+                      : span->use_count*OCCUPANCY_BUCKETS/buckets.total_objects;
+    if(bucket!=span->occupancy_bucket)
+    {
+        buckets.lists[span->occupancy_bucket].erase(span);
+        buckets.lists[bucket].push_front(span);
+        span->occupancy_bucket=bucket;
+    }
+}
+
+template<typename Lock>
+void BasicCentralCache<Lock>::detachEmptySpan(SpanBuckets& buckets, Span* span, size_t index)
+{
+    buckets.lists[span->occupancy_bucket].erase(span);
+    buckets.spans--;
+    span->occupancy_bucket=0;
+    span->objects=nullptr;
+    span->size_class=0;
+#if LLT_MEMPOOL_HARDENED
+    free(span->alloc_bitmap);
+    span->alloc_bitmap=nullptr;
+#endif
+    // location由deallocateSpans在PageCache锁内清掉；这里提前清的话，
+    // 别的线程合并空闲span时会在它进空闲索引之前就把它合并掉
+    LogInfo("[CentralCache:detachEmptySpan] 节点%zu 等级%zu 归还span %zu 页",node_,index,span->num_pages);
+    instrument::count(instrument::Event::SpanReturned);
+}
+
+template<typename Lock>
+size_t BasicCentralCache<Lock>::releaseEmptySpans()
+{
+    size_t released=0;
+    for(size_t index=0;index<FREE_LIST_SIZE;++index)
+    {
+        Span* emptied=nullptr;
+        {
+            std::lock_guard<Lock> lock(buckets_[index].lock);
+            SpanBuckets* buckets=buckets_[index].spans;
+            if(buckets==nullptr||buckets->empty_spans==0)
+            {
+                continue;
+            }
+            // 空span都在0号桶
+            SpanList& list=buckets->lists[0];
+            Span* span=list.begin();
+            while(span!=list.end())
+            {
+                Span* next=span->next;
+                if(span->use_count==0)
+                {
+                    detachEmptySpan(*buckets,span,index);
+                    span->next=emptied;
+                    emptied=span;
+                    released++;
+                }
+                span=next;
+            }
+            buckets->empty_spans=0;
+        }
+        if(emptied!=nullptr)
+        {
+            heap_.pageCache(node_).deallocateSpans(emptied);
+        }
+    }
+    return released;
+}
+
+template<typename Lock>
+Span* BasicCentralCache<Lock>::newSpanFor(size_t index, SpanBuckets& buckets, bool prefault)
+{
+    size_t num_pages=SizeClass::getPages(index);
+    Span* span=heap_.pageCache(node_).allocateSpan(num_pages);
+    if(span==nullptr)
+    {
+        return nullptr;
+    }
+    span->size_class=index;
+    buckets_[index].new_spans++;
+#if LLT_MEMPOOL_HARDENED
+    span->alloc_bitmap=static_cast<uint64_t*>(calloc((span->getTotalObjects()+63)/64,sizeof(uint64_t)));
+    if(span->alloc_bitmap==nullptr)
+    {
+        span->size_class=0;
+        heap_.pageCache(node_).deallocateSpan(span);
+        return nullptr;
+    }
+#endif
+    LogInfo("[CentralCache:newSpanFor] 节点%zu 等级%zu 申请新span %zu 页",node_,index,num_pages);
+    if(prefault)
+    {
+        PageCache::prefault(span);
+    }
+    char* ptr=static_cast<char*>(PageCache::getPageAddress(span));
+    size_t object_size=SizeClass::getSize(index);
+    size_t nums_object=span->getTotalObjects();
+    void* head=nullptr;
+    for(size_t i=0;i<nums_object;++i)
+    {
+        void* current=ptr+i*object_size;
+        storeNext(current,head);
+        head=current;
     }
+    span->objects=head;
+    span->occupancy_bucket=0;
+    buckets.lists[0].push_front(span);
+    buckets.spans++;
+    buckets.empty_spans++;
+    return span;
 }
 
-size_t CentralCache::fetchRange(void*& start,void*& end,size_t index, size_t batchNum)
+template<typename Lock>
+size_t BasicCentralCache<Lock>::reserve(size_t index, size_t count)
 {
-    
+    instrument::TimedLock<Lock> lock(buckets_[index].lock,instrument::Lock::CentralBucket,instrument::centralLock(index));
+    SpanBuckets& buckets=bucketsFor(index);
+    size_t available=0;
+    for(size_t bucket=0;bucket<OCCUPANCY_BUCKETS;++bucket)
+    {
+        SpanList& list=buckets.lists[bucket];
+        for(Span* span=list.begin();span!=list.end();span=span->next)
+        {
+            available+=span->getFreeObjects();
+        }
+    }
+    while(available<count)
+    {
+        Span* span=newSpanFor(index,buckets,true);
+        if(span==nullptr)
+        {
+            break;
+        }
+        available+=span->getTotalObjects();
+    }
+    return available;
+}
+
+template<typename Lock>
+typename BasicCentralCache<Lock>::BucketCounters BasicCentralCache<Lock>::counters(size_t index)
+{
+    CentralBucket<Lock>& bucket=buckets_[index];
+    std::lock_guard<Lock> lock(bucket.lock);
+    BucketCounters counters{bucket.fetches,bucket.releases,bucket.new_spans,0,0,0};
+    if(SpanBuckets* buckets=bucket.spans)
+    {
+        size_t used=buckets->used_objects;
+        // 批栈里的对象在span看来已经交出去了；深度是近似值，最多不超过交出去的对象数
+        size_t stacked=std::min(used,bucket.stack.depth.load(std::memory_order_relaxed)*
+                                     SizeClass::getBatchNum(SizeClass::getSize(index)));
+        counters.spans=buckets->spans;
+        counters.free_objects=buckets->spans*buckets->total_objects-used+stacked;
+        counters.used_objects=used-stacked;
+    }
+    return counters;
+}
+
+template<typename Lock>
+size_t BasicCentralCache<Lock>::fetchRange(void*& start,void*& end,size_t index, size_t batchNum)
+{
+    // 快路径：栈里有现成的一整批就直接拿走，不碰桶锁；加固模式下批栈一直是空的
+#if !LLT_MEMPOOL_HARDENED
+    if(batchNum==SizeClass::getBatchNum(SizeClass::getSize(index))&&popBatch(index,start,end))
+    {
+        instrument::count(instrument::Event::BatchStackPop);
+        return batchNum;
+    }
+#endif
+
     size_t fetchNum = 0;
-    SpanList& sp=*span_lists_[index];
     Span* target_span=nullptr;
-    std::lock_guard<std::mutex> lock(span_lists_mutex_[index]);
-    //span_lists_mutex_[index].lock();
-    for(Span* span=sp.begin();span!=sp.end();span=span->next)
+    instrument::TimedLock<Lock> lock(buckets_[index].lock,instrument::Lock::CentralBucket,instrument::centralLock(index));
+    buckets_[index].fetches++;
+    SpanBuckets& buckets=bucketsFor(index);
+    // 从最满的未满桶开始找，让快空的span有机会整个空出来
+    for(size_t bucket=OCCUPANCY_BUCKETS;bucket>0;--bucket)
     {
-        if(!span->isFull())
+        SpanList& list=buckets.lists[bucket-1];
+        if(!list.empty())
         {
-            target_span=span;
+            target_span=list.begin();
             break;
         }
     }
-    //span_lists_mutex_[index].unlock();
     if(target_span==nullptr)
     {
-        size_t num_pages=SizeClass::getPages(index);
         //解锁？
-        target_span = PageCache::getInstance().allocateSpan(num_pages);
-        //target_span->lock_.lock();
-        target_span->size_class=index;
+        target_span=newSpanFor(index,buckets,false);
         if(target_span==nullptr)
         {
+            // 堆上限或者mmap失败，交给ThreadCache走压力回收
             return 0;
         }
-        char* ptr=static_cast<char*>(PageCache::getPageAddress(target_span));
-        size_t object_size=SizeClass::getSize(index);
-        size_t nums_object=target_span->getTotalObjects();
-        void* head=nullptr;
-        for(size_t i=0;i<nums_object;++i)
-        {
-            void* current=ptr+i*object_size;
-            *reinterpret_cast<void**>(current)=head;
-            head=current;
-        }
-        target_span->objects=head;
-        //target_span->lock_.unlock();
-        //span_lists_mutex_[index].lock();
-        sp.push_front(target_span);
-        //span_lists_mutex_[index].unlock();
+    }
+    if(target_span->use_count==0)
+    {
+        buckets.empty_spans--;
     }
     //span_lists_mutex_[index].unlock();
     //target_span->lock_.lock();
@@ -81,69 +444,150 @@ size_t CentralCache::fetchRange(void*& start,void*& end,size_t index, size_t bat
             // The list is shorter than fetchNum. This indicates a likely bug in span's
             // object tracking. To prevent a crash, we must stop here and return what we have.
             // The list is now start -> ... -> end (which is the last valid node)
-            *reinterpret_cast<void**>(start) = nullptr; // Properly terminate the list we are returning
+            storeNext(start, nullptr); // Properly terminate the list we are returning
             fetchNum = i + 1; // We actually fetched i+1 items
             target_span->objects = nullptr; // The span's free list is now empty
             target_span->use_count += fetchNum;
-            target_span->location=true;
+            buckets.used_objects += fetchNum;
+#if LLT_MEMPOOL_HARDENED
+            markAllocated(target_span, start, fetchNum);
+#endif
+            rebucket(buckets, target_span);
             return fetchNum;
         }
-        end=*reinterpret_cast<void**>(end);
+        end=loadNext(end);
     }
  
     if (end != nullptr) {
-        target_span->objects=*reinterpret_cast<void**>(end);
-        *reinterpret_cast<void**>(end)=nullptr;
+        target_span->objects=loadNext(end);
+        storeNext(end,nullptr);
     } else {
         // This can happen if the list had exactly fetchNum-1 items.
         target_span->objects = nullptr;
     }
 
     target_span->use_count+=fetchNum;
-    target_span->location=true;
-    //target_span->lock_.unlock();
-    if(target_span->isFull())
-    {   
-        sp.erase(target_span);
-        sp.push_back(target_span);
-    }
+    buckets.used_objects+=fetchNum;
+#if LLT_MEMPOOL_HARDENED
+    markAllocated(target_span,start,fetchNum);
+#endif
+    rebucket(buckets,target_span);
     return fetchNum;
 }
 
-void CentralCache::releaseListToSpans(void* start, size_t size, size_t bytes)
+template<typename Lock>
+void BasicCentralCache<Lock>::releaseListToSpans(void* start, size_t size, size_t bytes)
 {
-    int index=SizeClass::getIndex(bytes);
-    SpanList& sp=*span_lists_[index];
+    size_t index=SizeClass::getIndex(bytes);
     void* current=start;
-    std::lock_guard<std::mutex> lock(span_lists_mutex_[index]);
+    // 不属于本节点的对象（其他节点的线程分配、本线程释放）先串起来，放锁以后再还
+    void* foreign=nullptr;
+    // 空了的span也先用next串起来，放掉桶锁以后一次还给PageCache
+    Span* emptied=nullptr;
+    instrument::count(instrument::Event::ReleaseToSpans);
+    {
+    instrument::TimedLock<Lock> lock(buckets_[index].lock,instrument::Lock::CentralBucket,instrument::centralLock(index));
+    buckets_[index].releases++;
+    SpanBuckets& buckets=bucketsFor(index);
     while(current!=nullptr)
     {
-        void* next=*reinterpret_cast<void**>(current);
-        Span* span=PageCache::getInstance().mapAddressToSpan(current);
-        //span->lock_.lock();
-        assert(index==span->size_class);
+        void* next=loadNext(current);
+        Span* span=heap_.pageCache(node_).mapAddressToSpan(current);
         if(span==nullptr)
         {
-            return;
+            storeNext(current,foreign);
+            foreign=current;
+            current=next;
+            continue;
         }
-        *static_cast<void**>(current)=span->objects;
+        //span->lock_.lock();
+#if LLT_MEMPOOL_HARDENED
+        // 等级对不上：释放时传的大小和分配时不一致（或者span根本不在中心缓存手里）
+        if(index!=span->size_class)
+        {
+            hardening::fail("sized free does not match allocation size",current);
+        }
+        if(span->alloc_bitmap==nullptr)
+        {
+            hardening::fail("free of pointer into a span that is not allocated",current);
+        }
+        size_t bit=objectIndex(span,current,SizeClass::getSize(index));
+        uint64_t mask=uint64_t(1)<<(bit%64);
+        if((span->alloc_bitmap[bit/64]&mask)==0)
+        {
+            hardening::fail("double free",current);
+        }
+        span->alloc_bitmap[bit/64]&=~mask;
+#endif
+        assert(index==span->size_class);
+        storeNext(current,span->objects);
         span->objects=current;
         span->use_count--;
-        span->lock_.unlock();
-        if(span->use_count==0){
-            //std::lock_guard<std::mutex> lock(span_lists_mutex_[index]);
-            //std::lock_guard<std::mutex> lock1(span->lock_);
-            sp.erase(span);
-            span->objects=nullptr;
-            span->size_class=0;
-            //感觉location这个变量没用到
-            span->location=false;
-            PageCache::getInstance().deallocateSpan(span);
+        buckets.used_objects--;
+        if(span->use_count==0&&buckets.empty_spans<emptySpanLimit()){
+            // 留着这个切好的span：同一批对象下一次取出时不用再向PageCache要、重新切
+            rebucket(buckets,span);
+            buckets.empty_spans++;
+        }
+        else if(span->use_count==0){
+            detachEmptySpan(buckets,span,index);
+            span->next=emptied;
+            emptied=span;
+        }
+        else
+        {
+            rebucket(buckets,span);
         }
         current=next;
     }
+    }
+    if(emptied!=nullptr)
+    {
+        heap_.pageCache(node_).deallocateSpans(emptied);
+    }
+    if(foreign!=nullptr)
+    {
+        instrument::count(instrument::Event::ForeignRelease);
+        releaseForeignObjects(foreign,bytes);
+    }
 }
 
+template<typename Lock>
+void BasicCentralCache<Lock>::releaseForeignObjects(void* start, size_t bytes)
+{
+    void* lists[MAX_NUMA_NODES]={};
+    size_t counts[MAX_NUMA_NODES]={};
+    void* current=start;
+    while(current!=nullptr)
+    {
+        void* next=loadNext(current);
+        size_t node=heap_.findNode(current,node_);
+        // 哪个节点都找不到的指针不是内存池的，和原来一样直接丢掉；加固模式下报错
+        if(node<MAX_NUMA_NODES&&node!=node_)
+        {
+            storeNext(current,lists[node]);
+            lists[node]=current;
+            counts[node]++;
+        }
+#if LLT_MEMPOOL_HARDENED
+        else
+        {
+            hardening::fail("free of pointer not owned by the pool",current);
+        }
+#endif
+        current=next;
+    }
+    for(size_t node=0;node<MAX_NUMA_NODES;++node)
+    {
+        if(lists[node]!=nullptr)
+        {
+            sibling(node).releaseListToSpans(lists[node],counts[node],bytes);
+        }
+    }
+}
 
+template class BasicCentralCache<std::mutex>;
+template class BasicCentralCache<SpinLock>;
+template class BasicCentralCache<TicketLock>;
 
-} // namespace memoryPool
\ No newline at end of file
+} // namespace memoryPool
@@ -0,0 +1,364 @@
+#include "../include/ChainBuffer.h"
+#include "../include/MemoryPool.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace llt_memoryPool
+{
+
+ChainBuffer::ChainBuffer(size_t blockSize)
+{
+    size_t size = 256;
+    while (size < blockSize && size < MAX_BYTES)
+    {
+        size <<= 1;
+    }
+    block_size_ = size;
+    capacity_ = size - sizeof(Block);
+}
+
+ChainBuffer::~ChainBuffer()
+{
+    releaseAll();
+}
+
+ChainBuffer::ChainBuffer(ChainBuffer&& other) noexcept
+    : block_size_(other.block_size_), capacity_(other.capacity_)
+{
+    swap(other);
+}
+
+ChainBuffer& ChainBuffer::operator=(ChainBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        releaseAll();
+        swap(other);
+    }
+    return *this;
+}
+
+void ChainBuffer::swap(ChainBuffer& other) noexcept
+{
+    std::swap(head_, other.head_);
+    std::swap(write_, other.write_);
+    std::swap(last_, other.last_);
+    std::swap(spare_, other.spare_);
+    std::swap(spare_count_, other.spare_count_);
+    std::swap(readable_, other.readable_);
+    std::swap(block_size_, other.block_size_);
+    std::swap(capacity_, other.capacity_);
+}
+
+size_t ChainBuffer::writableBytes() const
+{
+    size_t bytes = 0;
+    for (Block* block = write_; block != nullptr; block = block->next)
+    {
+        bytes += capacity_ - block->writer;
+    }
+    return bytes;
+}
+
+size_t ChainBuffer::copyOut(void* dst, size_t len) const
+{
+    char* out = static_cast<char*>(dst);
+    size_t copied = 0;
+    for (const Block* block = head_; block != nullptr && copied < len; block = block->next)
+    {
+        size_t n = std::min<size_t>(block->writer - block->reader, len - copied);
+        std::memcpy(out + copied, block->data() + block->reader, n);
+        copied += n;
+        if (block == write_)
+        {
+            break;
+        }
+    }
+    return copied;
+}
+
+void ChainBuffer::retrieve(size_t len)
+{
+    assert(len <= readable_);
+    len = std::min(len, readable_);
+    while (len > 0)
+    {
+        Block* block = head_;
+        size_t available = block->writer - block->reader;
+        if (len < available)
+        {
+            block->reader += static_cast<uint32_t>(len);
+            readable_ -= len;
+            return;
+        }
+        len -= available;
+        readable_ -= available;
+        if (block == write_)
+        {
+            break;
+        }
+        head_ = block->next;
+        recycle(block);
+    }
+    if (readable_ == 0 && head_ != nullptr)
+    {
+        // 读空了：和Muduo一样把位置拨回开头，后面挂着的空块留着继续写
+        head_->reader = head_->writer = kCheapPrepend;
+        write_ = head_;
+    }
+}
+
+std::string ChainBuffer::retrieveAsString(size_t len)
+{
+    len = std::min(len, readable_);
+    std::string result(len, '\0');
+    copyOut(&result[0], len);
+    retrieve(len);
+    return result;
+}
+
+void ChainBuffer::append(const void* data, size_t len)
+{
+    const char* in = static_cast<const char*>(data);
+    while (len > 0)
+    {
+        Block* block = writeBlock();
+        size_t n = std::min<size_t>(capacity_ - block->writer, len);
+        std::memcpy(block->data() + block->writer, in, n);
+        block->writer += static_cast<uint32_t>(n);
+        readable_ += n;
+        in += n;
+        len -= n;
+    }
+}
+
+void ChainBuffer::prepend(const void* data, size_t len)
+{
+    assert(len <= capacity_);
+    if (head_ == nullptr || head_->reader < len)
+    {
+        // 前面不够放：插一块新的，数据放在它的末尾
+        Block* block = newBlock();
+        block->reader = block->writer = static_cast<uint32_t>(capacity_);
+        block->next = head_;
+        head_ = block;
+        if (last_ == nullptr)
+        {
+            last_ = write_ = block;
+        }
+    }
+    head_->reader -= static_cast<uint32_t>(len);
+    std::memcpy(head_->data() + head_->reader, data, len);
+    readable_ += len;
+}
+
+int ChainBuffer::readableIov(struct iovec* iov, int maxIov) const
+{
+    int count = 0;
+    for (Block* block = head_; block != nullptr && count < maxIov; block = block->next)
+    {
+        if (block->writer > block->reader)
+        {
+            iov[count].iov_base = block->data() + block->reader;
+            iov[count].iov_len = block->writer - block->reader;
+            count++;
+        }
+        if (block == write_)
+        {
+            break;
+        }
+    }
+    return count;
+}
+
+int ChainBuffer::writableIov(struct iovec* iov, int maxIov, size_t len)
+{
+    size_t writable = writableBytes();
+    while (writable < len)
+    {
+        appendBlock();
+        writable += capacity_ - last_->writer;
+    }
+    int count = 0;
+    for (Block* block = write_; block != nullptr && count < maxIov; block = block->next)
+    {
+        if (block->writer < capacity_)
+        {
+            iov[count].iov_base = block->data() + block->writer;
+            iov[count].iov_len = capacity_ - block->writer;
+            count++;
+        }
+    }
+    return count;
+}
+
+void ChainBuffer::hasWritten(size_t len)
+{
+    while (len > 0)
+    {
+        Block* block = writeBlock();
+        size_t n = std::min<size_t>(capacity_ - block->writer, len);
+        block->writer += static_cast<uint32_t>(n);
+        readable_ += n;
+        len -= n;
+    }
+}
+
+ssize_t ChainBuffer::readFd(int fd, int* savedErrno)
+{
+    // 直接读进块里：可写区不够kReadChunk就先挂上块（优先用备用块），不经过栈上的缓冲再拷一遍
+    // 没写到的空块留在链尾，下一次接着用；连接空闲时调shrink()还掉
+    struct iovec vec[kMaxIov];
+    int count = writableIov(vec, kMaxIov, kReadChunk);
+    ssize_t n = ::readv(fd, vec, count);
+    if (n < 0)
+    {
+        *savedErrno = errno;
+    }
+    else
+    {
+        hasWritten(n);
+    }
+    return n;
+}
+
+ssize_t ChainBuffer::writeFd(int fd, int* savedErrno)
+{
+    struct iovec vec[kMaxIov];
+    int count = readableIov(vec, kMaxIov);
+    if (count == 0)
+    {
+        return 0;
+    }
+    ssize_t n = ::writev(fd, vec, count);
+    if (n < 0)
+    {
+        *savedErrno = errno;
+    }
+    else
+    {
+        retrieve(n);
+    }
+    return n;
+}
+
+void ChainBuffer::shrink()
+{
+    // 正在写的块后面的空块也还掉
+    if (write_ != nullptr)
+    {
+        Block* block = write_->next;
+        write_->next = nullptr;
+        last_ = write_;
+        while (block != nullptr)
+        {
+            Block* next = block->next;
+            recycle(block);
+            block = next;
+        }
+    }
+    releaseSpare(0);
+}
+
+size_t ChainBuffer::blockCount() const
+{
+    size_t count = 0;
+    for (Block* block = head_; block != nullptr; block = block->next)
+    {
+        count++;
+    }
+    return count;
+}
+
+ChainBuffer::Block* ChainBuffer::newBlock()
+{
+    Block* block = spare_;
+    if (block != nullptr)
+    {
+        spare_ = block->next;
+        spare_count_--;
+    }
+    else
+    {
+        block = static_cast<Block*>(MemoryPool::allocate(block_size_));
+        if (block == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+    }
+    block->next = nullptr;
+    block->reader = block->writer = 0;
+    return block;
+}
+
+void ChainBuffer::recycle(Block* block)
+{
+    block->next = spare_;
+    spare_ = block;
+    if (++spare_count_ > kMaxSpareBlocks)
+    {
+        releaseSpare(kMaxSpareBlocks / 2);
+    }
+}
+
+void ChainBuffer::releaseSpare(size_t keep)
+{
+    // 一次还一串，中间不夹着别的分配，线程缓存里这些块是连续压进去的
+    while (spare_count_ > keep)
+    {
+        Block* block = spare_;
+        spare_ = block->next;
+        spare_count_--;
+        MemoryPool::deallocate(block, block_size_);
+    }
+}
+
+void ChainBuffer::appendBlock()
+{
+    Block* block = newBlock();
+    if (last_ == nullptr)
+    {
+        block->reader = block->writer = kCheapPrepend;
+        head_ = write_ = last_ = block;
+        return;
+    }
+    last_->next = block;
+    last_ = block;
+}
+
+ChainBuffer::Block* ChainBuffer::writeBlock()
+{
+    if (write_ == nullptr)
+    {
+        appendBlock();
+    }
+    while (write_->writer == capacity_)
+    {
+        if (write_->next == nullptr)
+        {
+            appendBlock();
+        }
+        write_ = write_->next;
+    }
+    return write_;
+}
+
+void ChainBuffer::releaseAll()
+{
+    while (head_ != nullptr)
+    {
+        Block* block = head_;
+        head_ = block->next;
+        MemoryPool::deallocate(block, block_size_);
+    }
+    write_ = last_ = nullptr;
+    readable_ = 0;
+    releaseSpare(0);
+}
+
+} // namespace llt_memoryPool
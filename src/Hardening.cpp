@@ -0,0 +1,179 @@
+#include "../include/Hardening.h"
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+namespace llt_memoryPool
+{
+namespace hardening
+{
+
+uintptr_t freelist_key = 0;
+std::atomic<uintptr_t> guard_region_begin{0};
+
+namespace
+{
+    constexpr size_t GUARD_PAGE = 4096;
+    constexpr size_t GUARD_SLOT_BYTES = 2 * GUARD_PAGE;
+
+    std::atomic<size_t> sampleRate{LLT_MEMPOOL_GUARD_SAMPLE_RATE};
+
+    // 保护页槽的状态全部放在静态存储里，不走operator new
+    struct GuardSlot
+    {
+        void* object;
+        size_t size;
+        bool used;
+    };
+
+    struct GuardPool
+    {
+        std::mutex mutex;
+        GuardSlot slots[GUARD_SLOTS];
+        // 空闲槽的FIFO：刚释放的槽排在最后，尽量晚复用，释放后使用更容易撞上PROT_NONE
+        uint32_t queue[GUARD_SLOTS];
+        size_t head = 0;
+        size_t count = 0;
+        char* base = nullptr;
+    };
+
+    GuardPool guardPool;
+
+    // 在普通的静态构造之前跑，之后才可能有分配
+    __attribute__((constructor(101))) void initFreelistKey()
+    {
+        uintptr_t key = 0;
+        if (getrandom(&key, sizeof(key), GRND_NONBLOCK) != static_cast<ssize_t>(sizeof(key)))
+        {
+            // 熵池还没准备好（很早启动的进程），退而用时间和pid
+            key = static_cast<uintptr_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+                  (static_cast<uintptr_t>(getpid()) << 32);
+        }
+        freelist_key = key & ~uintptr_t(7);
+    }
+
+    // 调用者持有guardPool.mutex
+    bool reserveGuardRegion()
+    {
+        if (guardPool.base != nullptr)
+        {
+            return true;
+        }
+        void* region = mmap(nullptr, GUARD_REGION_BYTES, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED)
+        {
+            return false;
+        }
+        guardPool.base = static_cast<char*>(region);
+        for (size_t i = 0; i < GUARD_SLOTS; ++i)
+        {
+            guardPool.queue[i] = static_cast<uint32_t>(i);
+        }
+        guardPool.head = 0;
+        guardPool.count = GUARD_SLOTS;
+        guard_region_begin.store(reinterpret_cast<uintptr_t>(region), std::memory_order_release);
+        return true;
+    }
+
+    size_t roundUpObject(size_t size)
+    {
+        return size == 0 ? 8 : (size + 7) & ~size_t(7);
+    }
+}
+
+void fail(const char* what, const void* ptr)
+{
+    std::fprintf(stderr, "[llt_memorypool] hardened check failed: %s (address %p)\n", what, ptr);
+    std::fflush(stderr);
+    std::abort();
+}
+
+size_t guardSampleRate()
+{
+    return sampleRate.load(std::memory_order_relaxed);
+}
+
+void setGuardSampleRate(size_t rate)
+{
+    sampleRate.store(rate, std::memory_order_relaxed);
+}
+
+void* guardedAllocate(size_t size)
+{
+    size_t rounded = roundUpObject(size);
+    if (rounded > GUARD_PAGE)
+    {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(guardPool.mutex);
+    if (!reserveGuardRegion() || guardPool.count == 0)
+    {
+        return nullptr;
+    }
+    uint32_t index = guardPool.queue[guardPool.head];
+    guardPool.head = (guardPool.head + 1) % GUARD_SLOTS;
+    guardPool.count--;
+    char* page = guardPool.base + index * GUARD_SLOT_BYTES;
+    if (mprotect(page, GUARD_PAGE, PROT_READ | PROT_WRITE) != 0)
+    {
+        // 槽放回队尾，本次走普通路径
+        guardPool.queue[(guardPool.head + guardPool.count) % GUARD_SLOTS] = index;
+        guardPool.count++;
+        return nullptr;
+    }
+    // 靠右放：越过对象末尾（按8字节取整）的第一个字节就落在保护页上
+    void* object = page + GUARD_PAGE - rounded;
+    guardPool.slots[index] = GuardSlot{object, size, true};
+    return object;
+}
+
+bool guardedDeallocate(void* ptr, size_t size)
+{
+    if (!isGuarded(ptr))
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(guardPool.mutex);
+    size_t index = static_cast<size_t>(static_cast<char*>(ptr) - guardPool.base) / GUARD_SLOT_BYTES;
+    GuardSlot& slot = guardPool.slots[index];
+    if (!slot.used)
+    {
+        fail("double free of guarded object", ptr);
+    }
+    if (slot.object != ptr)
+    {
+        fail("free of pointer not returned by allocate (guarded slot)", ptr);
+    }
+    if (roundUpObject(size) != roundUpObject(slot.size))
+    {
+        fail("sized free does not match allocation size (guarded slot)", ptr);
+    }
+    slot.used = false;
+    char* page = guardPool.base + index * GUARD_SLOT_BYTES;
+    // 物理页还给系统，整页不可访问，释放后使用直接段错误
+    madvise(page, GUARD_PAGE, MADV_DONTNEED);
+    mprotect(page, GUARD_PAGE, PROT_NONE);
+    guardPool.queue[(guardPool.head + guardPool.count) % GUARD_SLOTS] = static_cast<uint32_t>(index);
+    guardPool.count++;
+    return true;
+}
+
+size_t guardedSize(const void* ptr)
+{
+    if (!isGuarded(ptr))
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(guardPool.mutex);
+    size_t index = static_cast<size_t>(static_cast<const char*>(ptr) - guardPool.base) / GUARD_SLOT_BYTES;
+    const GuardSlot& slot = guardPool.slots[index];
+    return slot.used && slot.object == ptr ? roundUpObject(slot.size) : 0;
+}
+
+} // namespace hardening
+} // namespace llt_memoryPool
@@ -0,0 +1,210 @@
+#include "../include/Heap.h"
+#include "../include/PageCache.h"
+#include <cassert>
+
+namespace llt_memoryPool
+{
+
+namespace
+{
+    // 堆编号的占用情况，0号永远是默认堆
+    struct HeapRegistry
+    {
+        std::mutex mutex;
+        bool used[MAX_HEAPS] = {true};
+    };
+
+    HeapRegistry& heapRegistry()
+    {
+        static HeapRegistry* instance = internalNew<HeapRegistry>();
+        return *instance;
+    }
+}
+
+Heap& Heap::defaultHeap()
+{
+    // 不析构：退出阶段别的线程还可能在分配
+    static Heap* instance = new (internalAllocate(sizeof(Heap), alignof(Heap))) Heap(0, 0);
+    return *instance;
+}
+
+Heap* Heap::create(size_t limit)
+{
+    HeapRegistry& reg = heapRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (size_t id = 1; id < MAX_HEAPS; ++id)
+    {
+        if (!reg.used[id])
+        {
+            reg.used[id] = true;
+            LogInfo("[Heap:create] 新建堆%zu，上限 %zu 字节", id, limit);
+            return new (internalAllocate(sizeof(Heap), alignof(Heap))) Heap(id, limit);
+        }
+    }
+    LogWarn("[Heap:create] %zu 个堆编号都在用，新建失败", MAX_HEAPS);
+    return nullptr;
+}
+
+void Heap::destroy()
+{
+    if (id_ == 0)
+    {
+        LogError("[Heap:destroy] 默认堆不能销毁");
+        return;
+    }
+    size_t id = id_;
+    LogInfo("[Heap:destroy] 销毁堆%zu，已提交 %zu 字节", id, committed());
+    // 先让所有线程忘掉这个堆，编号空出来之前它们不会再碰到这里的任何东西
+    ThreadCache::dropHeapCaches(id);
+    this->~Heap();
+    internalFree(this);
+    HeapRegistry& reg = heapRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.used[id] = false;
+}
+
+Heap::Heap(size_t id, size_t limit) : id_(id), limit_(*this)
+{
+    limit_.setLimit(limit);
+}
+
+Heap::~Heap()
+{
+    // 中心缓存只释放自己的桶，span的元数据和地址空间都由页堆一起释放
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        if (CentralCache* central = centrals_[node].load(std::memory_order_acquire))
+        {
+            central->~CentralCache();
+            internalFree(central);
+        }
+    }
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        if (PageCache* page = pages_[node].load(std::memory_order_acquire))
+        {
+            page->~PageCache();
+            internalFree(page);
+        }
+    }
+}
+
+PageCache& Heap::createPageCache(size_t node)
+{
+    std::call_once(page_flags_[node], [this, node] {
+        void* memory = internalAllocate(sizeof(PageCache), alignof(PageCache));
+        pages_[node].store(new (memory) PageCache(*this, node), std::memory_order_release);
+    });
+    return *pages_[node].load(std::memory_order_acquire);
+}
+
+CentralCache& Heap::centralCache(size_t node)
+{
+    if (id_ == 0)
+    {
+        return CentralCache::getInstance(node);
+    }
+    CentralCache* central = centrals_[node].load(std::memory_order_acquire);
+    if (central == nullptr)
+    {
+        std::call_once(central_flags_[node], [this, node] {
+            void* memory = internalAllocate(sizeof(CentralCache), alignof(CentralCache));
+            centrals_[node].store(new (memory) CentralCache(*this, node), std::memory_order_release);
+        });
+        central = centrals_[node].load(std::memory_order_acquire);
+    }
+    return *central;
+}
+
+void Heap::setEmptySpanLimit(size_t count)
+{
+    empty_span_limit_.store(count, std::memory_order_relaxed);
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        if (CentralCache* central = centralCacheIfCreated(node))
+        {
+            central->setEmptySpanLimit(count);
+        }
+    }
+}
+
+CentralCache* Heap::centralCacheIfCreated(size_t node) const
+{
+    if (id_ == 0)
+    {
+        return CentralCache::getIfCreated(node);
+    }
+    return centrals_[node].load(std::memory_order_acquire);
+}
+
+HeapStats Heap::stats() const
+{
+    HeapStats stats;
+    stats.committed = committed();
+    stats.limit = limit();
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        if (PageCache* page = pageCacheIfCreated(node))
+        {
+            stats.free_bytes += page->freeBytes();
+            stats.reserved += page->reservedBytes();
+        }
+    }
+    stats.thread_caches = ThreadCache::liveCount(id_);
+    return stats;
+}
+
+size_t Heap::findNode(void* ptr, size_t hint) const
+{
+    // 拓扑可能被simulate()改小，所以遍历所有已经创建的页堆而不是nodeCount()
+    // 每个节点一段连续的地址空间，这里只是几次区间比较
+    if (hint < MAX_NUMA_NODES)
+    {
+        PageCache* cache = pageCacheIfCreated(hint);
+        if (cache != nullptr && cache->owns(ptr))
+        {
+            return hint;
+        }
+    }
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        PageCache* cache = pageCacheIfCreated(node);
+        if (node != hint && cache != nullptr && cache->owns(ptr))
+        {
+            return node;
+        }
+    }
+    return MAX_NUMA_NODES;
+}
+
+Span* Heap::largeSpanOf(void* ptr, size_t size)
+{
+    size_t node = findNode(ptr);
+    Span* span = node < MAX_NUMA_NODES ? pageCache(node).mapAddressToSpan(ptr) : nullptr;
+#if LLT_MEMPOOL_HARDENED
+    if (span == nullptr || span->start_address != ptr || !span->location || !span->large)
+    {
+        hardening::fail("free of pointer not returned by allocate (large object)", ptr);
+    }
+    if (span->num_pages != (size + PAGE_SIZE - 1) >> PageShift)
+    {
+        hardening::fail("sized free does not match allocation size (large object)", ptr);
+    }
+#else
+    assert(span != nullptr && span->start_address == ptr);
+    (void)size;
+#endif
+    return span;
+}
+
+void Heap::deallocateLarge(void* ptr, size_t size)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    Span* span = largeSpanOf(ptr, size);
+    pageCache(span->node).deallocateSpan(span, span->num_pages >= PageCache::LARGE_DECOMMIT_PAGES);
+}
+
+} // namespace llt_memoryPool
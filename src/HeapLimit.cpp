@@ -0,0 +1,145 @@
+#include "../include/HeapLimit.h"
+#include "../include/Heap.h"
+#include "../include/PageCache.h"
+#include <chrono>
+
+namespace llt_memoryPool
+{
+
+namespace
+{
+    // 本线程正在跑级联或回调，回调里再分配触发的压力事件直接忽略
+    thread_local bool inPressure = false;
+
+    // 回调抛异常也要复位
+    struct PressureScope
+    {
+        PressureScope() { inPressure = true; }
+        ~PressureScope() { inPressure = false; }
+    };
+
+    // 两次Approaching处理之间至少隔这么久
+    constexpr uint64_t APPROACHING_INTERVAL_NS = 10 * 1000 * 1000;
+
+    uint64_t nowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+}
+
+HeapLimit& HeapLimit::getInstance()
+{
+    return Heap::defaultHeap().limiter();
+}
+
+bool HeapLimit::tryCharge(size_t bytes)
+{
+    size_t limit = limit_.load(std::memory_order_relaxed);
+    if (limit == 0)
+    {
+        committed_.fetch_add(bytes, std::memory_order_relaxed);
+        return true;
+    }
+    size_t committed = committed_.load(std::memory_order_relaxed);
+    do
+    {
+        if (committed + bytes > limit)
+        {
+            return false;
+        }
+    } while (!committed_.compare_exchange_weak(committed, committed + bytes, std::memory_order_relaxed));
+    return true;
+}
+
+void HeapLimit::setCallback(PressureCallback callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    callback_ = std::move(callback);
+}
+
+size_t HeapLimit::releaseMemory(bool aggressive)
+{
+    // 1.当前线程：aggressive时整个缓存都还回去，否则每个等级留一批
+    // 线程退出阶段tls_cache_已经清空，这时不去新建实例
+    ThreadCache* self = ThreadCache::currentIfCreated(heap_.id());
+    if (self != nullptr)
+    {
+        self->trim(!aggressive);
+    }
+    // 2.别的线程的缓存只能请求，它们下一次操作时才归还
+    ThreadCache::requestTrimAll(heap_.id());
+    // 3.中心缓存批栈里的整批拆回span，空span回到PageCache
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        if (CentralCache* central = heap_.centralCacheIfCreated(node))
+        {
+            central->drainBatchStacks();
+            if (aggressive)
+            {
+                // 各等级特意留着的空span也还掉
+                central->releaseEmptySpans();
+            }
+        }
+    }
+    // 只是接近上限时到此为止：接近上限的进程可能每10ms就来一次，
+    // 每次都把空闲span还给系统的话，稳定状态下的分配会不停地重新缺页
+    if (!aggressive)
+    {
+        return 0;
+    }
+    // 4.PageCache里的空闲span全部madvise还给系统
+    size_t released = 0;
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        if (PageCache* page = heap_.pageCacheIfCreated(node))
+        {
+            released += page->releaseFreeSpans();
+        }
+    }
+    return released;
+}
+
+size_t HeapLimit::onPressure(PressureLevel level)
+{
+    if (inPressure)
+    {
+        return 0;
+    }
+    if (level == PressureLevel::Approaching)
+    {
+        uint64_t now = nowNs();
+        uint64_t last = last_approaching_ns_.load(std::memory_order_relaxed);
+        if (now - last < APPROACHING_INTERVAL_NS ||
+            !last_approaching_ns_.compare_exchange_strong(last, now, std::memory_order_relaxed))
+        {
+            return 0;
+        }
+    }
+    PressureScope scope;
+    size_t released = releaseMemory(level == PressureLevel::Exhausted);
+    PressureCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(callback_mutex_);
+        callback = callback_;
+    }
+    size_t committed = committed_.load(std::memory_order_relaxed);
+    size_t limit = limit_.load(std::memory_order_relaxed);
+    if (level == PressureLevel::Exhausted)
+    {
+        LogWarn("[HeapLimit:onPressure] 已提交 %zu / 上限 %zu 字节，级联回收还给系统 %zu 字节",
+                committed, limit, released);
+    }
+    else
+    {
+        LogInfo("[HeapLimit:onPressure] 接近上限：已提交 %zu / 上限 %zu 字节，级联回收还给系统 %zu 字节",
+                committed, limit, released);
+    }
+    if (callback)
+    {
+        callback(level, committed, limit);
+    }
+    return released;
+}
+
+} // namespace llt_memoryPool
@@ -0,0 +1,323 @@
+#include "../include/Instrument.h"
+#include "../include/Common.h"
+#include "../include/Numa.h"
+#include <algorithm>
+#include <vector>
+
+namespace llt_memoryPool
+{
+namespace instrument
+{
+
+namespace
+{
+    const char* const PATH_NAMES[] = {
+        "fetchFromCentralCache",
+        "allocateSpan",
+        "newSpan",
+        "deallocateSpan",
+    };
+
+    const char* const EVENT_NAMES[] = {
+        "batch stack pop",
+        "batch stack push",
+        "release to spans",
+        "foreign release",
+        "span returned",
+        "arena commit",
+        "decommit",
+        "trim request",
+        "coalesce pass",
+    };
+
+    const char* const LOCK_NAMES[] = {
+        "central bucket",
+        "page cache",
+    };
+
+    static_assert(sizeof(PATH_NAMES) / sizeof(PATH_NAMES[0]) == static_cast<size_t>(Path::Count), "");
+    static_assert(sizeof(EVENT_NAMES) / sizeof(EVENT_NAMES[0]) == static_cast<size_t>(Event::Count), "");
+    static_assert(sizeof(LOCK_NAMES) / sizeof(LOCK_NAMES[0]) == static_cast<size_t>(Lock::Count), "");
+
+    // 冲突最多的桶锁打印几个
+    constexpr size_t TOP_CENTRAL_LOCKS = 8;
+}
+
+#if LLT_MEMPOOL_INSTRUMENT
+
+std::atomic<uint64_t> events[static_cast<size_t>(Event::Count)];
+
+namespace
+{
+    Histogram path_histograms[static_cast<size_t>(Path::Count)];
+    Histogram wait_histograms[static_cast<size_t>(Lock::Count)];
+    Histogram hold_histograms[static_cast<size_t>(Lock::Count)];
+    // 桶锁按等级统计，不分节点：同一等级在各节点上的冲突一起看
+    LockStats central_locks[FREE_LIST_SIZE];
+    LockStats page_locks[MAX_NUMA_NODES];
+
+    void updateMax(std::atomic<uint64_t>& target, uint64_t value)
+    {
+        uint64_t current = target.load(std::memory_order_relaxed);
+        while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void resetLock(LockStats& stats)
+    {
+        stats.acquisitions.store(0, std::memory_order_relaxed);
+        stats.contended.store(0, std::memory_order_relaxed);
+        stats.wait_ns.store(0, std::memory_order_relaxed);
+        stats.hold_ns.store(0, std::memory_order_relaxed);
+    }
+
+    void addLock(LockSnapshot& out, const LockStats& stats)
+    {
+        out.acquisitions += stats.acquisitions.load(std::memory_order_relaxed);
+        out.contended += stats.contended.load(std::memory_order_relaxed);
+        out.wait_ns += stats.wait_ns.load(std::memory_order_relaxed);
+        out.hold_ns += stats.hold_ns.load(std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(uint64_t ns)
+{
+    size_t bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    bucket = std::min(bucket, HISTOGRAM_BUCKETS - 1);
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(ns, std::memory_order_relaxed);
+    updateMax(max_ns_, ns);
+}
+
+uint64_t Histogram::percentile(double fraction) const
+{
+    uint64_t total = count_.load(std::memory_order_relaxed);
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen > rank)
+        {
+            return (uint64_t(2) << i) - 1;
+        }
+    }
+    return max_ns_.load(std::memory_order_relaxed);
+}
+
+void Histogram::snapshot(PathSnapshot& out) const
+{
+    out.count = count_.load(std::memory_order_relaxed);
+    out.total_ns = total_ns_.load(std::memory_order_relaxed);
+    out.max_ns = max_ns_.load(std::memory_order_relaxed);
+    out.p50_ns = percentile(0.5);
+    out.p99_ns = percentile(0.99);
+}
+
+void Histogram::reset()
+{
+    for (auto& bucket : buckets_)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    total_ns_.store(0, std::memory_order_relaxed);
+    max_ns_.store(0, std::memory_order_relaxed);
+}
+
+LockStats* centralLock(size_t index)
+{
+    return &central_locks[index];
+}
+
+LockStats* pageLock(size_t node)
+{
+    return &page_locks[node];
+}
+
+void recordPath(Path path, uint64_t ns)
+{
+    path_histograms[static_cast<size_t>(path)].record(ns);
+}
+
+void recordLock(Lock kind, LockStats* stats, bool contended, uint64_t wait_ns, uint64_t hold_ns)
+{
+    stats->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    if (contended)
+    {
+        stats->contended.fetch_add(1, std::memory_order_relaxed);
+        stats->wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    }
+    stats->hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+    wait_histograms[static_cast<size_t>(kind)].record(wait_ns);
+    hold_histograms[static_cast<size_t>(kind)].record(hold_ns);
+}
+
+PathSnapshot pathSnapshot(Path path)
+{
+    PathSnapshot out;
+    path_histograms[static_cast<size_t>(path)].snapshot(out);
+    return out;
+}
+
+LockSnapshot lockSnapshot(Lock lock)
+{
+    LockSnapshot out;
+    if (lock == Lock::CentralBucket)
+    {
+        for (const LockStats& stats : central_locks)
+        {
+            addLock(out, stats);
+        }
+    }
+    else
+    {
+        for (const LockStats& stats : page_locks)
+        {
+            addLock(out, stats);
+        }
+    }
+    PathSnapshot wait;
+    PathSnapshot hold;
+    wait_histograms[static_cast<size_t>(lock)].snapshot(wait);
+    hold_histograms[static_cast<size_t>(lock)].snapshot(hold);
+    out.max_wait_ns = wait.max_ns;
+    out.max_hold_ns = hold.max_ns;
+    out.p99_wait_ns = wait.p99_ns;
+    out.p99_hold_ns = hold.p99_ns;
+    return out;
+}
+
+uint64_t eventCount(Event event)
+{
+    return events[static_cast<size_t>(event)].load(std::memory_order_relaxed);
+}
+
+void reset()
+{
+    for (Histogram& histogram : path_histograms)
+    {
+        histogram.reset();
+    }
+    for (size_t i = 0; i < static_cast<size_t>(Lock::Count); ++i)
+    {
+        wait_histograms[i].reset();
+        hold_histograms[i].reset();
+    }
+    for (LockStats& stats : central_locks)
+    {
+        resetLock(stats);
+    }
+    for (LockStats& stats : page_locks)
+    {
+        resetLock(stats);
+    }
+    for (auto& event : events)
+    {
+        event.store(0, std::memory_order_relaxed);
+    }
+}
+
+void dump(FILE* out)
+{
+    std::fprintf(out, "[mempool instrumentation]\n");
+    std::fprintf(out, "%-24s %12s %12s %12s %12s %12s\n", "path", "count", "avg(ns)", "p50(ns)", "p99(ns)", "max(ns)");
+    for (size_t i = 0; i < static_cast<size_t>(Path::Count); ++i)
+    {
+        PathSnapshot path = pathSnapshot(static_cast<Path>(i));
+        std::fprintf(out, "%-24s %12llu %12llu %12llu %12llu %12llu\n", PATH_NAMES[i],
+                     (unsigned long long)path.count,
+                     (unsigned long long)(path.count != 0 ? path.total_ns / path.count : 0),
+                     (unsigned long long)path.p50_ns, (unsigned long long)path.p99_ns,
+                     (unsigned long long)path.max_ns);
+    }
+
+    std::fprintf(out, "%-24s %12s %12s %12s %12s %12s %12s\n", "lock", "acquired", "contended",
+                 "wait(us)", "hold(us)", "p99 wait", "p99 hold");
+    for (size_t i = 0; i < static_cast<size_t>(Lock::Count); ++i)
+    {
+        LockSnapshot lock = lockSnapshot(static_cast<Lock>(i));
+        std::fprintf(out, "%-24s %12llu %12llu %12llu %12llu %12llu %12llu\n", LOCK_NAMES[i],
+                     (unsigned long long)lock.acquisitions, (unsigned long long)lock.contended,
+                     (unsigned long long)(lock.wait_ns / 1000), (unsigned long long)(lock.hold_ns / 1000),
+                     (unsigned long long)lock.p99_wait_ns, (unsigned long long)lock.p99_hold_ns);
+    }
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+    {
+        LockSnapshot lock;
+        addLock(lock, page_locks[node]);
+        if (lock.acquisitions != 0)
+        {
+            std::fprintf(out, "  page cache node %-7zu %12llu %12llu %12llu %12llu\n", node,
+                         (unsigned long long)lock.acquisitions, (unsigned long long)lock.contended,
+                         (unsigned long long)(lock.wait_ns / 1000), (unsigned long long)(lock.hold_ns / 1000));
+        }
+    }
+
+    // 等待时间最长的几个桶锁
+    std::vector<std::pair<uint64_t, size_t>> waits;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index)
+    {
+        uint64_t wait = central_locks[index].wait_ns.load(std::memory_order_relaxed);
+        if (wait != 0)
+        {
+            waits.emplace_back(wait, index);
+        }
+    }
+    size_t top = std::min(waits.size(), TOP_CENTRAL_LOCKS);
+    std::partial_sort(waits.begin(), waits.begin() + top, waits.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (size_t i = 0; i < top; ++i)
+    {
+        LockSnapshot lock;
+        addLock(lock, central_locks[waits[i].second]);
+        std::fprintf(out, "  class %6zuB %12s %12llu %12llu %12llu %12llu\n", SizeClass::getSize(waits[i].second), "",
+                     (unsigned long long)lock.acquisitions, (unsigned long long)lock.contended,
+                     (unsigned long long)(lock.wait_ns / 1000), (unsigned long long)(lock.hold_ns / 1000));
+    }
+
+    std::fprintf(out, "%-24s %12s\n", "event", "count");
+    for (size_t i = 0; i < static_cast<size_t>(Event::Count); ++i)
+    {
+        std::fprintf(out, "%-24s %12llu\n", EVENT_NAMES[i], (unsigned long long)eventCount(static_cast<Event>(i)));
+    }
+    std::fflush(out);
+}
+
+#else
+
+PathSnapshot pathSnapshot(Path)
+{
+    return PathSnapshot();
+}
+
+LockSnapshot lockSnapshot(Lock)
+{
+    return LockSnapshot();
+}
+
+uint64_t eventCount(Event)
+{
+    return 0;
+}
+
+void reset()
+{
+}
+
+void dump(FILE* out)
+{
+    std::fprintf(out, "[mempool instrumentation] disabled, rebuild with -DLLT_MEMPOOL_INSTRUMENT=ON\n");
+    std::fflush(out);
+}
+
+#endif
+
+} // namespace instrument
+} // namespace llt_memoryPool
@@ -0,0 +1,614 @@
+#include "../include/LocalHeap.h"
+#include "../include/Heap.h"
+#include "../include/Numa.h"
+#include "../include/PageCache.h"
+#include <sys/mman.h>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+
+namespace llt_memoryPool
+{
+
+namespace
+{
+    // 堆id单调递增，不复用：线程退出后新线程拿到的id一定不同，不会误认成段的主人
+    std::atomic<uint64_t> nextHeapId{1};
+
+    // 本线程的堆已经析构（线程退出过程中）
+    thread_local bool heapDestroyed = false;
+
+    // 慢路径里每次最多检查几个满页
+    constexpr size_t FULL_SCAN = 4;
+    // 每次扩展最多串多少字节的对象，免得新页一次就把整页都写一遍
+    constexpr size_t EXTEND_BYTES = 4096;
+
+    struct AbandonedList
+    {
+        std::mutex mutex;
+        LocalSegment* head = nullptr;
+        size_t count = 0;
+    };
+
+    // 不析构：分离线程可能在静态对象析构之后才退出
+    AbandonedList& abandoned()
+    {
+        static AbandonedList* instance = internalNew<AbandonedList>();
+        return *instance;
+    }
+
+    // 段头按页取整：第0页的对象和其他页一样从页边界开始排，等级大小是对齐数的倍数时对象就是对齐的
+    size_t headerBytes()
+    {
+        return (sizeof(LocalSegment) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    }
+}
+
+// 线程退出时销毁本线程的堆；堆本身用malloc申请，不占每个线程的静态TLS
+struct LocalHeapHolder
+{
+    ~LocalHeapHolder()
+    {
+        LocalHeap* heap = LocalHeap::tls_heap_;
+        if (heap != nullptr)
+        {
+            heap->~LocalHeap();
+            std::free(heap);
+        }
+    }
+};
+
+namespace
+{
+    thread_local LocalHeapHolder heapHolder;
+}
+
+LocalHeap::LocalHeap()
+    : id_(nextHeapId.fetch_add(1, std::memory_order_relaxed)),
+      node_(NumaTopology::getInstance().currentNode())
+{
+    pages_.fill(nullptr);
+    tls_heap_ = this;
+}
+
+LocalHeap* LocalHeap::createInstance()
+{
+    void* memory = std::malloc(sizeof(LocalHeap));
+    LocalHeap* heap = new (memory) LocalHeap();
+    if (!heapDestroyed)
+    {
+        // 第一次用到时才注册析构
+        (void)&heapHolder;
+        return heap;
+    }
+    // 线程退出阶段（别的thread_local析构函数里）又用到了：构造函数已经把它挂上tls_heap_，之后的调用直接复用
+    // pthread键的析构在所有thread_local析构之后，那时再析构它，空段unmap、还有对象的段遗弃
+    struct ExitHeap
+    {
+        static void destroy(void* value)
+        {
+            LocalHeap* exitHeap = static_cast<LocalHeap*>(value);
+            exitHeap->~LocalHeap();
+            std::free(exitHeap);
+        }
+    };
+    static pthread_key_t key = [] {
+        pthread_key_t k;
+        pthread_key_create(&k, &ExitHeap::destroy);
+        return k;
+    }();
+    pthread_setspecific(key, heap);
+    return heap;
+}
+
+LocalHeap::~LocalHeap()
+{
+    LocalSegment* segment = segments_;
+    while (segment != nullptr)
+    {
+        LocalSegment* next = segment->next;
+        for (size_t i = 0; i < segment->page_count; ++i)
+        {
+            LocalPage* page = &segment->pages[i];
+            if (!page->in_use)
+            {
+                continue;
+            }
+            collect(page);
+            if (page->used == 0)
+            {
+                page->in_use = false;
+                segment->used_pages--;
+            }
+            page->next = nullptr;
+            page->prev = nullptr;
+            page->in_full = false;
+        }
+        if (segment->used_pages == 0)
+        {
+            segment->~LocalSegment();
+            munmap(segment, LOCAL_SEGMENT_SIZE);
+            HeapLimit::getInstance().uncharge(LOCAL_SEGMENT_SIZE);
+        }
+        else
+        {
+            // 还有对象在别的线程手里：遗弃，它们的释放照样CAS到页上，等别的堆来接管
+            segment->owner.store(0, std::memory_order_release);
+            AbandonedList& list = abandoned();
+            std::lock_guard<std::mutex> lock(list.mutex);
+            segment->prev = nullptr;
+            segment->next = list.head;
+            list.head = segment;
+            list.count++;
+        }
+        segment = next;
+    }
+    segments_ = nullptr;
+    tls_heap_ = nullptr;
+    heapDestroyed = true;
+}
+
+size_t LocalHeap::abandonedCount()
+{
+    AbandonedList& list = abandoned();
+    std::lock_guard<std::mutex> lock(list.mutex);
+    return list.count;
+}
+
+void* LocalHeap::allocateLarge(size_t size)
+{
+    return PageCache::getInstance(node_).allocateLarge(size);
+}
+
+void LocalHeap::deallocateLarge(void* ptr, size_t size)
+{
+    Heap::defaultHeap().deallocateLarge(ptr, size);
+}
+
+void* LocalHeap::allocateSlow(size_t index)
+{
+    LocalPage* page = findFreePage(index);
+    if (page == nullptr)
+    {
+        page = newPage(index);
+    }
+    if (page == nullptr)
+    {
+        // 上限内拿不到新段：跑一遍压力回收（回调里可能释放本引擎的对象），再试一次
+        HeapLimit::getInstance().onPressure(PressureLevel::Exhausted);
+        page = findFreePage(index);
+        if (page == nullptr)
+        {
+            page = newPage(index);
+        }
+        if (page == nullptr)
+        {
+            LogWarn("[LocalHeap:allocateSlow] 等级%zu 分配失败", index);
+            return nullptr;
+        }
+    }
+    void* ptr = page->free;
+    page->free = loadNext(ptr);
+    page->used++;
+    return ptr;
+}
+
+void LocalHeap::freeSlow(LocalPage* page)
+{
+    if (page->in_full)
+    {
+        // 满页又有了空闲对象，放回等级队列
+        fullRemove(page);
+        queuePushFront(page);
+    }
+    if (page->used == 0)
+    {
+        // 等级里只剩这一页就留着，免得下一次分配马上又要拿新页
+        if (pages_[page->size_class] == page && page->next == nullptr)
+        {
+            return;
+        }
+        queueRemove(page);
+        retirePage(page);
+    }
+}
+
+void LocalHeap::remoteFree(LocalPage* page, void* ptr)
+{
+    uintptr_t head = page->thread_free.load(std::memory_order_relaxed);
+    do
+    {
+        storeNext(ptr, reinterpret_cast<void*>(head));
+    } while (!page->thread_free.compare_exchange_weak(head, reinterpret_cast<uintptr_t>(ptr),
+                                                     std::memory_order_release, std::memory_order_relaxed));
+}
+
+void LocalHeap::collect(LocalPage* page)
+{
+    if (page->local_free != nullptr)
+    {
+        if (page->free == nullptr)
+        {
+            page->free = page->local_free;
+        }
+        else
+        {
+            void* tail = page->local_free;
+            while (void* next = loadNext(tail))
+            {
+                tail = next;
+            }
+            storeNext(tail, page->free);
+            page->free = page->local_free;
+        }
+        page->local_free = nullptr;
+    }
+    uintptr_t remote = page->thread_free.exchange(0, std::memory_order_acquire);
+    if (remote != 0)
+    {
+        // 别的线程释放的对象还没从used里扣掉，数一遍
+        void* head = reinterpret_cast<void*>(remote);
+        void* tail = head;
+        size_t count = 1;
+        while (void* next = loadNext(tail))
+        {
+            tail = next;
+            count++;
+        }
+        storeNext(tail, page->free);
+        page->free = head;
+        page->used -= count;
+    }
+}
+
+void LocalHeap::extend(LocalPage* page)
+{
+    size_t count = std::max(size_t(1), EXTEND_BYTES / page->block_size);
+    count = std::min(count, page->reserved - page->capacity);
+    char* base = page->start + page->capacity * page->block_size;
+    // 按地址顺序串起来，接在（空的）free前面
+    void* head = page->free;
+    for (size_t i = count; i > 0; --i)
+    {
+        void* block = base + (i - 1) * page->block_size;
+        storeNext(block, head);
+        head = block;
+    }
+    page->free = head;
+    page->capacity += count;
+}
+
+LocalPage* LocalHeap::findFreePage(size_t index)
+{
+    LocalPage* page = pages_[index];
+    while (page != nullptr)
+    {
+        LocalPage* next = page->next;
+        if (page->free == nullptr)
+        {
+            collect(page);
+        }
+        if (page->free == nullptr && page->capacity < page->reserved)
+        {
+            extend(page);
+        }
+        if (page->free != nullptr)
+        {
+            if (page != pages_[index])
+            {
+                queueRemove(page);
+                queuePushFront(page);
+            }
+            return page;
+        }
+        // 真满了，挪出等级队列，下次慢路径不再扫它
+        queueRemove(page);
+        fullPush(page);
+        page = next;
+    }
+
+    // 满页只有别的线程释放时才会重新有空位，每次看队头几个，看过的挪到队尾轮转
+    LocalPage* found = nullptr;
+    for (size_t i = 0; i < FULL_SCAN && full_ != nullptr; ++i)
+    {
+        page = full_;
+        fullRemove(page);
+        if (page->thread_free.load(std::memory_order_relaxed) != 0)
+        {
+            collect(page);
+            queuePushFront(page);
+            if (page->size_class == index)
+            {
+                found = page;
+            }
+        }
+        else
+        {
+            fullPush(page);
+        }
+    }
+    if (found != nullptr && pages_[index] != found)
+    {
+        queueRemove(found);
+        queuePushFront(found);
+    }
+    return found;
+}
+
+LocalPage* LocalHeap::newPage(size_t index)
+{
+    size_t page_shift = SizeClass::getSize(index) <= LOCAL_SMALL_BLOCK_MAX ? LOCAL_SMALL_PAGE_SHIFT
+                                                                           : LOCAL_LARGE_PAGE_SHIFT;
+    for (LocalSegment* segment = segments_; segment != nullptr; segment = segment->next)
+    {
+        if (segment->page_shift == page_shift && segment->used_pages < segment->page_count)
+        {
+            return takeFreePage(segment, index);
+        }
+    }
+    // 先接管遗弃的段：里面可能已经有这个等级、而且被释放过的页
+    if (LocalSegment* segment = adoptSegment(page_shift))
+    {
+        if (LocalPage* page = findFreePage(index))
+        {
+            return page;
+        }
+        if (segment->used_pages < segment->page_count)
+        {
+            return takeFreePage(segment, index);
+        }
+    }
+    if (LocalSegment* segment = newSegment(page_shift))
+    {
+        return takeFreePage(segment, index);
+    }
+    return nullptr;
+}
+
+LocalPage* LocalHeap::takeFreePage(LocalSegment* segment, size_t index)
+{
+    for (size_t i = 0; i < segment->page_count; ++i)
+    {
+        LocalPage* page = &segment->pages[i];
+        if (page->in_use)
+        {
+            continue;
+        }
+        char* page_begin = reinterpret_cast<char*>(segment) + (i << segment->page_shift);
+        char* page_end = page_begin + (size_t(1) << segment->page_shift);
+        // 第0页的开头是段头
+        page->start = i == 0 ? reinterpret_cast<char*>(segment) + headerBytes() : page_begin;
+        page->block_size = SizeClass::getSize(index);
+        page->size_class = index;
+        page->reserved = static_cast<size_t>(page_end - page->start) / page->block_size;
+        page->capacity = 0;
+        page->used = 0;
+        page->free = nullptr;
+        page->local_free = nullptr;
+        page->thread_free.store(0, std::memory_order_relaxed);
+        page->in_use = true;
+        page->in_full = false;
+        segment->used_pages++;
+        extend(page);
+        queuePushFront(page);
+        return page;
+    }
+    return nullptr;
+}
+
+LocalSegment* LocalHeap::newSegment(size_t page_shift)
+{
+    HeapLimit& heapLimit = HeapLimit::getInstance();
+    if (!heapLimit.tryCharge(LOCAL_SEGMENT_SIZE))
+    {
+        return nullptr;
+    }
+    // 多申请一个段的大小，截出按段大小对齐的那一块
+    size_t map_size = LOCAL_SEGMENT_SIZE * 2;
+    void* raw = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        heapLimit.uncharge(LOCAL_SEGMENT_SIZE);
+        LogError("[LocalHeap:newSegment] mmap %zu 字节失败", map_size);
+        return nullptr;
+    }
+    uintptr_t begin = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = (begin + LOCAL_SEGMENT_SIZE - 1) & ~(LOCAL_SEGMENT_SIZE - 1);
+    if (aligned > begin)
+    {
+        munmap(raw, aligned - begin);
+    }
+    uintptr_t end = begin + map_size;
+    if (end > aligned + LOCAL_SEGMENT_SIZE)
+    {
+        munmap(reinterpret_cast<void*>(aligned + LOCAL_SEGMENT_SIZE), end - aligned - LOCAL_SEGMENT_SIZE);
+    }
+    NumaTopology::getInstance().bindToNode(reinterpret_cast<void*>(aligned), LOCAL_SEGMENT_SIZE, node_);
+    LocalSegment* segment = new (reinterpret_cast<void*>(aligned)) LocalSegment();
+    segment->page_shift = page_shift;
+    segment->page_count = LOCAL_SEGMENT_SIZE >> page_shift;
+    segment->node = node_;
+    segment->owner.store(id_, std::memory_order_relaxed);
+    segmentPush(segment);
+    LogInfo("[LocalHeap:newSegment] 堆%llu 新段 %p，页大小 %zu",
+            static_cast<unsigned long long>(id_), segment, size_t(1) << page_shift);
+    return segment;
+}
+
+LocalSegment* LocalHeap::adoptSegment(size_t page_shift)
+{
+    LocalSegment* segment = nullptr;
+    {
+        AbandonedList& list = abandoned();
+        std::lock_guard<std::mutex> lock(list.mutex);
+        LocalSegment* prev = nullptr;
+        for (segment = list.head; segment != nullptr; prev = segment, segment = segment->next)
+        {
+            if (segment->page_shift == page_shift)
+            {
+                if (prev != nullptr)
+                {
+                    prev->next = segment->next;
+                }
+                else
+                {
+                    list.head = segment->next;
+                }
+                list.count--;
+                break;
+            }
+        }
+    }
+    if (segment == nullptr)
+    {
+        return nullptr;
+    }
+    // 之后本线程的释放走本地路径，别的线程照样CAS
+    segment->owner.store(id_, std::memory_order_relaxed);
+    segmentPush(segment);
+    for (size_t i = 0; i < segment->page_count; ++i)
+    {
+        LocalPage* page = &segment->pages[i];
+        if (!page->in_use)
+        {
+            continue;
+        }
+        collect(page);
+        if (page->used == 0)
+        {
+            page->in_use = false;
+            segment->used_pages--;
+            continue;
+        }
+        queuePushFront(page);
+    }
+    LogInfo("[LocalHeap:adoptSegment] 堆%llu 接管遗弃段 %p，%zu 页仍在使用",
+            static_cast<unsigned long long>(id_), segment, segment->used_pages);
+    return segment;
+}
+
+void LocalHeap::retirePage(LocalPage* page)
+{
+    LocalSegment* segment = segmentOf(page);
+    page->in_use = false;
+    page->free = nullptr;
+    page->local_free = nullptr;
+    segment->used_pages--;
+    // 至少留一个段，反复分配释放时不用每次都mmap
+    if (segment->used_pages == 0 && segment_count_ > 1)
+    {
+        releaseSegment(segment);
+    }
+}
+
+void LocalHeap::releaseSegment(LocalSegment* segment)
+{
+    segmentRemove(segment);
+    segment->~LocalSegment();
+    munmap(segment, LOCAL_SEGMENT_SIZE);
+    HeapLimit::getInstance().uncharge(LOCAL_SEGMENT_SIZE);
+}
+
+void LocalHeap::queuePushFront(LocalPage* page)
+{
+    LocalPage*& head = pages_[page->size_class];
+    page->prev = nullptr;
+    page->next = head;
+    if (head != nullptr)
+    {
+        head->prev = page;
+    }
+    head = page;
+}
+
+void LocalHeap::queueRemove(LocalPage* page)
+{
+    if (page->prev != nullptr)
+    {
+        page->prev->next = page->next;
+    }
+    else
+    {
+        pages_[page->size_class] = page->next;
+    }
+    if (page->next != nullptr)
+    {
+        page->next->prev = page->prev;
+    }
+    page->next = nullptr;
+    page->prev = nullptr;
+}
+
+void LocalHeap::fullPush(LocalPage* page)
+{
+    // 插到队尾，慢路径从队头检查，看过的再插回队尾，轮流检查
+    page->in_full = true;
+    page->next = nullptr;
+    page->prev = full_tail_;
+    if (full_tail_ != nullptr)
+    {
+        full_tail_->next = page;
+    }
+    else
+    {
+        full_ = page;
+    }
+    full_tail_ = page;
+}
+
+void LocalHeap::fullRemove(LocalPage* page)
+{
+    page->in_full = false;
+    if (page->prev != nullptr)
+    {
+        page->prev->next = page->next;
+    }
+    else
+    {
+        full_ = page->next;
+    }
+    if (page->next != nullptr)
+    {
+        page->next->prev = page->prev;
+    }
+    else
+    {
+        full_tail_ = page->prev;
+    }
+    page->next = nullptr;
+    page->prev = nullptr;
+}
+
+void LocalHeap::segmentPush(LocalSegment* segment)
+{
+    segment->prev = nullptr;
+    segment->next = segments_;
+    if (segments_ != nullptr)
+    {
+        segments_->prev = segment;
+    }
+    segments_ = segment;
+    segment_count_++;
+}
+
+void LocalHeap::segmentRemove(LocalSegment* segment)
+{
+    if (segment->prev != nullptr)
+    {
+        segment->prev->next = segment->next;
+    }
+    else
+    {
+        segments_ = segment->next;
+    }
+    if (segment->next != nullptr)
+    {
+        segment->next->prev = segment->prev;
+    }
+    segment->next = nullptr;
+    segment->prev = nullptr;
+    segment_count_--;
+}
+
+} // namespace llt_memoryPool
@@ -0,0 +1,258 @@
+#include "../include/MemoryPool.h"
+#include "../include/PageCache.h"
+#include "../include/CentralCache.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace llt_memoryPool
+{
+
+void* MemoryPool::allocateZeroed(size_t size)
+{
+    // 整页的span交给调用者时知道它们是不是零；清零大表时省掉一遍缺页和内存带宽
+#if LLT_MEMPOOL_PAGE_LOCAL
+    if (size > MAX_BYTES)
+    {
+        size_t node = LocalHeap::getInstance()->node();
+        bool zeroed = false;
+        void* ptr = PageCache::getInstance(node).allocateLarge(size, &zeroed);
+#else
+    // 三层引擎里中等对象也是整页的span；从本线程的中等对象缓存拿到的是用过的，照样清零
+    if (size > MEDIUM_BYTES)
+    {
+        bool zeroed = false;
+        void* ptr = ThreadCache::getInstance()->allocatePages(size, &zeroed);
+#endif
+        if (ptr != nullptr && !zeroed)
+        {
+            std::memset(ptr, 0, size);
+        }
+        if (ptr != nullptr)
+        {
+            trace::onAllocate(ptr, size);
+        }
+        return ptr;
+    }
+    // 小对象的链表指针就写在对象里，一定要清
+    void* ptr = allocate(size);
+    if (ptr != nullptr)
+    {
+        std::memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+size_t MemoryPool::usableSize(void* ptr)
+{
+    if (ptr == nullptr)
+    {
+        return 0;
+    }
+#if LLT_MEMPOOL_HARDENED
+    if (size_t guarded = hardening::guardedSize(ptr))
+    {
+        return guarded;
+    }
+#endif
+    // 大对象两种引擎都在页堆里；三层引擎的小对象也在，按span的等级算
+    size_t node = PageCache::findNode(ptr);
+    if (node < MAX_NUMA_NODES)
+    {
+        Span* span = PageCache::getInstance(node).mapAddressToSpan(ptr);
+        if (span == nullptr || !span->location)
+        {
+            return 0;
+        }
+        return span->large ? span->num_pages * PAGE_SIZE : SizeClass::getSize(span->size_class);
+    }
+#if LLT_MEMPOOL_PAGE_LOCAL
+    // 页本地引擎的段按4MB对齐，段头里就有页的块大小
+    LocalSegment* segment = LocalHeap::segmentOf(ptr);
+    return LocalHeap::pageOf(segment, ptr)->block_size;
+#else
+    return 0;
+#endif
+}
+
+size_t MemoryPool::trimThreadCaches()
+{
+    return ThreadCache::requestTrimAll();
+}
+
+void MemoryPool::trimCurrentThread()
+{
+    ThreadCache::getInstance()->trim();
+}
+
+void MemoryPool::setTrimThreshold(size_t bytes)
+{
+    PageCache::setTrimThreshold(bytes);
+}
+
+void MemoryPool::setEmptySpanLimit(size_t count)
+{
+    Heap::defaultHeap().setEmptySpanLimit(count);
+}
+
+void MemoryPool::setHeapLimit(size_t bytes)
+{
+    Heap::defaultHeap().setLimit(bytes);
+}
+
+size_t MemoryPool::heapLimit()
+{
+    return Heap::defaultHeap().limit();
+}
+
+size_t MemoryPool::committedBytes()
+{
+    return Heap::defaultHeap().committed();
+}
+
+void MemoryPool::setPressureCallback(PressureCallback callback)
+{
+    Heap::defaultHeap().setPressureCallback(std::move(callback));
+}
+
+size_t MemoryPool::releaseMemory()
+{
+    return Heap::defaultHeap().releaseMemory();
+}
+
+size_t MemoryPool::reserve(size_t size, size_t count, bool fillThreadCache)
+{
+    if (size == 0)
+    {
+        size = ALIGNMENT;
+    }
+    if (size > MAX_BYTES || count == 0)
+    {
+        return 0;
+    }
+#if LLT_MEMPOOL_PAGE_LOCAL
+    // 页本地引擎的页只属于一个线程，没有共享的一层可以预留：
+    // 在调用线程的堆里分配一遍再释放，页留在堆里，物理页也已经缺页进来了
+    (void)fillThreadCache;
+    LocalHeap* heap = LocalHeap::getInstance();
+    std::vector<void*> objects;
+    objects.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        void* ptr = heap->allocate(size);
+        if (ptr == nullptr)
+        {
+            break;
+        }
+        objects.push_back(ptr);
+    }
+    for (auto it = objects.rbegin(); it != objects.rend(); ++it)
+    {
+        LocalHeap::deallocate(*it, size);
+    }
+    return objects.size();
+#else
+    if (size > MEDIUM_BYTES)
+    {
+        // 中等对象不经过中心缓存，没有等级可以预留
+        return 0;
+    }
+    size_t index = SizeClass::getIndex(size);
+    ThreadCache* cache = ThreadCache::getInstance();
+    size_t available = CentralCache::getInstance(cache->node()).reserve(index, count);
+    if (fillThreadCache)
+    {
+        cache->prefill(index, count);
+    }
+    LogInfo("[MemoryPool:reserve] 等级%zu 预留 %zu 个，可用 %zu 个", index, count, available);
+    return available;
+#endif
+}
+
+size_t MemoryPool::reserve(const std::vector<ReserveEntry>& profile, bool fillThreadCache)
+{
+    size_t total = 0;
+    for (const ReserveEntry& entry : profile)
+    {
+        total += reserve(entry.size, entry.count, fillThreadCache);
+    }
+    return total;
+}
+
+size_t MemoryPool::reserveProfile(const char* profile, bool fillThreadCache)
+{
+    if (profile == nullptr)
+    {
+        profile = std::getenv("LLT_MEMPOOL_RESERVE");
+        if (profile == nullptr)
+        {
+            return 0;
+        }
+    }
+    std::vector<ReserveEntry> entries;
+    const char* p = profile;
+    while (*p != '\0')
+    {
+        char* end = nullptr;
+        unsigned long long size = std::strtoull(p, &end, 10);
+        if (end != p && *end == ':')
+        {
+            const char* countBegin = end + 1;
+            unsigned long long count = std::strtoull(countBegin, &end, 10);
+            if (end != countBegin && (*end == ',' || *end == '\0'))
+            {
+                entries.push_back(ReserveEntry{static_cast<size_t>(size), static_cast<size_t>(count)});
+                p = *end == ',' ? end + 1 : end;
+                continue;
+            }
+        }
+        // 跳过这一项
+        const char* comma = p;
+        while (*comma != '\0' && *comma != ',')
+        {
+            ++comma;
+        }
+        LogWarn("[MemoryPool:reserveProfile] 无法解析的预留项: %.*s", static_cast<int>(comma - p), p);
+        p = *comma == ',' ? comma + 1 : comma;
+    }
+    return reserve(entries, fillThreadCache);
+}
+
+void MemoryPool::setGuardSampleRate(size_t n)
+{
+    hardening::setGuardSampleRate(n);
+#if LLT_MEMPOOL_HARDENED
+    ThreadCache::getInstance()->resetGuardCountdown();
+#endif
+}
+
+bool MemoryPool::startTrace(const char* path, size_t maxRecords)
+{
+    return trace::start(path, maxRecords);
+}
+
+size_t MemoryPool::stopTrace()
+{
+    return trace::stop();
+}
+
+bool MemoryPool::startStatsExport(unsigned intervalMs)
+{
+    return stats::start(intervalMs);
+}
+
+void MemoryPool::stopStatsExport()
+{
+    stats::stop();
+}
+
+void MemoryPool::dumpInstrumentation(FILE* out)
+{
+    instrument::dump(out);
+}
+
+void MemoryPool::resetInstrumentation()
+{
+    instrument::reset();
+}
+
+} // namespace llt_memoryPool
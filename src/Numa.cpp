@@ -0,0 +1,86 @@
+#include "../include/Numa.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace llt_memoryPool
+{
+    // 不依赖libnuma，直接走系统调用，常量取自<numaif.h>
+    static const int MPOL_PREFERRED_MODE = 1;
+
+    // 解析"0"、"0-1"、"0,2-3"这种格式，返回最大节点号+1
+    static size_t parseNodeList(const std::string& text)
+    {
+        size_t max_node=0;
+        size_t value=0;
+        bool has_digit=false;
+        for(char c:text)
+        {
+            if(c>='0'&&c<='9')
+            {
+                value=value*10+static_cast<size_t>(c-'0');
+                has_digit=true;
+            }
+            else
+            {
+                if(has_digit) max_node=std::max(max_node,value);
+                value=0;
+                has_digit=false;
+            }
+        }
+        if(has_digit) max_node=std::max(max_node,value);
+        return max_node+1;
+    }
+
+    NumaTopology::NumaTopology()
+    {
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string line;
+        if(in&&std::getline(in,line)&&!line.empty())
+        {
+            node_count_.store(std::min(parseNodeList(line),MAX_NUMA_NODES),std::memory_order_relaxed);
+        }
+        if(const char* env=std::getenv("LLT_MEMPOOL_NUMA_NODES"))
+        {
+            size_t nodes=static_cast<size_t>(std::strtoul(env,nullptr,10));
+            if(nodes>0) simulate(nodes);
+        }
+    }
+
+    void NumaTopology::simulate(size_t nodes)
+    {
+        nodes=std::max(size_t(1),std::min(nodes,MAX_NUMA_NODES));
+        node_count_.store(nodes,std::memory_order_relaxed);
+        simulated_.store(true,std::memory_order_relaxed);
+    }
+
+    size_t NumaTopology::currentNode()
+    {
+        size_t count=nodeCount();
+        if(count<=1) return 0;
+        if(isSimulated())
+        {
+            return next_sim_node_.fetch_add(1,std::memory_order_relaxed)%count;
+        }
+        unsigned cpu=0;
+        unsigned node=0;
+        if(syscall(SYS_getcpu,&cpu,&node,nullptr)!=0)
+        {
+            return 0;
+        }
+        return node<count?node:0;
+    }
+
+    bool NumaTopology::bindToNode(void* addr, size_t len, size_t node)
+    {
+        if(isSimulated()||nodeCount()<=1) return false;
+        unsigned long mask=1UL<<node;
+        // PREFERRED而不是BIND：节点内存耗尽时退回到其他节点，而不是直接OOM
+        // maxnode按内核约定是位数+1
+        return syscall(SYS_mbind,addr,len,MPOL_PREFERRED_MODE,&mask,sizeof(mask)*8+1,0)==0;
+    }
+
+} // namespace llt_memoryPool
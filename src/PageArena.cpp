@@ -0,0 +1,124 @@
+#include "../include/PageArena.h"
+#include <sys/mman.h>
+
+namespace llt_memoryPool
+{
+
+PageArena::~PageArena()
+{
+    size_t count = chunk_count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+        munmap(reinterpret_cast<void*>(chunks_[i].base), chunks_[i].bytes);
+        munmap(chunks_[i].pagemap, (chunks_[i].bytes >> PageShift) * sizeof(std::atomic<Span*>));
+    }
+}
+
+bool PageArena::reserveChunk(size_t minBytes)
+{
+    size_t count = chunk_count_.load(std::memory_order_relaxed);
+    if (count == ARENA_MAX_CHUNKS)
+    {
+        LogError("[PageArena:reserveChunk] 已经预留了 %zu 块地址空间，不能再追加", count);
+        return false;
+    }
+    size_t bytes = ARENA_RESERVE_BYTES;
+    void* region = MAP_FAILED;
+    while (true)
+    {
+        if (bytes < minBytes)
+        {
+            bytes = (minBytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        }
+        // 只占地址空间：PROT_NONE + NORESERVE不算进overcommit
+        region = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region != MAP_FAILED || bytes <= ARENA_MIN_RESERVE_BYTES || bytes == minBytes)
+        {
+            break;
+        }
+        bytes /= 2;
+    }
+    if (region == MAP_FAILED)
+    {
+        LogError("[PageArena:reserveChunk] 预留 %zu 字节地址空间失败", bytes);
+        return false;
+    }
+    // 映射表每页一个指针，同样只在写到的地方才有物理页
+    size_t map_bytes = (bytes >> PageShift) * sizeof(std::atomic<Span*>);
+    void* pagemap = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pagemap == MAP_FAILED)
+    {
+        munmap(region, bytes);
+        LogError("[PageArena:reserveChunk] 映射表 %zu 字节申请失败", map_bytes);
+        return false;
+    }
+    Chunk& chunk = chunks_[count];
+    chunk.base = reinterpret_cast<uintptr_t>(region);
+    chunk.bytes = bytes;
+    chunk.used.store(0, std::memory_order_relaxed);
+    // 匿名映射本来就是0，也就是nullptr
+    chunk.pagemap = static_cast<std::atomic<Span*>*>(pagemap);
+    chunk_count_.store(count + 1, std::memory_order_release);
+    LogInfo("[PageArena:reserveChunk] 第%zu块：预留 %zu MB地址空间，地址: %p", count, bytes >> 20, region);
+    return true;
+}
+
+void* PageArena::commit(size_t numPages)
+{
+    size_t bytes = numPages * PAGE_SIZE;
+    size_t count = chunk_count_.load(std::memory_order_relaxed);
+    // 只从最后一块往后切，前面的块剩下的零头不要了
+    if (count == 0 || chunks_[count - 1].bytes - chunks_[count - 1].used.load(std::memory_order_relaxed) < bytes)
+    {
+        if (!reserveChunk(bytes))
+        {
+            return nullptr;
+        }
+        count++;
+    }
+    Chunk& chunk = chunks_[count - 1];
+    size_t used = chunk.used.load(std::memory_order_relaxed);
+    char* address = reinterpret_cast<char*>(chunk.base + used);
+    if (mprotect(address, bytes, PROT_READ | PROT_WRITE) != 0)
+    {
+        LogError("[PageArena:commit] mprotect %zu 页失败", numPages);
+        return nullptr;
+    }
+    chunk.used.store(used + bytes, std::memory_order_relaxed);
+    return address;
+}
+
+void PageArena::assign(void* start, size_t numPages, Span* span)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(start);
+    const Chunk* chunk = findChunk(address);
+    size_t first = (address - chunk->base) >> PageShift;
+    for (size_t i = 0; i < numPages; ++i)
+    {
+        chunk->pagemap[first + i].store(span, std::memory_order_release);
+    }
+}
+
+size_t PageArena::reservedBytes() const
+{
+    size_t total = 0;
+    size_t count = chunk_count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+        total += chunks_[i].bytes;
+    }
+    return total;
+}
+
+size_t PageArena::committedBytes() const
+{
+    size_t total = 0;
+    size_t count = chunk_count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+        total += chunks_[i].used.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+} // namespace llt_memoryPool
@@ -1,6 +1,16 @@
 #include "../include/PageCache.h"
+#include "../include/Heap.h"
+#include "../include/Instrument.h"
+#include <cassert>
 #include <sys/mman.h>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+
+// Linux 5.14加入，老的头文件里没有；内核不支持时madvise返回EINVAL，退回逐页写
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
 
 namespace llt_memoryPool
 {
@@ -11,155 +21,522 @@ namespace llt_memoryPool
         return span->start_address;
     }
 
-    Span* PageCache::mapAddressToSpan(void* ptr)
-    { 
-        std::lock_guard<std::mutex> lock(mutex_);
-        size_t page_id=reinterpret_cast<size_t>(ptr)>>PageShift;
-        auto it=span_map_.find(page_id);
-        if(it!=span_map_.end())
+    std::atomic<size_t> PageCache::mapped_bytes_{0};
+    std::atomic<size_t> PageCache::trim_threshold_{0};
+
+    PageCache& PageCache::getInstance(size_t node)
+    {
+        return Heap::defaultHeap().pageCache(node);
+    }
+
+    PageCache* PageCache::getIfCreated(size_t node)
+    {
+        return Heap::defaultHeap().pageCacheIfCreated(node);
+    }
+
+    size_t PageCache::findNode(void* ptr, size_t hint)
+    {
+        return Heap::defaultHeap().findNode(ptr,hint);
+    }
+
+    PageCache::~PageCache()
+    {
+        // 交出去的span（中心缓存、线程缓存和用户手里的）和空闲的一样，都只剩元数据要释放
+        arena_.forEachSpan([](Span* span)
         {
-            return it->second;
-        }
-        else {
-            return nullptr;
-        }
+#if LLT_MEMPOOL_HARDENED
+            free(span->alloc_bitmap);
+#endif
+            internalDelete(span);
+        });
+        mapped_bytes_.fetch_sub(arena_.committedBytes(),std::memory_order_relaxed);
     }
 
     Span* PageCache::allocateSpan(size_t numPages)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        SpanList* sp=nullptr;
+        instrument::PathTimer timer(instrument::Path::AllocateSpan);
+        bool wantTrim=false;
         Span* span=nullptr;
-        if(!free_lists_[numPages-1].empty())
         {
-            sp=&free_lists_[numPages-1];
-            span=sp->begin();
-            free_lists_[numPages-1].erase(span);
-            return span;
+            instrument::TimedLock<std::mutex> lock(mutex_,instrument::Lock::PageCache,instrument::pageLock(node_));
+            span=allocateSpanLocked(numPages,wantTrim);
         }
-        for(size_t i=numPages;i<MaxPages;i++)
+        // 请求回收要拿注册表的锁、扫所有线程缓存，放在页堆的锁外面
+        if(wantTrim)
         {
-            if(!free_lists_[i].empty())
-            {
-                sp=&free_lists_[i];
-                break;
-            }
+            requestTrim();
+        }
+        return span;
+    }
+
+    void PageCache::requestTrim()
+    {
+        // 超过软上限以后每次allocateSpan都想请求，限频：间隔内只有一个线程真正去扫
+        uint64_t now=static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        uint64_t last=last_trim_ns_.load(std::memory_order_relaxed);
+        if(now-last<TRIM_REQUEST_INTERVAL_NS||
+           !last_trim_ns_.compare_exchange_strong(last,now,std::memory_order_relaxed))
+        {
+            return;
         }
-        
-        if(sp==nullptr)
+        instrument::count(instrument::Event::TrimRequest);
+        ThreadCache::requestTrimAll(heap_.id());
+    }
+
+    Span* PageCache::allocateSpanLocked(size_t numPages, bool& wantTrim)
+    {
+        Span* span=findFree(numPages);
+        if(span==nullptr&&pending_!=nullptr)
+        {
+            // 释放时没有合并，真要一段更长的页时才把相连的空闲span拼起来
+            coalesceLocked();
+            span=findFree(numPages);
+        }
+
+        size_t threshold=trimThreshold();
+        if(span==nullptr||(threshold!=0&&mappedBytes()>threshold))
+        {
+            // 要向系统要内存了（或者已经超过软上限）：让空闲线程把囤着的内存吐出来，
+            // 这次来不及用上，但能让后续的分配复用而不是继续mmap；放掉锁以后再请求
+            wantTrim=true;
+        }
+        if(span==nullptr)
         {
             //先申请一大块内存
             span=newSpan(numPages);
+            if(span==nullptr)
+            {
+                return nullptr;
+            }
         }
         else{
-            span=sp->begin();
+            // 只给拿走的numPages页记账，剩下的部分保持原来的状态
+            if(!recommitSpan(span,numPages))
+            {
+                return nullptr;
+            }
             //多线程的bug，搞了一下午了，就是没有删除这个freelist里面的这个
-            sp->erase(span);
+            eraseFree(span);
+            // next/prev马上要给中心缓存用
+            unlinkPending(span);
         }
 
         if(span->num_pages > numPages)
         {
-            Span* remain_span=new Span();
+            Span* remain_span=internalNew<Span>();
+            remain_span->node=node_;
+            remain_span->decommitted=span->decommitted;
+            remain_span->zeroed=span->zeroed;
             char* address_=static_cast<char*>(span->start_address);
             remain_span->num_pages=span->num_pages-numPages;
             remain_span->start_address=address_+numPages*PAGE_SIZE;
             span->num_pages=numPages;
 
             // 更新被拆分出去的 span 的映射
-            size_t start_page=AddressToPageID(span->start_address);
-            for(size_t i=0;i<span->num_pages;i++)
+            arena_.assign(span->start_address,span->num_pages,span);
+            // 更新 remain_span 的映射
+            arena_.assign(remain_span->start_address,remain_span->num_pages,remain_span);
+            
+            insertFree(remain_span);
+            // 从新提交的span切下来的尾巴可能和上一块的空闲尾巴相连
+            pushPending(remain_span);
+        }
+        span->decommitted=false;
+        // 出了PageCache就要标记，否则别的线程归还相邻span时会把它当成空闲的合并掉
+        span->location=true;
+        return span;
+    }
+
+    void PageCache::insertFree(Span* span)
+    {
+        size_t pages=span->num_pages;
+        if(pages<SmallRunPages)
+        {
+            small_runs_[pages].insert(span);
+            small_bitmap_[pages/64]|=uint64_t(1)<<(pages%64);
+        }
+        else
+        {
+            large_runs_.insert(span);
+        }
+    }
+
+    void PageCache::eraseFree(Span* span)
+    {
+        size_t pages=span->num_pages;
+        if(pages<SmallRunPages)
+        {
+            small_runs_[pages].erase(span);
+            if(small_runs_[pages].empty())
             {
-                span_map_[start_page+i]=span;
+                small_bitmap_[pages/64]&=~(uint64_t(1)<<(pages%64));
             }
+        }
+        else
+        {
+            large_runs_.erase(span);
+        }
+    }
 
-            // 更新 remain_span 的映射
-            size_t remain_start_page=AddressToPageID(remain_span->start_address);
-            for(size_t i=0;i<remain_span->num_pages;i++)
+    Span* PageCache::findFree(size_t numPages)
+    {
+        if(numPages<SmallRunPages)
+        {
+            // 从numPages那一位开始找第一个非空的桶
+            size_t word=numPages/64;
+            uint64_t bits=small_bitmap_[word]&(~uint64_t(0)<<(numPages%64));
+            while(true)
             {
-                span_map_[remain_start_page+i]=remain_span;
+                if(bits!=0)
+                {
+                    size_t pages=word*64+__builtin_ctzll(bits);
+                    return *small_runs_[pages].begin();
+                }
+                if(++word==BitmapWords)
+                {
+                    break;
+                }
+                bits=small_bitmap_[word];
             }
-            
-            if(remain_span->num_pages > 0 && remain_span->num_pages <= MaxPages)
-                free_lists_[remain_span->num_pages-1].push_front(remain_span);
         }
-        return span;
+        // 只用页数和地址比较，栈上的假span当查询键
+        Span key;
+        key.num_pages=numPages;
+        key.start_address=nullptr;
+        auto it=large_runs_.lower_bound(&key);
+        return it==large_runs_.end()?nullptr:*it;
+    }
+
+    bool PageCache::recommitSpan(Span* span, size_t numPages)
+    {
+        if(!span->decommitted)
+        {
+            return true;
+        }
+        // madvise过的页再次访问时内核按需补零页，这里只需要记账
+        return heap_.limiter().tryCharge(numPages*PAGE_SIZE);
+    }
+
+    void PageCache::decommitSpan(Span* span)
+    {
+        if(span->decommitted)
+        {
+            return;
+        }
+        // 不munmap：批栈的popBatch可能还在读过期的对象头，映射必须一直可读
+        size_t bytes=span->num_pages*PAGE_SIZE;
+        madvise(span->start_address,bytes,MADV_DONTNEED);
+        instrument::count(instrument::Event::Decommit);
+        span->decommitted=true;
+        // 私有匿名映射madvise以后再访问是零页
+        span->zeroed=true;
+        heap_.limiter().uncharge(bytes);
+    }
+
+    void* PageCache::allocateLarge(size_t size, bool* zeroed)
+    {
+        size_t num_pages=(size+PAGE_SIZE-1)>>PageShift;
+        Span* span=allocateSpan(num_pages);
+        if(span==nullptr)
+        {
+            heap_.limiter().onPressure(PressureLevel::Exhausted);
+            span=allocateSpan(num_pages);
+            if(span==nullptr)
+            {
+                LogWarn("[PageCache:allocateLarge] 节点%zu 申请 %zu 页失败",node_,num_pages);
+                return nullptr;
+            }
+        }
+        span->large=true;
+        if(zeroed!=nullptr)
+        {
+            // 交出去之后只有调用者会写，这时读到的状态是准的
+            *zeroed=span->zeroed;
+        }
+        return span->start_address;
+    }
+
+    void PageCache::prefault(Span* span)
+    {
+        char* address=static_cast<char*>(span->start_address);
+        size_t bytes=span->num_pages*PAGE_SIZE;
+        if(madvise(address,bytes,MADV_POPULATE_WRITE)==0)
+        {
+            return;
+        }
+        // 每页读一个字节再原样写回：空闲span里可能已经有链表指针，不能清零
+        for(size_t offset=0;offset<bytes;offset+=PAGE_SIZE)
+        {
+            volatile char* byte=address+offset;
+            *byte=*byte;
+        }
+    }
+
+    size_t PageCache::releaseFreeSpans()
+    {
+        instrument::TimedLock<std::mutex> lock(mutex_,instrument::Lock::PageCache,instrument::pageLock(node_));
+        size_t released=0;
+        // decommitted不参与排序，可以原地改
+        auto release=[&](Span* span)
+        {
+            if(!span->decommitted)
+            {
+                released+=span->num_pages*PAGE_SIZE;
+                decommitSpan(span);
+                // 状态变了，以前因为状态不同没合并的邻居现在可能可以合并
+                pushPending(span);
+            }
+        };
+        for(size_t i=0;i<SmallRunPages;i++)
+        {
+            for(Span* span:small_runs_[i])
+            {
+                release(span);
+            }
+        }
+        for(Span* span:large_runs_)
+        {
+            release(span);
+        }
+        if(released!=0)
+        {
+            LogInfo("[PageCache:releaseFreeSpans] 节点%zu 还给系统 %zu 字节",node_,released);
+        }
+        return released;
+    }
+
+    size_t PageCache::freeBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t bytes=0;
+        auto add=[&](Span* span)
+        {
+            if(!span->decommitted)
+            {
+                bytes+=span->num_pages*PAGE_SIZE;
+            }
+        };
+        for(size_t i=0;i<SmallRunPages;i++)
+        {
+            for(Span* span:small_runs_[i])
+            {
+                add(span);
+            }
+        }
+        for(Span* span:large_runs_)
+        {
+            add(span);
+        }
+        return bytes;
+    }
+
+    void PageCache::freeRunHistogram(size_t* spans, size_t* pages, size_t buckets)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto add=[&](Span* span)
+        {
+            size_t bucket=std::min<size_t>(63-__builtin_clzll(span->num_pages),buckets-1);
+            spans[bucket]++;
+            pages[bucket]+=span->num_pages;
+        };
+        for(size_t i=0;i<SmallRunPages;i++)
+        {
+            for(Span* span:small_runs_[i])
+            {
+                add(span);
+            }
+        }
+        for(Span* span:large_runs_)
+        {
+            add(span);
+        }
     }
 
     Span* PageCache::newSpan(size_t numPages)
     {
+        instrument::PathTimer timer(instrument::Path::NewSpan);
         size_t size_alloc=std::max(numPages,MinSystemAllocPages)*PAGE_SIZE;
-        void* ptr=mmap(nullptr,size_alloc,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
-        if(ptr==MAP_FAILED)
+        HeapLimit& heap_limit=heap_.limiter();
+        if(!heap_limit.tryCharge(size_alloc))
+        {
+            // 按最小批量申请超上限了，只申请这次真正需要的页数再试一次
+            size_alloc=numPages*PAGE_SIZE;
+            if(!heap_limit.tryCharge(size_alloc))
+            {
+                LogInfo("[PageCache:newSpan] 节点%zu 申请 %zu 页超过堆上限 %zu 字节（已提交 %zu）",
+                        node_,numPages,heap_limit.limit(),heap_limit.committed());
+                return nullptr;
+            }
+        }
+        // 从预留的地址空间里往后提交，和上一次提交的页地址相连，空闲时可以一直合并下去
+        void* ptr=arena_.commit(size_alloc>>PageShift);
+        if(ptr==nullptr)
         {
+            heap_limit.uncharge(size_alloc);
+            LogError("[PageCache:newSpan] 节点%zu 提交 %zu 页失败",node_,size_alloc>>PageShift);
             return nullptr;
         }
-        Span* new_span=new Span();
-        size_t start_page=reinterpret_cast<size_t>(ptr)>>PageShift;
+        instrument::count(instrument::Event::ArenaCommit);
+        mapped_bytes_.fetch_add(size_alloc,std::memory_order_relaxed);
+        LogInfo("[PageCache:newSpan] 节点%zu 提交 %zu 页，地址: %p",node_,size_alloc>>PageShift,ptr);
+        // 首次访问之前就绑定节点，否则物理页会落在first touch的线程所在节点
+        NumaTopology::getInstance().bindToNode(ptr,size_alloc,node_);
+        Span* new_span=internalNew<Span>();
+        new_span->node=node_;
         size_t actual_pages=size_alloc>>PageShift;
 
         new_span->start_address=ptr;
         new_span->num_pages=actual_pages;
         new_span->location=false;
-        for(size_t i=0;i<actual_pages;i++)
+        // 刚从PROT_NONE提交出来的匿名页都是零
+        new_span->zeroed=true;
+        arena_.assign(ptr,actual_pages,new_span);
+        return new_span;
+    }
+
+    void PageCache::deallocateSpan(Span* ptr, bool decommit)
+    {
+        instrument::PathTimer timer(instrument::Path::DeallocateSpan);
+        instrument::TimedLock<std::mutex> lock(mutex_,instrument::Lock::PageCache,instrument::pageLock(node_));
+        releaseSpan(ptr,decommit);
+    }
+
+    void PageCache::deallocateSpans(Span* list)
+    {
+        instrument::PathTimer timer(instrument::Path::DeallocateSpan);
+        instrument::TimedLock<std::mutex> lock(mutex_,instrument::Lock::PageCache,instrument::pageLock(node_));
+        while(list!=nullptr)
         {
-            span_map_[start_page+i]=new_span;
+            Span* next=list->next;
+            releaseSpan(list,false);
+            list=next;
         }
-        return new_span;
     }
 
-    void PageCache::deallocateSpan(Span* ptr)
+    void PageCache::releaseSpan(Span* ptr, bool decommit)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        size_t current_id=AddressToPageID(ptr->start_address);
-        size_t prev_id=current_id-1;
-        auto it=span_map_.find(prev_id);
-        char* current_address=static_cast<char*>(ptr->start_address);
-        if(it!=span_map_.end())
-        {
-            Span* prev_span=it->second;
-            char* prev_address=static_cast<char*>(prev_span->start_address);
-            if(prev_span->location==false&&prev_address+prev_span->num_pages*PAGE_SIZE==current_address)
+        // 交出去的页已经被写过了
+        ptr->zeroed=false;
+        if(decommit)
+        {
+            decommitSpan(ptr);
+        }
+        ptr->location=false;
+        ptr->large=false;
+        ptr->use_count=0;
+        ptr->objects=nullptr;
+        ptr->size_class=0;
+        insertFree(ptr);
+        pushPending(ptr);
+    }
+
+    void PageCache::pushPending(Span* span)
+    {
+        if(span->coalesce_pending)
+        {
+            return;
+        }
+        span->coalesce_pending=true;
+        span->prev=nullptr;
+        span->next=pending_;
+        if(pending_!=nullptr)
+        {
+            pending_->prev=span;
+        }
+        pending_=span;
+    }
+
+    void PageCache::unlinkPending(Span* span)
+    {
+        if(!span->coalesce_pending)
+        {
+            return;
+        }
+        span->coalesce_pending=false;
+        if(span->prev!=nullptr)
+        {
+            span->prev->next=span->next;
+        }
+        else
+        {
+            pending_=span->next;
+        }
+        if(span->next!=nullptr)
+        {
+            span->next->prev=span->prev;
+        }
+        span->next=nullptr;
+        span->prev=nullptr;
+    }
+
+    size_t PageCache::coalesceFreeSpans()
+    {
+        instrument::TimedLock<std::mutex> lock(mutex_,instrument::Lock::PageCache,instrument::pageLock(node_));
+        return coalesceLocked();
+    }
+
+    size_t PageCache::coalesceLocked()
+    {
+        instrument::count(instrument::Event::Coalesce);
+        size_t merged=0;
+        // 合并时被吞掉的邻居如果也在链表上会被摘掉，每次都从表头重新取
+        while(Span* span=pending_)
+        {
+            unlinkPending(span);
+            mergeNeighbours(span,merged);
+        }
+        if(merged!=0)
+        {
+            LogDebug("[PageCache:coalesceLocked] 节点%zu 合并掉 %zu 个空闲span",node_,merged);
+        }
+        return merged;
+    }
+
+    Span* PageCache::mergeNeighbours(Span* span, size_t& merged)
+    {
+        // 能合并的邻居：同一块预留里、空闲、已提交还是已还给系统的状态一样
+        // 状态不同的不合并：合并时把已提交的一半madvise掉会让下一次分配白白缺页，两段分开留着
+        auto mergeable=[&](Span* neighbour)
+        {
+            return neighbour!=nullptr&&neighbour!=span&&!neighbour->location&&
+                   neighbour->decommitted==span->decommitted&&
+                   arena_.sameChunk(neighbour->start_address,span->start_address);
+        };
+        // 把right并进left，留下left
+        auto absorb=[&](Span* left, Span* right)
+        {
+            eraseFree(left);
+            eraseFree(right);
+            unlinkPending(right);
+            left->zeroed=left->zeroed&&right->zeroed;
+            arena_.assign(right->start_address,right->num_pages,left);
+            left->num_pages+=right->num_pages;
+            internalDelete(right);
+            insertFree(left);
+            merged++;
+        };
+        while(true)
+        {
+            Span* left=arena_.lookup(static_cast<char*>(span->start_address)-PAGE_SIZE);
+            if(!mergeable(left))
             {
-                //std::cout<<"prev_span->location=="<<prev_span->location<<std::endl;
-                free_lists_[prev_span->num_pages-1].erase(prev_span);
-                //归还的时候，它还不在空闲列表中
-                // free_lists_[ptr->num_pages-1].erase(ptr);
-                prev_span->num_pages+=ptr->num_pages;
-                for(size_t i=0;i<ptr->num_pages;i++)
-                {
-                    span_map_[current_id+i]=prev_span;
-                }
-                delete ptr;
-                ptr=prev_span;
+                break;
             }
+            absorb(left,span);
+            span=left;
         }
-        current_address=static_cast<char*>(ptr->start_address);
-        current_id=AddressToPageID(ptr->start_address);
-        size_t next_id=current_id+ptr->num_pages;
-        it=span_map_.find(next_id);
-        if(it!=span_map_.end())
-        { 
-            Span* next_span=it->second;
-            char* next_address=static_cast<char*>(next_span->start_address);
-            if(next_span->location==false&&next_address==current_address+ptr->num_pages*PAGE_SIZE && (ptr->num_pages + next_span->num_pages <= MaxPages))
+        while(true)
+        {
+            Span* right=arena_.lookup(static_cast<char*>(span->start_address)+span->num_pages*PAGE_SIZE);
+            if(!mergeable(right))
             {
-                free_lists_[next_span->num_pages-1].erase(next_span);
-                ptr->num_pages+=next_span->num_pages;
-                for(size_t i=0;i<next_span->num_pages;i++)
-                {
-                    span_map_[next_id+i]=ptr;
-                }
-                delete next_span;
+                break;
             }
+            absorb(span,right);
         }
-        ptr->location=false;
-        ptr->use_count=0;
-        ptr->objects=nullptr;
-        ptr->size_class=0;
-        if(ptr->num_pages>MaxPages)
-            ptr->num_pages=MaxPages;
-        free_lists_[ptr->num_pages-1].push_front(ptr);
-    } 
+        return span;
+    }
     
     
 } // namespace llt_memoryPool
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include "../include/StatsExport.h"
+#include "../include/Heap.h"
+#include "../include/PageCache.h"
+#include "../include/logger.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace llt_memoryPool
+{
+namespace stats
+{
+
+namespace
+{
+    // 每次发布都重写的部分从这里开始
+    constexpr size_t PAYLOAD_OFFSET = offsetof(StatsHeader, publishes);
+
+    // start/stop互斥；wake用来让发布线程提前醒来退出
+    std::mutex control_mutex;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    bool running = false;
+    std::thread publisher;
+    char segment_path[64];
+    char* segment = nullptr;
+    // 发布线程先在这里拼好一份，再在序列锁里整段复制，写者持有“奇数”的时间只有一次memcpy
+    char* staging = nullptr;
+    size_t segment_bytes = 0;
+    size_t class_count = 0;
+
+    uint64_t monotonicNs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    // 把默认堆的计数收集到staging，只在发布线程里调用
+    void collect(uint64_t publishes)
+    {
+        Heap& heap = Heap::defaultHeap();
+        StatsHeader* header = reinterpret_cast<StatsHeader*>(staging);
+        RunStats* run_stats = reinterpret_cast<RunStats*>(staging + sizeof(StatsHeader));
+        ClassStats* class_stats = reinterpret_cast<ClassStats*>(staging + sizeof(StatsHeader) + RUN_BUCKETS * sizeof(RunStats));
+        std::memset(staging + PAYLOAD_OFFSET, 0, segment_bytes - PAYLOAD_OFFSET);
+
+        HeapStats heap_stats = heap.stats();
+        header->publishes = publishes;
+        header->timestamp_ns = monotonicNs();
+        header->mapped_bytes = PageCache::mappedBytes();
+        header->committed_bytes = heap_stats.committed;
+        header->heap_limit = heap_stats.limit;
+        header->free_bytes = heap_stats.free_bytes;
+        header->reserved_bytes = heap_stats.reserved;
+        header->thread_caches = heap_stats.thread_caches;
+
+        size_t spans[RUN_BUCKETS];
+        size_t pages[RUN_BUCKETS];
+        for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+        {
+            PageCache* page = heap.pageCacheIfCreated(node);
+            if (page == nullptr)
+            {
+                continue;
+            }
+            std::fill(spans, spans + RUN_BUCKETS, 0);
+            std::fill(pages, pages + RUN_BUCKETS, 0);
+            page->freeRunHistogram(spans, pages, RUN_BUCKETS);
+            for (size_t i = 0; i < RUN_BUCKETS; ++i)
+            {
+                run_stats[i].spans += spans[i];
+                run_stats[i].pages += pages[i];
+            }
+        }
+
+        for (size_t index = 0; index < class_count; ++index)
+        {
+            ClassStats& entry = class_stats[index];
+            entry.size = SizeClass::getSize(index);
+        }
+        for (size_t node = 0; node < MAX_NUMA_NODES; ++node)
+        {
+            CentralCache* central = heap.centralCacheIfCreated(node);
+            if (central == nullptr)
+            {
+                continue;
+            }
+            // 每个等级单独加一次桶锁，不会长时间挡住某一个等级的慢路径
+            for (size_t index = 0; index < class_count; ++index)
+            {
+                CentralCache::BucketCounters counters = central->counters(index);
+                ClassStats& entry = class_stats[index];
+                entry.cached_bytes += counters.free_objects * entry.size;
+                entry.in_use_bytes += counters.used_objects * entry.size;
+                entry.spans += counters.spans;
+                entry.fetches += counters.fetches;
+                entry.releases += counters.releases;
+                entry.new_spans += counters.new_spans;
+            }
+        }
+        for (size_t index = 0; index < class_count; ++index)
+        {
+            header->fetches += class_stats[index].fetches;
+            header->releases += class_stats[index].releases;
+            header->new_spans += class_stats[index].new_spans;
+        }
+    }
+
+    void publish(uint64_t publishes)
+    {
+        collect(publishes);
+        StatsHeader* header = reinterpret_cast<StatsHeader*>(segment);
+        uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+        header->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(segment + PAYLOAD_OFFSET, staging + PAYLOAD_OFFSET, segment_bytes - PAYLOAD_OFFSET);
+        header->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    void publisherLoop(unsigned intervalMs)
+    {
+        uint64_t publishes = 0;
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        while (!stopping)
+        {
+            lock.unlock();
+            publish(++publishes);
+            lock.lock();
+            wake.wait_for(lock, std::chrono::milliseconds(intervalMs), [] { return stopping; });
+        }
+    }
+
+    // 环境变量LLT_MEMPOOL_STATS：库加载时开始导出，值是发布间隔（毫秒），不是正数时用默认间隔
+    struct EnvironmentStats
+    {
+        EnvironmentStats()
+        {
+            if (const char* value = std::getenv("LLT_MEMPOOL_STATS"))
+            {
+                long interval = std::strtol(value, nullptr, 10);
+                start(interval > 0 ? static_cast<unsigned>(interval) : DEFAULT_INTERVAL_MS);
+            }
+        }
+        ~EnvironmentStats()
+        {
+            stop();
+        }
+    };
+    EnvironmentStats environment_stats;
+}
+
+bool start(unsigned intervalMs)
+{
+    std::lock_guard<std::mutex> lock(control_mutex);
+    if (running || intervalMs == 0)
+    {
+        return false;
+    }
+    class_count = SizeClass::getIndex(MEDIUM_BYTES) + 1;
+    segment_bytes = segmentBytes(class_count);
+    segmentPath(segment_path, sizeof(segment_path), static_cast<uint64_t>(getpid()));
+    int fd = ::open(segment_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        LogError("[Stats:start] 创建统计段失败: %s", segment_path);
+        return false;
+    }
+    void* mapped = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(segment_bytes)) == 0)
+    {
+        mapped = mmap(nullptr, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        ::unlink(segment_path);
+        LogError("[Stats:start] 映射统计段失败: %s，%zu 字节", segment_path, segment_bytes);
+        return false;
+    }
+    segment = static_cast<char*>(mapped);
+    staging = static_cast<char*>(internalAllocate(segment_bytes, alignof(StatsHeader)));
+    StatsHeader* header = reinterpret_cast<StatsHeader*>(segment);
+    header->magic = STATS_MAGIC;
+    header->version = STATS_VERSION;
+    header->header_size = sizeof(StatsHeader);
+    header->class_count = static_cast<uint32_t>(class_count);
+    header->run_buckets = static_cast<uint32_t>(RUN_BUCKETS);
+    header->pid = static_cast<uint64_t>(getpid());
+    header->interval_ms = intervalMs;
+    header->page_size = PAGE_SIZE;
+    header->sequence.store(0, std::memory_order_release);
+    // 固定部分也拷到staging，collect只重写PAYLOAD_OFFSET之后
+    std::memcpy(staging, segment, PAYLOAD_OFFSET);
+    stopping = false;
+    running = true;
+    publisher = std::thread(publisherLoop, intervalMs);
+    LogInfo("[Stats:start] 开始导出统计: %s，每 %u 毫秒", segment_path, intervalMs);
+    return true;
+}
+
+void stop()
+{
+    std::lock_guard<std::mutex> lock(control_mutex);
+    if (!running)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> wake_lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    publisher.join();
+    munmap(segment, segment_bytes);
+    ::unlink(segment_path);
+    internalFree(staging);
+    segment = nullptr;
+    staging = nullptr;
+    running = false;
+    LogInfo("[Stats:stop] 停止导出统计: %s", segment_path);
+}
+
+bool active()
+{
+    std::lock_guard<std::mutex> lock(control_mutex);
+    return running;
+}
+
+} // namespace stats
+} // namespace llt_memoryPool
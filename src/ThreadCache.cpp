@@ -1,75 +1,455 @@
 #include "../include/ThreadCache.h"
-#include "../include/CentralCache.h"
+#include "../include/Heap.h"
+#include "../include/PageCache.h"
+#include "../include/Instrument.h"
+#include <new>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
 
 namespace llt_memoryPool
 {
 
-void* ThreadCache::allocate(size_t size)
+namespace
 {
+    // 本线程的ThreadCache已经析构（线程退出过程中）
+    thread_local bool cacheDestroyed = false;
 
-    // 处理0大小的分配请求
-    if (size == 0)
+    // 所有存活的ThreadCache，每个堆一条双向链表，挂在ThreadCache自己身上
+    struct CacheRegistry
     {
-        size = ALIGNMENT; // 至少分配一个对齐大小
-     }
-    
-    if (size > MAX_BYTES)
+        std::mutex mutex;
+        ThreadCache* heads[MAX_HEAPS] = {};
+        size_t counts[MAX_HEAPS] = {};
+        // 线程退出时已经摘下、还在往堆里还内存的缓存数，销毁堆要等它归零
+        std::atomic<size_t> exiting[MAX_HEAPS] = {};
+        // 每发起一轮回收请求+1，用来区分“上一轮以来有没有走过慢路径”
+        std::atomic<uint64_t> epoch{1};
+    };
+
+    // 不析构：分离线程的ThreadCache可能在静态对象析构之后才注销
+    CacheRegistry& registry()
     {
-        // 大对象直接从系统分配
-        return malloc(size);
+        static CacheRegistry* instance = internalNew<CacheRegistry>();
+        return *instance;
     }
+}
 
-    size_t index = SizeClass::getIndex(size);
+ThreadCache::ThreadCache(Heap& heap)
+    : heap_(&heap), heapId_(heap.id()), node_(NumaTopology::getInstance().currentNode())
+{
+    // 初始化数组
+    for (size_t i = 0; i < FREE_LIST_SIZE; ++i) {
+        freeList_[i] = nullptr;
+        freeListSize_[i] = 0;
+    }
+#if LLT_MEMPOOL_HARDENED
+    resetGuardCountdown();
+#endif
+    CacheRegistry& reg = registry();
+    lastActiveEpoch_.store(reg.epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        regNext_ = reg.heads[heapId_];
+        if (regNext_ != nullptr)
+        {
+            regNext_->regPrev_ = this;
+        }
+        reg.heads[heapId_] = this;
+        reg.counts[heapId_]++;
+        registered_ = true;
+        if (heapId_ != 0)
+        {
+            // 销毁堆的线程在锁里通过slot_清空这一格
+            slot_ = &tls_heap_caches_[heapId_];
+            *slot_ = this;
+        }
+    }
+    if (heapId_ == 0)
+    {
+        tls_cache_ = this;
+    }
+}
 
+void ThreadCache::unlink()
+{
+    CacheRegistry& reg = registry();
+    if (regPrev_ != nullptr)
+    {
+        regPrev_->regNext_ = regNext_;
+    }
+    else
+    {
+        reg.heads[heapId_] = regNext_;
+    }
+    if (regNext_ != nullptr)
+    {
+        regNext_->regPrev_ = regPrev_;
+    }
+    regPrev_ = nullptr;
+    regNext_ = nullptr;
+    reg.counts[heapId_]--;
+    registered_ = false;
+}
 
-    // 检查线程本地自由链表
-    // 如果 freeList_[index] 不为空，表示该链表中有可用内存块
-    if (void* ptr = freeList_[index])
+size_t ThreadCache::liveCount(size_t heap)
+{
+    CacheRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    return reg.counts[heap];
+}
+
+size_t ThreadCache::requestTrimAll(size_t heap)
+{
+    CacheRegistry& reg = registry();
+    ThreadCache* self = currentIfCreated(heap);
+    size_t requested = 0;
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    uint64_t epoch = reg.epoch.fetch_add(1, std::memory_order_relaxed);
+    for (ThreadCache* cache = reg.heads[heap]; cache != nullptr; cache = cache->regNext_)
     {
-        freeList_[index] = *reinterpret_cast<void**>(ptr); // 将freeList_[index]指向的内存块的下一个内存块地址（取决于内存块的实现）
-        // 更新自由链表大小
-        freeListSize_[index]--;
-        return ptr;
+        // 发起者自己和上一轮以来走过慢路径的线程都算忙，不打扰
+        if (cache == self || cache->lastActiveEpoch_.load(std::memory_order_relaxed) >= epoch)
+        {
+            continue;
+        }
+        cache->trimRequested_.store(true, std::memory_order_relaxed);
+        requested++;
     }
+    if (requested != 0)
+    {
+        LogInfo("[ThreadCache:requestTrimAll] 第%llu轮，请求堆%zu上%zu个空闲线程缓存归还内存",
+                static_cast<unsigned long long>(epoch), heap, requested);
+    }
+    return requested;
+}
 
-    // 如果线程本地自由链表为空，则从中心缓存获取一批内存
-    fetchFromCentralCache(index);
-    return allocate(size);
+size_t ThreadCache::cachedBytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < FREE_LIST_SIZE; ++i)
+    {
+        bytes += freeListSize_[i] * SizeClass::getSize(i);
+    }
+    return bytes + mediumBytes_;
 }
 
-void ThreadCache::deallocate(void* ptr, size_t size)
+void ThreadCache::markActive()
 {
+    uint64_t epoch = registry().epoch.load(std::memory_order_relaxed);
+    if (lastActiveEpoch_.load(std::memory_order_relaxed) != epoch)
+    {
+        lastActiveEpoch_.store(epoch, std::memory_order_relaxed);
+    }
+}
 
+void ThreadCache::trim(bool keepBatch)
+{
+    // 直通实例一直保持回收请求，释放总是走慢路径
+    trimRequested_.store(passthrough_, std::memory_order_relaxed);
+    // 每个等级最多留一批，下一次分配不用立刻回中心缓存
+    size_t released = 0;
+    for (size_t i = 0; i < FREE_LIST_SIZE; ++i)
+    {
+        size_t keep = keepBatch ? SizeClass::getBatchNum(SizeClass::getSize(i)) : 0;
+        if (freeListSize_[i] > keep)
+        {
+            released += (freeListSize_[i] - keep) * SizeClass::getSize(i);
+            releaseFromList(i, freeListSize_[i] - keep, false);
+        }
+    }
+    released += mediumBytes_;
+    releaseMediumCache();
+    LogInfo("[ThreadCache:trim] 堆%zu 节点%zu 线程缓存归还 %zu 字节", heapId_, node_, released);
+}
+
+void* ThreadCache::allocatePages(size_t size, bool* zeroed)
+{
     if (size > MAX_BYTES)
     {
+        return allocateLarge(size, zeroed);
+    }
+    size_t pages = (size + PAGE_SIZE - 1) >> PageShift;
+    void*& list = mediumList_[pages - MEDIUM_MIN_PAGES];
+    if (void* ptr = list)
+    {
+        list = loadNext(ptr);
+        mediumBytes_ -= pages << PageShift;
+        if (zeroed != nullptr)
+        {
+            *zeroed = false;
+        }
+        return ptr;
+    }
+    markActive();
+    if (trimRequested_.load(std::memory_order_relaxed) && !passthrough_)
+    {
+        trim();
+    }
+    // 按整页要：释放时按同样的页数放回对应的链表
+    void* ptr = allocateLarge(pages << PageShift, zeroed);
+    // 和小对象的慢路径一样，快到上限时提前回收（拿不到时PageCache已经跑过Exhausted）
+    HeapLimit& heapLimit = heap_->limiter();
+    if (ptr != nullptr && heapLimit.underPressure())
+    {
+        heapLimit.onPressure(PressureLevel::Approaching);
+    }
+    return ptr;
+}
 
-        free(ptr);
+void ThreadCache::deallocatePages(void* ptr, size_t size)
+{
+    if (size > MAX_BYTES)
+    {
+        deallocateLarge(ptr, size);
         return;
     }
+    size_t pages = (size + PAGE_SIZE - 1) >> PageShift;
+    size_t bytes = pages << PageShift;
+    void*& list = mediumList_[pages - MEDIUM_MIN_PAGES];
+#if LLT_MEMPOOL_HARDENED
+    if (ptr == list)
+    {
+        hardening::fail("double free", ptr);
+    }
+    // 先确认是页堆交出去的、页数对得上，坏指针留在缓存里会被再分配出去
+    heap_->largeSpanOf(ptr, bytes);
+#endif
+    if (passthrough_)
+    {
+        deallocateLarge(ptr, bytes);
+        return;
+    }
+    if (mediumBytes_ + bytes > MEDIUM_CACHE_BYTES || trimRequested_.load(std::memory_order_relaxed)) [[unlikely]]
+    {
+        markActive();
+        if (trimRequested_.load(std::memory_order_relaxed))
+        {
+            trim();
+        }
+        else
+        {
+            releaseMediumCache();
+        }
+    }
+    storeNext(ptr, list);
+    list = ptr;
+    mediumBytes_ += bytes;
+}
 
-    size_t index = SizeClass::getIndex(size);
+void ThreadCache::releaseMediumCache()
+{
+    for (size_t i = 0; i < MEDIUM_PAGE_KINDS; ++i)
+    {
+        size_t bytes = (MEDIUM_MIN_PAGES + i) << PageShift;
+        void* ptr = mediumList_[i];
+        while (ptr != nullptr)
+        {
+            void* next = loadNext(ptr);
+            deallocateLarge(ptr, bytes);
+            ptr = next;
+        }
+        mediumList_[i] = nullptr;
+    }
+    mediumBytes_ = 0;
+}
 
-    // 插入到线程本地自由链表
-    *reinterpret_cast<void**>(ptr) = freeList_[index];
-    freeList_[index] = ptr;
+void* ThreadCache::allocateLarge(size_t size, bool* zeroed)
+{
+    return heap_->pageCache(node_).allocateLarge(size, zeroed);
+}
+
+void ThreadCache::deallocateLarge(void* ptr, size_t size)
+{
+    heap_->deallocateLarge(ptr, size);
+}
 
-     // 更新自由链表大小
-    freeListSize_[index]++; // 增加对应大小类的自由链表大小
+size_t ThreadCache::prefill(size_t index, size_t count)
+{
+    size_t target = std::min(count, SizeClass::getBatchNum(SizeClass::getSize(index)) * 2);
+    while (freeListSize_[index] < target)
+    {
+        size_t before = freeListSize_[index];
+        fetchFromCentralCache(index);
+        if (freeListSize_[index] == before)
+        {
+            break;
+        }
+    }
+    return freeListSize_[index];
+}
 
-    // 判断是否需要将部分内存回收给中心缓存
-    //bug:getsize是这个index的字节大小，而不是尺寸
-    // if (freeListSize_[index]>SizeClass::getSize(index))
-    // {
-    //     releaseExcessMemory(index);
-    // }
-    if(freeListSize_[index]>SizeClass::getBatchNum(SizeClass::getSize(index))*2){
+void ThreadCache::deallocateSlow(size_t index)
+{
+    markActive();
+    if (passthrough_)
+    {
+        releaseAllMemory(index);
+        return;
+    }
+    if (freeListSize_[index] > SizeClass::getBatchNum(SizeClass::getSize(index)) * 2)
+    {
         releaseExcessMemory(index);
     }
+    if (trimRequested_.load(std::memory_order_relaxed))
+    {
+        trim();
+    }
+}
+
+ThreadCache* ThreadCache::createInstance()
+{
+    if (cacheDestroyed)
+    {
+        // 线程退出时别的thread_local析构函数里还在分配：不能再用已析构的实例，换一个直通的
+        // 构造函数把它挂上tls_cache_，之后的调用直接复用；它不囤对象，线程结束时没有内存被丢下
+        // pthread键的析构在所有thread_local析构之后，到那时再释放实例本身
+        struct ExitCache
+        {
+            static void destroy(void* value)
+            {
+                ThreadCache* cache = static_cast<ThreadCache*>(value);
+                cache->~ThreadCache();
+                internalFree(cache);
+            }
+        };
+        static pthread_key_t key = [] {
+            pthread_key_t k;
+            pthread_key_create(&k, &ExitCache::destroy);
+            return k;
+        }();
+        ThreadCache* cache = new (internalAllocate(sizeof(ThreadCache), alignof(ThreadCache))) ThreadCache(Heap::defaultHeap());
+        cache->passthrough_ = true;
+        // 释放的快路径看到回收请求就进慢路径
+        cache->trimRequested_.store(true, std::memory_order_relaxed);
+        pthread_setspecific(key, cache);
+        LogDebug("[ThreadCache:createInstance] 线程退出阶段改用直通实例");
+        return cache;
+    }
+    static thread_local ThreadCache instance(Heap::defaultHeap());
+    return &instance;
+}
+
+ThreadCache* ThreadCache::createInstance(Heap& heap)
+{
+    // 线程退出时把本线程在各个堆上的缓存还回去；局部类能调用私有的releaseHeapCaches
+    struct ExitHook
+    {
+        ~ExitHook() { releaseHeapCaches(); }
+    };
+    static thread_local ExitHook hook;
+    (void)hook;
+    return new (internalAllocate(sizeof(ThreadCache), alignof(ThreadCache))) ThreadCache(heap);
+}
+
+void ThreadCache::releaseHeapCaches()
+{
+    CacheRegistry& reg = registry();
+    for (size_t heap = 1; heap < MAX_HEAPS; ++heap)
+    {
+        ThreadCache* cache = nullptr;
+        {
+            // 和dropHeapCaches互斥：要么在这里摘下自己还内存，要么已经被销毁堆的线程清空
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            cache = tls_heap_caches_[heap];
+            if (cache == nullptr)
+            {
+                continue;
+            }
+            cache->unlink();
+            tls_heap_caches_[heap] = nullptr;
+            reg.exiting[heap].fetch_add(1, std::memory_order_relaxed);
+        }
+        cache->~ThreadCache();
+        internalFree(cache);
+        reg.exiting[heap].fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ThreadCache::dropHeapCaches(size_t heap)
+{
+    CacheRegistry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        ThreadCache* cache = reg.heads[heap];
+        while (cache != nullptr)
+        {
+            ThreadCache* next = cache->regNext_;
+            *cache->slot_ = nullptr;
+            // 不析构：析构会把内存还给马上就要销毁的中心缓存
+            internalFree(cache);
+            cache = next;
+        }
+        reg.heads[heap] = nullptr;
+        reg.counts[heap] = 0;
+    }
+    while (reg.exiting[heap].load(std::memory_order_acquire) != 0)
+    {
+        std::this_thread::yield();
+    }
+}
+
+void* ThreadCache::allocateSlow(size_t index)
+{
+    markActive();
+    if (trimRequested_.load(std::memory_order_relaxed) && !passthrough_)
+    {
+        trim();
+    }
+    fetchFromCentralCache(index);
+    HeapLimit& heapLimit = heap_->limiter();
+    if (freeList_[index] == nullptr)
+    {
+        // 堆上限内找不到内存：把能还的都还掉、通知回调，再试最后一次
+        heapLimit.onPressure(PressureLevel::Exhausted);
+        fetchFromCentralCache(index);
+    }
+    else if (heapLimit.underPressure())
+    {
+        heapLimit.onPressure(PressureLevel::Approaching);
+    }
+    void* ptr = freeList_[index];
+    if (ptr == nullptr)
+    {
+        LogWarn("[ThreadCache:allocateSlow] 等级%zu 分配失败，已提交 %zu / 上限 %zu 字节",
+                index, heapLimit.committed(), heapLimit.limit());
+        return nullptr;
+    }
+    freeList_[index] = loadNext(ptr);
+    freeListSize_[index]--;
+    if (passthrough_)
+    {
+        // 同一批里多拿的立刻还回去
+        releaseAllMemory(index);
+    }
+    return ptr;
 }
 
+#if LLT_MEMPOOL_HARDENED
+void ThreadCache::resetGuardCountdown()
+{
+    // 保护页区域是整个进程共用的，不随堆销毁，只给默认堆采样
+    size_t rate = heapId_ == 0 ? hardening::guardSampleRate() : 0;
+    // 关闭时设成最大值，实际上不会再倒数到0
+    guardCountdown_ = rate == 0 ? SIZE_MAX : rate;
+}
+
+void* ThreadCache::allocateGuarded(size_t size)
+{
+    resetGuardCountdown();
+    return hardening::guardedAllocate(size);
+}
+#endif
+
 void ThreadCache::releaseExcessMemory(size_t index)
 {
-    size_t num_to_release = freeListSize_[index]/2;
+    releaseFromList(index, freeListSize_[index]/2, true);
+}
+
+void ThreadCache::releaseFromList(size_t index, size_t num_to_release, bool batchable)
+{
     if(num_to_release==0) return;
     void* start=freeList_[index];
     void* end=start;
@@ -82,7 +462,7 @@ void ThreadCache::releaseExcessMemory(size_t index)
             // Abort releasing memory to prevent a crash.
             return;
         }
-        end=*reinterpret_cast<void**>(end);
+        end=loadNext(end);
     }
 
     if (end == nullptr) {
@@ -90,10 +470,18 @@ void ThreadCache::releaseExcessMemory(size_t index)
         return;
     }
 
-    freeList_[index]=*reinterpret_cast<void**>(end);
-    *reinterpret_cast<void**>(end)=nullptr;
+    freeList_[index]=loadNext(end);
+    storeNext(end,nullptr);
     freeListSize_[index]-=num_to_release;
-    CentralCache::getInstance().releaseListToSpans(start, num_to_release, SizeClass::getSize(index));
+    if(batchable)
+    {
+        heap_->centralCache(node_).releaseRange(start, num_to_release, index);
+    }
+    else
+    {
+        // 回收时直接拆回span，别让内存又囤进中心缓存的批栈
+        heap_->centralCache(node_).releaseListToSpans(start, num_to_release, SizeClass::getSize(index));
+    }
 }
 
 ThreadCache::~ThreadCache()
@@ -104,6 +492,17 @@ ThreadCache::~ThreadCache()
             releaseAllMemory(i);
         }
     }
+    releaseMediumCache();
+    if (registered_)
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        unlink();
+    }
+    if (heapId_ == 0)
+    {
+        tls_cache_ = nullptr;
+        cacheDestroyed = true;
+    }
 }
 
 void ThreadCache::releaseAllMemory(size_t index)
@@ -112,21 +511,22 @@ void ThreadCache::releaseAllMemory(size_t index)
     void* start = freeList_[index];
     size_t num_to_release = freeListSize_[index];
     size_t bytes=SizeClass::getSize(index);
-    CentralCache::getInstance().releaseListToSpans(start, num_to_release, bytes);
+    heap_->centralCache(node_).releaseListToSpans(start, num_to_release, bytes);
     freeList_[index]=nullptr;
     freeListSize_[index]=0;
 }
 
 void ThreadCache::fetchFromCentralCache(size_t index)
 {
+    instrument::PathTimer timer(instrument::Path::FetchFromCentral);
     void* start=nullptr;
     void* end=nullptr;
-    size_t size = (index + 1) * ALIGNMENT;
+    size_t size = SizeClass::getSize(index);
     // 根据对象内存大小计算批量获取的数量
     size_t batchNum = SizeClass::getBatchNum(size);
 
     // 从中心缓存批量获取内存
-    size_t fetchNum=CentralCache::getInstance().fetchRange(start,end,index, batchNum);
+    size_t fetchNum=heap_->centralCache(node_).fetchRange(start,end,index, batchNum);
     //std::cout<<"fetchNum:"<<fetchNum<<std::endl;
     if (fetchNum==0) {
         return;
@@ -138,7 +538,7 @@ void ThreadCache::fetchFromCentralCache(size_t index)
     }
     else
     {
-        *reinterpret_cast<void**>(findTail(freeList_[index])) = start;
+        storeNext(findTail(freeList_[index]), start);
     }
     // 更新自由链表大小
     freeListSize_[index] += fetchNum; // 增加对应大小类的自由链表大小
@@ -150,9 +550,9 @@ void ThreadCache::fetchFromCentralCache(size_t index)
 
 void* ThreadCache::findTail(void* head)
 {
-    while(*reinterpret_cast<void**>(head))
+    while(void* next=loadNext(head))
     {
-        head=*reinterpret_cast<void**>(head);
+        head=next;
     }
     return head;
 }
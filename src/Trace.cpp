@@ -0,0 +1,203 @@
+#include "../include/Trace.h"
+#include "../include/logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace llt_memoryPool
+{
+namespace trace
+{
+
+#if LLT_MEMPOOL_TRACE
+
+std::atomic<bool> enabled{false};
+
+namespace
+{
+    // start/stop互斥，record不拿这把锁
+    std::mutex control_mutex;
+    int trace_fd = -1;
+    char* region = nullptr;
+    size_t region_bytes = 0;
+    size_t capacity = 0;
+    uint64_t start_ns = 0;
+    std::atomic<size_t> cursor{0};
+    std::atomic<uint64_t> dropped{0};
+    // 正在写记录的线程数，stop等它归零以后才能munmap
+    std::atomic<size_t> writers{0};
+    std::atomic<uint32_t> next_thread{0};
+    thread_local uint32_t thread_id = UINT32_MAX;
+
+    uint64_t nowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    TraceHeader* header()
+    {
+        return reinterpret_cast<TraceHeader*>(region);
+    }
+
+    TraceRecord* records()
+    {
+        return reinterpret_cast<TraceRecord*>(region + sizeof(TraceHeader));
+    }
+
+    // 环境变量LLT_MEMPOOL_TRACE_FILE：库加载时开始录，进程退出时收尾
+    struct EnvironmentTrace
+    {
+        EnvironmentTrace()
+        {
+            if (const char* path = std::getenv("LLT_MEMPOOL_TRACE_FILE"))
+            {
+                start(path);
+            }
+        }
+        ~EnvironmentTrace()
+        {
+            stop();
+        }
+    };
+    EnvironmentTrace environment_trace;
+}
+
+void record(Op op, const void* ptr, size_t size)
+{
+    // 先登记再复查开关：stop关掉开关以后只要等writers归零，就不会再有人写映射
+    writers.fetch_add(1, std::memory_order_seq_cst);
+    if (!enabled.load(std::memory_order_seq_cst))
+    {
+        writers.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+    size_t slot = cursor.fetch_add(1, std::memory_order_relaxed);
+    if (slot < capacity)
+    {
+        if (thread_id == UINT32_MAX)
+        {
+            thread_id = next_thread.fetch_add(1, std::memory_order_relaxed);
+        }
+        TraceRecord& record = records()[slot];
+        record.timestamp_ns = nowNs() - start_ns;
+        record.object = reinterpret_cast<uint64_t>(ptr);
+        record.size = size > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(size);
+        record.thread = static_cast<uint16_t>(thread_id);
+        record.op = static_cast<uint8_t>(op);
+        record.reserved = 0;
+    }
+    else
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    writers.fetch_sub(1, std::memory_order_release);
+}
+
+bool start(const char* path, size_t maxRecords)
+{
+    std::lock_guard<std::mutex> lock(control_mutex);
+    if (enabled.load(std::memory_order_relaxed) || maxRecords == 0)
+    {
+        return false;
+    }
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LogError("[Trace:start] 打开轨迹文件失败: %s", path);
+        return false;
+    }
+    size_t bytes = sizeof(TraceHeader) + maxRecords * sizeof(TraceRecord);
+    void* mapped = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(bytes)) == 0)
+    {
+        mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapped == MAP_FAILED)
+    {
+        ::close(fd);
+        LogError("[Trace:start] 映射轨迹文件失败: %s，%zu 字节", path, bytes);
+        return false;
+    }
+    trace_fd = fd;
+    region = static_cast<char*>(mapped);
+    region_bytes = bytes;
+    capacity = maxRecords;
+    start_ns = nowNs();
+    cursor.store(0, std::memory_order_relaxed);
+    dropped.store(0, std::memory_order_relaxed);
+    next_thread.store(0, std::memory_order_relaxed);
+    TraceHeader* h = header();
+    h->magic = TRACE_MAGIC;
+    h->version = TRACE_VERSION;
+    h->record_size = sizeof(TraceRecord);
+    h->record_count = 0;
+    h->dropped = 0;
+    h->start_ns = start_ns;
+    enabled.store(true, std::memory_order_seq_cst);
+    LogInfo("[Trace:start] 开始录制分配轨迹: %s，最多 %zu 条", path, maxRecords);
+    return true;
+}
+
+size_t stop()
+{
+    std::lock_guard<std::mutex> lock(control_mutex);
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    enabled.store(false, std::memory_order_seq_cst);
+    while (writers.load(std::memory_order_acquire) != 0)
+    {
+        std::this_thread::yield();
+    }
+    size_t count = std::min(cursor.load(std::memory_order_relaxed), capacity);
+    uint64_t lost = dropped.load(std::memory_order_relaxed);
+    TraceHeader* h = header();
+    h->record_count = count;
+    h->dropped = lost;
+    msync(region, region_bytes, MS_SYNC);
+    munmap(region, region_bytes);
+    if (::ftruncate(trace_fd, static_cast<off_t>(sizeof(TraceHeader) + count * sizeof(TraceRecord))) != 0)
+    {
+        LogWarn("[Trace:stop] 截断轨迹文件失败，文件尾部是空记录");
+    }
+    ::close(trace_fd);
+    trace_fd = -1;
+    region = nullptr;
+    LogInfo("[Trace:stop] 录制结束：%zu 条，丢弃 %llu 条", count, (unsigned long long)lost);
+    return count;
+}
+
+bool active()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool start(const char*, size_t)
+{
+    LogWarn("[Trace:start] 没有打开LLT_MEMPOOL_TRACE，不能录制分配轨迹");
+    return false;
+}
+
+size_t stop()
+{
+    return 0;
+}
+
+bool active()
+{
+    return false;
+}
+
+#endif
+
+} // namespace trace
+} // namespace llt_memoryPool
@@ -1,7 +1,130 @@
 #include "../include/logger.h"
+#include <chrono>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <new>
+#include <pthread.h>
 
 namespace llt_memoryPool
 {
+    std::atomic<bool> Logger::shutdown_{false};
+
+    bool LogRing::push(LogLevel level, bool isThread, const char* fmt, ...){
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail - head_.load(std::memory_order_acquire) >= CAPACITY){
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        char text[LOG_MAX_MESSAGE];
+        va_list args;
+        va_start(args, fmt);
+        int formatted = std::vsnprintf(text, sizeof(text), fmt, args);
+        va_end(args);
+        size_t length = formatted < 0 ? 0 : static_cast<size_t>(formatted);
+        if(length >= sizeof(text)){
+            length = utf8Cut(text, sizeof(text) - 1);
+        }
+        uint64_t timestamp_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        uint64_t thread_id = static_cast<uint64_t>(pthread_self());
+        // 按记录切开，每段都在完整的UTF-8字符处结束；全部写好以后才一次发布，写线程看不到半条消息
+        size_t next = tail;
+        size_t offset = 0;
+        do{
+            if(next - head_.load(std::memory_order_acquire) >= CAPACITY){
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            size_t take = std::min(length - offset, LOG_MESSAGE_SIZE - 1);
+            if(offset + take < length){
+                take = utf8Cut(text + offset, take);
+            }
+            LogRecord& record = records_[next & (CAPACITY - 1)];
+            record.timestamp_ns = timestamp_ns;
+            record.thread_id = thread_id;
+            record.level = level;
+            record.isThread = isThread;
+            std::memcpy(record.message, text + offset, take);
+            record.message[take] = '\0';
+            offset += take;
+            record.continued = offset < length;
+            ++next;
+        }while(offset < length);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool LogRing::pop(LogRecord& record){
+        size_t head = head_.load(std::memory_order_relaxed);
+        if(head == tail_.load(std::memory_order_acquire)){
+            return false;
+        }
+        record = records_[head & (CAPACITY - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    namespace
+    {
+        // 指针单独放在平凡析构的thread_local里：holder析构以后，
+        // 后析构的thread_local（比如ThreadCache）再写日志时能看到nullptr并重新申请
+        thread_local LogRing* localRingPtr = nullptr;
+
+        // 线程退出时把自己的缓冲区标记为dead，内存由写线程排空后回收
+        struct LocalRingHolder
+        {
+            ~LocalRingHolder(){
+                if(localRingPtr != nullptr){
+                    localRingPtr->dead.store(true, std::memory_order_release);
+                    localRingPtr = nullptr;
+                }
+            }
+        };
+        thread_local LocalRingHolder localRingHolder;
+    }
+
+    Logger::Logger(const std::string& filePath) {
+        logFileTime = getCurrentTime();
+        logFilePath = filePath;
+        if(logFilePath.empty()){
+            if(const char* dir = std::getenv("LLT_MEMPOOL_LOG_DIR")){
+                logFilePath = dir;
+            }
+        }
+        // 库被别的程序链接时，不能在它的工作目录下随便建目录
+        if(!logFilePath.empty()){
+            if(logFilePath.back() != '/'){
+                logFilePath += '/';
+            }
+            logFileName = "log_" + logFileTime + ".txt";
+            std::error_code ec;
+            std::filesystem::create_directories(logFilePath, ec);
+            logFile.open(logFilePath + logFileName, std::ios::app);
+            if (!logFile.is_open()) {
+                std::cerr << "Failed to open log file: " << logFilePath + logFileName << std::endl;
+            }
+        }
+        writer_ = std::thread(&Logger::writerLoop, this);
+    }
+
+    Logger::~Logger() {
+        shutdown_.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(writerMutex_);
+            stop_ = true;
+        }
+        writerCond_.notify_one();
+        if(writer_.joinable()){
+            writer_.join();
+        }
+        drain();
+        logFile.close();
+        // 还活着的线程可能仍持有缓冲区指针，这里不释放
+    }
+
     std::string Logger::getCurrentTime(){
         std::time_t now = std::time(nullptr);
         std::string timeStr = std::ctime(&now);
@@ -10,18 +133,30 @@ namespace llt_memoryPool
         }
         return timeStr;
     }
-    void Logger::log(LogLevel level, const std::string& message, bool isThread){
 
-        while(logFileLock.test_and_set(std::memory_order_acquire)){
-            std::this_thread::yield();
+    LogRing* Logger::localRing(){
+        if(localRingPtr != nullptr){
+            return localRingPtr;
         }
-        if(!logFile.is_open()){
-            std::cerr << "Log file is not open" << std::endl;
-            logFileLock.clear(std::memory_order_release);
-            return;
+        // 不走operator new：日志可能在内存池持锁的路径上写
+        void* memory = std::malloc(sizeof(LogRing));
+        if(memory == nullptr){
+            return nullptr;
         }
+        LogRing* ring = new (memory) LogRing();
+        LogRing* head = rings_.load(std::memory_order_relaxed);
+        do{
+            ring->next = head;
+        }while(!rings_.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+        localRingPtr = ring;
+        // 第一次用到时才注册析构
+        (void)&localRingHolder;
+        return ring;
+    }
+
+    void Logger::write(const LogRecord& record, const char* message){
         std::string levelStr;
-        switch(level){
+        switch(record.level){
             case LogLevel::INFO:
                 levelStr = "INFO";
                 break;
@@ -35,17 +170,88 @@ namespace llt_memoryPool
                 levelStr = "DEBUG";
                 break;
         }
-        std::string threadId = "";
-        if(isThread){
-           std::stringstream ss;
-           ss << "ThreadID:[" << std::this_thread::get_id() << "] ";
-           threadId = ss.str();
+        std::time_t seconds = static_cast<std::time_t>(record.timestamp_ns / 1000000000ULL);
+        char timeBuf[64];
+        std::tm tm;
+        localtime_r(&seconds, &tm);
+        std::strftime(timeBuf, sizeof(timeBuf), "%a %b %d %H:%M:%S %Y", &tm);
+
+        char threadBuf[64] = "";
+        if(record.isThread){
+            std::snprintf(threadBuf, sizeof(threadBuf), "ThreadID:[%llu] ",
+                          static_cast<unsigned long long>(record.thread_id));
+        }
+
+        std::string logMessage =" [" + levelStr + "] " + " : [" + timeBuf + "] : " + threadBuf + message + "\n";
+        // 慢路径事件（INFO/DEBUG）只进文件，WARN/ERROR同时打到stderr；没有日志文件时全部打到stderr
+        if(record.level <= LogLevel::WARN || !logFile.is_open()){
+            std::cerr << logMessage;
+        }
+        if(logFile.is_open()){
+            logFile << logMessage;
         }
+    }
+
+    size_t Logger::drain(){
+        size_t written = 0;
+        LogRecord record;
+        // 拆成几条记录的消息：同一条消息的记录是一起发布的，pop到续记录时后面的一定已经在了
+        std::string joined;
+        LogRing* prev = nullptr;
+        LogRing* ring = rings_.load(std::memory_order_acquire);
+        while(ring != nullptr){
+            bool dead = ring->dead.load(std::memory_order_acquire);
+            while(ring->pop(record)){
+                if(record.continued || !joined.empty()){
+                    joined += record.message;
+                    if(record.continued){
+                        continue;
+                    }
+                    write(record, joined.c_str());
+                    joined.clear();
+                }else{
+                    write(record, record.message);
+                }
+                ++written;
+            }
+            uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if(dropped != 0){
+                LogRecord note{};
+                note.timestamp_ns = static_cast<uint64_t>(std::time(nullptr)) * 1000000000ULL;
+                // 只记进文件，不刷屏
+                note.level = LogLevel::INFO;
+                std::snprintf(note.message, LOG_MESSAGE_SIZE, "[Logger] %llu log messages dropped (ring full)",
+                              static_cast<unsigned long long>(dropped));
+                write(note, note.message);
+            }
+            LogRing* next = ring->next;
+            // 新缓冲区只会插在链表头，所以非头结点可以安全摘掉
+            if(dead && prev != nullptr){
+                prev->next = next;
+                ring->~LogRing();
+                std::free(ring);
+            }else{
+                prev = ring;
+            }
+            ring = next;
+        }
+        if(written != 0 && logFile.is_open()){
+            logFile.flush();
+        }
+        return written;
+    }
+
+    void Logger::writerLoop(){
+        std::unique_lock<std::mutex> lock(writerMutex_);
+        // 持着writerMutex_排空，和flush()互斥，保证每个缓冲区只有一个消费者
+        while(!stop_){
+            writerCond_.wait_for(lock, std::chrono::milliseconds(20));
+            drain();
+        }
+    }
 
-        std::string logMessage =" [" + levelStr + "] " + " : [" + getCurrentTime() + "] : " + (isThread ? threadId : "") + message + "\n";
-        std::cout << logMessage;
-        logFile << logMessage;
-        logFile.flush();
-        logFileLock.clear(std::memory_order_release);
+    void Logger::flush(){
+        std::lock_guard<std::mutex> lock(writerMutex_);
+        drain();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,413 @@
+// 全局operator new/delete替换：不在库里，想让整个程序的new/delete都走内存池时，
+// 把这个目标文件（CMake目标llt_memorypool_newdelete）和库一起链接，不需要LD_PRELOAD也不用改代码
+//   - 普通、数组、nothrow、带大小、std::align_val_t各个版本全部替换
+//   - 带大小的delete直接MemoryPool::deallocate(ptr, size)，不查span；不带大小的先用MemoryPool::usableSize查出大小
+//   - 超过8字节的请求按16字节取整，满足__STDCPP_DEFAULT_NEW_ALIGNMENT__（和glibc malloc一样）
+//   - 对齐不超过一页：请求取整成对齐数的倍数。对象从页边界开始按等级大小排，等级大小是对齐数的倍数就自然对齐了
+//     对齐超过一页：多要一段走大对象路径，返回其中对齐的地址，释放时查span找回起点
+//   - 内存池内部再来的operator new（建NUMA拓扑时读sysfs、第一次写日志时启动写线程、压力回调……）不能再进内存池，
+//     从单独mmap的引导区分配，delete按地址区间认出来还回引导区
+#include "../../include/MemoryPool.h"
+#include "../../include/PageCache.h"
+#include "../../include/SpinLock.h"
+#include <cassert>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+namespace llt_memoryPool
+{
+namespace
+{
+    constexpr size_t NEW_ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+    // 不带std::align_val_t的版本传这个：不超过8字节的对象不需要16字节对齐
+    constexpr size_t DEFAULT_ALIGN = 0;
+
+    // 本线程正在内存池里面（分配或者释放的过程中）
+    __attribute__((tls_model("initial-exec")))
+    thread_local bool inside_pool = false;
+
+    class PoolScope
+    {
+    public:
+        PoolScope() : outer_(!inside_pool) { inside_pool = true; }
+        ~PoolScope()
+        {
+            if (outer_)
+            {
+                inside_pool = false;
+            }
+        }
+        PoolScope(const PoolScope&) = delete;
+        PoolScope& operator=(const PoolScope&) = delete;
+
+    private:
+        bool outer_;
+    };
+
+    // 引导区：块按2的幂取整，对象前16字节的头记着块的起点和等级，释放挂回同等级的链表
+    // 只有初始化和回调里的少量分配落在这里，只预留地址空间，物理页按需缺页
+    namespace bootstrap
+    {
+        constexpr size_t REGION_BYTES = size_t(256) << 20;
+        constexpr size_t HEADER_BYTES = 16;
+        constexpr size_t MIN_SHIFT = 5;
+        constexpr size_t MAX_SHIFT = 28;
+
+        struct Header
+        {
+            char* block;
+            size_t shift;
+        };
+        static_assert(sizeof(Header) == HEADER_BYTES, "bootstrap header must keep objects 16-byte aligned");
+
+        // 全部是常量初始化，静态构造之前就能用
+        std::atomic<char*> base{nullptr};
+        SpinLock lock;
+        size_t used = 0;
+        void* free_lists[MAX_SHIFT - MIN_SHIFT + 1] = {};
+
+        bool contains(const void* ptr)
+        {
+            char* begin = base.load(std::memory_order_relaxed);
+            return begin != nullptr &&
+                   reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(begin) < REGION_BYTES;
+        }
+
+        void* allocate(size_t size, size_t align)
+        {
+            // 对齐超过16时对象放在块起点往后align字节，块起点按align对齐
+            size_t offset = std::max(HEADER_BYTES, align);
+            if (size > REGION_BYTES - offset)
+            {
+                return nullptr;
+            }
+            size_t shift = MIN_SHIFT;
+            while ((size_t(1) << shift) < size + offset)
+            {
+                ++shift;
+            }
+            std::lock_guard<SpinLock> guard(lock);
+            char* block = nullptr;
+            void*& list = free_lists[shift - MIN_SHIFT];
+            if (offset == HEADER_BYTES && list != nullptr)
+            {
+                block = static_cast<char*>(list);
+                list = *reinterpret_cast<void**>(block);
+            }
+            else
+            {
+                char* begin = base.load(std::memory_order_relaxed);
+                if (begin == nullptr)
+                {
+                    void* region = mmap(nullptr, REGION_BYTES, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                    if (region == MAP_FAILED)
+                    {
+                        return nullptr;
+                    }
+                    begin = static_cast<char*>(region);
+                    base.store(begin, std::memory_order_release);
+                }
+                size_t start = (used + offset - 1) & ~(offset - 1);
+                if (start + (size_t(1) << shift) > REGION_BYTES)
+                {
+                    return nullptr;
+                }
+                block = begin + start;
+                used = start + (size_t(1) << shift);
+            }
+            char* object = block + offset;
+            Header* header = reinterpret_cast<Header*>(object - HEADER_BYTES);
+            header->block = block;
+            header->shift = shift;
+            return object;
+        }
+
+        void deallocate(void* ptr)
+        {
+            const Header* header = reinterpret_cast<const Header*>(static_cast<char*>(ptr) - HEADER_BYTES);
+            char* block = header->block;
+            size_t shift = header->shift;
+            std::lock_guard<SpinLock> guard(lock);
+            void*& list = free_lists[shift - MIN_SHIFT];
+            *reinterpret_cast<void**>(block) = list;
+            list = block;
+        }
+    }
+
+    // 向内存池要多大才能按align对齐：对齐数的倍数，并且落到的等级大小也是对齐数的倍数
+    // 分配和带大小的释放都用它，两边算出来的等级一定一致
+    size_t requestSize(size_t size, size_t align)
+    {
+        if (align == DEFAULT_ALIGN)
+        {
+            if (size <= ALIGNMENT)
+            {
+                return size;
+            }
+            align = NEW_ALIGNMENT;
+        }
+        size_t request = (size + align - 1) & ~(align - 1);
+#if LLT_MEMPOOL_GENERATED_CLASSES
+        // 生成的等级表只保证8字节对齐，跳过大小不是align倍数的等级；MAX_BYTES一定是页的倍数，循环会停
+        while (request <= MAX_BYTES)
+        {
+            size_t classSize = SizeClass::getSize(SizeClass::getIndex(request));
+            if (classSize % align == 0)
+            {
+                break;
+            }
+            request = (classSize + align - 1) & ~(align - 1);
+        }
+#endif
+        return request;
+    }
+
+    // 对齐超过一页：多要align-PAGE_SIZE字节并且一定走大对象路径（起点按页对齐），返回其中第一个对齐的地址
+    void* allocateOverAligned(size_t size, size_t align)
+    {
+        size_t request = std::max(size + align - PAGE_SIZE, MAX_BYTES + 1);
+        void* start = MemoryPool::allocate(request);
+        if (start == nullptr)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(start) + align - 1) & ~(uintptr_t(align) - 1));
+    }
+
+    // 返回的地址在大对象span中间，按span找回起点和整页的大小
+    void deallocateOverAligned(void* ptr)
+    {
+        size_t node = PageCache::findNode(ptr);
+        assert(node < MAX_NUMA_NODES);
+        Span* span = PageCache::getInstance(node).mapAddressToSpan(ptr);
+        MemoryPool::deallocate(span->start_address, span->num_pages * PAGE_SIZE);
+    }
+
+    void* allocate(size_t size, size_t align)
+    {
+        if (size > SIZE_MAX - std::max(align, PAGE_SIZE)) [[unlikely]]
+        {
+            return nullptr;
+        }
+        if (inside_pool) [[unlikely]]
+        {
+            return bootstrap::allocate(size, align);
+        }
+        PoolScope scope;
+        if (align <= PAGE_SIZE) [[likely]]
+        {
+            return MemoryPool::allocate(requestSize(size, align));
+        }
+        return allocateOverAligned(size, align);
+    }
+
+    void deallocate(void* ptr, size_t size, size_t align)
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        if (bootstrap::contains(ptr)) [[unlikely]]
+        {
+            bootstrap::deallocate(ptr);
+            return;
+        }
+        PoolScope scope;
+        if (align <= PAGE_SIZE) [[likely]]
+        {
+            MemoryPool::deallocate(ptr, requestSize(size, align));
+            return;
+        }
+        deallocateOverAligned(ptr);
+    }
+
+    void deallocateUnsized(void* ptr, size_t align)
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        if (bootstrap::contains(ptr)) [[unlikely]]
+        {
+            bootstrap::deallocate(ptr);
+            return;
+        }
+        PoolScope scope;
+        if (align > PAGE_SIZE) [[unlikely]]
+        {
+            deallocateOverAligned(ptr);
+            return;
+        }
+        // 等级大小（大对象是整页）和申请时的大小落在同一个等级
+        size_t size = MemoryPool::usableSize(ptr);
+#if LLT_MEMPOOL_HARDENED
+        if (size == 0)
+        {
+            hardening::fail("delete of pointer not returned by operator new", ptr);
+        }
+#endif
+        assert(size != 0);
+        MemoryPool::deallocate(ptr, size);
+    }
+
+    // 分配失败时按标准调new_handler再试，没有handler时返回nullptr
+    void* allocateOrHandle(size_t size, size_t align)
+    {
+        while (true)
+        {
+            if (void* ptr = allocate(size, align)) [[likely]]
+            {
+                return ptr;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr)
+            {
+                return nullptr;
+            }
+            handler();
+        }
+    }
+
+    void* allocateOrThrow(size_t size, size_t align)
+    {
+        void* ptr = allocateOrHandle(size, align);
+        if (ptr == nullptr) [[unlikely]]
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void* allocateNothrow(size_t size, size_t align) noexcept
+    {
+        try
+        {
+            return allocateOrHandle(size, align);
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    }
+
+    // 在普通的静态构造之前把内存池的单例（NUMA拓扑、日志、页堆……）在引导区的保护下建好，
+    // 之后先碰到它们的即使是直接调MemoryPool的代码，也不会在持锁时再构造单例
+    // 优先级排在加固模式初始化链表密钥（constructor(101)）之后
+    struct Warmup
+    {
+        Warmup()
+        {
+            ::operator delete(::operator new(1));
+        }
+    };
+    __attribute__((init_priority(102))) Warmup warmup;
+}
+} // namespace llt_memoryPool
+
+using llt_memoryPool::allocateNothrow;
+using llt_memoryPool::allocateOrThrow;
+using llt_memoryPool::deallocate;
+using llt_memoryPool::deallocateUnsized;
+using llt_memoryPool::DEFAULT_ALIGN;
+
+void* operator new(std::size_t size)
+{
+    return allocateOrThrow(size, DEFAULT_ALIGN);
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocateOrThrow(size, DEFAULT_ALIGN);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocateNothrow(size, DEFAULT_ALIGN);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocateNothrow(size, DEFAULT_ALIGN);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    return allocateOrThrow(size, static_cast<std::size_t>(align));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+    return allocateOrThrow(size, static_cast<std::size_t>(align));
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    return allocateNothrow(size, static_cast<std::size_t>(align));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    return allocateNothrow(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void* ptr) noexcept
+{
+    deallocateUnsized(ptr, DEFAULT_ALIGN);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    deallocateUnsized(ptr, DEFAULT_ALIGN);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    deallocateUnsized(ptr, DEFAULT_ALIGN);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    deallocateUnsized(ptr, DEFAULT_ALIGN);
+}
+
+void operator delete(void* ptr, std::size_t size) noexcept
+{
+    deallocate(ptr, size, DEFAULT_ALIGN);
+}
+
+void operator delete[](void* ptr, std::size_t size) noexcept
+{
+    deallocate(ptr, size, DEFAULT_ALIGN);
+}
+
+void operator delete(void* ptr, std::align_val_t align) noexcept
+{
+    deallocateUnsized(ptr, static_cast<std::size_t>(align));
+}
+
+void operator delete[](void* ptr, std::align_val_t align) noexcept
+{
+    deallocateUnsized(ptr, static_cast<std::size_t>(align));
+}
+
+void operator delete(void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    deallocateUnsized(ptr, static_cast<std::size_t>(align));
+}
+
+void operator delete[](void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    deallocateUnsized(ptr, static_cast<std::size_t>(align));
+}
+
+void operator delete(void* ptr, std::size_t size, std::align_val_t align) noexcept
+{
+    deallocate(ptr, size, static_cast<std::size_t>(align));
+}
+
+void operator delete[](void* ptr, std::size_t size, std::align_val_t align) noexcept
+{
+    deallocate(ptr, size, static_cast<std::size_t>(align));
+}
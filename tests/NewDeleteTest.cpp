@@ -0,0 +1,302 @@
+#include "../include/MemoryPool.h"
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <deque>
+
+// 这个程序链接了llt_memorypool_newdelete，全局operator new/delete都是内存池
+
+using namespace llt_memoryPool;
+
+namespace
+{
+    bool isAligned(const void* ptr, size_t align)
+    {
+        return (reinterpret_cast<uintptr_t>(ptr) & (align - 1)) == 0;
+    }
+
+    struct Tracked
+    {
+        static int live;
+        std::string name;
+        explicit Tracked(int i) : name("object-" + std::to_string(i)) { ++live; }
+        ~Tracked() { --live; }
+    };
+    int Tracked::live = 0;
+
+    struct alignas(64) CacheLine
+    {
+        char bytes[64];
+    };
+
+    struct alignas(8192) TwoPages
+    {
+        char bytes[100];
+    };
+}
+
+// new出来的内存来自内存池：usableSize只认内存池的指针
+void testPlainNewDelete()
+{
+    std::cout << "Running plain new/delete test..." << std::endl;
+
+    int* value = new int(42);
+    assert(*value == 42);
+    assert(MemoryPool::usableSize(value) >= sizeof(int));
+    delete value;
+
+    std::string* text = new std::string(1000, 'x');
+    assert(MemoryPool::usableSize(text) >= sizeof(std::string));
+    assert(MemoryPool::usableSize(const_cast<char*>(text->data())) >= 1000);
+    delete text;
+
+    // 大对象走页堆
+    char* big = new char[1 << 20];
+    std::memset(big, 0xab, 1 << 20);
+    assert(MemoryPool::usableSize(big) >= (1 << 20));
+    delete[] big;
+
+    std::cout << "Plain new/delete test passed!" << std::endl;
+}
+
+// 超过8字节的请求和malloc一样按16字节对齐
+void testDefaultAlignment()
+{
+    std::cout << "Running default alignment test..." << std::endl;
+
+    std::vector<void*> blocks;
+    for (size_t size = 1; size <= 2048; ++size)
+    {
+        void* ptr = ::operator new(size);
+        if (size > ALIGNMENT)
+        {
+            assert(isAligned(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__));
+        }
+        std::memset(ptr, 0x5a, size);
+        blocks.push_back(ptr);
+    }
+    for (size_t size = 1; size <= 2048; ++size)
+    {
+        ::operator delete(blocks[size - 1], size);
+    }
+
+    std::cout << "Default alignment test passed!" << std::endl;
+}
+
+// 数组：非平凡析构的类型delete[]带数组头的大小，平凡类型不带大小
+void testArrayNewDelete()
+{
+    std::cout << "Running array new/delete test..." << std::endl;
+
+    Tracked* objects = new Tracked[3]{Tracked(1), Tracked(2), Tracked(3)};
+    assert(Tracked::live == 3);
+    assert(objects[2].name == "object-3");
+    delete[] objects;
+    assert(Tracked::live == 0);
+
+    double* numbers = new double[777];
+    for (size_t i = 0; i < 777; ++i)
+    {
+        numbers[i] = static_cast<double>(i);
+    }
+    delete[] numbers;
+
+    void* raw = ::operator new[](300);
+    ::operator delete[](raw, 300);
+
+    std::cout << "Array new/delete test passed!" << std::endl;
+}
+
+// 不带大小的delete按span查出等级：释放后同一线程再要同样大小，拿回的是同一块
+void testUnsizedDelete()
+{
+    std::cout << "Running unsized delete test..." << std::endl;
+
+    const size_t sizes[] = {1, 8, 24, 100, 1000, 4096, 70000, 256 * 1024, 300 * 1024, 3 << 20};
+    for (size_t size : sizes)
+    {
+        void* ptr = ::operator new(size);
+        std::memset(ptr, 0x11, size);
+        ::operator delete(ptr);
+#if !LLT_MEMPOOL_PAGE_LOCAL
+        if (size <= MAX_BYTES && hardening::guardSampleRate() == 0)
+        {
+            // 三层引擎的线程缓存是后进先出的（保护页采样会打乱）
+            void* again = ::operator new(size);
+            assert(again == ptr);
+            ::operator delete(again, size);
+        }
+#endif
+    }
+
+    std::cout << "Unsized delete test passed!" << std::endl;
+}
+
+// 堆上限内拿不到内存：nothrow版本返回nullptr，普通版本先调new_handler，没有handler时抛bad_alloc
+void testNothrowAndHandler()
+{
+    std::cout << "Running nothrow and new_handler test..." << std::endl;
+
+    const size_t hugeBytes = size_t(64) << 20;
+    MemoryPool::setHeapLimit(MemoryPool::committedBytes() + (size_t(1) << 20));
+
+    char* none = new (std::nothrow) char[hugeBytes];
+    assert(none == nullptr);
+    void* alignedNone = ::operator new(hugeBytes, std::align_val_t(64), std::nothrow);
+    assert(alignedNone == nullptr);
+
+    bool thrown = false;
+    try
+    {
+        char* never = new char[hugeBytes];
+        delete[] never;
+    }
+    catch (const std::bad_alloc&)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // handler放开上限，下一次重试就能成功
+    static int handlerCalls = 0;
+    std::set_new_handler([] {
+        ++handlerCalls;
+        MemoryPool::setHeapLimit(0);
+    });
+    char* granted = new char[hugeBytes];
+    assert(handlerCalls == 1);
+    granted[hugeBytes - 1] = 1;
+    delete[] granted;
+    std::set_new_handler(nullptr);
+    MemoryPool::setHeapLimit(0);
+
+    std::cout << "Nothrow and new_handler test passed!" << std::endl;
+}
+
+// 对齐版本：一页以内靠等级大小对齐，超过一页走大对象路径；带大小和不带大小的释放都要能还回去
+void testAlignedNew()
+{
+    std::cout << "Running aligned new test..." << std::endl;
+
+    const size_t sizes[] = {1, 100, 5000, 300 * 1024};
+    for (size_t align = 16; align <= 65536; align <<= 1)
+    {
+        for (size_t size : sizes)
+        {
+            void* sized = ::operator new(size, std::align_val_t(align));
+            void* unsized = ::operator new[](size, std::align_val_t(align));
+            assert(isAligned(sized, align));
+            assert(isAligned(unsized, align));
+            std::memset(sized, 0x22, size);
+            std::memset(unsized, 0x33, size);
+            ::operator delete(sized, size, std::align_val_t(align));
+            ::operator delete[](unsized, std::align_val_t(align));
+        }
+    }
+
+    CacheLine* line = new CacheLine();
+    assert(isAligned(line, 64));
+    delete line;
+
+    TwoPages* pages = new TwoPages[3];
+    assert(isAligned(pages, 8192));
+    delete[] pages;
+
+    std::vector<std::unique_ptr<TwoPages>> many;
+    for (int i = 0; i < 32; ++i)
+    {
+        many.emplace_back(new TwoPages());
+        assert(isAligned(many.back().get(), 8192));
+    }
+    many.clear();
+
+    std::cout << "Aligned new test passed!" << std::endl;
+}
+
+// 标准库容器在多个线程里用，对象在一个线程new、另一个线程delete
+void testContainersAcrossThreads()
+{
+    std::cout << "Running containers across threads test..." << std::endl;
+
+    const int kThreads = 4;
+    const int kObjects = 20000;
+    std::mutex mutex;
+    std::deque<std::string*> handoff;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            std::map<int, std::string> local;
+            for (int i = 0; i < kObjects; ++i)
+            {
+                local[i] = std::string(static_cast<size_t>(i % 300), static_cast<char>('a' + t));
+                if (i % 3 == 0)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    handoff.push_back(new std::string(local[i] + "!"));
+                }
+                if (i % 5 == 0)
+                {
+                    std::string* other = nullptr;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!handoff.empty())
+                        {
+                            other = handoff.front();
+                            handoff.pop_front();
+                        }
+                    }
+                    if (other != nullptr)
+                    {
+                        assert(other->back() == '!');
+                        delete other;
+                    }
+                }
+            }
+            assert(local.size() == static_cast<size_t>(kObjects));
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    for (std::string* text : handoff)
+    {
+        delete text;
+    }
+
+    std::cout << "Containers across threads test passed!" << std::endl;
+}
+
+int main()
+{
+    try
+    {
+        std::cout << "Starting operator new/delete replacement tests..." << std::endl;
+
+        testPlainNewDelete();
+        testDefaultAlignment();
+        testArrayNewDelete();
+        testUnsizedDelete();
+        testNothrowAndHandler();
+        testAlignedNew();
+        testContainersAcrossThreads();
+
+        std::cout << "All operator new/delete tests passed!" << std::endl;
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Test failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
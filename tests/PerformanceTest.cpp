@@ -1,10 +1,23 @@
 #include "../include/MemoryPool.h"
+#include "../include/Numa.h"
+#include "../include/LocalHeap.h"
+#include "../include/ChainBuffer.h"
+#include "../include/CentralCache.h"
 #include <iostream>
 #include <vector>
 #include <chrono>
 #include <random>
 #include <iomanip>
 #include <thread>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <type_traits>
 
 using namespace llt_memoryPool;
 using namespace std::chrono;
@@ -23,6 +36,102 @@ public:
     }
 };
 
+// 对照组：Muduo原来的Buffer，一整块std::vector<char>，不够时扩容或者把数据挪回开头
+class VectorBuffer 
+{
+public:
+    static constexpr size_t kCheapPrepend = 8;
+    static constexpr size_t kInitialSize = 1024;
+
+    VectorBuffer() : buffer_(kCheapPrepend + kInitialSize), readerIndex_(kCheapPrepend), writerIndex_(kCheapPrepend) {}
+
+    size_t readableBytes() const { return writerIndex_ - readerIndex_; }
+    size_t writableBytes() const { return buffer_.size() - writerIndex_; }
+
+    void retrieve(size_t len) 
+    {
+        if (len < readableBytes()) 
+        {
+            readerIndex_ += len;
+        } 
+        else 
+        {
+            readerIndex_ = writerIndex_ = kCheapPrepend;
+        }
+    }
+
+    void append(const char* data, size_t len) 
+    {
+        if (writableBytes() < len) 
+        {
+            makeSpace(len);
+        }
+        std::copy(data, data + len, buffer_.begin() + writerIndex_);
+        writerIndex_ += len;
+    }
+
+    ssize_t readFd(int fd, int* savedErrno) 
+    {
+        char extrabuf[65536];
+        struct iovec vec[2];
+        const size_t writable = writableBytes();
+        vec[0].iov_base = buffer_.data() + writerIndex_;
+        vec[0].iov_len = writable;
+        vec[1].iov_base = extrabuf;
+        vec[1].iov_len = sizeof(extrabuf);
+        const int iovcnt = (writable < sizeof(extrabuf)) ? 2 : 1;
+        const ssize_t n = ::readv(fd, vec, iovcnt);
+        if (n < 0) 
+        {
+            *savedErrno = errno;
+        } 
+        else if (static_cast<size_t>(n) <= writable) 
+        {
+            writerIndex_ += n;
+        } 
+        else 
+        {
+            writerIndex_ = buffer_.size();
+            append(extrabuf, n - writable);
+        }
+        return n;
+    }
+
+    ssize_t writeFd(int fd, int* savedErrno) 
+    {
+        ssize_t n = ::write(fd, buffer_.data() + readerIndex_, readableBytes());
+        if (n < 0) 
+        {
+            *savedErrno = errno;
+        } 
+        else 
+        {
+            retrieve(n);
+        }
+        return n;
+    }
+
+private:
+    void makeSpace(size_t len) 
+    {
+        if (writableBytes() + readerIndex_ < len + kCheapPrepend) 
+        {
+            buffer_.resize(writerIndex_ + len);
+        } 
+        else 
+        {
+            size_t readable = readableBytes();
+            std::copy(buffer_.begin() + readerIndex_, buffer_.begin() + writerIndex_, buffer_.begin() + kCheapPrepend);
+            readerIndex_ = kCheapPrepend;
+            writerIndex_ = readerIndex_ + readable;
+        }
+    }
+
+    std::vector<char> buffer_;
+    size_t readerIndex_;
+    size_t writerIndex_;
+};
+
 // 性能测试类
 class PerformanceTest 
 {
@@ -292,20 +401,843 @@ public:
                       << t.elapsed() << " ms" << std::endl;
         }
     }
+
+    // 5. 热点等级测试：多线程反复整批分配释放64字节对象，
+    //    每轮都会整批进出CentralCache，测的是无锁批栈对span_lists_mutex_的分流效果
+    static void testHotSizeClass() 
+    {
+        constexpr size_t NUM_THREADS = 8;
+        constexpr size_t ROUNDS = 2000;
+        constexpr size_t OBJECT_SIZE = 64;
+        const size_t burst = SizeClass::getBatchNum(OBJECT_SIZE) * 3;
+
+        std::cout << "\nTesting hot size class (" << NUM_THREADS << " threads, "
+                  << ROUNDS << " rounds x " << burst << " objects of "
+                  << OBJECT_SIZE << " bytes):" << std::endl;
+
+        auto threadFunc = [burst](bool useMemPool) 
+        {
+            std::vector<void*> ptrs(burst);
+            for (size_t r = 0; r < ROUNDS; ++r) 
+            {
+                for (size_t i = 0; i < burst; ++i) 
+                {
+                    ptrs[i] = useMemPool ? MemoryPool::allocate(OBJECT_SIZE) 
+                                         : new char[OBJECT_SIZE];
+                }
+                for (size_t i = 0; i < burst; ++i) 
+                {
+                    if (useMemPool) 
+                    {
+                        MemoryPool::deallocate(ptrs[i], OBJECT_SIZE);
+                    } 
+                    else 
+                    {
+                        delete[] static_cast<char*>(ptrs[i]);
+                    }
+                }
+            }
+        };
+
+        for (bool useMemPool : {true, false}) 
+        {
+            Timer t;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < NUM_THREADS; ++i) 
+            {
+                threads.emplace_back(threadFunc, useMemPool);
+            }
+            for (auto& thread : threads) 
+            {
+                thread.join();
+            }
+            std::cout << (useMemPool ? "Memory Pool: " : "New/Delete: ") 
+                      << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        }
+    }
+
+    // 6. NUMA节点测试：真实拓扑与模拟2节点拓扑下各跑一遍
+    //    单节点机器上测不出远端访问的差别，但能看到按节点拆分CentralCache以后锁竞争的变化
+    static void testNumaLocality() 
+    {
+        constexpr size_t NUM_THREADS = 4;
+        constexpr size_t ROUNDS = 200;
+        constexpr size_t BATCH = 256;
+        constexpr size_t OBJECT_SIZE = 64;
+
+        std::cout << "\nTesting NUMA locality (" << NUM_THREADS << " threads, "
+                  << ROUNDS << " rounds x " << BATCH << " objects of "
+                  << OBJECT_SIZE << " bytes):" << std::endl;
+
+        auto threadFunc = []() 
+        {
+            std::vector<void*> ptrs(BATCH);
+            for (size_t r = 0; r < ROUNDS; ++r) 
+            {
+                for (size_t i = 0; i < BATCH; ++i) 
+                {
+                    ptrs[i] = MemoryPool::allocate(OBJECT_SIZE);
+                    // 写一遍，模拟真实访问
+                    static_cast<char*>(ptrs[i])[0] = static_cast<char>(i);
+                }
+                for (size_t i = 0; i < BATCH; ++i) 
+                {
+                    MemoryPool::deallocate(ptrs[i], OBJECT_SIZE);
+                }
+            }
+        };
+
+        auto run = [&](const char* label) 
+        {
+            Timer t;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < NUM_THREADS; ++i) 
+            {
+                threads.emplace_back(threadFunc);
+            }
+            for (auto& thread : threads) 
+            {
+                thread.join();
+            }
+            std::cout << label << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        };
+
+        NumaTopology& topology = NumaTopology::getInstance();
+        std::cout << "Detected nodes: " << topology.nodeCount() 
+                  << (topology.isSimulated() ? " (simulated)" : "") << std::endl;
+        run("Memory Pool (detected topology): ");
+
+        // 模拟拓扑只影响之后新建的线程
+        topology.simulate(2);
+        run("Memory Pool (simulated 2 nodes): ");
+        topology.simulate(1);
+    }
+    // 7. 加固模式开销：同一个负载分别链普通库和加固库（perf_hardening目标两边都跑）
+    //    单线程小对象随机分配/释放，保持一个活跃窗口，几乎都走线程缓存的快路径
+    static void testHardeningOverhead() 
+    {
+        constexpr size_t NUM_OPS = 2000000;
+        constexpr size_t WINDOW = 4096;
+        constexpr size_t REPEATS = 5;
+        const size_t SIZES[] = {16, 24, 32, 48, 64, 96, 128, 256};
+
+        std::cout << "\nTesting hardening overhead (" << NUM_OPS << " ops, "
+                  << (HARDENED ? "hardened" : "regular") << " build):" << std::endl;
+
+        std::vector<std::pair<void*, size_t>> window(WINDOW, {nullptr, 0});
+        double best = 0.0;
+        for (size_t r = 0; r < REPEATS; ++r) 
+        {
+            std::mt19937 rng(42);
+            Timer t;
+            for (size_t i = 0; i < NUM_OPS; ++i) 
+            {
+                auto& slot = window[rng() % WINDOW];
+                if (slot.first != nullptr) 
+                {
+                    MemoryPool::deallocate(slot.first, slot.second);
+                }
+                slot.second = SIZES[rng() % 8];
+                slot.first = MemoryPool::allocate(slot.second);
+            }
+            for (auto& slot : window) 
+            {
+                if (slot.first != nullptr) 
+                {
+                    MemoryPool::deallocate(slot.first, slot.second);
+                    slot.first = nullptr;
+                }
+            }
+            double elapsed = t.elapsed();
+            best = (r == 0 || elapsed < best) ? elapsed : best;
+        }
+        std::cout << "Memory Pool (best of " << REPEATS << "): " << std::fixed << std::setprecision(3) 
+                  << best << " ms" << std::endl;
+    }
+    // 8. 跨线程释放：生产者分配、通过单生产者单消费者环传给消费者释放
+    //    三层设计里对象先进消费者的线程缓存，再经中心缓存回到生产者；页本地引擎里一次CAS挂回所在页
+    static void testCrossThreadFree() 
+    {
+        constexpr size_t NUM_PAIRS = 4;
+        constexpr size_t NUM_OBJECTS = 500000;
+        constexpr size_t RING_SIZE = 1024;
+        constexpr size_t OBJECT_SIZE = 64;
+
+        std::cout << "\nTesting cross-thread free (" << NUM_PAIRS << " producer/consumer pairs, "
+                  << NUM_OBJECTS << " objects of " << OBJECT_SIZE << " bytes each):" << std::endl;
+
+        struct Ring 
+        {
+            void* slots[RING_SIZE];
+            alignas(64) std::atomic<size_t> head{0};
+            alignas(64) std::atomic<size_t> tail{0};
+        };
+
+        enum class Engine { Tiered, PageLocal, System };
+        auto run = [&](Engine engine, const char* label) 
+        {
+            std::vector<Ring> rings(NUM_PAIRS);
+            Timer t;
+            std::vector<std::thread> threads;
+            for (size_t pair = 0; pair < NUM_PAIRS; ++pair) 
+            {
+                Ring& ring = rings[pair];
+                threads.emplace_back([&ring, engine]() 
+                {
+                    for (size_t i = 0; i < NUM_OBJECTS; ++i) 
+                    {
+                        void* p = engine == Engine::Tiered    ? ThreadCache::getInstance()->allocate(OBJECT_SIZE)
+                                : engine == Engine::PageLocal ? LocalHeap::getInstance()->allocate(OBJECT_SIZE)
+                                                              : static_cast<void*>(new char[OBJECT_SIZE]);
+                        static_cast<char*>(p)[0] = static_cast<char>(i);
+                        size_t tail = ring.tail.load(std::memory_order_relaxed);
+                        while (tail - ring.head.load(std::memory_order_acquire) == RING_SIZE) 
+                        {
+                            std::this_thread::yield();
+                        }
+                        ring.slots[tail % RING_SIZE] = p;
+                        ring.tail.store(tail + 1, std::memory_order_release);
+                    }
+                });
+                threads.emplace_back([&ring, engine]() 
+                {
+                    for (size_t i = 0; i < NUM_OBJECTS; ++i) 
+                    {
+                        size_t head = ring.head.load(std::memory_order_relaxed);
+                        while (head == ring.tail.load(std::memory_order_acquire)) 
+                        {
+                            std::this_thread::yield();
+                        }
+                        void* p = ring.slots[head % RING_SIZE];
+                        ring.head.store(head + 1, std::memory_order_release);
+                        if (engine == Engine::Tiered) 
+                        {
+                            ThreadCache::getInstance()->deallocate(p, OBJECT_SIZE);
+                        } 
+                        else if (engine == Engine::PageLocal) 
+                        {
+                            LocalHeap::deallocate(p, OBJECT_SIZE);
+                        } 
+                        else 
+                        {
+                            delete[] static_cast<char*>(p);
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) 
+            {
+                thread.join();
+            }
+            std::cout << label << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        };
+
+        run(Engine::Tiered, "Tiered (ThreadCache/CentralCache): ");
+        run(Engine::PageLocal, "Page-local (LocalHeap): ");
+        run(Engine::System, "New/Delete: ");
+    }
+
+    // 9. 冷启动：新线程里对一个没人用过的等级连续分配并写入，看逐次延迟的p99
+    //    不预留时前几批要mmap、切span、逐页缺页；reserve之后应该和稳态一样
+    static void testColdStart() 
+    {
+        constexpr size_t NUM_ALLOCS = 20000;
+        constexpr size_t COLD_SIZE = 3000;
+        constexpr size_t RESERVED_SIZE = 3008;
+
+        std::cout << "\nTesting cold start latency (" << NUM_ALLOCS << " allocations of ~"
+                  << COLD_SIZE << " bytes, allocate + first write):" << std::endl;
+
+        auto measure = [](size_t size, const char* label, bool twice) 
+        {
+            std::thread([size, label, twice]() 
+            {
+                std::vector<void*> ptrs(NUM_ALLOCS);
+                std::vector<double> latencies(NUM_ALLOCS);
+                for (int pass = 0; pass < (twice ? 2 : 1); ++pass) 
+                {
+                    for (size_t i = 0; i < NUM_ALLOCS; ++i) 
+                    {
+                        auto start = high_resolution_clock::now();
+                        ptrs[i] = MemoryPool::allocate(size);
+                        static_cast<char*>(ptrs[i])[0] = 1;
+                        static_cast<char*>(ptrs[i])[size - 1] = 1;
+                        latencies[i] = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count();
+                    }
+                    for (void* p : ptrs) 
+                    {
+                        MemoryPool::deallocate(p, size);
+                    }
+                }
+                std::sort(latencies.begin(), latencies.end());
+                std::cout << label << std::fixed << std::setprecision(0)
+                          << "p50 " << latencies[NUM_ALLOCS / 2] << " ns, p99 "
+                          << latencies[NUM_ALLOCS * 99 / 100] << " ns, max "
+                          << latencies.back() << " ns" << std::endl;
+            }).join();
+        };
+
+        measure(COLD_SIZE, "Cold:     ", false);
+        Timer t;
+        MemoryPool::reserve(RESERVED_SIZE, NUM_ALLOCS);
+        double reserveMs = t.elapsed();
+        measure(RESERVED_SIZE, "Reserved: ", false);
+        // 同一个等级第二遍：span和物理页都已经在了
+        measure(COLD_SIZE, "Warm:     ", true);
+        std::cout << "reserve() took " << std::setprecision(3) << reserveMs << " ms" << std::endl;
+    }
+
+    // 10. 请求级分配：每个请求几十个小对象，请求结束一起释放
+    static void testRequestArena() 
+    {
+        constexpr size_t NUM_REQUESTS = 100000;
+        constexpr size_t OBJECTS_PER_REQUEST = 48;
+        const size_t SIZES[] = {16, 32, 48, 64, 96, 128, 192, 256};
+
+        std::cout << "\nTesting request-scoped allocations (" << NUM_REQUESTS << " requests x "
+                  << OBJECTS_PER_REQUEST << " objects):" << std::endl;
+
+        std::vector<std::pair<void*, size_t>> objects(OBJECTS_PER_REQUEST);
+        {
+            Timer t;
+            for (size_t r = 0; r < NUM_REQUESTS; ++r) 
+            {
+                for (size_t i = 0; i < OBJECTS_PER_REQUEST; ++i) 
+                {
+                    size_t size = SIZES[(r + i) % 8];
+                    objects[i] = {MemoryPool::allocate(size), size};
+                    static_cast<char*>(objects[i].first)[0] = 1;
+                }
+                for (auto& [p, size] : objects) 
+                {
+                    MemoryPool::deallocate(p, size);
+                }
+            }
+            std::cout << "MemoryPool allocate/deallocate: " << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        }
+        {
+            MemoryPool::Arena arena;
+            Timer t;
+            for (size_t r = 0; r < NUM_REQUESTS; ++r) 
+            {
+                for (size_t i = 0; i < OBJECTS_PER_REQUEST; ++i) 
+                {
+                    size_t size = SIZES[(r + i) % 8];
+                    void* p = arena.allocate(size);
+                    static_cast<char*>(p)[0] = 1;
+                }
+                arena.reset();
+            }
+            std::cout << "Arena + reset(): " << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms (" << arena.spanCount() << " spans kept)" << std::endl;
+        }
+        {
+            Timer t;
+            for (size_t r = 0; r < NUM_REQUESTS; ++r) 
+            {
+                for (size_t i = 0; i < OBJECTS_PER_REQUEST; ++i) 
+                {
+                    size_t size = SIZES[(r + i) % 8];
+                    objects[i] = {new char[size], size};
+                    static_cast<char*>(objects[i].first)[0] = 1;
+                }
+                for (auto& [p, size] : objects) 
+                {
+                    delete[] static_cast<char*>(p);
+                }
+            }
+            std::cout << "New/Delete: " << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        }
+    }
+
+    // 11. socketpair回显：客户端一个线程写、一个线程读，服务端用缓冲区readFd收、writeFd原样发回
+    //     每个连接一个缓冲区，模拟很多连接时每次循环都新建连接
+    //     storeAndForward时服务端先把所有数据收完再一次发回，缓冲区要一直长到totalBytes
+    template<typename Buffer>
+    static double echoOnce(size_t totalBytes, size_t messageSize, bool storeAndForward = false) 
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) 
+        {
+            return -1.0;
+        }
+        Timer t;
+        std::thread server([fd = fds[1], storeAndForward]() 
+        {
+            Buffer buf;
+            int savedErrno = 0;
+            while (buf.readFd(fd, &savedErrno) > 0) 
+            {
+                while (!storeAndForward && buf.readableBytes() > 0) 
+                {
+                    if (buf.writeFd(fd, &savedErrno) <= 0) 
+                    {
+                        return;
+                    }
+                }
+            }
+            while (buf.readableBytes() > 0) 
+            {
+                if (buf.writeFd(fd, &savedErrno) <= 0) 
+                {
+                    return;
+                }
+            }
+        });
+        std::thread writer([fd = fds[0], totalBytes, messageSize]() 
+        {
+            std::vector<char> message(messageSize, 'm');
+            for (size_t sent = 0; sent < totalBytes; sent += messageSize) 
+            {
+                size_t off = 0;
+                while (off < messageSize) 
+                {
+                    ssize_t n = ::write(fd, message.data() + off, messageSize - off);
+                    if (n <= 0) 
+                    {
+                        return;
+                    }
+                    off += n;
+                }
+            }
+            ::shutdown(fd, SHUT_WR);
+        });
+        std::vector<char> sink(65536);
+        size_t received = 0;
+        while (received < totalBytes) 
+        {
+            ssize_t n = ::read(fds[0], sink.data(), sink.size());
+            if (n <= 0) 
+            {
+                break;
+            }
+            received += n;
+        }
+        writer.join();
+        server.join();
+        double elapsed = t.elapsed();
+        close(fds[0]);
+        close(fds[1]);
+        return elapsed;
+    }
+
+    static void testBufferEcho() 
+    {
+        constexpr size_t TOTAL_BYTES = 64 * 1024 * 1024;
+        constexpr size_t CONNECTIONS = 8;
+
+        std::cout << "\nTesting socketpair echo (" << CONNECTIONS << " connections x "
+                  << (TOTAL_BYTES >> 20) << " MB each):" << std::endl;
+        for (size_t messageSize : {1024, 16 * 1024, 256 * 1024}) 
+        {
+            double chain = 0;
+            double vec = 0;
+            for (size_t c = 0; c < CONNECTIONS; ++c) 
+            {
+                chain += echoOnce<ChainBuffer>(TOTAL_BYTES, messageSize);
+                vec += echoOnce<VectorBuffer>(TOTAL_BYTES, messageSize);
+            }
+            std::cout << std::setw(7) << messageSize << "B messages  ChainBuffer: " << std::fixed << std::setprecision(3)
+                      << chain << " ms, vector<char>: " << vec << " ms" << std::endl;
+        }
+
+        // 先收完再发：vector要反复扩容搬数据，链式缓冲区只是往后挂块
+        constexpr size_t STORED_BYTES = 16 * 1024 * 1024;
+        double chain = 0;
+        double vec = 0;
+        for (size_t c = 0; c < CONNECTIONS; ++c) 
+        {
+            chain += echoOnce<ChainBuffer>(STORED_BYTES, 16 * 1024, true);
+            vec += echoOnce<VectorBuffer>(STORED_BYTES, 16 * 1024, true);
+        }
+        std::cout << "store-and-forward " << (STORED_BYTES >> 20) << " MB  ChainBuffer: " << std::fixed << std::setprecision(3)
+                  << chain << " ms, vector<char>: " << vec << " ms" << std::endl;
+    }
+
+    // 12. 长时间碎片：活跃集合反复涨到峰值再缩到一成，随机挑对象释放，中间不停替换
+    //    每轮缩完调一次releaseMemory，看钉在系统里的内存（RSS）和活跃字节的比值会不会越滚越大
+    static void testFragmentation(size_t rounds = 8) 
+    {
+        constexpr size_t PEAK_OBJECTS = 400000;
+        constexpr size_t CHURN_OPS = 400000;
+
+        std::cout << "\nTesting fragmentation (" << rounds << " rounds, peak "
+                  << PEAK_OBJECTS << " objects of 16-1024 bytes):" << std::endl;
+        std::cout << std::setw(6) << "round" << std::setw(8) << "phase"
+                  << std::setw(14) << "live MB" << std::setw(14) << "RSS MB"
+                  << std::setw(14) << "RSS/live" << std::endl;
+
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<size_t> sizeDist(16, 1024);
+        std::vector<std::pair<void*, size_t>> live;
+        live.reserve(PEAK_OBJECTS);
+        size_t liveBytes = 0;
+
+        auto allocateOne = [&]() 
+        {
+            size_t size = sizeDist(gen);
+            void* p = MemoryPool::allocate(size);
+            static_cast<char*>(p)[0] = 1;
+            live.emplace_back(p, size);
+            liveBytes += size;
+        };
+        auto freeRandom = [&]() 
+        {
+            size_t i = std::uniform_int_distribution<size_t>(0, live.size() - 1)(gen);
+            MemoryPool::deallocate(live[i].first, live[i].second);
+            liveBytes -= live[i].second;
+            live[i] = live.back();
+            live.pop_back();
+        };
+        auto report = [&](size_t round, const char* phase) 
+        {
+            double liveMB = liveBytes / (1024.0 * 1024.0);
+            double rssMB = residentBytes() / (1024.0 * 1024.0);
+            std::cout << std::setw(6) << round << std::setw(8) << phase << std::fixed << std::setprecision(2)
+                      << std::setw(14) << liveMB << std::setw(14) << rssMB
+                      << std::setw(14) << (liveBytes == 0 ? 0.0 : rssMB / liveMB) << std::endl;
+        };
+
+        Timer t;
+        for (size_t round = 1; round <= rounds; ++round) 
+        {
+            while (live.size() < PEAK_OBJECTS) 
+            {
+                allocateOne();
+            }
+            for (size_t i = 0; i < CHURN_OPS; ++i) 
+            {
+                freeRandom();
+                allocateOne();
+            }
+            report(round, "peak");
+            while (live.size() > PEAK_OBJECTS / 10) 
+            {
+                freeRandom();
+            }
+            MemoryPool::releaseMemory();
+            report(round, "shrunk");
+        }
+        for (auto& [p, size] : live) 
+        {
+            MemoryPool::deallocate(p, size);
+        }
+        std::cout << "Total: " << std::fixed << std::setprecision(3) << t.elapsed() << " ms" << std::endl;
+    }
+
+    // 13. 中心缓存桶锁：三种锁各自的中心缓存实例，线程直接在加锁路径上取、还一批
+    //     批数故意比整批少一个，绕开无锁批栈，测的就是桶锁保护的短临界区
+    //     同一等级是真冲突；相邻等级每个线程一个等级，看桶之间还有没有伪共享
+    static void testCentralLocks(size_t threadCount = 4, size_t rounds = 20000)
+    {
+        std::cout << "\nTesting CentralCache bucket locks (" << threadCount << " threads, "
+                  << rounds << " fetch/release rounds each, library default: "
+                  << lockName<CentralLock>() << "):" << std::endl;
+        std::cout << std::left << std::setw(10) << "lock"
+                  << std::right << std::setw(16) << "same class"
+                  << std::setw(20) << "adjacent classes" << std::endl;
+        printCentralLock<std::mutex>(threadCount, rounds);
+        printCentralLock<SpinLock>(threadCount, rounds);
+        printCentralLock<TicketLock>(threadCount, rounds);
+    }
+
+    // 14. 中等对象：32KB~256KB，每个线程保持一小批活跃对象随机替换，只写每页的第一个字节
+    //     看耗时，以及所有线程都拿着活跃对象时已提交内存比活跃字节多出多少
+    static void testMediumObjects(size_t threadCount = 2, size_t rounds = 100000)
+    {
+        constexpr size_t LIVE_PER_THREAD = 32;
+        std::cout << "\nTesting medium objects (32KB-256KB, " << threadCount << " threads, "
+                  << rounds << " replacements each, " << LIVE_PER_THREAD << " live per thread):" << std::endl;
+
+        auto run = [threadCount, rounds](bool usePool, double& committedRatio)
+        {
+            std::atomic<size_t> arrived{0};
+            std::atomic<bool> release{false};
+            std::atomic<size_t> liveBytes{0};
+            size_t committedBefore = MemoryPool::committedBytes();
+            auto threadFunc = [&](size_t id)
+            {
+                std::mt19937 gen(static_cast<unsigned>(id + 1));
+                // 按1KB取整：大小完全随机时原来的每8字节一个等级会在两万多个等级里各囤几个对象
+                std::uniform_int_distribution<size_t> kbDist(33, MAX_BYTES / 1024);
+                auto sizeDist = [&kbDist](std::mt19937& g) { return kbDist(g) * 1024; };
+                std::vector<std::pair<char*, size_t>> live(LIVE_PER_THREAD, {nullptr, 0});
+                auto allocateOne = [&](size_t size)
+                {
+                    char* p = usePool ? static_cast<char*>(MemoryPool::allocate(size)) : new char[size];
+                    for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+                    {
+                        p[offset] = 1;
+                    }
+                    return p;
+                };
+                auto freeOne = [&](char* p, size_t size)
+                {
+                    if (usePool)
+                    {
+                        MemoryPool::deallocate(p, size);
+                    }
+                    else
+                    {
+                        delete[] p;
+                    }
+                };
+                for (auto& slot : live)
+                {
+                    slot.second = sizeDist(gen);
+                    slot.first = allocateOne(slot.second);
+                }
+                for (size_t r = 0; r < rounds; ++r)
+                {
+                    auto& slot = live[gen() % LIVE_PER_THREAD];
+                    freeOne(slot.first, slot.second);
+                    slot.second = sizeDist(gen);
+                    slot.first = allocateOne(slot.second);
+                }
+                size_t bytes = 0;
+                for (auto& slot : live)
+                {
+                    bytes += slot.second;
+                }
+                liveBytes.fetch_add(bytes);
+                arrived.fetch_add(1);
+                while (!release.load())
+                {
+                    std::this_thread::yield();
+                }
+                for (auto& slot : live)
+                {
+                    freeOne(slot.first, slot.second);
+                }
+            };
+            Timer t;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < threadCount; ++i)
+            {
+                threads.emplace_back(threadFunc, i);
+            }
+            while (arrived.load() != threadCount)
+            {
+                std::this_thread::yield();
+            }
+            size_t committed = MemoryPool::committedBytes() - committedBefore;
+            committedRatio = static_cast<double>(committed) / static_cast<double>(liveBytes.load());
+            release.store(true);
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+            return t.elapsed();
+        };
+
+        double ratio = 0.0;
+        double poolTime = run(true, ratio);
+        std::cout << "Memory Pool: " << std::fixed << std::setprecision(3) << poolTime
+                  << " ms, committed/live " << std::setprecision(2) << ratio << std::endl;
+        double unused = 0.0;
+        double systemTime = run(false, unused);
+        std::cout << "New/Delete: " << std::fixed << std::setprecision(3) << systemTime << " ms" << std::endl;
+    }
+
+    // 15. 空span抖动：单线程反复把一个等级的整个span取空再全部还回，
+    //     不留空span时每一轮都要把span还给页堆、下一轮再要回来重新切
+    static void testSpanOscillation(size_t rounds = 20000)
+    {
+        constexpr size_t OBJECT_SIZE = 1024;
+        std::cout << "\nTesting empty span oscillation (" << OBJECT_SIZE << " bytes, "
+                  << rounds << " rounds):" << std::endl;
+        std::cout << std::left << std::setw(14) << "empty spans"
+                  << std::right << std::setw(14) << "time"
+                  << std::setw(12) << "new spans" << std::endl;
+
+        auto run = [rounds](size_t keep)
+        {
+            // 单独的堆：中心缓存和页堆只有这个测试在用
+            Heap* heap = Heap::create();
+            heap->setEmptySpanLimit(keep);
+            CentralCache& central = heap->centralCache(0);
+            size_t index = SizeClass::getIndex(OBJECT_SIZE);
+            size_t total = SizeClass::getPages(index) * PAGE_SIZE / OBJECT_SIZE;
+            size_t batch = SizeClass::getBatchNum(OBJECT_SIZE) - 1;
+            std::vector<std::pair<void*, size_t>> ranges;
+            Timer t;
+            for (size_t r = 0; r < rounds; ++r)
+            {
+                ranges.clear();
+                for (size_t fetched = 0; fetched < total;)
+                {
+                    void* start = nullptr;
+                    void* end = nullptr;
+                    size_t got = central.fetchRange(start, end, index, std::min(batch, total - fetched));
+                    ranges.emplace_back(start, got);
+                    fetched += got;
+                }
+                for (auto& range : ranges)
+                {
+                    central.releaseListToSpans(range.first, range.second, OBJECT_SIZE);
+                }
+            }
+            double elapsed = t.elapsed();
+            std::cout << std::left << std::setw(14) << keep
+                      << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(11) << elapsed << " ms"
+                      << std::setw(12) << central.counters(index).new_spans << std::endl;
+            heap->destroy();
+        };
+        run(0);
+        run(DEFAULT_EMPTY_SPANS);
+    }
+
+private:
+    // /proc/self/statm第二列是常驻页数
+    static size_t residentBytes() 
+    {
+        size_t pages = 0;
+        size_t resident = 0;
+        if (FILE* f = std::fopen("/proc/self/statm", "r")) 
+        {
+            if (std::fscanf(f, "%zu %zu", &pages, &resident) != 2) 
+            {
+                resident = 0;
+            }
+            std::fclose(f);
+        }
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    template<typename Lock>
+    static const char* lockName()
+    {
+        if (std::is_same<Lock, SpinLock>::value) return "spin";
+        if (std::is_same<Lock, TicketLock>::value) return "ticket";
+        return "mutex";
+    }
+
+    // 每个线程反复从index等级取一批、原样还回去，返回总耗时（毫秒）
+    template<typename Lock>
+    static double centralLockRun(size_t threadCount, size_t rounds, bool sameClass)
+    {
+        constexpr size_t OBJECT_SIZE = 64;
+        // 最后一个节点的中心缓存没人用，不和库里的实例抢同一个PageCache锁
+        BasicCentralCache<Lock>& central = BasicCentralCache<Lock>::getInstance(MAX_NUMA_NODES - 1);
+        auto threadFunc = [&central, rounds, sameClass](size_t id)
+        {
+            size_t index = SizeClass::getIndex(OBJECT_SIZE) + (sameClass ? 0 : id);
+            size_t size = SizeClass::getSize(index);
+            size_t batch = SizeClass::getBatchNum(size) - 1;
+            for (size_t r = 0; r < rounds; ++r)
+            {
+                void* start = nullptr;
+                void* end = nullptr;
+                size_t got = central.fetchRange(start, end, index, batch);
+                if (got != 0)
+                {
+                    central.releaseListToSpans(start, got, size);
+                }
+            }
+        };
+        Timer t;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back(threadFunc, i);
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        return t.elapsed();
+    }
+
+    template<typename Lock>
+    static void printCentralLock(size_t threadCount, size_t rounds)
+    {
+        double same = centralLockRun<Lock>(threadCount, rounds, true);
+        double adjacent = centralLockRun<Lock>(threadCount, rounds, false);
+        std::cout << std::left << std::setw(10) << lockName<Lock>()
+                  << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(13) << same << " ms"
+                  << std::setw(17) << adjacent << " ms" << std::endl;
+    }
 };
 
-int main() 
+int main(int argc, char* argv[]) 
 {
 
     std::cout << "Starting performance tests..." << std::endl;
     
     // 预热系统
     PerformanceTest::warmup();
+    MemoryPool::resetInstrumentation();
+
+    // 只跑加固开销对比
+    if (argc > 1 && std::string(argv[1]) == "--hardening") 
+    {
+        PerformanceTest::testHardeningOverhead();
+        return 0;
+    }
+
+    // 只跑缓冲区回显
+    if (argc > 1 && std::string(argv[1]) == "--buffer") 
+    {
+        PerformanceTest::testBufferEcho();
+        return 0;
+    }
+
+    // 只跑中心缓存桶锁对比，可以指定线程数
+    if (argc > 1 && std::string(argv[1]) == "--locks") 
+    {
+        PerformanceTest::testCentralLocks(argc > 2 ? std::stoul(argv[2]) : 4);
+        return 0;
+    }
+
+    // 只跑碎片测试，可以指定轮数跑更久
+    if (argc > 1 && std::string(argv[1]) == "--fragmentation") 
+    {
+        PerformanceTest::testFragmentation(argc > 2 ? std::stoul(argv[2]) : 32);
+        return 0;
+    }
+    
+    // 只跑中等对象，可以指定线程数
+    if (argc > 1 && std::string(argv[1]) == "--medium") 
+    {
+        PerformanceTest::testMediumObjects(argc > 2 ? std::stoul(argv[2]) : 2);
+        return 0;
+    }
+    
+    // 只跑空span抖动，可以指定轮数
+    if (argc > 1 && std::string(argv[1]) == "--oscillation") 
+    {
+        PerformanceTest::testSpanOscillation(argc > 2 ? std::stoul(argv[2]) : 20000);
+        return 0;
+    }
     
     // 运行测试
     PerformanceTest::testSmallAllocation();
     PerformanceTest::testMultiThreaded();
     PerformanceTest::testMixedSizes();
+    PerformanceTest::testHotSizeClass();
+    PerformanceTest::testNumaLocality();
+    PerformanceTest::testHardeningOverhead();
+    PerformanceTest::testCrossThreadFree();
+    PerformanceTest::testColdStart();
+    PerformanceTest::testRequestArena();
+    PerformanceTest::testBufferEcho();
+    PerformanceTest::testFragmentation();
+    PerformanceTest::testCentralLocks();
+    PerformanceTest::testMediumObjects();
+    PerformanceTest::testSpanOscillation();
+
+    // 打开LLT_MEMPOOL_INSTRUMENT构建时，顺便看看整轮压测里哪把锁、哪条慢路径最贵
+    if (INSTRUMENTED)
+    {
+        MemoryPool::dumpInstrumentation(stdout);
+    }
     
     return 0;
 }
\ No newline at end of file
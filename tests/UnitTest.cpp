@@ -1,12 +1,30 @@
 #include "../include/MemoryPool.h"
+#include "../include/PageCache.h"
+#include "../include/CentralCache.h"
+#include "../include/LocalHeap.h"
+#include "../include/ChainBuffer.h"
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <string>
 #include <thread>
 #include <cassert>
 #include <cstring>
 #include <random>
 #include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cerrno>
 
 using namespace llt_memoryPool;
 
@@ -183,6 +201,1521 @@ void testStress()
     std::cout << "Stress test passed!" << std::endl;
 }
 
+// NUMA模拟拓扑测试
+void testNumaSimulatedTopology()
+{
+    std::cout << "Running simulated NUMA topology test..." << std::endl;
+
+    NumaTopology::getInstance().simulate(2);
+
+    // 前面的测试没用过的大小等级，保证这些span里只有本测试的对象
+    constexpr size_t OBJECT_SIZE = 12 * 1024;
+    constexpr int ALLOCS_PER_THREAD = 128;
+    std::vector<void*> ptrs[2];
+    size_t nodes[2] = {0, 0};
+
+    // 每个线程只能拿到自己节点页堆里的内存
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            nodes[t] = ThreadCache::getInstance()->node();
+            for (int i = 0; i < ALLOCS_PER_THREAD; ++i)
+            {
+                void* p = MemoryPool::allocate(OBJECT_SIZE);
+                assert(p != nullptr);
+                assert(PageCache::getInstance(nodes[t]).mapAddressToSpan(p) != nullptr);
+                ptrs[t].push_back(p);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    assert(nodes[0] != nodes[1]);
+    threads.clear();
+
+    // 交叉释放：线程退出时对象要回到分配它的那个节点
+    for (int t = 0; t < 2; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (void* p : ptrs[1 - t])
+            {
+                MemoryPool::deallocate(p, OBJECT_SIZE);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    // 整批还回来的对象会先囤在无锁栈里，拆回span以后再检查
+    // 拆栈时跨节点的对象会还到另一个节点，两边都拆完再把各等级留着的空span还掉
+    CentralCache::getInstance(nodes[0]).drainBatchStacks();
+    CentralCache::getInstance(nodes[1]).drainBatchStacks();
+    CentralCache::getInstance(nodes[0]).releaseEmptySpans();
+    CentralCache::getInstance(nodes[1]).releaseEmptySpans();
+    for (int t = 0; t < 2; ++t)
+    {
+        for (void* p : ptrs[t])
+        {
+            assert(PageCache::findNode(p, 0) == nodes[t]);
+            // span全部归还以后应该回到了页堆的空闲链表
+            assert(PageCache::getInstance(nodes[t]).mapAddressToSpan(p)->location == false);
+        }
+    }
+
+    NumaTopology::getInstance().simulate(1);
+    std::cout << "Simulated NUMA topology test passed!" << std::endl;
+}
+
+// 页堆空闲索引测试：按页数找最合适的空闲span，拆分剩下的部分和归还的span能再被找到
+void testPageCacheFreeIndex()
+{
+    std::cout << "Running page cache free index test..." << std::endl;
+
+    // 用一个没人用过的节点的页堆，里面只有本测试的span
+    PageCache& cache = PageCache::getInstance(MAX_NUMA_NODES - 1);
+    constexpr size_t RUN_PAGES = 1000;
+
+    Span* run = cache.allocateSpan(RUN_PAGES);
+    assert(run != nullptr && run->num_pages == RUN_PAGES);
+    char* base = static_cast<char*>(PageCache::getPageAddress(run));
+    // 超过以前256页的上限也要整段留在空闲索引里
+    cache.deallocateSpan(run);
+    Span* free_run = cache.mapAddressToSpan(base);
+    assert(free_run != nullptr && !free_run->location && free_run->num_pages == RUN_PAGES);
+
+    // 从低地址往后切
+    Span* a = cache.allocateSpan(300);
+    Span* b = cache.allocateSpan(300);
+    Span* c = cache.allocateSpan(300);
+    Span* d = cache.allocateSpan(3);
+    assert(PageCache::getPageAddress(a) == base);
+    assert(PageCache::getPageAddress(b) == base + 300 * PAGE_SIZE);
+    assert(PageCache::getPageAddress(c) == base + 600 * PAGE_SIZE);
+    assert(PageCache::getPageAddress(d) == base + 900 * PAGE_SIZE);
+
+    // 空闲的有300页（b）和97页（尾巴），200页要选刚好够用的b
+    cache.deallocateSpan(b);
+    Span* e = cache.allocateSpan(200);
+    assert(PageCache::getPageAddress(e) == base + 300 * PAGE_SIZE);
+    // 97页的尾巴比b剩下的100页小，50页从尾巴里切
+    Span* f = cache.allocateSpan(50);
+    assert(PageCache::getPageAddress(f) == base + 903 * PAGE_SIZE);
+
+    // 按任意顺序还回去：释放时不合并，a还是原来的300页
+    for (Span* span : {c, a, f, e, d})
+    {
+        cache.deallocateSpan(span);
+    }
+    free_run = cache.mapAddressToSpan(base);
+    assert(free_run == a && !free_run->location && free_run->num_pages == 300);
+
+    // 要整段时才合并，拿到的还是原来那一段，不提交新页
+    const size_t mapped = PageCache::mappedBytes();
+    run = cache.allocateSpan(RUN_PAGES);
+    assert(PageCache::getPageAddress(run) == base);
+    assert(cache.mapAddressToSpan(base + (RUN_PAGES - 1) * PAGE_SIZE) == run);
+    assert(PageCache::mappedBytes() == mapped);
+    cache.deallocateSpan(run);
+
+    std::cout << "Page cache free index test passed!" << std::endl;
+}
+
+void testPageArena()
+{
+    std::cout << "Running page arena test..." << std::endl;
+
+    constexpr size_t NODE = MAX_NUMA_NODES - 2;
+    PageCache& cache = PageCache::getInstance(NODE);
+
+    // 每次提交都接着上一次往后，地址连续
+    Span* a = cache.allocateSpan(MinSystemAllocPages);
+    Span* b = cache.allocateSpan(MinSystemAllocPages);
+    char* a_address = static_cast<char*>(PageCache::getPageAddress(a));
+    char* b_address = static_cast<char*>(PageCache::getPageAddress(b));
+    assert(b_address == a_address + MinSystemAllocPages * PAGE_SIZE);
+    assert(cache.reservedBytes() >= ARENA_MIN_RESERVE_BYTES);
+
+    // 归属判断只看地址区间
+    int on_stack = 0;
+    assert(cache.owns(a_address) && cache.owns(b_address + PAGE_SIZE - 1));
+    assert(!cache.owns(&on_stack));
+    assert(PageCache::findNode(b_address, 0) == NODE);
+    assert(PageCache::findNode(&on_stack, NODE) == MAX_NUMA_NODES);
+    assert(cache.mapAddressToSpan(a_address + PAGE_SIZE) == a);
+    assert(cache.mapAddressToSpan(&on_stack) == nullptr);
+    // 预留了但还没提交的地址也不属于任何span
+    assert(cache.mapAddressToSpan(b_address + MinSystemAllocPages * PAGE_SIZE) == nullptr);
+
+    cache.deallocateSpan(b);
+    cache.deallocateSpan(a);
+    assert(cache.coalesceFreeSpans() >= 1);
+    Span* merged = cache.mapAddressToSpan(b_address);
+    assert(merged != nullptr && !merged->location && merged->num_pages == 2 * MinSystemAllocPages);
+
+    // 已经还给系统的和还提交着的相邻span不合并，提交着的那一半不会被madvise掉
+    a = cache.allocateSpan(MinSystemAllocPages);
+    b = cache.allocateSpan(MinSystemAllocPages);
+    assert(PageCache::getPageAddress(a) == a_address && PageCache::getPageAddress(b) == b_address);
+    cache.deallocateSpan(a, true);
+    cache.deallocateSpan(b);
+    cache.coalesceFreeSpans();
+    assert(cache.mapAddressToSpan(a_address) == a && a->decommitted && a->num_pages == MinSystemAllocPages);
+    assert(cache.mapAddressToSpan(b_address) == b && !b->decommitted && b->num_pages == MinSystemAllocPages);
+    // 两半都还给系统以后可以合并
+    cache.releaseFreeSpans();
+    assert(cache.coalesceFreeSpans() >= 1);
+    merged = cache.mapAddressToSpan(b_address);
+    assert(merged->decommitted && merged->num_pages == 2 * MinSystemAllocPages);
+
+    std::cout << "Page arena test passed!" << std::endl;
+}
+
+// 热点等级测试：大量线程反复整批分配释放同一个大小，
+// 走CentralCache的无锁栈，检查同一个对象不会同时发给两个线程
+void testHotSizeClass()
+{
+    std::cout << "Running hot size class test..." << std::endl;
+
+    const int NUM_THREADS = 8;
+    const int ROUNDS = 200;
+    const size_t OBJECT_SIZE = 64;
+    // 比两批多一点，保证每轮都会整批还给CentralCache
+    const size_t BATCH = SizeClass::getBatchNum(OBJECT_SIZE) * 3;
+    std::atomic<bool> has_error{false};
+
+    auto threadFunc = [&](int id)
+    {
+        std::vector<void*> ptrs(BATCH);
+        for (int r = 0; r < ROUNDS && !has_error; ++r)
+        {
+            for (size_t i = 0; i < BATCH; ++i)
+            {
+                ptrs[i] = MemoryPool::allocate(OBJECT_SIZE);
+                std::memset(ptrs[i], id, OBJECT_SIZE);
+            }
+            std::this_thread::yield();
+            for (size_t i = 0; i < BATCH; ++i)
+            {
+                const unsigned char* bytes = static_cast<unsigned char*>(ptrs[i]);
+                for (size_t j = 0; j < OBJECT_SIZE; ++j)
+                {
+                    if (bytes[j] != static_cast<unsigned char>(id))
+                    {
+                        has_error = true;
+                    }
+                }
+                MemoryPool::deallocate(ptrs[i], OBJECT_SIZE);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.emplace_back(threadFunc, i + 1);
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    assert(!has_error);
+
+    std::cout << "Hot size class test passed!" << std::endl;
+}
+
+// 异步日志测试：多线程并发写日志，flush以后缓冲区应该被排空
+void testAsyncLogger()
+{
+    std::cout << "Running async logger test..." << std::endl;
+
+    // 编译期被关掉的级别，实参根本不会被求值
+    int evaluated = 0;
+    auto touch = [&evaluated]() { return ++evaluated; };
+    if constexpr (!isLogLevelEnabled(LogLevel::DEBUG))
+    {
+        LogDebug("[UnitTest] never formatted %d", 0);
+    }
+    else
+    {
+        LogDebug("[UnitTest] debug enabled %d", touch());
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([t]() {
+            for (int i = 0; i < 100; ++i)
+            {
+                LogInfo("[UnitTest] thread %d message %d", t, i);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    Logger::getInstance().flush();
+    assert(evaluated == (isLogLevelEnabled(LogLevel::DEBUG) ? 1 : 0));
+
+    // 比一条记录长的中文消息拆成几条记录，每条都在完整的字符处断开，拼起来和原文一样
+    std::string text;
+    for (int i = 0; i < 20; ++i)
+    {
+        text += "级联回收还给系统" + std::to_string(i) + "字节，";
+    }
+    std::unique_ptr<LogRing> ring(new LogRing());
+    assert(ring->push(LogLevel::INFO, false, "%s", text.c_str()));
+    std::string joined;
+    LogRecord record;
+    size_t records = 0;
+    do
+    {
+        assert(ring->pop(record));
+        size_t length = std::strlen(record.message);
+        assert(utf8Cut(record.message, length) == length);
+        joined += record.message;
+        ++records;
+    } while (record.continued);
+    assert(joined == text);
+    assert(records > 1);
+    assert(!ring->pop(record));
+
+    std::cout << "Async logger test passed!" << std::endl;
+}
+
+// 线程缓存回收测试：空闲线程收到回收请求后，在下一次操作时把多余的缓存还回去
+void testThreadCacheTrim()
+{
+    std::cout << "Running thread cache trim test..." << std::endl;
+
+    const size_t liveBefore = ThreadCache::liveCount();
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool ready = false;
+    bool go = false;
+    size_t cachedBefore = 0;
+    size_t cachedAfter = 0;
+
+    std::thread worker([&]() {
+        // 在很多等级上各留下接近两批的空闲对象
+        for (size_t size = 16; size <= 1024; size += 8)
+        {
+            const size_t count = SizeClass::getBatchNum(size) * 2;
+            std::vector<void*> ptrs;
+            for (size_t i = 0; i < count; ++i)
+            {
+                ptrs.push_back(MemoryPool::allocate(size));
+            }
+            for (void* p : ptrs)
+            {
+                MemoryPool::deallocate(p, size);
+            }
+        }
+        cachedBefore = ThreadCache::getInstance()->cachedBytes();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready = true;
+            cond.notify_all();
+            cond.wait(lock, [&] { return go; });
+        }
+        // 醒来后的第一次释放会看到回收请求
+        void* p = MemoryPool::allocate(16);
+        MemoryPool::deallocate(p, 16);
+        cachedAfter = ThreadCache::getInstance()->cachedBytes();
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return ready; });
+    }
+    assert(ThreadCache::liveCount() >= liveBefore + 1);
+
+    // 第一轮里worker刚走过慢路径，算忙；第二轮它已经空闲了一整轮
+    MemoryPool::trimThreadCaches();
+    assert(MemoryPool::trimThreadCaches() >= 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        go = true;
+    }
+    cond.notify_all();
+    worker.join();
+
+    assert(cachedAfter < cachedBefore);
+    assert(ThreadCache::liveCount() == liveBefore);
+
+    // 当前线程直接回收
+    MemoryPool::trimCurrentThread();
+
+    std::cout << "Thread cache trim test passed!" << std::endl;
+}
+
+// 线程退出阶段的分配测试用：析构函数里反复分配释放，记下用到的线程缓存
+bool exitCacheReused = false;
+bool exitCacheEmpty = false;
+
+struct ExitAllocator
+{
+    ~ExitAllocator()
+    {
+        ThreadCache* first = nullptr;
+        bool reused = true;
+        bool empty = true;
+        for (int round = 0; round < 100; ++round)
+        {
+            void* small = MemoryPool::allocate(64);
+            void* medium = MemoryPool::allocate(MEDIUM_BYTES);
+            std::memset(small, 0x5a, 64);
+            MemoryPool::deallocate(medium, MEDIUM_BYTES);
+            MemoryPool::deallocate(small, 64);
+            ThreadCache* cache = ThreadCache::currentIfCreated();
+            if (first == nullptr)
+            {
+                first = cache;
+            }
+            reused = reused && cache == first;
+            empty = empty && cache != nullptr && cache->cachedBytes() == 0;
+        }
+        exitCacheReused = reused;
+        exitCacheEmpty = empty;
+    }
+};
+
+// 线程退出阶段的分配测试：线程缓存析构以后，别的thread_local析构函数里还能分配，
+// 反复用同一个直通实例，不囤对象，线程结束时实例也被归还
+void testThreadExitAllocation()
+{
+    std::cout << "Running thread exit allocation test..." << std::endl;
+
+    const size_t liveBefore = ThreadCache::liveCount();
+    exitCacheReused = false;
+    exitCacheEmpty = false;
+    std::thread worker([] {
+        // 先于线程缓存构造，所以在它之后析构
+        static thread_local ExitAllocator allocator;
+        (void)allocator;
+        void* p = MemoryPool::allocate(64);
+        MemoryPool::deallocate(p, 64);
+    });
+    worker.join();
+
+    assert(exitCacheReused);
+    assert(exitCacheEmpty);
+    assert(ThreadCache::liveCount() == liveBefore);
+
+    std::cout << "Thread exit allocation test passed!" << std::endl;
+}
+
+// 中等对象测试：按整页从页堆拿，释放后留在本线程的缓存里，超过预算或回收时还给页堆
+void testMediumObjects()
+{
+    std::cout << "Running medium objects test..." << std::endl;
+
+    std::thread worker([] {
+        ThreadCache* cache = ThreadCache::getInstance();
+        const size_t cachedBefore = cache->cachedBytes();
+
+        // 40000字节占10页，起点按页对齐，usableSize是整页
+        void* p = MemoryPool::allocate(40000);
+        assert(p != nullptr);
+        assert(reinterpret_cast<uintptr_t>(p) % PAGE_SIZE == 0);
+        assert(MemoryPool::usableSize(p) == 10 * PAGE_SIZE);
+        std::memset(p, 0x3c, 40000);
+        MemoryPool::deallocate(p, 40000);
+        assert(cache->cachedBytes() == cachedBefore + 10 * PAGE_SIZE);
+
+        // 页数相同的请求直接拿回刚释放的那块
+        void* q = MemoryPool::allocate(10 * PAGE_SIZE);
+        assert(q == p);
+        MemoryPool::deallocate(q, 10 * PAGE_SIZE);
+
+        // 释放超过缓存预算：之前缓存的全部还给页堆
+        std::vector<void*> ptrs;
+        for (size_t i = 0; i < MEDIUM_CACHE_BYTES / MAX_BYTES + 2; ++i)
+        {
+            ptrs.push_back(MemoryPool::allocate(MAX_BYTES));
+        }
+        for (void* ptr : ptrs)
+        {
+            MemoryPool::deallocate(ptr, MAX_BYTES);
+            assert(cache->cachedBytes() <= cachedBefore + MEDIUM_CACHE_BYTES);
+        }
+
+        MemoryPool::trimCurrentThread();
+        assert(cache->cachedBytes() <= cachedBefore);
+    });
+    worker.join();
+
+    // 中等对象不经过中心缓存，没有可预留的等级
+    assert(MemoryPool::reserve(MEDIUM_BYTES + 1, 10) == 0);
+    assert(MemoryPool::reserve(MEDIUM_BYTES, 1) > 0);
+
+    std::cout << "Medium objects test passed!" << std::endl;
+}
+
+// 空span留存测试：一个span的对象全部取出再还回，span留在中心缓存里，下一次不用重新向页堆要
+// 在单独的堆上做，中心缓存和页堆都只有这个测试在用；另一个堆不留空span，两个堆的设置互不影响
+void testEmptySpanCache()
+{
+    std::cout << "Running empty span cache test..." << std::endl;
+
+    Heap* heap = Heap::create();
+    Heap* eager = Heap::create();
+    assert(heap != nullptr && eager != nullptr);
+    assert(heap->emptySpanLimit() == DEFAULT_EMPTY_SPANS);
+    eager->setEmptySpanLimit(0);
+    const size_t size = 1024;
+    const size_t index = SizeClass::getIndex(size);
+    const size_t total = SizeClass::getPages(index) * PAGE_SIZE / size;
+
+    // 在h上取空整个span，每段原样还回去，返回那个span
+    auto cycle = [&](Heap* h) {
+        CentralCache& central = h->centralCache(0);
+        std::vector<std::pair<void*, size_t>> ranges;
+        size_t fetched = 0;
+        while (fetched < total)
+        {
+            void* start = nullptr;
+            void* end = nullptr;
+            size_t got = central.fetchRange(start, end, index, SizeClass::getBatchNum(size) - 1);
+            assert(got != 0);
+            ranges.emplace_back(start, got);
+            fetched += got;
+        }
+        assert(fetched == total);
+        Span* span = h->pageCache(0).mapAddressToSpan(ranges.front().first);
+        for (auto& range : ranges)
+        {
+            assert(h->pageCache(0).mapAddressToSpan(range.first) == span);
+            central.releaseListToSpans(range.first, range.second, size);
+        }
+        return span;
+    };
+
+    CentralCache& central = heap->centralCache(0);
+    PageCache& pages = heap->pageCache(0);
+    Span* span = cycle(heap);
+    assert(central.counters(index).new_spans == 1);
+    assert(span->location && span->size_class == index);
+    // 第二轮拿到的还是同一个切好的span
+    assert(cycle(heap) == span);
+    assert(central.counters(index).new_spans == 1);
+
+    // 不留空span的堆一空就还，每轮都要新span
+    assert(eager->centralCache(0).emptySpanLimit() == 0);
+    Span* eagerSpan = cycle(eager);
+    assert(!eager->pageCache(0).mapAddressToSpan(eagerSpan->start_address)->location);
+    cycle(eager);
+    assert(eager->centralCache(0).counters(index).new_spans == 2);
+    // 第一个堆的空span还留着
+    assert(pages.mapAddressToSpan(span->start_address)->location);
+
+    // 释放级联把留着的空span还给页堆
+    heap->releaseMemory();
+    assert(!pages.mapAddressToSpan(span->start_address)->location);
+
+    // 已经创建的中心缓存改了设置也立即生效
+    heap->setEmptySpanLimit(0);
+    span = cycle(heap);
+    assert(central.counters(index).new_spans == 2);
+    assert(!pages.mapAddressToSpan(span->start_address)->location);
+    assert(eager->centralCache(0).counters(index).new_spans == 2);
+
+    eager->destroy();
+    heap->destroy();
+    std::cout << "Empty span cache test passed!" << std::endl;
+}
+
+// 堆上限测试：超过上限时分配返回nullptr并触发压力回调，归还后又能分配，类型化接口抛bad_alloc
+void testHeapLimit()
+{
+    std::cout << "Running heap limit test..." << std::endl;
+
+    // 先把空闲内存都还给系统，上限之内的每一页都要重新记账
+    MemoryPool::releaseMemory();
+    const size_t budget = 2 * 1024 * 1024;
+    const size_t limit = MemoryPool::committedBytes() + budget;
+    std::atomic<size_t> approaching{0};
+    std::atomic<size_t> exhausted{0};
+    MemoryPool::setPressureCallback([&](PressureLevel level, size_t committed, size_t cbLimit) {
+        // 上限可能被调到已提交量以下，这里只检查回调拿到的是设置过的上限
+        assert(cbLimit != 0);
+        (void)committed;
+        if (level == PressureLevel::Approaching)
+        {
+            approaching++;
+        }
+        else
+        {
+            exhausted++;
+        }
+    });
+    MemoryPool::setHeapLimit(limit);
+
+    std::thread worker([&]() {
+        // 中等对象，新线程的缓存是空的，全部内存都要从PageCache新拿
+        const size_t size = 40000;
+        const size_t maxCount = 1000;
+        std::vector<void*> ptrs;
+        while (ptrs.size() < maxCount)
+        {
+            void* p = MemoryPool::allocate(size);
+            if (p == nullptr)
+            {
+                break;
+            }
+            std::memset(p, 0x5A, size);
+            ptrs.push_back(p);
+        }
+        assert(ptrs.size() < maxCount);
+        assert(ptrs.size() * size <= budget);
+        assert(MemoryPool::committedBytes() <= limit);
+
+        const size_t committedFull = MemoryPool::committedBytes();
+        for (void* p : ptrs)
+        {
+            MemoryPool::deallocate(p, size);
+        }
+        // 还给系统以后同样的预算又能用了
+        MemoryPool::releaseMemory();
+        assert(MemoryPool::committedBytes() < committedFull);
+        void* p = MemoryPool::allocate(size);
+        assert(p != nullptr);
+        MemoryPool::deallocate(p, size);
+    });
+    worker.join();
+    assert(approaching.load() >= 1);
+    assert(exhausted.load() >= 1);
+
+    // 没有余量时类型化接口抛bad_alloc
+    struct Big
+    {
+        char data[100000];
+    };
+    MemoryPool::releaseMemory();
+    // 空闲span全部还掉以后已提交量可能是0，而0表示不限制
+    MemoryPool::setHeapLimit(std::max<size_t>(MemoryPool::committedBytes(), 1));
+    bool thrown = false;
+    try
+    {
+        Big* big = MemoryPool::create<Big>();
+        MemoryPool::destroy(big);
+    }
+    catch (const std::bad_alloc&)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    MemoryPool::setHeapLimit(0);
+    MemoryPool::setPressureCallback(nullptr);
+    Big* big = MemoryPool::create<Big>();
+    big->data[0] = 1;
+    MemoryPool::destroy(big);
+
+    std::cout << "Heap limit test passed!" << std::endl;
+}
+
+// 独立堆测试：内存来自堆自己的页堆，上限和统计只算自己，线程退出和销毁都能收干净
+void testHeaps()
+{
+    std::cout << "Running independent heaps test..." << std::endl;
+
+    const size_t defaultCommitted = MemoryPool::committedBytes();
+    const size_t budget = 4 * 1024 * 1024;
+    Heap* limited = Heap::create(budget);
+    Heap* scratch = Heap::create();
+    assert(limited != nullptr && scratch != nullptr);
+    assert(limited->id() != 0 && limited->id() != scratch->id());
+
+    // 各种大小都从堆自己的地址空间里拿，默认堆不认识这些指针
+    const size_t sizes[] = {16, 1000, 40000, 1 << 20};
+    std::vector<void*> ptrs;
+    for (size_t size : sizes)
+    {
+        void* p = limited->allocate(size);
+        assert(p != nullptr);
+        std::memset(p, 0x42, size);
+        assert(limited->findNode(p) < MAX_NUMA_NODES);
+        assert(scratch->findNode(p) == MAX_NUMA_NODES);
+        assert(PageCache::findNode(p) == MAX_NUMA_NODES);
+        ptrs.push_back(p);
+    }
+    HeapStats stats = limited->stats();
+    assert(stats.committed > 0 && stats.committed <= budget);
+    assert(stats.limit == budget);
+    assert(stats.reserved >= ARENA_MIN_RESERVE_BYTES);
+    assert(stats.thread_caches == 1);
+    for (size_t i = 0; i < ptrs.size(); ++i)
+    {
+        limited->deallocate(ptrs[i], sizes[i]);
+    }
+
+    // 上限只管这个堆：拿不到时回调收到Exhausted，默认堆照常分配
+    std::atomic<size_t> exhausted{0};
+    limited->setPressureCallback([&](PressureLevel level, size_t, size_t limit) {
+        assert(limit == budget);
+        if (level == PressureLevel::Exhausted)
+        {
+            exhausted++;
+        }
+    });
+    ptrs.clear();
+    while (void* p = limited->allocate(64 * 1024))
+    {
+        ptrs.push_back(p);
+        assert(ptrs.size() < 1000);
+    }
+    assert(exhausted.load() >= 1);
+    assert(limited->committed() <= budget);
+    void* fromDefault = MemoryPool::allocate(64 * 1024);
+    assert(fromDefault != nullptr);
+    MemoryPool::deallocate(fromDefault, 64 * 1024);
+    for (void* p : ptrs)
+    {
+        limited->deallocate(p, 64 * 1024);
+    }
+    limited->setPressureCallback(nullptr);
+
+    // 别的线程在堆上有自己的缓存，退出时还回来
+    std::thread worker([limited] {
+        std::vector<void*> local;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            local.push_back(limited->allocate(48));
+        }
+        assert(limited->stats().thread_caches == 2);
+        for (void* p : local)
+        {
+            limited->deallocate(p, 48);
+        }
+    });
+    worker.join();
+    assert(limited->stats().thread_caches == 1);
+    // 接近上限只回收缓存，页堆里的空闲span还提交着；耗尽或者releaseMemory时才还给系统
+    const size_t freeBefore = limited->stats().free_bytes;
+    assert(freeBefore > 0);
+    // 隔开Approaching的限频间隔，这一次一定会真正跑
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    assert(limited->limiter().onPressure(PressureLevel::Approaching) == 0);
+    assert(limited->stats().free_bytes >= freeBefore);
+    assert(limited->releaseMemory() > 0 || limited->stats().free_bytes == 0);
+    assert(limited->stats().free_bytes == 0);
+
+    // 销毁：还没释放的对象和别的线程（还活着）的缓存一起丢掉，地址空间已经unmap
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool allocated = false;
+    bool destroyed = false;
+    void* leaked = nullptr;
+    std::thread holder([&] {
+        void* p = scratch->allocate(200);
+        std::unique_lock<std::mutex> lock(mutex);
+        leaked = p;
+        allocated = true;
+        cond.notify_all();
+        // 堆销毁以后才退出，退出钩子看到的缓存已经被清空
+        cond.wait(lock, [&] { return destroyed; });
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return allocated; });
+    }
+    void* mine = scratch->allocate(300 * 1024);
+    assert(scratch->stats().thread_caches == 2);
+    size_t scratchId = scratch->id();
+    scratch->destroy();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        destroyed = true;
+    }
+    cond.notify_all();
+    holder.join();
+    unsigned char vec = 0;
+    void* page = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(leaked) & ~(uintptr_t(PAGE_SIZE) - 1));
+    assert(mincore(page, PAGE_SIZE, &vec) == -1 && errno == ENOMEM);
+    assert(mincore(mine, PAGE_SIZE, &vec) == -1 && errno == ENOMEM);
+    assert(ThreadCache::liveCount(scratchId) == 0);
+
+    // 编号可以再用，新堆上的线程缓存是新建的
+    Heap* again = Heap::create();
+    assert(again != nullptr);
+    void* fresh = again->allocate(200);
+    std::memset(fresh, 1, 200);
+    again->deallocate(fresh, 200);
+    again->destroy();
+    limited->destroy();
+
+    // 默认堆不能销毁，也没有受影响
+    Heap::defaultHeap().destroy();
+    assert(MemoryPool::committedBytes() >= defaultCommitted);
+
+    std::cout << "Independent heaps test passed!" << std::endl;
+}
+
+// 预留测试：提前备好某个等级的对象，之后分配这么多个不再向系统要内存
+void testReserve()
+{
+    std::cout << "Running reserve test..." << std::endl;
+
+    // 其他测试不用的等级
+    constexpr size_t SIZE = 2056;
+    constexpr size_t COUNT = 3000;
+    size_t available = MemoryPool::reserve(SIZE, COUNT, true);
+    assert(available >= COUNT);
+    assert(MemoryPool::reserve(MAX_BYTES + 1, 10) == 0);
+
+    // 预留够了，分配COUNT个不应该再mmap
+    const size_t mapped = PageCache::mappedBytes();
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+        void* p = MemoryPool::allocate(SIZE);
+        assert(p != nullptr);
+        std::memset(p, 0x3C, SIZE);
+        ptrs.push_back(p);
+    }
+    assert(PageCache::mappedBytes() == mapped);
+    for (void* p : ptrs)
+    {
+        MemoryPool::deallocate(p, SIZE);
+    }
+
+    // 文本配置：格式不对的项跳过
+    available = MemoryPool::reserveProfile("2064:100,oops,2072:50,2080:");
+    assert(available >= 150);
+    setenv("LLT_MEMPOOL_RESERVE", "2088:20", 1);
+    assert(MemoryPool::reserveProfile() >= 20);
+    unsetenv("LLT_MEMPOOL_RESERVE");
+    assert(MemoryPool::reserveProfile() == 0);
+
+    std::cout << "Reserve test passed!" << std::endl;
+}
+
+void testArena()
+{
+    std::cout << "Running arena test..." << std::endl;
+
+    MemoryPool::Arena arena(4);
+    assert(arena.spanCount() == 0);
+    assert(arena.allocate(0) != nullptr);
+
+    // 对齐
+    for (size_t align : {8, 16, 64, 256, 4096})
+    {
+        void* p = arena.allocate(24, align);
+        assert(reinterpret_cast<uintptr_t>(p) % align == 0);
+    }
+
+    // 嵌套检查点
+    auto outer = arena.checkpoint();
+    void* a = arena.allocate(100);
+    auto inner = arena.checkpoint();
+    void* b = arena.allocate(100);
+    arena.rewind(inner);
+    assert(arena.allocate(100) == b);
+    arena.rewind(outer);
+    assert(arena.allocate(100) == a);
+
+    // 一个请求：很多小对象加一个超过span大小的对象
+    struct Item
+    {
+        int id;
+        double value;
+    };
+    auto fillRequest = [&arena]() {
+        std::vector<Item*> items;
+        for (int i = 0; i < 2000; ++i)
+        {
+            Item* item = arena.create<Item>(Item{i, i * 0.5});
+            items.push_back(item);
+        }
+        char* big = static_cast<char*>(arena.allocate(100 * 1024));
+        std::memset(big, 0x42, 100 * 1024);
+        for (int i = 0; i < 2000; ++i)
+        {
+            assert(items[i]->id == i);
+        }
+        return items.front();
+    };
+    arena.reset();
+    Item* first = fillRequest();
+    size_t spans = arena.spanCount();
+    size_t bytes = arena.reservedBytes();
+    assert(spans >= 2);
+
+    // 保留span：同样的请求不需要再向PageCache要，地址也从头复用
+    arena.reset();
+    assert(fillRequest() == first);
+    assert(arena.spanCount() == spans && arena.reservedBytes() == bytes);
+
+    // 全部还给PageCache
+    void* span_address = PageCache::getPageAddress(PageCache::getInstance(PageCache::findNode(first)).mapAddressToSpan(first));
+    arena.reset(false);
+    assert(arena.spanCount() == 0 && arena.reservedBytes() == 0);
+    Span* span = PageCache::getInstance(PageCache::findNode(span_address)).mapAddressToSpan(span_address);
+    assert(span != nullptr && !span->location);
+
+    std::cout << "Arena test passed!" << std::endl;
+}
+
+void testChainBuffer()
+{
+    std::cout << "Running chain buffer test..." << std::endl;
+
+    ChainBuffer buf(256);
+    assert(buf.blockSize() == 256);
+    assert(buf.readableBytes() == 0 && buf.prependableBytes() == ChainBuffer::kCheapPrepend);
+
+    // 跨好几块的追加和读取
+    std::string payload;
+    for (int i = 0; i < 3000; ++i)
+    {
+        payload.push_back(static_cast<char>('a' + i % 26));
+    }
+    buf.append(payload);
+    assert(buf.readableBytes() == payload.size());
+    assert(buf.blockCount() > 1);
+    assert(buf.retrieveAsString(10) == payload.substr(0, 10));
+    assert(buf.contiguousReadable() > 0 && *buf.peek() == payload[10]);
+
+    // prepend：第一块前面放得下就原地写，放不下就在前面插一块
+    uint32_t header = 0x01020304;
+    buf.prepend(&header, sizeof(header));
+    assert(buf.readableBytes() == payload.size() - 10 + sizeof(header));
+    std::string big_header(200, 'h');
+    buf.prepend(big_header.data(), big_header.size());
+    std::string all = buf.retrieveAllAsString();
+    assert(all == big_header + std::string(reinterpret_cast<char*>(&header), sizeof(header)) + payload.substr(10));
+    assert(buf.readableBytes() == 0 && buf.prependableBytes() == ChainBuffer::kCheapPrepend);
+
+    // iovec：可读区的iovec拼起来就是全部数据，可写区的iovec至少有要求的大小
+    buf.append(payload);
+    struct iovec iov[ChainBuffer::kMaxIov];
+    int count = buf.readableIov(iov, ChainBuffer::kMaxIov);
+    std::string joined;
+    for (int i = 0; i < count; ++i)
+    {
+        joined.append(static_cast<char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    assert(joined == payload);
+    count = buf.writableIov(iov, ChainBuffer::kMaxIov, 1000);
+    size_t writable = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        std::memset(iov[i].iov_base, 'w', iov[i].iov_len);
+        writable += iov[i].iov_len;
+    }
+    assert(writable >= 1000 && writable == buf.writableBytes());
+    buf.hasWritten(1000);
+    assert(buf.readableBytes() == payload.size() + 1000);
+    buf.retrieve(payload.size());
+    assert(buf.retrieveAllAsString() == std::string(1000, 'w'));
+
+    // readFd/writeFd走socketpair
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    int saved_errno = 0;
+    buf.append(payload);
+    size_t sent = 0;
+    while (buf.readableBytes() > 0)
+    {
+        ssize_t n = buf.writeFd(fds[0], &saved_errno);
+        assert(n > 0);
+        sent += n;
+    }
+    assert(sent == payload.size());
+    ChainBuffer received(512);
+    while (received.readableBytes() < payload.size())
+    {
+        assert(received.readFd(fds[1], &saved_errno) > 0);
+    }
+    assert(received.retrieveAllAsString() == payload);
+    close(fds[0]);
+    close(fds[1]);
+
+    // 移动以后原来的缓冲区是空的
+    ChainBuffer moved(std::move(received));
+    moved.append("abc", 3);
+    assert(moved.retrieveAllAsString() == "abc");
+    moved.shrink();
+
+    std::cout << "Chain buffer test passed!" << std::endl;
+}
+
+void testAllocateZeroed()
+{
+    std::cout << "Running zeroed allocation test..." << std::endl;
+
+    auto allZero = [](const void* p, size_t size, size_t step) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(p);
+        for (size_t i = 0; i < size; i += step)
+        {
+            if (bytes[i] != 0)
+            {
+                return false;
+            }
+        }
+        return bytes[size - 1] == 0;
+    };
+    auto residentBytes = []() {
+        size_t pages = 0;
+        size_t resident = 0;
+        FILE* f = std::fopen("/proc/self/statm", "r");
+        assert(f != nullptr);
+        assert(std::fscanf(f, "%zu %zu", &pages, &resident) == 2);
+        std::fclose(f);
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    };
+
+    // 小对象：用过的内存一定要清
+    void* p = MemoryPool::allocate(200);
+    std::memset(p, 0xFF, 200);
+    MemoryPool::deallocate(p, 200);
+    p = MemoryPool::allocateZeroed(200);
+    assert(allZero(p, 200, 1));
+    MemoryPool::deallocate(p, 200);
+
+    // 中等对象：新线程第一次拿到的是新提交的页；释放后留在本线程的中等对象缓存，命中时照样清零
+    std::thread([&]() {
+        constexpr size_t PAGES = 100 * 1024;
+        void* q = MemoryPool::allocateZeroed(PAGES);
+        assert(allZero(q, PAGES, 1));
+        std::memset(q, 0xFF, PAGES);
+        MemoryPool::deallocate(q, PAGES);
+        void* r = MemoryPool::allocateZeroed(PAGES);
+        assert(allZero(r, PAGES, 1));
+        MemoryPool::deallocate(r, PAGES);
+    }).join();
+
+    // 没到LARGE_DECOMMIT_PAGES的大对象释放后还留着内容，再分配要清零
+    constexpr size_t MEDIUM = 300 * 1024;
+    p = MemoryPool::allocate(MEDIUM);
+    std::memset(p, 0xFF, MEDIUM);
+    MemoryPool::deallocate(p, MEDIUM);
+    p = MemoryPool::allocateZeroed(MEDIUM);
+    assert(allZero(p, MEDIUM, 1));
+    MemoryPool::deallocate(p, MEDIUM);
+
+    // 新提交的大表不用memset：常驻内存几乎不涨
+    constexpr size_t TABLE = 64 * 1024 * 1024;
+    size_t before = residentBytes();
+    void* table = MemoryPool::allocateZeroed(TABLE);
+    assert(table != nullptr);
+    assert(residentBytes() - std::min(before, residentBytes()) < TABLE / 4);
+    assert(allZero(table, TABLE, PAGE_SIZE));
+
+    // 写满以后释放：大对象立即madvise，下一次还是零页
+    std::memset(table, 0xAB, TABLE);
+    MemoryPool::deallocate(table, TABLE);
+    void* again = MemoryPool::allocateZeroed(TABLE);
+    assert(allZero(again, TABLE, PAGE_SIZE));
+    MemoryPool::deallocate(again, TABLE);
+
+    std::cout << "Zeroed allocation test passed!" << std::endl;
+}
+
+// 统计导出测试：按PID找到共享内存段，序列锁读出来的快照里能看到本线程拿走的对象，停止以后段被删掉
+void testStatsExport()
+{
+    std::cout << "Running stats export test..." << std::endl;
+
+    const size_t size = 96;
+    const size_t count = 2000;
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < count; ++i)
+    {
+        ptrs.push_back(MemoryPool::allocate(size));
+    }
+
+    assert(MemoryPool::startStatsExport(10));
+    assert(!MemoryPool::startStatsExport(10));
+    char path[64];
+    stats::segmentPath(path, sizeof(path), static_cast<uint64_t>(getpid()));
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    struct stat st;
+    assert(fstat(fd, &st) == 0);
+    const size_t bytes = static_cast<size_t>(st.st_size);
+    void* segment = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(segment != MAP_FAILED);
+
+    // 等两次发布，第二次一定是在映射之后写的
+    std::vector<char> snapshot(bytes);
+    const stats::StatsHeader& header = *reinterpret_cast<const stats::StatsHeader*>(snapshot.data());
+    for (int i = 0; i < 1000; ++i)
+    {
+        assert(stats::readSnapshot(segment, snapshot.data(), bytes));
+        if (header.publishes >= 2)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    assert(header.magic == stats::STATS_MAGIC && header.version == stats::STATS_VERSION);
+    assert(header.publishes >= 2 && header.sequence % 2 == 0);
+    assert(header.pid == static_cast<uint64_t>(getpid()));
+    assert(stats::segmentBytes(header.class_count) == bytes);
+    assert(header.mapped_bytes > 0 && header.thread_caches >= 1);
+    assert(header.fetches > 0 && header.new_spans > 0);
+
+    const stats::ClassStats& entry = stats::classes(snapshot.data())[SizeClass::getIndex(size)];
+    assert(entry.size == SizeClass::getSize(SizeClass::getIndex(size)));
+    // 保护页采样的对象不经过中心缓存
+    assert(entry.in_use_bytes >= (hardening::guardSampleRate() == 0 ? count * entry.size : entry.size));
+    assert(entry.spans > 0 && entry.fetches > 0);
+
+    munmap(segment, bytes);
+    MemoryPool::stopStatsExport();
+    assert(access(path, F_OK) != 0 && errno == ENOENT);
+
+    for (void* p : ptrs)
+    {
+        MemoryPool::deallocate(p, size);
+    }
+    std::cout << "Stats export test passed!" << std::endl;
+}
+
+void testInstrumentation()
+{
+    std::cout << "Running instrumentation test..." << std::endl;
+
+    MemoryPool::resetInstrumentation();
+    // 新线程的缓存是空的，第一次分配一定走fetchFromCentralCache和桶锁
+    std::thread worker([] {
+        std::vector<void*> ptrs;
+        for (size_t i = 0; i < 256; ++i)
+        {
+            ptrs.push_back(MemoryPool::allocate(9000));
+        }
+        for (void* ptr : ptrs)
+        {
+            MemoryPool::deallocate(ptr, 9000);
+        }
+    });
+    worker.join();
+
+    instrument::PathSnapshot fetch = instrument::pathSnapshot(instrument::Path::FetchFromCentral);
+    instrument::LockSnapshot central = instrument::lockSnapshot(instrument::Lock::CentralBucket);
+    char text[8192] = {};
+    FILE* out = fmemopen(text, sizeof(text) - 1, "w");
+    assert(out != nullptr);
+    MemoryPool::dumpInstrumentation(out);
+    std::fclose(out);
+    if (INSTRUMENTED)
+    {
+        assert(fetch.count > 0);
+        assert(fetch.p50_ns <= fetch.p99_ns);
+        assert(fetch.max_ns * fetch.count >= fetch.total_ns);
+        assert(central.acquisitions >= fetch.count);
+        assert(central.contended <= central.acquisitions);
+        assert(std::strstr(text, "fetchFromCentralCache") != nullptr);
+        assert(std::strstr(text, "page cache") != nullptr);
+
+        MemoryPool::resetInstrumentation();
+        assert(instrument::pathSnapshot(instrument::Path::FetchFromCentral).count == 0);
+        assert(instrument::eventCount(instrument::Event::ReleaseToSpans) == 0);
+    }
+    else
+    {
+        assert(fetch.count == 0 && central.acquisitions == 0);
+        assert(std::strstr(text, "disabled") != nullptr);
+    }
+
+    std::cout << "Instrumentation test passed!" << std::endl;
+}
+
+void testTrace()
+{
+    std::cout << "Running allocation trace test..." << std::endl;
+
+    char path[] = "/tmp/llt_mempool_trace_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    bool started = MemoryPool::startTrace(path, 1024);
+    if (!TRACED)
+    {
+        assert(!started);
+        assert(MemoryPool::stopTrace() == 0);
+        unlink(path);
+        std::cout << "Allocation trace test skipped (LLT_MEMPOOL_TRACE off)" << std::endl;
+        return;
+    }
+    assert(started);
+    assert(!MemoryPool::startTrace(path));
+
+    // 两个线程各自分配释放，另外一批在线程之间交接
+    constexpr size_t COUNT = 50;
+    std::vector<void*> handoff(COUNT);
+    std::thread producer([&handoff] {
+        for (size_t i = 0; i < COUNT; ++i)
+        {
+            void* p = MemoryPool::allocate(48);
+            MemoryPool::deallocate(p, 48);
+            handoff[i] = MemoryPool::allocate(100 + i);
+        }
+    });
+    producer.join();
+    std::thread consumer([&handoff] {
+        for (size_t i = 0; i < COUNT; ++i)
+        {
+            MemoryPool::deallocate(handoff[i], 100 + i);
+        }
+    });
+    consumer.join();
+    assert(MemoryPool::stopTrace() == 4 * COUNT);
+    assert(MemoryPool::stopTrace() == 0);
+
+    FILE* f = std::fopen(path, "rb");
+    assert(f != nullptr);
+    trace::TraceHeader header;
+    assert(std::fread(&header, sizeof(header), 1, f) == 1);
+    assert(header.magic == trace::TRACE_MAGIC && header.version == trace::TRACE_VERSION);
+    assert(header.record_count == 4 * COUNT && header.dropped == 0);
+    std::vector<trace::TraceRecord> records(header.record_count);
+    assert(std::fread(records.data(), sizeof(trace::TraceRecord), records.size(), f) == records.size());
+    assert(std::fgetc(f) == EOF);
+    std::fclose(f);
+
+    // 每个释放都能对上前面同一线程或者另一个线程的分配，大小一致，时间戳不倒退
+    std::vector<std::pair<uint64_t, uint32_t>> live;
+    uint64_t last = 0;
+    for (const trace::TraceRecord& record : records)
+    {
+        assert(record.timestamp_ns >= last);
+        last = record.timestamp_ns;
+        assert(record.thread < 2);
+        if (record.op == static_cast<uint8_t>(trace::Op::Allocate))
+        {
+            live.emplace_back(record.object, record.size);
+            continue;
+        }
+        auto it = std::find_if(live.begin(), live.end(),
+                               [&record](const auto& entry) { return entry.first == record.object; });
+        assert(it != live.end() && it->second == record.size);
+        live.erase(it);
+    }
+    assert(live.empty());
+
+    // 写满以后丢弃，文件只留前面的部分
+    assert(MemoryPool::startTrace(path, 10));
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+        MemoryPool::deallocate(MemoryPool::allocate(64), 64);
+    }
+    assert(MemoryPool::stopTrace() == 10);
+    f = std::fopen(path, "rb");
+    assert(std::fread(&header, sizeof(header), 1, f) == 1);
+    assert(header.record_count == 10 && header.dropped == 2 * COUNT - 10);
+    std::fclose(f);
+    unlink(path);
+
+    std::cout << "Allocation trace test passed!" << std::endl;
+}
+
+void testSizeClassTable()
+{
+    std::cout << "Running size class table test..." << std::endl;
+
+    // 默认表和生成的表都要满足：每个大小落在能放下它的最小等级里，span至少放得下一个对象
+    size_t previous = 0;
+    for (size_t size = 1; size <= MAX_BYTES; ++size)
+    {
+        size_t index = SizeClass::getIndex(size);
+        assert(index < FREE_LIST_SIZE);
+        assert(index >= previous);
+        previous = index;
+        assert(SizeClass::getSize(index) >= size);
+        assert(index == 0 || SizeClass::getSize(index - 1) < size);
+    }
+    assert(SizeClass::getIndex(MAX_BYTES) == FREE_LIST_SIZE - 1);
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index)
+    {
+        size_t size = SizeClass::getSize(index);
+        assert(size % ALIGNMENT == 0);
+        assert(SizeClass::getPages(index) * PAGE_SIZE >= size);
+        assert(SizeClass::getBatchNum(size) >= 1);
+    }
+
+    std::cout << "Size class table test passed! (" << FREE_LIST_SIZE << " classes)" << std::endl;
+}
+
+// 页本地引擎测试：跨线程释放只CAS到页上，由所属线程收回复用；线程退出后的段被遗弃、再被接管
+void testPageLocalEngine()
+{
+    std::cout << "Running page-local engine test..." << std::endl;
+
+    const size_t size = 64;
+    const size_t count = 1000;
+    std::vector<void*> first(count);
+    std::mutex mutex;
+    std::condition_variable cond;
+    int stage = 0;
+
+    std::thread owner([&]() {
+        LocalHeap* heap = LocalHeap::getInstance();
+        for (size_t i = 0; i < count; ++i)
+        {
+            first[i] = heap->allocate(size);
+            std::memset(first[i], 0x3C, size);
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stage = 1;
+            cond.notify_all();
+            cond.wait(lock, [&] { return stage == 2; });
+        }
+        // 别的线程释放的对象还挂在页的thread_free上
+        LocalPage* page = LocalHeap::pageOf(LocalHeap::segmentOf(first[0]), first[0]);
+        assert(page->thread_free.load() != 0);
+        // 再分配一轮，满页上被远程释放的对象会被收回来复用
+        std::vector<void*> second(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            second[i] = heap->allocate(size);
+        }
+        size_t reused = 0;
+        for (void* p : second)
+        {
+            reused += std::find(first.begin(), first.end(), p) != first.end() ? 1 : 0;
+        }
+        assert(reused > 0);
+        assert(heap->segmentCount() == 1);
+        for (void* p : second)
+        {
+            LocalHeap::deallocate(p, size);
+        }
+    });
+
+    std::thread remote([&]() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return stage == 1; });
+        }
+        for (void* p : first)
+        {
+            LocalHeap::deallocate(p, size);
+        }
+        // 远程释放不会给本线程建堆
+        assert(LocalHeap::currentIfCreated() == nullptr);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stage = 2;
+        }
+        cond.notify_all();
+    });
+    owner.join();
+    remote.join();
+
+    // 线程带着没释放的对象退出：段被遗弃
+    const size_t abandonedBefore = LocalHeap::abandonedCount();
+    std::vector<void*> leftovers;
+    std::thread exiting([&]() {
+        for (size_t i = 0; i < 16; ++i)
+        {
+            leftovers.push_back(LocalHeap::getInstance()->allocate(size));
+        }
+    });
+    exiting.join();
+    assert(LocalHeap::abandonedCount() == abandonedBefore + 1);
+    for (void* p : leftovers)
+    {
+        LocalHeap::deallocate(p, size);
+    }
+
+    // 新线程需要新页时先接管遗弃的段，不再mmap
+    std::thread adopter([&]() {
+        LocalHeap* heap = LocalHeap::getInstance();
+        void* p = heap->allocate(size);
+        assert(LocalHeap::segmentOf(p) == LocalHeap::segmentOf(leftovers[0]));
+        assert(heap->segmentCount() == 1);
+        LocalHeap::deallocate(p, size);
+    });
+    adopter.join();
+    assert(LocalHeap::abandonedCount() == abandonedBefore);
+
+    std::cout << "Page-local engine test passed!" << std::endl;
+}
+
+// 页本地引擎线程退出阶段的分配测试用：析构函数里反复分配释放，记下用到的堆
+bool exitHeapReused = false;
+
+struct ExitLocalAllocator
+{
+    ~ExitLocalAllocator()
+    {
+        LocalHeap* first = nullptr;
+        bool reused = true;
+        for (int round = 0; round < 100; ++round)
+        {
+            void* p = LocalHeap::getInstance()->allocate(64);
+            std::memset(p, 0x5a, 64);
+            LocalHeap::deallocate(p, 64);
+            LocalHeap* heap = LocalHeap::currentIfCreated();
+            if (first == nullptr)
+            {
+                first = heap;
+            }
+            reused = reused && heap != nullptr && heap == first;
+        }
+        exitHeapReused = reused;
+    }
+};
+
+// 页本地引擎线程退出阶段的分配测试：本线程的堆析构以后还能分配，反复用同一个堆，
+// 线程结束时它的段也被释放，提交量回到原来的水平
+void testLocalHeapThreadExit()
+{
+    std::cout << "Running page-local thread exit allocation test..." << std::endl;
+
+    const size_t committedBefore = HeapLimit::getInstance().committed();
+    for (int t = 0; t < 8; ++t)
+    {
+        exitHeapReused = false;
+        std::thread worker([] {
+            // 先于本线程的堆构造，所以在它之后析构
+            static thread_local ExitLocalAllocator allocator;
+            (void)allocator;
+            void* p = LocalHeap::getInstance()->allocate(64);
+            LocalHeap::deallocate(p, 64);
+        });
+        worker.join();
+        assert(exitHeapReused);
+        assert(HeapLimit::getInstance().committed() == committedBefore);
+    }
+
+    std::cout << "Page-local thread exit allocation test passed!" << std::endl;
+}
+
+#if LLT_MEMPOOL_HARDENED
+// 在子进程里跑fn，断言它被signal杀掉
+template<typename Fn>
+void expectKilledBy(int signal, Fn fn)
+{
+    std::cout.flush();
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+    {
+        // 加固检查的报错信息不刷到测试输出里
+        std::freopen("/dev/null", "w", stderr);
+        fn();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == signal);
+}
+
+// 加固模式测试：各类误用都要在子进程里被拦下来
+void testHardenedChecks()
+{
+    std::cout << "Running hardened checks test..." << std::endl;
+
+    // 连着释放两次，线程缓存直接拦住
+    expectKilledBy(SIGABRT, [] {
+        void* p = MemoryPool::allocate(64);
+        MemoryPool::deallocate(p, 64);
+        MemoryPool::deallocate(p, 64);
+    });
+
+    // 隔了一次释放的重复释放，回到span时被位图拦住；q留在span里，span不会还给PageCache
+    expectKilledBy(SIGABRT, [] {
+        void* p = MemoryPool::allocate(48);
+        void* q = MemoryPool::allocate(48);
+        MemoryPool::deallocate(p, 48);
+        MemoryPool::releaseMemory();
+        MemoryPool::deallocate(p, 48);
+        MemoryPool::releaseMemory();
+        MemoryPool::deallocate(q, 48);
+    });
+
+    // 整批重复归还：刚好一整批时也要逐个过位图，不能压进批栈再原样分出去
+    expectKilledBy(SIGABRT, [] {
+        const size_t index = SizeClass::getIndex(64);
+        const size_t batch = SizeClass::getBatchNum(64);
+        CentralCache& central = CentralCache::getInstance(0);
+        void* start = nullptr;
+        void* end = nullptr;
+        assert(central.fetchRange(start, end, index, batch) == batch);
+        std::vector<void*> ptrs;
+        for (void* p = start; p != nullptr; p = loadNext(p))
+        {
+            ptrs.push_back(p);
+        }
+        central.releaseRange(start, batch, index);
+        for (size_t i = 0; i < ptrs.size(); ++i)
+        {
+            storeNext(ptrs[i], i + 1 < ptrs.size() ? ptrs[i + 1] : nullptr);
+        }
+        central.releaseRange(ptrs[0], batch, index);
+        void* again = nullptr;
+        central.fetchRange(again, end, index, batch);
+    });
+
+    // 中等对象连着释放两次，同样在线程缓存里拦住
+    expectKilledBy(SIGABRT, [] {
+        void* p = MemoryPool::allocate(100 * 1024);
+        MemoryPool::deallocate(p, 100 * 1024);
+        MemoryPool::deallocate(p, 100 * 1024);
+    });
+
+    // 释放时传的大小和分配时不一致
+    expectKilledBy(SIGABRT, [] {
+        void* p = MemoryPool::allocate(64);
+        MemoryPool::deallocate(p, 128);
+        MemoryPool::releaseMemory();
+    });
+
+    // 释放后改写了next指针，下一次分配解码出来的地址不对齐
+    expectKilledBy(SIGABRT, [] {
+        void* p = MemoryPool::allocate(64);
+        MemoryPool::deallocate(p, 64);
+        *static_cast<uintptr_t*>(p) = 0x1234567;
+        void* q = MemoryPool::allocate(64);
+        (void)q;
+    });
+
+    // 采样到保护页的对象，越界一个字就段错误
+    expectKilledBy(SIGSEGV, [] {
+        MemoryPool::setGuardSampleRate(1);
+        char* p = static_cast<char*>(MemoryPool::allocate(100));
+        assert(hardening::isGuarded(p));
+        volatile char* overflow = p + 104;
+        *overflow = 1;
+    });
+
+    // 正常使用保护页：分配、写满、释放都没问题，释放后槽不可访问
+    std::thread worker([] {
+        MemoryPool::setGuardSampleRate(4);
+        std::vector<char*> ptrs;
+        for (size_t i = 0; i < 64; ++i)
+        {
+            char* p = static_cast<char*>(MemoryPool::allocate(200));
+            std::memset(p, 0x11, 200);
+            ptrs.push_back(p);
+        }
+        size_t guarded = 0;
+        for (char* p : ptrs)
+        {
+            guarded += hardening::isGuarded(p) ? 1 : 0;
+            MemoryPool::deallocate(p, 200);
+        }
+        assert(guarded == 16);
+        MemoryPool::setGuardSampleRate(0);
+    });
+    worker.join();
+
+    std::cout << "Hardened checks test passed!" << std::endl;
+}
+#endif
+
 int main() 
 {
 
@@ -193,10 +1726,37 @@ int main()
         std::cout << "Starting memory pool tests..." << std::endl;
 
         testBasicAllocation();
+        testSizeClassTable();
         testMemoryWriting();
         testMultiThreading();
         testEdgeCases();
         testStress();
+        testPageCacheFreeIndex();
+        testPageArena();
+        testHotSizeClass();
+        testAsyncLogger();
+        testArena();
+        testChainBuffer();
+        testAllocateZeroed();
+        testTrace();
+        testPageLocalEngine();
+        testLocalHeapThreadExit();
+        testHeaps();
+        testEmptySpanCache();
+        // 下面这些检查的是三层引擎内部的状态，MemoryPool走页本地引擎时不适用
+#if !LLT_MEMPOOL_PAGE_LOCAL
+        testNumaSimulatedTopology();
+        testThreadCacheTrim();
+        testThreadExitAllocation();
+        testMediumObjects();
+        testHeapLimit();
+        testReserve();
+        testInstrumentation();
+        testStatsExport();
+#if LLT_MEMPOOL_HARDENED
+        testHardenedChecks();
+#endif
+#endif
 
         std::cout << "All tests passed successfully!" << std::endl;
         return 0;
@@ -0,0 +1,334 @@
+// 内存池实时统计：附着到打开了统计导出（MemoryPool::startStatsExport或者LLT_MEMPOOL_STATS）的进程，
+// 读它的共享内存段（见include/StatsExport.h），按间隔刷新
+//
+//   mempool-top <pid> [--interval ms] [--top N] [--once]
+//
+//   --interval 刷新间隔，默认1000毫秒；比进程的发布间隔短没有意义
+//   --top      按每秒慢路径次数列出最忙的N个等级，默认20
+//   --once     打印一份绝对值就退出（没有速率），方便脚本里抓
+//
+// 只读映射，不给目标进程发信号、不停它的线程；进程退出以后段被删掉，这边随之退出
+#include "../include/StatsExport.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llt_memoryPool;
+
+namespace
+{
+
+struct Options
+{
+    long pid = 0;
+    unsigned interval_ms = 1000;
+    size_t top = 20;
+    bool once = false;
+};
+
+void usage(const char* program)
+{
+    std::fprintf(stderr, "usage: %s <pid> [--interval ms] [--top N] [--once]\n", program);
+}
+
+bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--interval" && i + 1 < argc)
+        {
+            long value = std::strtol(argv[++i], nullptr, 10);
+            if (value <= 0)
+            {
+                return false;
+            }
+            options.interval_ms = static_cast<unsigned>(value);
+        }
+        else if (arg == "--top" && i + 1 < argc)
+        {
+            options.top = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--once")
+        {
+            options.once = true;
+        }
+        else if (options.pid == 0 && arg[0] != '-')
+        {
+            options.pid = std::strtol(argv[i], nullptr, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return options.pid > 0;
+}
+
+// 只读映射目标进程的统计段，段的大小从文件长度和头部一起校验
+class Segment
+{
+public:
+    ~Segment()
+    {
+        if (mapped_ != nullptr)
+        {
+            munmap(mapped_, bytes_);
+        }
+    }
+
+    bool attach(long pid)
+    {
+        char path[64];
+        stats::segmentPath(path, sizeof(path), static_cast<uint64_t>(pid));
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            std::fprintf(stderr, "cannot open %s (is the process running with LLT_MEMPOOL_STATS set?)\n", path);
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(stats::StatsHeader))
+        {
+            std::fprintf(stderr, "%s: not a stats segment\n", path);
+            ::close(fd);
+            return false;
+        }
+        bytes_ = static_cast<size_t>(st.st_size);
+        void* mapped = mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            std::fprintf(stderr, "%s: mmap failed\n", path);
+            return false;
+        }
+        mapped_ = mapped;
+        const stats::StatsHeader* header = static_cast<const stats::StatsHeader*>(mapped_);
+        if (header->magic != stats::STATS_MAGIC || header->version != stats::STATS_VERSION ||
+            header->header_size != sizeof(stats::StatsHeader) || header->run_buckets != stats::RUN_BUCKETS ||
+            stats::segmentBytes(header->class_count) != bytes_)
+        {
+            std::fprintf(stderr, "%s: unknown stats layout (version %u)\n", path, header->version);
+            return false;
+        }
+        return true;
+    }
+
+    bool read(std::vector<char>& snapshot) const
+    {
+        snapshot.resize(bytes_);
+        return stats::readSnapshot(mapped_, snapshot.data(), bytes_);
+    }
+
+private:
+    void* mapped_ = nullptr;
+    size_t bytes_ = 0;
+};
+
+const stats::StatsHeader& headerOf(const std::vector<char>& snapshot)
+{
+    return *reinterpret_cast<const stats::StatsHeader*>(snapshot.data());
+}
+
+std::string formatBytes(uint64_t bytes)
+{
+    char buffer[32];
+    if (bytes >= (uint64_t(1) << 30))
+    {
+        std::snprintf(buffer, sizeof(buffer), "%.2fG", bytes / 1073741824.0);
+    }
+    else if (bytes >= (uint64_t(1) << 20))
+    {
+        std::snprintf(buffer, sizeof(buffer), "%.1fM", bytes / 1048576.0);
+    }
+    else if (bytes >= 1024)
+    {
+        std::snprintf(buffer, sizeof(buffer), "%.1fK", bytes / 1024.0);
+    }
+    else
+    {
+        std::snprintf(buffer, sizeof(buffer), "%lluB", static_cast<unsigned long long>(bytes));
+    }
+    return buffer;
+}
+
+// 两份快照之间每秒多少次；没有上一份时返回0
+double rate(uint64_t now, uint64_t before, double seconds)
+{
+    return seconds > 0.0 && now >= before ? static_cast<double>(now - before) / seconds : 0.0;
+}
+
+void render(const Options& options, const std::vector<char>& now, const std::vector<char>* before)
+{
+    const stats::StatsHeader& header = headerOf(now);
+    double seconds = 0.0;
+    if (before != nullptr)
+    {
+        seconds = static_cast<double>(header.timestamp_ns - headerOf(*before).timestamp_ns) / 1e9;
+    }
+    std::printf("pid %llu  publish #%llu  every %llu ms\n",
+                static_cast<unsigned long long>(header.pid),
+                static_cast<unsigned long long>(header.publishes),
+                static_cast<unsigned long long>(header.interval_ms));
+    std::printf("mapped %s  committed %s  limit %s  page-heap free %s  reserved %s  thread caches %llu\n",
+                formatBytes(header.mapped_bytes).c_str(), formatBytes(header.committed_bytes).c_str(),
+                header.heap_limit == 0 ? "none" : formatBytes(header.heap_limit).c_str(),
+                formatBytes(header.free_bytes).c_str(), formatBytes(header.reserved_bytes).c_str(),
+                static_cast<unsigned long long>(header.thread_caches));
+    if (before != nullptr)
+    {
+        const stats::StatsHeader& prev = headerOf(*before);
+        std::printf("slow path/s  fetch %.0f  release %.0f  new span %.0f\n",
+                    rate(header.fetches, prev.fetches, seconds),
+                    rate(header.releases, prev.releases, seconds),
+                    rate(header.new_spans, prev.new_spans, seconds));
+    }
+    else
+    {
+        std::printf("slow path total  fetch %llu  release %llu  new span %llu\n",
+                    static_cast<unsigned long long>(header.fetches),
+                    static_cast<unsigned long long>(header.releases),
+                    static_cast<unsigned long long>(header.new_spans));
+    }
+
+    std::printf("\npage heap free runs\n%-14s%10s%12s\n", "pages", "spans", "bytes");
+    const stats::RunStats* runs = stats::runs(now.data());
+    for (size_t i = 0; i < stats::RUN_BUCKETS; ++i)
+    {
+        if (runs[i].spans == 0)
+        {
+            continue;
+        }
+        char label[32];
+        if (i + 1 == stats::RUN_BUCKETS)
+        {
+            std::snprintf(label, sizeof(label), ">=%zu", size_t(1) << i);
+        }
+        else if (i == 0)
+        {
+            std::snprintf(label, sizeof(label), "1");
+        }
+        else
+        {
+            std::snprintf(label, sizeof(label), "%zu-%zu", size_t(1) << i, (size_t(2) << i) - 1);
+        }
+        // 内存池的页大小不一定是系统页大小，用段里记的
+        std::printf("%-14s%10llu%12s\n", label, static_cast<unsigned long long>(runs[i].spans),
+                    formatBytes(runs[i].pages * header.page_size).c_str());
+    }
+
+    // 有动静的等级：有速率时按每秒慢路径次数排，否则按在用字节排
+    const stats::ClassStats* classes = stats::classes(now.data());
+    const stats::ClassStats* prevClasses = before != nullptr ? stats::classes(before->data()) : nullptr;
+    struct Row
+    {
+        size_t index;
+        double activity;
+    };
+    std::vector<Row> rows;
+    for (size_t i = 0; i < header.class_count; ++i)
+    {
+        const stats::ClassStats& entry = classes[i];
+        if (entry.spans == 0 && entry.fetches == 0)
+        {
+            continue;
+        }
+        double activity = static_cast<double>(entry.in_use_bytes);
+        if (prevClasses != nullptr)
+        {
+            activity = rate(entry.fetches + entry.releases, prevClasses[i].fetches + prevClasses[i].releases, seconds);
+        }
+        rows.push_back({i, activity});
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.activity > b.activity; });
+    if (rows.size() > options.top)
+    {
+        rows.resize(options.top);
+    }
+    std::printf("\n%-10s%12s%12s%8s", "class", "in use", "cached", "spans");
+    if (prevClasses != nullptr)
+    {
+        std::printf("%10s%12s%12s\n", "fetch/s", "release/s", "new span/s");
+    }
+    else
+    {
+        std::printf("%10s%12s%12s\n", "fetches", "releases", "new spans");
+    }
+    for (const Row& row : rows)
+    {
+        const stats::ClassStats& entry = classes[row.index];
+        std::printf("%-10llu%12s%12s%8llu", static_cast<unsigned long long>(entry.size),
+                    formatBytes(entry.in_use_bytes).c_str(), formatBytes(entry.cached_bytes).c_str(),
+                    static_cast<unsigned long long>(entry.spans));
+        if (prevClasses != nullptr)
+        {
+            const stats::ClassStats& prev = prevClasses[row.index];
+            std::printf("%10.0f%12.0f%12.0f\n", rate(entry.fetches, prev.fetches, seconds),
+                        rate(entry.releases, prev.releases, seconds), rate(entry.new_spans, prev.new_spans, seconds));
+        }
+        else
+        {
+            std::printf("%10llu%12llu%12llu\n", static_cast<unsigned long long>(entry.fetches),
+                        static_cast<unsigned long long>(entry.releases), static_cast<unsigned long long>(entry.new_spans));
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    Segment segment;
+    if (!segment.attach(options.pid))
+    {
+        return 1;
+    }
+    std::vector<char> now;
+    std::vector<char> before;
+    if (!segment.read(now))
+    {
+        std::fprintf(stderr, "stats segment is being rewritten continuously, giving up\n");
+        return 1;
+    }
+    if (options.once)
+    {
+        render(options, now, nullptr);
+        return 0;
+    }
+    while (true)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.interval_ms));
+        // 目标进程没了：段可能因为崩溃没被删掉，不再等它
+        if (::kill(static_cast<pid_t>(options.pid), 0) != 0 && errno == ESRCH)
+        {
+            std::printf("process %ld exited\n", options.pid);
+            return 0;
+        }
+        before.swap(now);
+        // 发布间隔比刷新间隔长时可能还是同一份，速率全是0，保留上一屏等下一次发布
+        if (!segment.read(now) || headerOf(now).publishes == headerOf(before).publishes)
+        {
+            now.swap(before);
+            continue;
+        }
+        std::printf("\033[H\033[2J");
+        render(options, now, &before);
+        std::fflush(stdout);
+    }
+}
@@ -0,0 +1,466 @@
+// 按实际的分配大小分布离线生成等级表
+//
+//   sizeclass_gen (--trace <轨迹文件> | --histogram <文本>) [--classes N] [--max-gap R] [--output <头文件>]
+//
+//   --trace      MemoryPool::startTrace录下来的轨迹（见include/Trace.h），统计每个大小的分配次数
+//   --histogram  文本直方图，每行“大小 次数”，#开头是注释；统计导出或者别的分配器的数据都可以转成这个格式
+//   --classes    等级总数的预算，默认128（默认表是MAX_BYTES/8=32768个等级）
+//   --max-gap    骨架等级之间的最大倍数，默认1.25：直方图里没出现的大小最多浪费20%
+//   --output     生成的头文件，给CMake变量LLT_MEMPOOL_SIZE_CLASS_TABLE用；不给时只打印报告
+//
+// 做法：先按--max-gap铺一套几何间隔的骨架等级保证任何大小都有合适的等级，
+// 剩下的预算用动态规划放在直方图上，使“对象内部浪费 + span尾部浪费”的期望值最小
+// 批量数沿用默认规则，span页数在默认页数和MAX_BYTES_PER_SPAN之间挑尾部浪费最小的
+#include "../include/Common.h"
+#include "../include/Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace llt_memoryPool;
+
+namespace
+{
+
+struct Options
+{
+    const char* trace = nullptr;
+    const char* histogram = nullptr;
+    const char* output = nullptr;
+    size_t classes = 128;
+    double max_gap = 1.25;
+};
+
+// 一个候选等级
+struct ClassShape
+{
+    size_t size;
+    size_t batch;
+    size_t pages;
+    // 每个对象分摊的span尾部浪费
+    double tail_per_object;
+};
+
+// 直方图里的一个大小（已经按8字节取整）
+struct Bucket
+{
+    size_t size;
+    double count;
+};
+
+struct Waste
+{
+    double allocations = 0;
+    double requested = 0;
+    double internal = 0;
+    double tail = 0;
+};
+
+void usage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s (--trace <file> | --histogram <file>) [--classes N] [--max-gap R] [--output <header>]\n",
+                 program);
+}
+
+bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        if (arg == "--trace")
+        {
+            options.trace = argv[++i];
+        }
+        else if (arg == "--histogram")
+        {
+            options.histogram = argv[++i];
+        }
+        else if (arg == "--output")
+        {
+            options.output = argv[++i];
+        }
+        else if (arg == "--classes")
+        {
+            options.classes = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--max-gap")
+        {
+            options.max_gap = std::strtod(argv[++i], nullptr);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return (options.trace != nullptr) != (options.histogram != nullptr) && options.max_gap > 1.0;
+}
+
+// 超过MAX_BYTES的分配走整页，不归等级表管
+void addSample(std::map<size_t, double>& histogram, size_t size, double count)
+{
+    if (size <= MAX_BYTES && count > 0)
+    {
+        histogram[SizeClass::roundUp(std::max(size, ALIGNMENT))] += count;
+    }
+}
+
+bool readTrace(const char* path, std::map<size_t, double>& histogram)
+{
+    FILE* f = std::fopen(path, "rb");
+    if (f == nullptr)
+    {
+        std::fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    trace::TraceHeader header;
+    if (std::fread(&header, sizeof(header), 1, f) != 1 || header.magic != trace::TRACE_MAGIC ||
+        header.version != trace::TRACE_VERSION || header.record_size != sizeof(trace::TraceRecord))
+    {
+        std::fprintf(stderr, "%s: not a trace file\n", path);
+        std::fclose(f);
+        return false;
+    }
+    trace::TraceRecord records[4096];
+    size_t n = 0;
+    while ((n = std::fread(records, sizeof(trace::TraceRecord), 4096, f)) > 0)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (records[i].op == static_cast<uint8_t>(trace::Op::Allocate))
+            {
+                addSample(histogram, records[i].size, 1);
+            }
+        }
+    }
+    std::fclose(f);
+    return true;
+}
+
+bool readHistogram(const char* path, std::map<size_t, double>& histogram)
+{
+    FILE* f = std::fopen(path, "r");
+    if (f == nullptr)
+    {
+        std::fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    char line[256];
+    size_t number = 0;
+    while (std::fgets(line, sizeof(line), f) != nullptr)
+    {
+        ++number;
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+        {
+            ++p;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\0')
+        {
+            continue;
+        }
+        unsigned long long size = 0;
+        double count = 0;
+        if (std::sscanf(p, "%llu %lf", &size, &count) != 2)
+        {
+            std::fprintf(stderr, "%s:%zu: expected \"size count\"\n", path, number);
+            std::fclose(f);
+            return false;
+        }
+        addSample(histogram, static_cast<size_t>(size), count);
+    }
+    std::fclose(f);
+    return true;
+}
+
+// 默认页数（够放MIN_BATCHES_PER_SPAN批）到单个span上限之间，挑尾部浪费比例最小的，一样时取页数少的
+ClassShape shapeFor(size_t size)
+{
+    ClassShape shape;
+    shape.size = size;
+    shape.batch = detail::defaultBatchNum(size);
+    size_t min_pages = detail::defaultPages(size);
+    size_t max_pages = std::max(min_pages, MAX_BYTES_PER_SPAN / PAGE_SIZE);
+    size_t best_pages = min_pages;
+    double best_fraction = 2.0;
+    for (size_t pages = min_pages; pages <= max_pages; ++pages)
+    {
+        size_t bytes = pages * PAGE_SIZE;
+        double fraction = static_cast<double>(bytes % size) / static_cast<double>(bytes);
+        // 差不到1/1000的不值得多占页
+        if (fraction + 0.001 < best_fraction)
+        {
+            best_fraction = fraction;
+            best_pages = pages;
+        }
+    }
+    shape.pages = best_pages;
+    size_t bytes = best_pages * PAGE_SIZE;
+    shape.tail_per_object = static_cast<double>(bytes % size) / static_cast<double>(bytes / size);
+    return shape;
+}
+
+// 默认表里size所在等级的形状：每8字节一个等级，页数用默认规则
+ClassShape defaultShapeFor(size_t size)
+{
+    ClassShape shape;
+    shape.size = SizeClass::roundUp(size);
+    shape.batch = detail::defaultBatchNum(shape.size);
+    shape.pages = detail::defaultPages(shape.size);
+    size_t bytes = shape.pages * PAGE_SIZE;
+    shape.tail_per_object = static_cast<double>(bytes % shape.size) / static_cast<double>(bytes / shape.size);
+    return shape;
+}
+
+// 骨架：前几个等级每8字节一个，之后相邻等级之比不超过max_gap，最后一个是MAX_BYTES
+std::vector<size_t> backbone(double max_gap)
+{
+    std::vector<size_t> sizes;
+    size_t size = ALIGNMENT;
+    while (size < MAX_BYTES)
+    {
+        sizes.push_back(size);
+        size_t next = static_cast<size_t>(static_cast<double>(size) * max_gap) & ~(ALIGNMENT - 1);
+        size = std::max(size + ALIGNMENT, next);
+    }
+    sizes.push_back(MAX_BYTES);
+    return sizes;
+}
+
+// 在骨架之外再放extra个等级，等级只放在直方图里出现过的大小上
+// cost(i, j)：(候选i, 候选j]里的大小都用候选j这个等级时的期望浪费
+std::vector<size_t> optimize(const std::vector<Bucket>& buckets, const std::vector<size_t>& forced, size_t budget)
+{
+    std::vector<size_t> candidates;
+    for (const Bucket& bucket : buckets)
+    {
+        candidates.push_back(bucket.size);
+    }
+    candidates.insert(candidates.end(), forced.begin(), forced.end());
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    size_t n = candidates.size();
+
+    std::vector<bool> is_forced(n + 1, false);
+    for (size_t size : forced)
+    {
+        size_t pos = std::lower_bound(candidates.begin(), candidates.end(), size) - candidates.begin();
+        is_forced[pos + 1] = true;
+    }
+    // 前缀和：到第j个候选为止的次数、次数*大小
+    std::vector<double> count_prefix(n + 1, 0);
+    std::vector<double> bytes_prefix(n + 1, 0);
+    size_t b = 0;
+    for (size_t j = 0; j < n; ++j)
+    {
+        double count = 0;
+        double bytes = 0;
+        if (b < buckets.size() && buckets[b].size == candidates[j])
+        {
+            count = buckets[b].count;
+            bytes = count * static_cast<double>(buckets[b].size);
+            ++b;
+        }
+        count_prefix[j + 1] = count_prefix[j] + count;
+        bytes_prefix[j + 1] = bytes_prefix[j] + bytes;
+    }
+    std::vector<ClassShape> shapes;
+    for (size_t size : candidates)
+    {
+        shapes.push_back(shapeFor(size));
+    }
+    auto cost = [&](size_t i, size_t j) {
+        double count = count_prefix[j] - count_prefix[i];
+        double bytes = bytes_prefix[j] - bytes_prefix[i];
+        const ClassShape& shape = shapes[j - 1];
+        return count * static_cast<double>(shape.size) - bytes + count * shape.tail_per_object;
+    };
+
+    // 位置0是虚拟的起点，位置j（1..n）表示第j个候选是一个等级
+    // 每一段不能跨过骨架等级，所以i只能从j前面最近的骨架等级开始往后取
+    const double INF = std::numeric_limits<double>::infinity();
+    std::vector<std::vector<double>> dp(budget + 1, std::vector<double>(n + 1, INF));
+    std::vector<std::vector<uint32_t>> from(budget + 1, std::vector<uint32_t>(n + 1, 0));
+    dp[0][0] = 0;
+    std::vector<size_t> last_forced(n + 1, 0);
+    for (size_t j = 1; j <= n; ++j)
+    {
+        last_forced[j] = is_forced[j - 1] ? j - 1 : last_forced[j - 1];
+    }
+    for (size_t k = 1; k <= budget; ++k)
+    {
+        for (size_t j = 1; j <= n; ++j)
+        {
+            for (size_t i = last_forced[j]; i < j; ++i)
+            {
+                if (dp[k - 1][i] == INF)
+                {
+                    continue;
+                }
+                double value = dp[k - 1][i] + cost(i, j);
+                if (value < dp[k][j])
+                {
+                    dp[k][j] = value;
+                    from[k][j] = static_cast<uint32_t>(i);
+                }
+            }
+        }
+    }
+    size_t best_k = 0;
+    for (size_t k = 1; k <= budget; ++k)
+    {
+        if (dp[k][n] < INF && (best_k == 0 || dp[k][n] < dp[best_k][n]))
+        {
+            best_k = k;
+        }
+    }
+    std::vector<size_t> result;
+    for (size_t k = best_k, j = n; k > 0; --k)
+    {
+        result.push_back(candidates[j - 1]);
+        j = from[k][j];
+    }
+    std::reverse(result.begin(), result.end());
+    return result;
+}
+
+template<typename ShapeOf>
+Waste expectedWaste(const std::vector<Bucket>& buckets, ShapeOf shapeOf)
+{
+    Waste waste;
+    for (const Bucket& bucket : buckets)
+    {
+        ClassShape shape = shapeOf(bucket.size);
+        waste.allocations += bucket.count;
+        waste.requested += bucket.count * static_cast<double>(bucket.size);
+        waste.internal += bucket.count * static_cast<double>(shape.size - bucket.size);
+        waste.tail += bucket.count * shape.tail_per_object;
+    }
+    return waste;
+}
+
+void printWaste(const char* name, size_t classes, const Waste& waste)
+{
+    double total = waste.internal + waste.tail;
+    std::printf("%-10s %8zu %14.0f %14.0f %14.0f %9.2f%%\n", name, classes, waste.internal, waste.tail, total,
+                waste.requested > 0 ? 100.0 * total / waste.requested : 0.0);
+}
+
+bool writeHeader(const char* path, const Options& options, const std::vector<ClassShape>& table,
+                 const Waste& before, const Waste& after)
+{
+    FILE* out = std::fopen(path, "w");
+    if (out == nullptr)
+    {
+        std::fprintf(stderr, "cannot write %s\n", path);
+        return false;
+    }
+    std::fprintf(out, "#pragma once\n");
+    std::fprintf(out, "// 由tools/sizeclass_gen生成，不要手改\n");
+    std::fprintf(out, "// 输入: %s，等级预算 %zu，骨架间隔 %.3f\n",
+                 options.trace != nullptr ? options.trace : options.histogram, options.classes, options.max_gap);
+    std::fprintf(out, "// 期望浪费（占请求字节）: 默认表 %.2f%% -> 本表 %.2f%%\n",
+                 before.requested > 0 ? 100.0 * (before.internal + before.tail) / before.requested : 0.0,
+                 after.requested > 0 ? 100.0 * (after.internal + after.tail) / after.requested : 0.0);
+    std::fprintf(out, "#include <cstddef>\n#include <cstdint>\n\n");
+    std::fprintf(out, "namespace llt_memoryPool\n{\nnamespace generated\n{\n");
+    std::fprintf(out, "    constexpr size_t CLASS_COUNT = %zu;\n", table.size());
+    auto emit = [&](const char* type, const char* name, auto field) {
+        std::fprintf(out, "    constexpr %s %s[CLASS_COUNT] = {", type, name);
+        for (size_t i = 0; i < table.size(); ++i)
+        {
+            std::fprintf(out, "%s%zu", i % 12 == 0 ? "\n        " : " ", field(table[i]));
+            if (i + 1 != table.size())
+            {
+                std::fprintf(out, ",");
+            }
+        }
+        std::fprintf(out, "\n    };\n");
+    };
+    emit("uint32_t", "CLASS_SIZES", [](const ClassShape& shape) { return shape.size; });
+    emit("uint16_t", "CLASS_BATCH", [](const ClassShape& shape) { return shape.batch; });
+    emit("uint16_t", "CLASS_PAGES", [](const ClassShape& shape) { return shape.pages; });
+    std::fprintf(out, "}\n}\n");
+    std::fclose(out);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    std::map<size_t, double> histogram;
+    bool ok = options.trace != nullptr ? readTrace(options.trace, histogram) : readHistogram(options.histogram, histogram);
+    if (!ok)
+    {
+        return 1;
+    }
+    if (histogram.empty())
+    {
+        std::fprintf(stderr, "no allocations of at most %zu bytes in the input\n", MAX_BYTES);
+        return 1;
+    }
+    std::vector<Bucket> buckets;
+    for (const auto& [size, count] : histogram)
+    {
+        buckets.push_back(Bucket{size, count});
+    }
+
+    std::vector<size_t> forced = backbone(options.max_gap);
+    if (options.classes < forced.size())
+    {
+        std::fprintf(stderr, "--classes %zu is below the %zu backbone classes needed for --max-gap %.3f\n",
+                     options.classes, forced.size(), options.max_gap);
+        return 1;
+    }
+    std::vector<size_t> sizes = optimize(buckets, forced, options.classes);
+    std::vector<ClassShape> table;
+    for (size_t size : sizes)
+    {
+        table.push_back(shapeFor(size));
+    }
+    auto generatedShape = [&table](size_t size) {
+        return *std::lower_bound(table.begin(), table.end(), size,
+                                 [](const ClassShape& shape, size_t value) { return shape.size < value; });
+    };
+
+    Waste before = expectedWaste(buckets, defaultShapeFor);
+    Waste after = expectedWaste(buckets, generatedShape);
+    std::printf("%zu distinct sizes, %.0f allocations, %.0f bytes requested\n", buckets.size(),
+                before.allocations, before.requested);
+    std::printf("%-10s %8s %14s %14s %14s %10s\n", "table", "classes", "internal(B)", "span tail(B)", "total(B)",
+                "waste");
+    printWaste("default", MAX_BYTES / ALIGNMENT, before);
+    printWaste("generated", table.size(), after);
+    // 每个线程缓存按等级数开两个数组（链表头和长度），等级少了这部分也跟着小
+    std::printf("thread cache free-list arrays: default %zu KB per thread, generated %.1f KB per thread\n",
+                MAX_BYTES / ALIGNMENT * (sizeof(void*) + sizeof(size_t)) / 1024,
+                table.size() * (sizeof(void*) + sizeof(size_t)) / 1024.0);
+
+    if (options.output != nullptr)
+    {
+        if (!writeHeader(options.output, options, table, before, after))
+        {
+            return 1;
+        }
+        std::printf("wrote %s (%zu classes), build with -DLLT_MEMPOOL_SIZE_CLASS_TABLE=%s\n", options.output,
+                    table.size(), options.output);
+    }
+    return 0;
+}
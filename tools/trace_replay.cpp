@@ -0,0 +1,510 @@
+// 分配轨迹重放：把MemoryPool录下来的轨迹（见include/Trace.h）按原来的线程交错再跑一遍
+//
+//   trace_replay <trace文件> [--backend pool|malloc] [--strict] [--no-touch]
+//
+//   --backend  pool用内存池（默认），malloc用系统malloc/free，同一条轨迹两边各跑一次对比
+//   --strict   严格按录制时的全局顺序一条一条执行（每次只有一个线程在动），完全确定但测不出并发
+//              默认只保留因果顺序：释放要等它对应的分配执行完，其余的操作各线程自由并发
+//   --no-touch 分配以后不写对象；默认整个对象memset一遍，常驻内存才和真实负载一致（不计入延迟）
+//
+// 输出：总操作数、吞吐、分配/释放各自的延迟分位数、重放期间的峰值常驻内存
+#include "../include/MemoryPool.h"
+#include "../include/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llt_memoryPool;
+
+namespace
+{
+
+enum class Backend
+{
+    Pool,
+    Malloc,
+};
+
+// 预处理以后的一步操作：对象换成连续的槽号，重放时不用查哈希表
+struct ReplayOp
+{
+    // 在全局顺序里的位置，--strict时按它排队
+    uint64_t sequence;
+    uint32_t slot;
+    uint32_t size;
+    uint8_t op;
+};
+
+struct Options
+{
+    const char* path = nullptr;
+    Backend backend = Backend::Pool;
+    bool strict = false;
+    bool touch = true;
+};
+
+struct Workload
+{
+    std::vector<std::vector<ReplayOp>> threads;
+    size_t slots = 0;
+    size_t operations = 0;
+    // 录制开始之前分配的对象的释放，对不上，跳过
+    size_t orphan_frees = 0;
+    // 录制结束时还活着的对象，重放完统一释放（不计时）
+    size_t live_at_end = 0;
+};
+
+uint64_t nowNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void usage(const char* program)
+{
+    std::fprintf(stderr, "usage: %s <trace> [--backend pool|malloc] [--strict] [--no-touch]\n", program);
+}
+
+bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--backend" && i + 1 < argc)
+        {
+            std::string backend = argv[++i];
+            if (backend == "pool")
+            {
+                options.backend = Backend::Pool;
+            }
+            else if (backend == "malloc")
+            {
+                options.backend = Backend::Malloc;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (arg == "--strict")
+        {
+            options.strict = true;
+        }
+        else if (arg == "--no-touch")
+        {
+            options.touch = false;
+        }
+        else if (options.path == nullptr && arg[0] != '-')
+        {
+            options.path = argv[i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return options.path != nullptr;
+}
+
+// 读入轨迹：按线程拆开，地址换成槽号（同一个地址先释放后再分配出来是另一个槽）
+bool loadTrace(const char* path, Workload& workload)
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        std::fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(trace::TraceHeader))
+    {
+        std::fprintf(stderr, "%s: not a trace file\n", path);
+        ::close(fd);
+        return false;
+    }
+    size_t bytes = static_cast<size_t>(st.st_size);
+    void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        std::fprintf(stderr, "%s: mmap failed\n", path);
+        return false;
+    }
+    const trace::TraceHeader* header = static_cast<const trace::TraceHeader*>(mapped);
+    if (header->magic != trace::TRACE_MAGIC || header->version != trace::TRACE_VERSION ||
+        header->record_size != sizeof(trace::TraceRecord))
+    {
+        std::fprintf(stderr, "%s: bad magic or version\n", path);
+        munmap(mapped, bytes);
+        return false;
+    }
+    size_t count = (bytes - sizeof(trace::TraceHeader)) / sizeof(trace::TraceRecord);
+    const trace::TraceRecord* records = reinterpret_cast<const trace::TraceRecord*>(
+        static_cast<const char*>(mapped) + sizeof(trace::TraceHeader));
+    if (header->record_count != 0)
+    {
+        count = std::min<size_t>(count, header->record_count);
+    }
+    else
+    {
+        // 录制中途崩溃时record_count还是0，文件还是按容量ftruncate的大小，没写到的槽读出来全是零。
+        // 真正的记录不会全零（分配的地址不为空，释放的op是1），读到第一个全零的槽就是录到的末尾
+        const trace::TraceRecord empty{};
+        size_t written = 0;
+        while (written < count && std::memcmp(&records[written], &empty, sizeof(empty)) != 0)
+        {
+            ++written;
+        }
+        if (written < count)
+        {
+            std::printf("warning: trace was not stopped cleanly, keeping the first %zu records\n", written);
+        }
+        count = written;
+    }
+    if (header->dropped != 0)
+    {
+        std::printf("warning: %llu records were dropped while recording, the tail is missing\n",
+                    (unsigned long long)header->dropped);
+    }
+
+    std::unordered_map<uint64_t, uint32_t> live;
+    live.reserve(1024);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const trace::TraceRecord& record = records[i];
+        if (record.thread >= workload.threads.size())
+        {
+            workload.threads.resize(record.thread + 1);
+        }
+        ReplayOp op{i, 0, record.size, record.op};
+        if (record.op == static_cast<uint8_t>(trace::Op::Allocate))
+        {
+            op.slot = static_cast<uint32_t>(workload.slots++);
+            live[record.object] = op.slot;
+        }
+        else
+        {
+            auto it = live.find(record.object);
+            if (it == live.end())
+            {
+                workload.orphan_frees++;
+                continue;
+            }
+            op.slot = it->second;
+            live.erase(it);
+        }
+        workload.threads[record.thread].push_back(op);
+        workload.operations++;
+    }
+    workload.live_at_end = live.size();
+    munmap(mapped, bytes);
+    return true;
+}
+
+size_t residentBytes(const char* field)
+{
+    FILE* f = std::fopen("/proc/self/status", "r");
+    if (f == nullptr)
+    {
+        return 0;
+    }
+    char line[256];
+    size_t kb = 0;
+    size_t length = std::strlen(field);
+    while (std::fgets(line, sizeof(line), f) != nullptr)
+    {
+        if (std::strncmp(line, field, length) == 0)
+        {
+            kb = std::strtoull(line + length, nullptr, 10);
+            break;
+        }
+    }
+    std::fclose(f);
+    return kb * 1024;
+}
+
+// 把峰值常驻内存清成当前值（Linux 4.0以后），之后的VmHWM只反映重放本身
+void resetPeakResident()
+{
+    int fd = ::open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        if (::write(fd, "5", 1) != 1)
+        {
+            std::fprintf(stderr, "warning: cannot reset peak RSS, VmHWM includes loading the trace\n");
+        }
+        ::close(fd);
+    }
+}
+
+uint64_t percentile(std::vector<uint32_t>& samples, double fraction)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+    size_t rank = std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+class Replayer
+{
+public:
+    Replayer(const Workload& workload, const Options& options)
+        : workload_(workload), options_(options), objects_(workload.slots)
+    {
+        for (auto& object : objects_)
+        {
+            object.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    // --strict时先排出全局顺序，第一条要执行的序号放进turn_
+    void prepareStrict()
+    {
+        buildOrder();
+        turn_.store(sequence_order_.empty() ? UINT64_MAX : sequence_order_.front(), std::memory_order_relaxed);
+    }
+
+    void run()
+    {
+        size_t threads = workload_.threads.size();
+        alloc_latency_.resize(threads);
+        free_latency_.resize(threads);
+        std::vector<std::thread> workers;
+        uint64_t begin = nowNs();
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([this, t] { replayThread(t); });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        elapsed_ns_ = nowNs() - begin;
+        failed_ = failed_count_.load(std::memory_order_relaxed);
+    }
+
+    // 录制结束时还活着的对象
+    void releaseRemaining()
+    {
+        std::vector<uint32_t> sizes(workload_.slots, 0);
+        for (const auto& ops : workload_.threads)
+        {
+            for (const ReplayOp& op : ops)
+            {
+                if (op.op == static_cast<uint8_t>(trace::Op::Allocate))
+                {
+                    sizes[op.slot] = op.size;
+                }
+            }
+        }
+        for (size_t slot = 0; slot < objects_.size(); ++slot)
+        {
+            void* ptr = objects_[slot].load(std::memory_order_relaxed);
+            if (ptr != nullptr && ptr != released())
+            {
+                release(ptr, sizes[slot]);
+            }
+        }
+    }
+
+    void report()
+    {
+        std::vector<uint32_t> allocs;
+        std::vector<uint32_t> frees;
+        for (auto& samples : alloc_latency_)
+        {
+            allocs.insert(allocs.end(), samples.begin(), samples.end());
+        }
+        for (auto& samples : free_latency_)
+        {
+            frees.insert(frees.end(), samples.begin(), samples.end());
+        }
+        double seconds = static_cast<double>(elapsed_ns_) / 1e9;
+        size_t ops = allocs.size() + frees.size();
+        std::printf("backend: %s, mode: %s, threads: %zu\n",
+                    options_.backend == Backend::Pool ? "pool" : "malloc",
+                    options_.strict ? "strict" : "causal", workload_.threads.size());
+        std::printf("operations: %zu (%zu allocations, %zu frees), failed allocations: %zu\n",
+                    ops, allocs.size(), frees.size(), failed_);
+        std::printf("elapsed: %.3f ms, throughput: %.2f Mops/s\n", seconds * 1e3,
+                    seconds > 0 ? static_cast<double>(ops) / seconds / 1e6 : 0.0);
+        std::printf("%-10s %10s %10s %10s %10s\n", "latency", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+        printLatency("allocate", allocs);
+        printLatency("free", frees);
+    }
+
+private:
+    // 释放过的槽放这个标记，和还没分配的nullptr区分开
+    static void* released()
+    {
+        return reinterpret_cast<void*>(uintptr_t(1));
+    }
+
+    void* acquire(size_t size)
+    {
+        return options_.backend == Backend::Pool ? MemoryPool::allocate(size) : std::malloc(size);
+    }
+
+    void release(void* ptr, size_t size)
+    {
+        if (options_.backend == Backend::Pool)
+        {
+            MemoryPool::deallocate(ptr, size);
+        }
+        else
+        {
+            std::free(ptr);
+        }
+    }
+
+    void replayThread(size_t t)
+    {
+        const std::vector<ReplayOp>& ops = workload_.threads[t];
+        std::vector<uint32_t>& alloc_latency = alloc_latency_[t];
+        std::vector<uint32_t>& free_latency = free_latency_[t];
+        alloc_latency.reserve(ops.size());
+        free_latency.reserve(ops.size());
+        for (const ReplayOp& op : ops)
+        {
+            if (options_.strict)
+            {
+                while (turn_.load(std::memory_order_acquire) != op.sequence)
+                {
+                    std::this_thread::yield();
+                }
+            }
+            if (op.op == static_cast<uint8_t>(trace::Op::Allocate))
+            {
+                uint64_t begin = nowNs();
+                void* ptr = acquire(op.size);
+                uint64_t end = nowNs();
+                alloc_latency.push_back(static_cast<uint32_t>(std::min<uint64_t>(end - begin, UINT32_MAX)));
+                if (ptr == nullptr)
+                {
+                    failed_count_.fetch_add(1, std::memory_order_relaxed);
+                    ptr = released();
+                }
+                else if (options_.touch)
+                {
+                    std::memset(ptr, 0xA5, op.size);
+                }
+                objects_[op.slot].store(ptr, std::memory_order_release);
+            }
+            else
+            {
+                // 对象是别的线程分配的：等那边执行到
+                void* ptr = objects_[op.slot].load(std::memory_order_acquire);
+                while (ptr == nullptr)
+                {
+                    std::this_thread::yield();
+                    ptr = objects_[op.slot].load(std::memory_order_acquire);
+                }
+                objects_[op.slot].store(released(), std::memory_order_relaxed);
+                if (ptr != released())
+                {
+                    uint64_t begin = nowNs();
+                    release(ptr, op.size);
+                    uint64_t end = nowNs();
+                    free_latency.push_back(static_cast<uint32_t>(std::min<uint64_t>(end - begin, UINT32_MAX)));
+                }
+            }
+            if (options_.strict)
+            {
+                // 跳过的孤儿释放不在任何线程里，序号会有空洞，直接跳到下一条
+                turn_.store(nextSequence(op.sequence), std::memory_order_release);
+            }
+        }
+    }
+
+    // 全局顺序里op之后的下一条（跳过被丢掉的孤儿释放），prepareStrict已经排好序
+    uint64_t nextSequence(uint64_t sequence) const
+    {
+        auto it = std::upper_bound(sequence_order_.begin(), sequence_order_.end(), sequence);
+        return it == sequence_order_.end() ? UINT64_MAX : *it;
+    }
+
+    void buildOrder()
+    {
+        std::vector<uint64_t> order;
+        order.reserve(workload_.operations);
+        for (const auto& ops : workload_.threads)
+        {
+            for (const ReplayOp& op : ops)
+            {
+                order.push_back(op.sequence);
+            }
+        }
+        std::sort(order.begin(), order.end());
+        sequence_order_.swap(order);
+    }
+
+    void printLatency(const char* name, std::vector<uint32_t>& samples)
+    {
+        uint64_t max = samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+        std::printf("%-10s %10llu %10llu %10llu %10llu\n", name,
+                    (unsigned long long)percentile(samples, 0.5),
+                    (unsigned long long)percentile(samples, 0.99),
+                    (unsigned long long)percentile(samples, 0.999),
+                    (unsigned long long)max);
+    }
+
+    const Workload& workload_;
+    const Options& options_;
+    std::vector<std::atomic<void*>> objects_;
+    std::vector<std::vector<uint32_t>> alloc_latency_;
+    std::vector<std::vector<uint32_t>> free_latency_;
+    std::atomic<uint64_t> turn_{0};
+    std::vector<uint64_t> sequence_order_;
+    std::atomic<size_t> failed_count_{0};
+    size_t failed_ = 0;
+    uint64_t elapsed_ns_ = 0;
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    Workload workload;
+    if (!loadTrace(options.path, workload))
+    {
+        return 1;
+    }
+    std::printf("trace: %s, %zu operations on %zu objects, %zu orphan frees skipped, %zu objects live at end\n",
+                options.path, workload.operations, workload.slots, workload.orphan_frees, workload.live_at_end);
+
+    Replayer replayer(workload, options);
+    if (options.strict)
+    {
+        replayer.prepareStrict();
+    }
+    size_t baseline = residentBytes("VmRSS:");
+    resetPeakResident();
+    replayer.run();
+    size_t peak = residentBytes("VmHWM:");
+    replayer.report();
+    std::printf("peak RSS: %.2f MB (baseline before replay %.2f MB, growth %.2f MB)\n",
+                peak / 1048576.0, baseline / 1048576.0,
+                (peak > baseline ? peak - baseline : 0) / 1048576.0);
+    replayer.releaseRemaining();
+    return 0;
+}